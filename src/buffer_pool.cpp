@@ -0,0 +1,125 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "buffer_pool.h"
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+using namespace std;
+
+buffer_pool::buffer_pool(int numBuffers, int bufferSize, int flags)
+{
+	this->numBuffers = numBuffers;
+	size = bufferSize;
+	// round every buffer up to full cache lines, no false sharing between neighbours
+	stride = ((size_t)bufferSize + c_cacheLineSize - 1) & ~(size_t)(c_cacheLineSize - 1);
+	allocate(stride * numBuffers, flags);
+}
+
+buffer_pool::~buffer_pool()
+{
+	free();
+}
+
+void buffer_pool::allocate(size_t bytes, int flags)
+{
+#ifndef _WIN32
+#ifdef MAP_HUGETLB
+	if (flags & POOL_HUGE_PAGES)
+	{
+		// explicit huge pages need a multiple of the huge page size (2 MB on x86 and ARM)
+		const size_t hugePageSize = 2 * 1024 * 1024;
+		size_t hugeBytes = (bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+		void* p = mmap(NULL, hugeBytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			memory = (BYTE*)p;
+			allocated = hugeBytes;
+			mapped = true;
+			hugePages = true;
+		}
+	}
+#endif
+	if (memory == 0 && (flags & POOL_HUGE_PAGES))
+	{
+		// no reserved huge pages: ask for transparent huge pages instead
+		void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			memory = (BYTE*)p;
+			allocated = bytes;
+			mapped = true;
+#ifdef MADV_HUGEPAGE
+			hugePages = madvise(p, bytes, MADV_HUGEPAGE) == 0;
+#endif
+		}
+	}
+	if (memory == 0)
+	{
+		void* p = 0;
+		if (posix_memalign(&p, c_cacheLineSize, bytes) != 0)
+			throw msg_exception("buffer_pool: out of memory");
+		memory = (BYTE*)p;
+		allocated = bytes;
+	}
+	if (flags & POOL_LOCKED)
+	{
+		locked = mlock(memory, allocated) == 0;
+		if (!locked)
+			cout << "buffer_pool: mlock failed with " << errno << ", continuing unlocked" << endl;
+	}
+#else
+	memory = (BYTE*)_aligned_malloc(bytes, c_cacheLineSize);
+	if (memory == 0)
+		throw msg_exception("buffer_pool: out of memory");
+	allocated = bytes;
+	if (flags & POOL_LOCKED)
+		locked = VirtualLock(memory, allocated) != 0;
+#endif
+	// touch every page now, not in the stream callback
+	memset(memory, 0, allocated);
+}
+
+void buffer_pool::free()
+{
+	if (memory == 0)
+		return;
+#ifndef _WIN32
+	if (locked)
+		munlock(memory, allocated);
+	if (mapped)
+		munmap(memory, allocated);
+	else
+		::free(memory);
+#else
+	if (locked)
+		VirtualUnlock(memory, allocated);
+	_aligned_free(memory);
+#endif
+	memory = 0;
+	allocated = 0;
+}
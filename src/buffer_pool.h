@@ -0,0 +1,69 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <stddef.h>
+#include "common.h"
+
+/// <summary>
+/// Preallocated pool of equally sized, cache line aligned buffers in one
+/// contiguous allocation. Optionally locked into RAM and huge page backed,
+/// so the streaming path never touches the allocator or faults in pages.
+/// </summary>
+class buffer_pool
+{
+public:
+	enum eFlags
+	{
+		POOL_DEFAULT = 0
+		, POOL_LOCKED = 1		// mlock, no paging of sample buffers
+		, POOL_HUGE_PAGES = 2	// try huge pages, fall back to normal pages
+	};
+
+	static const int c_cacheLineSize = 64;
+
+	buffer_pool(int numBuffers, int bufferSize, int flags);
+	~buffer_pool();
+
+	BYTE* buffer(int index) const { return memory + (size_t)index * stride; }
+	BYTE* base() const { return memory; }
+	int count() const { return numBuffers; }
+	int bufferSize() const { return size; }
+
+	bool isLocked() const { return locked; }
+	bool isHugePages() const { return hugePages; }
+	size_t bytesAllocated() const { return allocated; }
+
+private:
+	buffer_pool(buffer_pool const&);		// Don't Implement
+	void operator=(buffer_pool const&);		// Don't implement
+
+	void allocate(size_t bytes, int flags);
+	void free();
+
+	BYTE* memory = 0;
+	size_t allocated = 0;
+	size_t stride = 0;
+	int numBuffers = 0;
+	int size = 0;
+	bool locked = false;
+	bool hugePages = false;
+	bool mapped = false;
+};
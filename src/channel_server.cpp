@@ -0,0 +1,291 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "channel_server.h"
+#include "iq_convert.h"
+#include <iostream>
+#include <string.h>
+using namespace std;
+
+channel_server::channel_server()
+	: working(false), accepting(false)
+{
+	pthread_mutex_init(&mutex_outputs, NULL);
+}
+
+channel_server::~channel_server()
+{
+	stop();
+	if (accepting)
+	{
+		accepting = false;
+		pthread_join(thrdAccept, NULL);
+	}
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		if (outputs[i].file != 0)
+			fclose(outputs[i].file);
+		if (outputs[i].client != INVALID_SOCKET)
+			closesocket(outputs[i].client);
+		if (outputs[i].listenSock != INVALID_SOCKET)
+			closesocket(outputs[i].listenSock);
+	}
+	pthread_mutex_destroy(&mutex_outputs);
+}
+
+SOCKET channel_server::openListener(const IPAddress& address, int port)
+{
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = inet_addr(address.sIPAddress.c_str());
+
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	int r = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+	if (::bind(sock, (struct sockaddr *)&local, sizeof(local)) == SOCKET_ERROR || listen(sock, 1) == SOCKET_ERROR)
+	{
+		cout << "Channel port " << port << ": " << common::getSocketErrorString() << endl;
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+bool channel_server::open(int numChannels, const std::vector<int>& channels, const std::string& filePrefix,
+	const IPAddress& address, int basePort)
+{
+	this->numChannels = numChannels;
+	this->channels = channels;
+	channelizer.configure(numChannels, channels);
+	for (size_t i = 0; i < channels.size(); i++)
+	{
+		output o;
+		o.channel = channels[i];
+		o.file = 0;
+		o.listenSock = INVALID_SOCKET;
+		o.client = INVALID_SOCKET;
+		o.droppedSamples = 0;
+		if (!filePrefix.empty())
+		{
+			string name = filePrefix + "_ch" + to_string(channels[i]) + ".cs16";
+			o.file = fopen(name.c_str(), "wb");
+			if (o.file == 0)
+			{
+				cout << "Cannot open channel file " << name << endl;
+				return false;
+			}
+			cout << "Channel " << channels[i] << " -> " << name << endl;
+		}
+		else
+		{
+			o.listenSock = openListener(address, basePort + (int)i);
+			if (o.listenSock == INVALID_SOCKET)
+				return false;
+			cout << "Channel " << channels[i] << " -> " << address.sIPAddress << ":" << basePort + i << endl;
+		}
+		outputs.push_back(o);
+	}
+	if (filePrefix.empty())
+	{
+		accepting = true;
+		pthread_create(&thrdAccept, NULL, channelAccept, this);
+	}
+	return true;
+}
+
+void channel_server::reportGrid() const
+{
+	int M = channelizer.numChannels();
+	cout << "Channelizer: " << M << " channels of " << rateHz / M << " Hz spacing, "
+		<< 2 * rateHz / M << " Hz sampling rate" << endl;
+}
+
+/// <summary>
+/// Called before the stream starts, not thread safe with push
+/// </summary>
+void channel_server::start(int rateHz)
+{
+	stop();
+	this->rateHz = rateHz;
+	int blockSize = iq_channelizer::c_maxChunk * 4;
+	int numBlocks = (int)((double)rateHz * 4 * c_ringMs / 1000 / blockSize) + 1;
+	if (numBlocks < c_ringMinBlocks)
+		numBlocks = c_ringMinBlocks;
+	ring.allocate(numBlocks, blockSize, 0);
+	openBlock = 0;
+	channelizer.configure(numChannels, channels);
+	reportGrid();
+	working = true;
+	pthread_create(&thrdWork, NULL, channelWork, this);
+}
+
+void channel_server::stop()
+{
+	if (!working)
+		return;
+	working = false;
+	ring.wakeup();
+	pthread_join(thrdWork, NULL);
+	if (ring.droppedBlocks() > 0)
+		cout << "Channelizer: " << ring.droppedBlocks() << " blocks dropped, the channelizer was too slow" << endl;
+	for (size_t i = 0; i < outputs.size(); i++)
+		if (outputs[i].droppedSamples > 0)
+			cout << "Channel " << outputs[i].channel << ": " << outputs[i].droppedSamples << " samples dropped by a slow client" << endl;
+	ring.release_all();
+}
+
+void channel_server::setRate(int rateHz)
+{
+	this->rateHz = rateHz;
+	reportGrid();
+}
+
+void channel_server::push(const short* xi, const short* xq, int numSamples)
+{
+	long long now = common::monotonicMicros();
+	while (numSamples > 0)
+	{
+		if (openBlock == 0)
+		{
+			openBlock = ring.acquire();
+			if (openBlock == 0)
+				return;	// full, counted as dropped
+			openBlockUs = now;
+		}
+		int n = (openBlock->capacity - openBlock->length) / 4;
+		if (n > numSamples)
+			n = numSamples;
+		iq_convert::interleave16(xi, xq, n, openBlock->data + openBlock->length);
+		openBlock->length += n * 4;
+		xi += n;
+		xq += n;
+		numSamples -= n;
+		if (openBlock->capacity - openBlock->length < 4 || now - openBlockUs >= c_maxLatencyUs)
+		{
+			ring.commit();
+			openBlock = 0;
+		}
+	}
+}
+
+/// <summary>
+/// Worker thread: never blocks on a client, a client which cannot take
+/// the samples loses them
+/// </summary>
+void channel_server::write(output& o, const short* iq, int numSamples)
+{
+	const BYTE* data = (const BYTE*)iq;
+	int length = numSamples * 4;
+	if (o.file != 0)
+	{
+		fwrite(data, 1, length, o.file);
+		return;
+	}
+	pthread_mutex_lock(&mutex_outputs);
+	if (o.client != INVALID_SOCKET && !o.pending.empty())
+	{
+		int res = send(o.client, (const char*)&o.pending[0], o.pending.size(), MSG_DONTWAIT);
+		if (res > 0)
+			o.pending.erase(o.pending.begin(), o.pending.begin() + res);
+	}
+	if (o.client != INVALID_SOCKET)
+	{
+		int res = 0;
+		if (o.pending.empty())
+			res = send(o.client, (const char*)data, length, MSG_DONTWAIT);
+		if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			cout << "Channel " << o.channel << ": client disconnected" << endl;
+			closesocket(o.client);
+			o.client = INVALID_SOCKET;
+			o.pending.clear();
+		}
+		else if (res < 0 || (res == 0 && !o.pending.empty()))
+			o.droppedSamples += numSamples;
+		else if (res < length)
+			o.pending.assign(data + res, data + length);
+	}
+	pthread_mutex_unlock(&mutex_outputs);
+}
+
+void* channelWork(void* p)
+{
+	channel_server* cs = (channel_server*)p;
+	while (cs->working)
+	{
+		sample_ring::block* b = cs->ring.peek(100);
+		if (b == 0)
+			continue;
+		cs->channelizer.process((const short*)b->data, b->length / 4);
+		cs->ring.release();
+		for (size_t i = 0; i < cs->outputs.size(); i++)
+		{
+			std::vector<short>& y = cs->channelizer.output((int)i);
+			cs->write(cs->outputs[i], &y[0], (int)y.size() / 2);
+			y.clear();
+		}
+	}
+	return 0;
+}
+
+/// <summary>
+/// Accepts the clients of the channel ports, a new client of a channel replaces the old one
+/// </summary>
+void* channelAccept(void* p)
+{
+	channel_server* cs = (channel_server*)p;
+	while (cs->accepting)
+	{
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		SOCKET maxSock = 0;
+		for (size_t i = 0; i < cs->outputs.size(); i++)
+		{
+			FD_SET(cs->outputs[i].listenSock, &readSet);
+			if (cs->outputs[i].listenSock > maxSock)
+				maxSock = cs->outputs[i].listenSock;
+		}
+		struct timeval tv = { 0, 200000 };
+		if (select(maxSock + 1, &readSet, 0, 0, &tv) <= 0)
+			continue;
+		for (size_t i = 0; i < cs->outputs.size(); i++)
+		{
+			channel_server::output& o = cs->outputs[i];
+			if (!FD_ISSET(o.listenSock, &readSet))
+				continue;
+			SOCKET client = accept(o.listenSock, 0, 0);
+			if (client == INVALID_SOCKET)
+				continue;
+			cout << "Channel " << o.channel << ": client accepted" << endl;
+			pthread_mutex_lock(&cs->mutex_outputs);
+			if (o.client != INVALID_SOCKET)
+				closesocket(o.client);
+			o.client = client;
+			o.pending.clear();
+			pthread_mutex_unlock(&cs->mutex_outputs);
+		}
+	}
+	return 0;
+}
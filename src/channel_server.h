@@ -0,0 +1,104 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "common.h"
+#include "IPAddress.h"
+#include "sample_ring.h"
+#include "iq_channelizer.h"
+
+void* channelWork(void* p);
+void* channelAccept(void* p);
+
+/// <summary>
+/// Serves the channels of an iq_channelizer, each on its own TCP port or into its own file,
+/// as raw interleaved cs16 samples.
+/// The stream callback pushes the samples into a ring, the channelizer runs on a thread of its own,
+/// so the callback only copies. A slow channel client loses samples of its own channel only.
+/// </summary>
+class channel_server
+{
+public:
+	channel_server();
+	~channel_server();
+
+	/// <summary>
+	/// Opens the outputs, the files are named prefix_ch[channel].cs16
+	/// </summary>
+	/// <param name="filePrefix">empty: TCP ports basePort, basePort + 1, ... in the order of channels</param>
+	/// <returns>false, if an output cannot be opened</returns>
+	bool open(int numChannels, const std::vector<int>& channels, const std::string& filePrefix,
+		const IPAddress& address, int basePort);
+
+	// Starts / stops the channelizer with the stream of the device, rateHz sizes the ring
+	void start(int rateHz);
+	void stop();
+	// the grid follows a change of the sampling rate
+	void setRate(int rateHz);
+
+	// ---- producer side (stream callback) ----
+	void push(const short* xi, const short* xq, int numSamples);
+
+private:
+	channel_server(channel_server const&);		// Don't Implement
+	void operator=(channel_server const&);		// Don't implement
+
+	friend void* channelWork(void* p);
+	friend void* channelAccept(void* p);
+
+	struct output
+	{
+		int channel;
+		FILE* file;
+		SOCKET listenSock;
+		SOCKET client;
+		std::vector<BYTE> pending;	// rest of a partial send
+		unsigned long long droppedSamples;
+	};
+
+	SOCKET openListener(const IPAddress& address, int port);
+	void write(output& o, const short* iq, int numSamples);
+	void reportGrid() const;
+
+	// commits the open block of the callback at the latest after this
+	const int c_maxLatencyUs = 20000;
+	const int c_ringMs = 250;
+	const int c_ringMinBlocks = 8;
+
+	iq_channelizer channelizer;
+	int numChannels = 0;
+	std::vector<int> channels;
+	std::vector<output> outputs;
+	pthread_mutex_t mutex_outputs;
+	sample_ring ring;
+	sample_ring::block* openBlock = 0;
+	long long openBlockUs = 0;
+	int rateHz = 0;
+
+	pthread_t thrdWork;
+	pthread_t thrdAccept;
+	std::atomic<bool> working;
+	std::atomic<bool> accepting;
+};
@@ -0,0 +1,248 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "client_session.h"
+#include "mir_sdr_device.h"
+#include "sample_sender.h"
+#include <iostream>
+using namespace std;
+
+client_session::client_session(mir_sdr_device* device, SOCKET sock, int id, bool owner)
+	: device(device), sock(sock), clientId(id), owner(owner), closed(false), running(false), replayMs(-1), lent(0)
+{
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	if (getpeername(sock, (SOCKADDR*)&addr, &len) == 0)
+		peer = string(inet_ntoa(addr.sin_addr)) + ":" + to_string(ntohs(addr.sin_port));
+	else
+		peer = "unknown";
+}
+
+client_session::~client_session()
+{
+	stop();
+	delete sender;
+	if (sock != INVALID_SOCKET)
+		closesocket(sock);
+}
+
+void client_session::start(int numBlocks, int blockSize, int poolFlags, int txMode)
+{
+	queue.allocate(numBlocks, blockSize, poolFlags);
+	sender = new sample_sender(queue, sock, txMode);
+	running = true;
+
+	thrdTx = new pthread_t();
+	pthread_create(thrdTx, NULL, &clientTransmit, this);
+	thrdRx = new pthread_t();
+	pthread_create(thrdRx, NULL, &clientReceive, this);
+}
+
+void client_session::resize(int numBlocks, int blockSize)
+{
+	queue.resize(numBlocks, blockSize);
+}
+
+void client_session::disconnect(const char* reason)
+{
+	if (!closed.exchange(true))
+	{
+		cout << "Client " << clientId << " (" << peer << ") disconnected: " << reason << endl;
+		device->wakeListener();
+	}
+	running = false;
+	shutdown(sock, SHUT_RDWR);	// unblocks recv() and send() of the client threads
+	queue.wakeup();
+	sample_ring* r = lent.load();
+	if (r != 0)
+		r->wakeup();
+}
+
+void client_session::stop()
+{
+	if (thrdRx == 0 && thrdTx == 0)
+		return;
+	disconnect("session closed");
+	void* status;
+	if (thrdTx != 0)
+	{
+		pthread_join(*thrdTx, &status);
+		delete thrdTx;
+		thrdTx = 0;
+	}
+	if (thrdRx != 0)
+	{
+		pthread_join(*thrdRx, &status);
+		delete thrdRx;
+		thrdRx = 0;
+	}
+}
+
+bool client_session::deliver(const BYTE* data, int length, int kickMs)
+{
+	if (closed)
+		return false;
+	sample_ring::block* b = queue.acquire();
+	if (b == 0 || b->capacity < length)
+	{
+		// queue full: this client is too slow, only its own blocks are dropped.
+		// Drops less than kickMs apart belong to the same overflow
+		long long now = common::monotonicMicros();
+		if (now - lastDropUs > kickMs * 1000LL)
+			overflowSinceUs = now;
+		lastDropUs = now;
+		if (kickMs > 0 && now - overflowSinceUs > kickMs * 1000LL)
+			disconnect("too slow, queue overflow");
+		return false;
+	}
+	memcpy(b->data, data, length);
+	b->length = length;
+	queue.commit();
+	delivered++;
+	return true;
+}
+
+unsigned long long client_session::bytesSent() const
+{
+	return sender != 0 ? sender->bytesSent() : 0;
+}
+
+unsigned long long client_session::sendStalls() const
+{
+	return sender != 0 ? sender->sendStalls() : 0;
+}
+
+unsigned long long client_session::blockedMicros() const
+{
+	return sender != 0 ? sender->blockedMicros() : 0;
+}
+
+unsigned long long client_session::partialWrites() const
+{
+	return sender != 0 ? sender->partialWrites() : 0;
+}
+
+void client_session::mergeLatency(latency_histogram& select, latency_histogram& send) const
+{
+	if (sender == 0)
+		return;
+	select.merge(sender->selectLatency());
+	send.merge(sender->sendLatency());
+}
+
+void client_session::reportStatistics() const
+{
+	cout << "Client " << clientId << " (" << peer << "): " << delivered << " blocks queued, "
+		<< queue.droppedBlocks() << " dropped, queue high-water " << queue.highWaterMark()
+		<< "/" << queue.capacity() << ", " << sendStalls() << " send stalls, "
+		<< blockedMicros() / 1000 << " ms blocked, " << partialWrites() << " partial writes";
+	if (ignoredCommands > 0)
+		cout << ", " << ignoredCommands << " commands ignored";
+	cout << endl;
+}
+
+/// <summary>
+/// Transmit thread of one client, drains its queue to the socket
+/// </summary>
+void* clientTransmit(void* p)
+{
+	client_session* cs = (client_session*)p;
+	sample_sender& sender = *cs->sender;
+	sample_ring* source = &cs->queue;
+	try
+	{
+		while (cs->running)
+		{
+			sample_ring* lent = cs->lent.load();
+			sample_ring* wanted = lent != 0 ? lent : &cs->queue;
+			// the device ring continues, where the queue ends: the queue is drained first,
+			// and the sends from one ring complete, before the other one is read
+			if (wanted != source && (source != &cs->queue || cs->queue.fillLevel() == cs->queue.peekedBlocks()))
+			{
+				sender.finish(100);
+				if (!sender.idle())
+					continue;
+				sender.setRing(*wanted);
+				if (source != &cs->queue)
+					cs->device->returnRing();
+				source = wanted;
+			}
+			sender.poll(100, cs->running);
+		}
+	}
+	catch (exception& e)
+	{
+		cs->disconnect(e.what());
+	}
+	// the kernel may still read from the ring, what it didn't complete
+	// in time, is given up with the connection
+	sender.finish(1000);
+	while (source->peekedBlocks() > 0)
+		source->release();
+	if (source != &cs->queue)
+		cs->device->returnRing();
+	return 0;
+}
+
+/// <summary>
+/// Receive thread of one client: forwards the commands of the owner to the device
+/// </summary>
+void* clientReceive(void* p)
+{
+	client_session* cs = (client_session*)p;
+	const int cmd_length = 5;
+	// a burst of commands is read at once and handed on as one batch
+	char rxBuf[client_session::c_maxCommandBatch * cmd_length];
+	char forward[client_session::c_maxCommandBatch * cmd_length];
+	int received = 0;
+	while (cs->running)
+	{
+		int rcvd = recv(cs->sock, rxBuf + received, sizeof(rxBuf) - received, 0);
+		if (rcvd <= 0)
+		{
+			cs->disconnect(rcvd == 0 ? "Socket closed" : "Socket error");
+			return 0;
+		}
+		received += rcvd;
+		int complete = received / cmd_length;
+		int forwarded = 0;
+		for (int i = 0; i < complete; i++)
+		{
+			char* c = rxBuf + i * cmd_length;
+			int value = 0;
+			int cmd = getCommandAndValue(c, value);
+			// the history goes to this client only, read-only clients may ask for it, too
+			if (cmd == mir_sdr_device::CMD_REPLAY_HISTORY)
+				cs->replayMs = value < 0 ? 0 : value;
+			else if (cs->isOwner())
+				memcpy(forward + cmd_length * forwarded++, c, cmd_length);
+			// logged once, a client may keep sending them
+			else if (cs->ignoredCommands++ == 0)
+				cout << "Client " << cs->clientId << " is read-only, its commands are ignored, the first one 0x"
+					<< hex << (int)(BYTE)c[0] << dec << endl;
+		}
+		if (forwarded > 0)
+			cs->device->pushCommands(forward, forwarded);
+		received -= complete * cmd_length;
+		memmove(rxBuf, rxBuf + complete * cmd_length, received);
+	}
+	return 0;
+}
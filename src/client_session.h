@@ -0,0 +1,117 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <pthread.h>
+#include "common.h"
+#include "sample_ring.h"
+#include "latency_histogram.h"
+
+class mir_sdr_device;
+class sample_sender;
+
+void* clientReceive(void* cs);
+void* clientTransmit(void* cs);
+
+/// <summary>
+/// One TCP client of a shared device stream.
+/// The distributor copies the device's sample blocks into the bounded queue of
+/// each client, the client's own transmit thread drains it to its socket.
+/// A slow client loses blocks from its own queue only, the device and the
+/// other clients are not affected.
+/// A single client is lent the device ring instead: its transmit thread drains
+/// the ring directly after its queue, without the copy, until the distributor
+/// reclaims the ring for a second client.
+/// Commands are forwarded to the device for the owner, dropped for read-only clients.
+/// </summary>
+class client_session
+{
+public:
+	client_session(mir_sdr_device* device, SOCKET sock, int id, bool owner);
+	~client_session();
+
+	void start(int numBlocks, int blockSize, int poolFlags, int txMode);
+	// Follows a geometry change of the device ring, called by the distributor
+	void resize(int numBlocks, int blockSize);
+	// Disconnects and joins the threads of the client
+	void stop();
+
+	// ---- distributor side ----
+	// Queues one block of samples, returns false, if it was dropped.
+	// A client, that keeps overflowing its queue for longer than kickMs (0: never), is disconnected.
+	bool deliver(const BYTE* data, int length, int kickMs);
+	// Under mutex_clients: the transmit thread continues in the device ring, after the queue.
+	// Reclaimed, it goes back to the queue and returns the ring with returnRing() of the device
+	void lendRing(sample_ring* r) { lent.store(r); }
+	void reclaimRing() { lent.store(0); }
+	// CMD_REPLAY_HISTORY of the client, ms of history or -1, taken by the distributor
+	int takeReplayRequest() { return replayMs.load(std::memory_order_relaxed) < 0 ? -1 : replayMs.exchange(-1); }
+
+	int id() const { return clientId; }
+	bool isOwner() const { return owner.load(); }
+	void setOwner(bool on) { owner.store(on); }
+	bool isClosed() const { return closed.load(); }
+	const std::string& peerName() const { return peer; }
+	unsigned long long droppedBlocks() const { return queue.droppedBlocks(); }
+	unsigned long long deliveredBlocks() const { return delivered; }
+	// of the transmit thread, see sample_sender
+	unsigned long long bytesSent() const;
+	unsigned long long sendStalls() const;
+	unsigned long long blockedMicros() const;
+	unsigned long long partialWrites() const;
+	// adds the latencies of the transmit thread
+	void mergeLatency(latency_histogram& select, latency_histogram& send) const;
+	void reportStatistics() const;
+
+private:
+	client_session(client_session const&);		// Don't Implement
+	void operator=(client_session const&);		// Don't implement
+
+	friend void* clientReceive(void* p);
+	friend void* clientTransmit(void* p);
+	void disconnect(const char* reason);
+
+	static const int c_maxCommandBatch = 64;	// commands taken from the socket at once
+
+	mir_sdr_device* device;
+	SOCKET sock;
+	int clientId;
+	std::string peer;
+	std::atomic<bool> owner;
+	std::atomic<bool> closed;
+	std::atomic<bool> running;
+	std::atomic<int> replayMs;
+
+	sample_ring queue;
+	sample_sender* sender = 0;	// drains the queue on the transmit thread
+	std::atomic<sample_ring*> lent;	// the device ring, while it is lent to this client
+	pthread_t* thrdRx = 0;
+	pthread_t* thrdTx = 0;
+
+	// used by the receive thread only, read after it was joined
+	unsigned long long ignoredCommands = 0;
+
+	// used by the distributor only
+	long long overflowSinceUs = 0;
+	long long lastDropUs = 0;
+	unsigned long long delivered = 0;
+};
@@ -19,6 +19,7 @@
 **/
 
 #include "common.h"
+#include <string.h>
 
 #ifdef _WIN32
 int common::gettimeofday(struct timeval *tv, void* ignored)
@@ -82,6 +83,72 @@ int common::gettimeofday(struct timeval *tv, void* ignored)
 		return timeout;
 	}
 
+	long long common::monotonicMicros()
+	{
+	#ifdef _WIN32
+		static LARGE_INTEGER freq = { 0 };
+		LARGE_INTEGER now;
+		if (freq.QuadPart == 0)
+			QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return (long long)(now.QuadPart * 1000000.0 / freq.QuadPart);
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	#endif
+	}
+
+	long long common::monotonicNanos()
+	{
+	#ifdef _WIN32
+		static LARGE_INTEGER freq = { 0 };
+		LARGE_INTEGER now;
+		if (freq.QuadPart == 0)
+			QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return (long long)(now.QuadPart * 1000000000.0 / freq.QuadPart);
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	#endif
+	}
+
+	long long common::realtimeNanos()
+	{
+	#ifdef _WIN32
+		FILETIME ft;
+		GetSystemTimeAsFileTime(&ft);
+		long long t = ((long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+		return (t - 116444736000000000LL) * 100;	// 100 ns since 1601
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	#endif
+	}
 
+	timespec common::getRelativeTimeoutValueMs(int relativeTimeoutMs)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		long long nsec = (long long)now.tv_usec * 1000 + (long long)(relativeTimeoutMs % 1000) * 1000000;
+		struct timespec timeout;
+		timeout.tv_sec = now.tv_sec + relativeTimeoutMs / 1000 + (time_t)(nsec / 1000000000);
+		timeout.tv_nsec = (long)(nsec % 1000000000);
+		return timeout;
+	}
 
+int getCommandAndValue(char* rxBuf, int& value)
+{
+	BYTE valbuf[4];
+	int cmd = rxBuf[0];
+	memcpy( valbuf, rxBuf + 1,4);
 
+	if (common::isLittleEndian())
+		value = valbuf[3] + valbuf[2] * 0x100 + valbuf[1] * 0x10000 + valbuf[0] * 0x1000000;
+	else
+		value = valbuf[0] + valbuf[1] * 0x100 + valbuf[2] * 0x10000 + valbuf[3] * 0x1000000;
+	return cmd;
+}
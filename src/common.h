@@ -44,6 +44,7 @@
 #pragma comment(lib, "ws2_32.lib")
 
 	typedef int socklen_t;
+#define SHUT_RDWR SD_BOTH
 
 #else
 #define closesocket close
@@ -65,6 +66,10 @@ public:
 
 	static bool isLittleEndian();
 	static timespec getRelativeTimeoutValue(int relativeTimeoutSec);
+	static timespec getRelativeTimeoutValueMs(int relativeTimeoutMs);
+	static long long monotonicMicros();
+	static long long monotonicNanos();
+	static long long realtimeNanos();
 	#ifdef _WIN32
 	static int gettimeofday(struct timeval *tv, void* ignored);
 	#endif
@@ -80,6 +85,9 @@ public:
 	}
 };
 
+// Splits a 5 byte rtl_tcp command into its id and its big endian value
+int getCommandAndValue(char* rxBuf, int& value);
+
 class msg_exception : public std::exception
 {
 public:
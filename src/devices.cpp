@@ -22,8 +22,11 @@
 #include <string>
 #include<thread>
 #include "devices.h"
+#include "uring_backend.h"
+#include "metrics_server.h"
 #ifndef _WIN32
 #include <netdb.h>
+#include <fcntl.h>
 #endif
 
 using namespace std;
@@ -37,6 +40,16 @@ void devices::Start(rsp_cmdLineArgs*  pargs)
 	{
 		listenerAddress = pargs->Address;
 		listenerPort = pargs->Port;
+		if (pargs->metricsPort > 0 && metrics == 0)
+		{
+			metrics = new metrics_server();
+			if (!metrics->open(pargs->metricsAddress, pargs->metricsPort))
+			{
+				cout << "Metrics not available" << endl;
+				delete metrics;
+				metrics = 0;
+			}
+		}
 		initListener();
 		doListen();
 
@@ -54,6 +67,9 @@ void devices::Start(rsp_cmdLineArgs*  pargs)
 // Intent is to stop all devices and release everything
 void devices::Stop()
 {
+	// reads the devices, stopped first
+	delete metrics;
+	metrics = 0;
 
 	map<string, mir_sdr_device*>::iterator it;
 
@@ -80,6 +96,17 @@ mir_sdr_device* devices::findFreeDevice()
 	return 0;
 }
 
+mir_sdr_device* devices::findRequestedDevice(const string& serno)
+{
+	map<string, mir_sdr_device*>::iterator it = mirDevices.find(serno);
+	if (it == mirDevices.end())
+		return 0;
+	mir_sdr_device* pd = it->second;
+	if (!pd->started && pd->devAvail)
+		return pd;
+	return 0;
+}
+
 mir_sdr_device* devices::findRequestedDevice(int rqIdx) 
 {
 	map<string, mir_sdr_device*>::iterator it;
@@ -95,26 +122,171 @@ mir_sdr_device* devices::findRequestedDevice(int rqIdx)
 
 
 
+/// <summary>
+/// Finds and selects the device requested on the command line
+/// </summary>
+/// <returns>The device, 0 if not available</returns>
+mir_sdr_device* devices::openRequestedDevice()
+{
+	mir_sdr_device* pd;
+	if (!pargs->requestedSerial.empty())
+	{
+		pd = findRequestedDevice(pargs->requestedSerial);
+		if (pd == 0)
+		{
+			cout << "Requested Device " << pargs->requestedSerial << " not available.\n";
+			return 0;
+		}
+	}
+	else
+	{
+		pd = findRequestedDevice(pargs->requestedDeviceIndex);
+		if (pd == 0)
+		{
+			cout << "Requested Device " << pargs->requestedDeviceIndex << " not available.\n";
+			return 0;
+		}
+	}
+	mir_sdr_ErrT err = mir_sdr_SetDeviceIdx(pd->DeviceIndex);
+	cout << "mir_sdr_SetDeviceIdx " << pd->DeviceIndex << " returned with: " << err << endl;
+	if (err != mir_sdr_Success)
+		return 0;
+	cout << "Device Index" << pd->DeviceIndex << "successfully set" << endl;
+	return pd;
+}
+
+/// <summary>
+/// Session handling for the io_uring backend: the device streams into its
+/// ring without transmit thread, commands are pushed to its receive thread
+/// </summary>
+class uring_session : public uring_backend::handler
+{
+public:
+	uring_session(devices& d) : d(d) {}
+
+	sample_ring* sessionStart(SOCKET client)
+	{
+		d.currentDevice = 0;
+		if (d.mirDevices.size() == 0 || !d.getDevices())
+		{
+			cout << "getDevices failed.\n";
+			return 0;
+		}
+		mir_sdr_device* pd = d.openRequestedDevice();
+		if (pd == 0)
+			return 0;
+		d.currentDevice = pd;
+		pd->init(d.pargs);
+		pd->start(client, false);
+		return pd->sampleRing();
+	}
+
+	void command(const char* cmd)
+	{
+		if (d.currentDevice != 0)
+			d.currentDevice->pushCommand(cmd);
+	}
+
+	void sessionEnd()
+	{
+		mir_sdr_device* pd = d.currentDevice;
+		if (pd == 0)
+			return;
+		d.endSession(pd);
+		cout << "Listening to " << d.listenerAddress.sIPAddress << ":" << to_string(d.listenerPort) << endl;
+	}
+
+private:
+	devices& d;
+};
+
+void devices::doListenUring()
+{
+	uring_backend backend;
+	if (!backend.init())
+	{
+		cout << "Falling back to the threaded network backend" << endl;
+		pargs->ioUring = 0;
+		doListen();
+		return;
+	}
+	cout << "Network backend: io_uring" << endl;
+	if (pargs->maxClients > 1)
+		cout << "The io_uring backend serves one client at a time" << endl;
+	if (pargs->recordUnattended)
+		cout << "The io_uring backend streams with a client only, unattended recording is off" << endl;
+	cout << "Listening to " << listenerAddress.sIPAddress << ":" << to_string(listenerPort) << endl;
+	uring_session session(*this);
+	std::atomic<bool> running(true);
+	try
+	{
+		backend.serve(listenSocket, session, running);
+	}
+	catch (exception& e)
+	{
+		cout << "Error in io_uring backend: " << e.what() << endl;
+	}
+}
+
 void devices::doListen()
 {
-	mir_sdr_ErrT err;
 	try
 	{
 		devices* d = this;
-		int maxConnections = 1;
+		int maxConnections = pargs->maxClients;
 		SOCKET sock = listenSocket;
 		int res = listen(sock, maxConnections);
 		if (res == SOCKET_ERROR)
 			throw msg_exception(common::getSocketErrorString());
+
+		if (pargs->ioUring)
+		{
+			doListenUring();
+			return;
+		}
 			
+		currentDevice = 0;
+		cout << "Listening to " << listenerAddress.sIPAddress << ":" << to_string(d->listenerPort) << endl;
 		while (sock != INVALID_SOCKET)
 		{
-			currentDevice = 0;
-			cout << "Listening to " << listenerAddress.sIPAddress << ":" << to_string(d->listenerPort) << endl;
-			socklen_t rlen = sizeof(remote);
-			clientSocket = accept(sock, (struct sockaddr *)&remote, &rlen);
+			mir_sdr_device* current = currentDevice;
+			bool streaming = current != 0 && current->started;
+			if (streaming)
+			{
+				// the stream ends with its last client, unless it runs unattended
+				if (current->reapClients() == 0 && !pargs->recordUnattended)
+				{
+					endSession(current);
+					cout << "Listening to " << listenerAddress.sIPAddress << ":" << to_string(d->listenerPort) << endl;
+					continue;
+				}
+				// all slots taken: further clients wait in the backlog, until one leaves
+				if (!waitForClient(sock, current->numClients() < pargs->maxClients))
+					continue;
+			}
 
-			cout << "Client Accepted!\n" << endl;
+			if (streaming || !pargs->recordUnattended)
+			{
+				socklen_t rlen = sizeof(remote);
+				clientSocket = accept(sock, (struct sockaddr *)&remote, &rlen);
+				if (clientSocket == INVALID_SOCKET)
+					continue;
+
+				cout << "Client Accepted!\n" << endl;
+
+				if (streaming)
+				{
+					current->addClient(clientSocket);
+					continue;
+				}
+			}
+			else
+			{
+				// unattended: the stream starts without a client, the clients join it
+				clientSocket = INVALID_SOCKET;
+				cout << "Starting the stream without a client" << endl;
+			}
+			currentDevice = 0;
 
 			if (mirDevices.size() != 0)
 			{
@@ -126,29 +298,18 @@ void devices::doListen()
 				//mir_sdr_device* pd = findFreeDevice();
 				//if (pd == 0)
 				//	cout << "No free device available.\n";
-				mir_sdr_device* pd = findRequestedDevice(pargs->requestedDeviceIndex);
-				if (pd == 0)
-					cout << "Requested Device " << pargs->requestedDeviceIndex << " not available.\n";
-				else
+				mir_sdr_device* pd = openRequestedDevice();
+				if (pd != 0)
 				{
 					currentDevice = pd;
-					err = mir_sdr_SetDeviceIdx(pd->DeviceIndex);
-					cout << "mir_sdr_SetDeviceIdx " << pd->DeviceIndex << " returned with: " << err << endl;
-
-					if (err == mir_sdr_Success)
-					{
-						cout << "Device Index" << pd->DeviceIndex << "successfully set" << endl;
-						pd->init(pargs);
-						pd->start(clientSocket);
-
-						void* status;
-						pthread_join(*pd->thrdRx, &status);
-						cout << endl << "++++ Rx thread terminated ++++" << endl;
-						delete pd->thrdRx;
-						pd->thrdRx = 0;
-						pd->stop();
-					}
+					pd->init(pargs);
+#ifndef _WIN32
+					pd->setListenerWakeup(wakeupPipe[1]);
+#endif
+					pd->start(clientSocket);
 				}
+				else if (pargs->recordUnattended)
+					usleep(1000000);	// not without a client to wait for
 			}
 		}
 	}
@@ -158,6 +319,52 @@ void devices::doListen()
 	}
 }
 
+/// <summary>
+/// Ends the stream of a device, after its clients have gone
+/// </summary>
+void devices::endSession(mir_sdr_device* pd)
+{
+	pd->closeCommands();
+	void* status;
+	pthread_join(*pd->thrdRx, &status);
+	cout << endl << "++++ Rx thread terminated ++++" << endl;
+	delete pd->thrdRx;
+	pd->thrdRx = 0;
+	pd->stop();
+	currentDevice = 0;
+}
+
+/// <summary>
+/// Blocks until a client connects or a client session has closed, see mir_sdr_device::wakeListener
+/// </summary>
+/// <param name="acceptClients">false: the listen socket is not watched, the clients wait in the backlog</param>
+/// <returns>true, if a client may be accepted</returns>
+bool devices::waitForClient(SOCKET sock, bool acceptClients)
+{
+	fd_set readSet;
+	FD_ZERO(&readSet);
+	if (acceptClients)
+		FD_SET(sock, &readSet);
+#ifdef _WIN32
+	// no pipes in select: the sessions are polled
+	struct timeval tv = { 0, 200000 };
+	return select(sock + 1, &readSet, 0, 0, &tv) > 0 && acceptClients;
+#else
+	int wakeup = wakeupPipe[0];
+	FD_SET(wakeup, &readSet);
+	int res = select((sock > wakeup ? sock : wakeup) + 1, &readSet, 0, 0, 0);
+	if (res <= 0)
+		return false;
+	if (FD_ISSET(wakeup, &readSet))
+	{
+		char buf[64];
+		while (read(wakeup, buf, sizeof(buf)) > 0)
+			;
+	}
+	return acceptClients && FD_ISSET(sock, &readSet);
+#endif
+}
+
 void devices::initListener()
 {
 	memset(&local, 0, sizeof(local));
@@ -182,6 +389,17 @@ void devices::initListener()
 	res = ::bind(listenSocket, (struct sockaddr *)&local, sizeof(local));
 	if (res == SOCKET_ERROR)
 		throw msg_exception(common::getSocketErrorString().c_str());
+
+#ifndef _WIN32
+	// written by the client sessions, when they close, both ends never block
+	if (wakeupPipe[0] < 0)
+	{
+		if (pipe(wakeupPipe) != 0)
+			throw msg_exception("Cannot create the wakeup pipe of the listener");
+		fcntl(wakeupPipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wakeupPipe[1], F_SETFL, O_NONBLOCK);
+	}
+#endif
 }
 /// <summary>
 /// Collect all sdrplay devices
@@ -215,6 +433,7 @@ bool devices::getDevices()
 				pd->serno = mydevices[i].SerNo;
 				pd->DevNm = mydevices[i].DevNm;
 				pd->DeviceIndex = (unsigned int)i;
+				pthread_mutex_lock(&mutex_devices);
 				if (mirDevices.count(pd->serno) == 0)
 					mirDevices.insert (pair<string, mir_sdr_device*>(pd->serno, pd));
 				else
@@ -225,6 +444,7 @@ bool devices::getDevices()
 					mirDevices[pd->serno]->DeviceIndex = pd->DeviceIndex;
 					delete pd;
 				}
+				pthread_mutex_unlock(&mutex_devices);
 			}
 		}
 	}
@@ -235,3 +455,13 @@ bool devices::getDevices()
 	}
 	return true;
 }
+
+void devices::collectMetrics(vector<device_metrics>& m)
+{
+	pthread_mutex_lock(&mutex_devices);
+	m.resize(mirDevices.size());
+	size_t i = 0;
+	for (map<string, mir_sdr_device*>::iterator it = mirDevices.begin(); it != mirDevices.end(); it++)
+		it->second->readMetrics(m[i++]);
+	pthread_mutex_unlock(&mutex_devices);
+}
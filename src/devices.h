@@ -30,6 +30,8 @@
 #include <mirsdrapi-rsp.h>
 #include "rsp_cmdLineArgs.h"
 
+class metrics_server;
+
 class devices
 {
 
@@ -49,18 +51,28 @@ public:
 	//void operator=(devices const&)	= delete;	
 	mir_sdr_device* findFreeDevice() ;
 	mir_sdr_device* findRequestedDevice(int rqIdx);
+	mir_sdr_device* findRequestedDevice(const string& serno);
 	void Start(rsp_cmdLineArgs*  pargs);
 	void Stop();
 	void doListen();
+	void doListenUring();
 	bool getDevices() ;
 	int getNumberOfDevices() const { return mirDevices.size(); }
+	// Snapshot of all devices, for the metrics server thread
+	void collectMetrics(vector<device_metrics>& m);
 
 private:
 	void initListener();
+	mir_sdr_device* openRequestedDevice();
+	void endSession(mir_sdr_device* pd);
+	bool waitForClient(SOCKET sock, bool acceptClients);
+	friend class uring_session;
 
 	mir_sdr_device* currentDevice;
 	SOCKET clientSocket = INVALID_SOCKET;
 	SOCKET listenSocket = INVALID_SOCKET;
+	// read end: select of the listener, write end: the closing client sessions
+	int wakeupPipe[2] = { -1, -1 };
 	sockaddr_in local;
 	sockaddr_in remote;
 	struct addrinfo *result = NULL;
@@ -69,6 +81,11 @@ private:
 	// command line arguments
 	rsp_cmdLineArgs* pargs;
 
+	// Prometheus metrics, from the command line
+	metrics_server* metrics = 0;
+	// guards mirDevices against the metrics server, the map is only changed by getDevices
+	pthread_mutex_t mutex_devices = PTHREAD_MUTEX_INITIALIZER;
+
 	// default values, may be overridden by command line arguments
     IPAddress  listenerAddress = IPAddress(0,0,0,0);
 	int listenerPort = 7890;
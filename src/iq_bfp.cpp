@@ -0,0 +1,103 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_bfp.h"
+#include "iq_convert.h"
+#include <math.h>
+
+int iq_bfp::encode(const short* xi, const short* xq, int numSamples, int mantissaBits, BYTE* out)
+{
+	const int b = mantissaBits;
+	// smallest exponent, for which the peak fits the mantissas: peak < 2^(b - 1 + e)
+	int peak = iq_convert::peak(xi, xq, numSamples);
+	int e = 8 - b;
+	while ((peak >> (b - 1 + e)) != 0)
+		e++;
+	out[0] = (BYTE)e;
+
+	// 8 bit mantissas: floor((x + 0.5) * 2^-(e - (8 - b))) + 128, rounded and vectorized as cu8
+	convert8Params p;
+	p.shift = e - (8 - b);
+	p.lut = 0;
+	p.ditherI = 0;
+	p.ditherQ = 0;
+	BYTE* m = out + 1;
+	iq_convert::convert8(xi, xq, numSamples, m, p);
+	if (b == 8)
+		return 1 + 2 * numSamples;
+
+	// fewer bits: the high bits of the 8 bit mantissas, packed in place
+	if (b == 6)
+	{
+		// four mantissas in three bytes, without a bit accumulator
+		BYTE* o = m;
+		for (int i = 0; i < 2 * numSamples; i += 4, o += 3)
+		{
+			unsigned int m0 = m[i] >> 2, m1 = m[i + 1] >> 2, m2 = m[i + 2] >> 2, m3 = m[i + 3] >> 2;
+			o[0] = (BYTE)(m0 | m1 << 6);
+			o[1] = (BYTE)(m1 >> 2 | m2 << 4);
+			o[2] = (BYTE)(m2 >> 4 | m3 << 2);
+		}
+		return (int)(o - out);
+	}
+	const int drop = 8 - b;
+	unsigned int acc = 0;
+	int bits = 0;
+	BYTE* o = m;
+	for (int i = 0; i < 2 * numSamples; i++)
+	{
+		acc |= (unsigned int)(m[i] >> drop) << bits;
+		bits += b;
+		if (bits >= 8)
+		{
+			*o++ = (BYTE)acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	return (int)(o - out);
+}
+
+int iq_bfp::decode(const BYTE* in, int numSamples, int mantissaBits, float* xi, float* xq)
+{
+	const int b = mantissaBits;
+	float step = (float)ldexp(1.0, in[0] - 15);		// 2^e / 32768
+	float offset = (float)(1 << (b - 1)) - 0.5f;
+	const BYTE* m = in + 1;
+	unsigned int acc = 0;
+	int bits = 0;
+	for (int i = 0; i < 2 * numSamples; i++)
+	{
+		while (bits < b)
+		{
+			acc |= (unsigned int)*m++ << bits;
+			bits += 8;
+		}
+		float v = ((acc & ((1u << b) - 1)) - offset) * step;
+		acc >>= b;
+		bits -= b;
+		if (i & 1)
+			xq[i / 2] = v;
+		else
+			xi[i / 2] = v;
+	}
+	return encodedBytes(numSamples, mantissaBits);
+}
@@ -0,0 +1,48 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include "common.h"
+
+/// <summary>
+/// Block floating point format: a block of n I/Q samples shares one exponent e,
+/// every value is a mantissa m of b bits (6..8), offset binary, of the value (m - 2^(b-1) + 0.5) * 2^e.
+/// The exponent is the smallest one, for which the block fits. The error is at most 2^(e-1),
+/// half a mantissa step: relative to the peak of the block, about 2^-b.
+/// Mantissas below 8 bit are derived from the 8 bit quantization, so the exponent is at least 8 - b.
+///
+/// Block: one byte e, followed by the mantissas of I0 Q0 I1 Q1 ..., LSB first in b bits.
+/// n must be a multiple of 4, so a block ends at a byte boundary.
+/// </summary>
+class iq_bfp
+{
+public:
+	static const int c_minMantissaBits = 6;
+	static const int c_maxMantissaBits = 8;
+
+	static int encodedBytes(int numSamples, int mantissaBits) { return 1 + numSamples * mantissaBits / 4; }
+
+	// encodes one block of numSamples, returns the number of bytes written to out
+	static int encode(const short* xi, const short* xq, int numSamples, int mantissaBits, BYTE* out);
+
+	// reference decoder, to float of full scale +-1.0 as the cf32 formats; returns the block size
+	static int decode(const BYTE* in, int numSamples, int mantissaBits, float* xi, float* xq);
+};
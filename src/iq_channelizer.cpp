@@ -0,0 +1,145 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_channelizer.h"
+#include <math.h>
+#include <string.h>
+
+static const double c_pi = 3.14159265358979323846;
+static const double c_kaiserBeta = 8.0;
+
+// modified Bessel function of order 0
+static double bessel0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; k < 50; k++)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+void iq_channelizer::configure(int numChannels, const std::vector<int>& channels)
+{
+	delete fft;
+	fft = new iq_fft(numChannels);
+	M = numChannels;
+	D = numChannels / 2;
+	this->channels = channels;
+
+	// prototype: lowpass of half the channel spacing, unity DC gain
+	const int length = c_tapsPerBranch * M;
+	std::vector<double> proto(length);
+	const double center = (length - 1) / 2.0;
+	const double norm = bessel0(c_kaiserBeta);
+	double sum = 0;
+	for (int i = 0; i < length; i++)
+	{
+		double t = i - center;
+		double r = t / (center + 1);
+		double x = c_pi * t / M;
+		proto[i] = bessel0(c_kaiserBeta * sqrt(1 - r * r)) / norm * (x == 0 ? 1 : sin(x) / x);
+		sum += proto[i];
+	}
+	// branch k of tap p is applied to x[n - k - p * M]: stored reversed within the taps,
+	// so the inner loops run over ascending samples
+	coeffs.resize(length);
+	for (int p = 0; p < c_tapsPerBranch; p++)
+		for (int k = 0; k < M; k++)
+			coeffs[p * M + (M - 1 - k)] = (float)(proto[k + p * M] / sum);
+
+	histI.assign(length - 1 + c_maxChunk, 0);
+	histQ.assign(length - 1 + c_maxChunk, 0);
+	fill = length - 1;
+	next = length - 1;
+	step = 0;
+	sumI.resize(M);
+	sumQ.resize(M);
+	fftI.resize(M);
+	fftQ.resize(M);
+	outputs.assign(channels.size(), std::vector<short>());
+}
+
+static inline short toShort(float x)
+{
+	x = x < -32768.0f ? -32768.0f : (x > 32767.0f ? 32767.0f : x);
+	return (short)lrintf(x);
+}
+
+int iq_channelizer::process(const short* iq, int numSamples)
+{
+	for (int i = 0; i < numSamples; i++)
+	{
+		histI[fill + i] = iq[2 * i];
+		histQ[fill + i] = iq[2 * i + 1];
+	}
+	fill += numSamples;
+
+	int count = 0;
+	const int length = c_tapsPerBranch * M;
+	for (; next < fill; next += D, step++, count++)
+	{
+		// sum over the taps of every branch
+		for (int k = 0; k < M; k++)
+		{
+			sumI[k] = 0;
+			sumQ[k] = 0;
+		}
+		for (int p = 0; p < c_tapsPerBranch; p++)
+		{
+			const float* c = &coeffs[p * M];
+			const float* xi = &histI[next - (p + 1) * M + 1];
+			const float* xq = &histQ[next - (p + 1) * M + 1];
+			for (int k = 0; k < M; k++)
+			{
+				sumI[k] += c[k] * xi[k];
+				sumQ[k] += c[k] * xq[k];
+			}
+		}
+		// channel c is sum_k u[k] exp(+j 2 pi c k / M), with u[k] = sum[M - 1 - k]:
+		// the forward FFT of u[-k], i.e. of the sums rotated by one
+		fftI[0] = sumI[M - 1];
+		fftQ[0] = sumQ[M - 1];
+		memcpy(&fftI[1], &sumI[0], (M - 1) * sizeof(float));
+		memcpy(&fftQ[1], &sumQ[0], (M - 1) * sizeof(float));
+		fft->forward(&fftI[0], &fftQ[0]);
+
+		// the mixer of channel c advances by pi * c per output: odd channels alternate
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			int bin = channels[i] & (M - 1);
+			float sign = (bin & step & 1) ? -1.0f : 1.0f;
+			outputs[i].push_back(toShort(sign * fftI[bin]));
+			outputs[i].push_back(toShort(sign * fftQ[bin]));
+		}
+	}
+
+	int keep = length - 1;
+	int drop = fill - keep;
+	memmove(&histI[0], &histI[drop], keep * sizeof(float));
+	memmove(&histQ[0], &histQ[drop], keep * sizeof(float));
+	fill = keep;
+	next -= drop;
+	return count;
+}
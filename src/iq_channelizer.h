@@ -0,0 +1,82 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include "iq_fft.h"
+#include <vector>
+
+/// <summary>
+/// Polyphase filter bank channelizer: splits the I/Q stream of rate fs into a grid of
+/// numChannels equally spaced channels, channel c centered at c * fs / numChannels
+/// (c negative below the center frequency), each of rate 2 * fs / numChannels.
+/// The channels are oversampled by 2, so a channel is free of aliases across its whole width.
+/// Every numChannels / 2 input samples, the numChannels branches of the prototype filter
+/// are evaluated and one FFT yields a sample of all channels at once:
+/// per input sample 2 * c_tapsPerBranch multiplications plus log2(numChannels) for the FFT,
+/// independent of the number of channels exported.
+/// </summary>
+class iq_channelizer
+{
+public:
+	static const int c_tapsPerBranch = 12;
+	static const int c_maxChunk = 16384;	// input samples per call of process
+
+	iq_channelizer() {}
+	~iq_channelizer() { delete fft; }
+
+	/// <summary>
+	/// Sets up the filter bank, clears the history
+	/// </summary>
+	/// <param name="numChannels">power of two, 2 ..</param>
+	/// <param name="channels">channels exported, -numChannels/2 .. numChannels/2 - 1</param>
+	void configure(int numChannels, const std::vector<int>& channels);
+
+	int numChannels() const { return M; }
+	int numExported() const { return (int)channels.size(); }
+	int channel(int index) const { return channels[index]; }
+
+	// channelizes numSamples (at most c_maxChunk) interleaved cs16 samples,
+	// returns the number of samples appended to each output
+	int process(const short* iq, int numSamples);
+
+	// interleaved cs16 samples of an exported channel, the caller clears them after use
+	std::vector<short>& output(int index) { return outputs[index]; }
+
+private:
+	int M = 0;						// channels, FFT size
+	int D = 0;						// decimation, M / 2
+	std::vector<int> channels;
+	std::vector<float> coeffs;		// c_tapsPerBranch * M, branch order reversed
+	std::vector<float> histI;		// c_tapsPerBranch * M - 1 samples history, followed by the input
+	std::vector<float> histQ;
+	int fill = 0;
+	int next = 0;					// index of the newest sample of the next output
+	unsigned step = 0;				// output counter, for the phase of the odd channels
+	std::vector<float> sumI;
+	std::vector<float> sumQ;
+	std::vector<float> fftI;
+	std::vector<float> fftQ;
+	std::vector<std::vector<short> > outputs;
+	iq_fft* fft = 0;
+
+	iq_channelizer(iq_channelizer const&);		// Don't Implement
+	void operator=(iq_channelizer const&);		// Don't implement
+};
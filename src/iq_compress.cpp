@@ -0,0 +1,332 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_compress.h"
+#include <string.h>
+
+namespace
+{
+	// LSB first bit stream, with at most 32 bits per write
+	struct bitWriter
+	{
+		BYTE* out;
+		unsigned long long acc;
+		int bits;
+
+		bitWriter(BYTE* out) : out(out), acc(0), bits(0) {}
+
+		void write(unsigned int value, int n)
+		{
+			acc |= (unsigned long long)value << bits;
+			bits += n;
+			if (bits >= 32)
+			{
+				out[0] = (BYTE)acc;
+				out[1] = (BYTE)(acc >> 8);
+				out[2] = (BYTE)(acc >> 16);
+				out[3] = (BYTE)(acc >> 24);
+				out += 4;
+				acc >>= 32;
+				bits -= 32;
+			}
+		}
+
+		void flush()
+		{
+			for (; bits > 0; bits -= 8, acc >>= 8)
+				*out++ = (BYTE)acc;
+			bits = 0;
+		}
+	};
+
+	struct bitReader
+	{
+		const BYTE* in;
+		const BYTE* end;
+		unsigned long long acc;
+		int bits;
+
+		bitReader(const BYTE* in, const BYTE* end) : in(in), end(end), acc(0), bits(0) {}
+
+		// returns false at the end of the data
+		bool read(int n, unsigned int& value)
+		{
+			while (bits < n && in < end)
+			{
+				acc |= (unsigned long long)*in++ << bits;
+				bits += 8;
+			}
+			if (bits < n)
+				return false;
+			value = (unsigned int)(acc & ((1ULL << n) - 1));
+			acc >>= n;
+			bits -= n;
+			return true;
+		}
+	};
+
+	struct predictor
+	{
+		int order;
+		int x1, x2;		// the previous samples
+
+		predictor(int order) : order(order), x1(0), x2(0) {}
+
+		int residual(int x)
+		{
+			int r = order == 0 ? x : (order == 1 ? x - x1 : x - 2 * x1 + x2);
+			x2 = x1;
+			x1 = x;
+			return r;
+		}
+
+		int sample(int r)
+		{
+			int x = order == 0 ? r : (order == 1 ? r + x1 : r + 2 * x1 - x2);
+			x2 = x1;
+			x1 = x;
+			return x;
+		}
+	};
+
+	inline int bitLength(unsigned int u)
+	{
+#if defined(__GNUC__)
+		return u != 0 ? 32 - __builtin_clz(u) : 0;
+#else
+		int n = 0;
+		for (; u != 0; u >>= 1)
+			n++;
+		return n;
+#endif
+	}
+
+	inline unsigned int zigzag(int r) { return ((unsigned int)r << 1) ^ (unsigned int)(r >> 31); }
+	inline int unzigzag(unsigned int u) { return (int)(u >> 1) ^ -(int)(u & 1); }
+
+	inline void put16(BYTE* p, unsigned int v) { p[0] = (BYTE)v; p[1] = (BYTE)(v >> 8); }
+	inline void put32(BYTE* p, unsigned int v) { put16(p, v & 0xffff); put16(p + 2, v >> 16); }
+	inline unsigned int get16(const BYTE* p) { return p[0] | (p[1] << 8); }
+	inline unsigned int get32(const BYTE* p) { return get16(p) | (get16(p + 2) << 16); }
+}
+
+unsigned int iq_compress::hash(const BYTE* data, int length)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < length; i++)
+	{
+		h ^= data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/// <summary>
+/// Chooses the predictor and the Rice parameter, which give the shortest code.
+/// The mean residual would be dominated by a few large ones, as at a block start or a step.
+/// The histogram of the bit lengths gives the cost of every parameter instead:
+/// a value of b bits costs about k + 1 + 1.5 * 2^(b - 1 - k) bits, or the escape.
+/// </summary>
+BYTE iq_compress::chooseCode(const short* x, int numSamples)
+{
+	int histogram[3][33];
+	memset(histogram, 0, sizeof(histogram));
+	int x1 = 0, x2 = 0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		int v = x[i];
+		histogram[0][bitLength(zigzag(v))]++;
+		histogram[1][bitLength(zigzag(v - x1))]++;
+		histogram[2][bitLength(zigzag(v - 2 * x1 + x2))]++;
+		x2 = x1;
+		x1 = v;
+	}
+	int order = 0, k = 0;
+	double best = -1;
+	for (int o = 0; o < 3; o++)
+	{
+		for (int kk = 0; kk <= 18; kk++)
+		{
+			double cost = 0;
+			for (int b = 0; b <= c_escapeBits; b++)
+			{
+				if (histogram[o][b] == 0)
+					continue;
+				double q = b > kk ? 1.5 * (1 << (b - 1 - kk)) : 0.5;
+				cost += histogram[o][b] * (q < c_escapeZeros ? kk + 1 + q : c_escapeZeros + c_escapeBits);
+			}
+			if (best < 0 || cost < best)
+			{
+				best = cost;
+				order = o;
+				k = kk;
+			}
+		}
+	}
+	return (BYTE)(order << 5 | k);
+}
+
+int iq_compress::encode(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	if (numSamples > c_maxSamples)
+		numSamples = c_maxSamples;
+	const int rawBytes = 4 * numSamples;
+	memcpy(out, "RSPZ", 4);
+	put16(out + 4, numSamples);
+
+	// I and Q are coded separately, into the deinterleaved halves of the buffer
+	BYTE code[2];
+	code[0] = chooseCode(xi, numSamples);
+	code[1] = chooseCode(xq, numSamples);
+
+	BYTE* payload = out + c_headerBytes;
+	bitWriter w(payload);
+	predictor p[2] = { predictor(code[0] >> 5), predictor(code[1] >> 5) };
+	const int k[2] = { code[0] & 0x1f, code[1] & 0x1f };
+	const short* x[2] = { xi, xq };
+	// stop, when the coded size approaches the raw one: the codes of a sample write
+	// at most four words, the flush one more, none of them may pass the raw size
+	const BYTE* limit = payload + rawBytes - 5 * 4;
+	bool raw = false;
+	for (int i = 0; i < numSamples; i++)
+	{
+		if (w.out > limit)
+		{
+			raw = true;
+			break;
+		}
+		for (int c = 0; c < 2; c++)
+		{
+			unsigned int u = zigzag(p[c].residual(x[c][i]));
+			unsigned int q = u >> k[c];
+			if (q >= (unsigned int)c_escapeZeros)
+			{
+				w.write(0, c_escapeZeros);
+				w.write(u, c_escapeBits);
+			}
+			else if (q + 1 + k[c] <= 32)
+				w.write((u & ((1u << k[c]) - 1)) << (q + 1) | 1u << q, q + 1 + k[c]);
+			else
+			{
+				w.write(1u << q, q + 1);
+				w.write(u & ((1u << k[c]) - 1), k[c]);
+			}
+		}
+	}
+	w.flush();
+
+	int payloadBytes = (int)(w.out - payload);
+	if (raw || payloadBytes >= rawBytes)
+	{
+		code[0] = code[1] = c_raw;
+		for (int i = 0; i < numSamples; i++)
+		{
+			put16(payload + 4 * i, (unsigned short)xi[i]);
+			put16(payload + 4 * i + 2, (unsigned short)xq[i]);
+		}
+		payloadBytes = rawBytes;
+	}
+	out[6] = code[0];
+	out[7] = code[1];
+	put32(out + 8, payloadBytes);
+	put32(out + 12, hash(payload, payloadBytes));
+	return c_headerBytes + payloadBytes;
+}
+
+int iq_compress::decode(const BYTE* in, int length, short* xi, short* xq, int maxSamples, int& blockBytes)
+{
+	blockBytes = 0;
+	if (length < c_headerBytes)
+		return 0;
+	if (memcmp(in, "RSPZ", 4) != 0)
+		return -1;
+	int numSamples = get16(in + 4);
+	BYTE code[2] = { in[6], in[7] };
+	unsigned int payloadBytes = get32(in + 8);
+	if (numSamples > maxSamples || payloadBytes > (unsigned int)4 * numSamples)
+		return -1;
+	if ((unsigned int)length < c_headerBytes + payloadBytes)
+		return 0;
+	const BYTE* payload = in + c_headerBytes;
+	if (hash(payload, payloadBytes) != get32(in + 12))
+		return -1;
+	blockBytes = c_headerBytes + payloadBytes;
+
+	if (code[0] == c_raw)
+	{
+		if (payloadBytes != (unsigned int)4 * numSamples)
+			return -1;
+		for (int i = 0; i < numSamples; i++)
+		{
+			xi[i] = (short)get16(payload + 4 * i);
+			xq[i] = (short)get16(payload + 4 * i + 2);
+		}
+		return numSamples;
+	}
+
+	bitReader r(payload, payload + payloadBytes);
+	predictor p[2] = { predictor(code[0] >> 5), predictor(code[1] >> 5) };
+	const int k[2] = { code[0] & 0x1f, code[1] & 0x1f };
+	short* x[2] = { xi, xq };
+	for (int i = 0; i < numSamples; i++)
+	{
+		for (int c = 0; c < 2; c++)
+		{
+			unsigned int bit = 0, q = 0, low = 0, u;
+			while (q < (unsigned int)c_escapeZeros)
+			{
+				if (!r.read(1, bit))
+					return -1;
+				if (bit)
+					break;
+				q++;
+			}
+			if (q == (unsigned int)c_escapeZeros)
+			{
+				if (!r.read(c_escapeBits, u))
+					return -1;
+			}
+			else
+			{
+				if (k[c] > 0 && !r.read(k[c], low))
+					return -1;
+				u = q << k[c] | low;
+			}
+			x[c][i] = (short)p[c].sample(unzigzag(u));
+		}
+	}
+	return numSamples;
+}
+
+int iq_compress::findBlock(const BYTE* in, int length)
+{
+	for (int i = 0; i + c_headerBytes <= length; i++)
+	{
+		if (in[i] != 'R' || memcmp(in + i, "RSPZ", 4) != 0)
+			continue;
+		unsigned int payloadBytes = get32(in + i + 8);
+		if (payloadBytes > (unsigned int)4 * get16(in + i + 4) || i + c_headerBytes + payloadBytes > (unsigned int)length)
+			continue;
+		if (hash(in + i + c_headerBytes, payloadBytes) == get32(in + i + 12))
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,71 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include "common.h"
+
+/// <summary>
+/// Lossless compression of I/Q blocks.
+/// Every block is self-delimiting: a 16 byte header with a sync word, followed by the payload.
+/// Per block and component, the best of the fixed predictors of order 0, 1 or 2 is chosen,
+/// the residuals are Rice coded with the parameter fitted to the block.
+/// A block not getting smaller is sent as raw 16 bit samples.
+///
+/// Header, little endian:
+///   0  "RSPZ"
+///   4  uint16 number of samples
+///   6  uint8 code of I, uint8 code of Q: predictor order << 5 | Rice parameter, 0xff: raw
+///   8  uint32 payload bytes
+///   12 uint32 FNV-1a hash of the payload, to confirm a sync word found by a client
+/// Payload: the codes of I0 Q0 I1 Q1 ..., LSB first. A code is q zero bits, a one bit
+/// and the k low bits of the zigzag mapped residual, where q are its high bits.
+/// If q reaches c_escapeZeros, the zeros are followed by the residual in c_escapeBits instead.
+/// Raw payload: interleaved 16 bit little endian samples.
+/// </summary>
+class iq_compress
+{
+public:
+	static const int c_headerBytes = 16;
+	static const int c_maxSamples = 65535;
+	static const int c_escapeZeros = 24;
+	static const int c_escapeBits = 19;
+	static const BYTE c_raw = 0xff;
+
+	// largest encoding of numSamples, raw samples plus the header
+	static int maxEncodedBytes(int numSamples) { return c_headerBytes + 4 * numSamples; }
+
+	// encodes one block, returns the number of bytes written to out
+	static int encode(const short* xi, const short* xq, int numSamples, BYTE* out);
+
+	/// <summary>
+	/// Reference decoder: decodes the block at the start of in
+	/// </summary>
+	/// <param name="blockBytes">size of the block, header included</param>
+	/// <returns>Number of samples, 0 if the block is incomplete, -1 if it is invalid</returns>
+	static int decode(const BYTE* in, int length, short* xi, short* xq, int maxSamples, int& blockBytes);
+
+	// offset of the first complete, valid block in the data, -1 if there is none: to resync a stream
+	static int findBlock(const BYTE* in, int length);
+
+private:
+	static unsigned int hash(const BYTE* data, int length);
+	static BYTE chooseCode(const short* x, int numSamples);
+};
@@ -0,0 +1,337 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "iq_convert.h"
+#include <string.h>
+#if defined(_MSC_VER) && (defined(RSP_TCP_HAVE_AVX2) || defined(RSP_TCP_HAVE_SSE2))
+#include <intrin.h>
+#endif
+#if defined(RSP_TCP_HAVE_NEON) && defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+void iq_convert::interleave16_scalar(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	for (int i = 0, j = 0; i < numSamples; i++)
+	{
+		out[j++] = (BYTE)(xi[i] & 0xff);
+		out[j++] = (BYTE)((xi[i] & 0xff00) >> 8);
+
+		out[j++] = (BYTE)(xq[i] & 0xff);
+		out[j++] = (BYTE)((xq[i] & 0xff00) >> 8);
+	}
+}
+
+static inline int level8(short x, const convert8Params& p)
+{
+	if (p.shift < 0)
+		return p.lut[(unsigned short)x];
+	// beyond these, the output saturates anyway: the level fits 16 bits
+	int lo = -(128 << p.shift);
+	int hi = (128 << p.shift) - 1;
+	int c = x < lo ? lo : (x > hi ? hi : x);
+	// floor((c + 0.5) * 2^(8 - shift))
+	return c * (1 << (8 - p.shift)) + (p.shift < 8 ? 1 << (7 - p.shift) : 0);
+}
+
+static inline BYTE output8(int level, const short* dither, int i)
+{
+	if (dither != 0)
+	{
+		level += dither[i];
+		level = level < -32768 ? -32768 : (level > 32767 ? 32767 : level);
+	}
+	return (BYTE)((level + 32768) >> 8);
+}
+
+void iq_convert::convert8_scalar(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p)
+{
+	for (int i = 0, j = 0; i < numSamples; i++)
+	{
+		out[j++] = output8(level8(xi[i], p), p.ditherI, i);
+		out[j++] = output8(level8(xq[i], p), p.ditherQ, i);
+	}
+}
+
+void iq_convert::interleave16be_scalar(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	for (int i = 0, j = 0; i < numSamples; i++)
+	{
+		out[j++] = (BYTE)((xi[i] & 0xff00) >> 8);
+		out[j++] = (BYTE)(xi[i] & 0xff);
+
+		out[j++] = (BYTE)((xq[i] & 0xff00) >> 8);
+		out[j++] = (BYTE)(xq[i] & 0xff);
+	}
+}
+
+static inline void storeF32(short x, BYTE* out)
+{
+	float f = x * (1.0f / 32768);	// exact, the SIMD kernels give the same bits
+	unsigned int u;
+	memcpy(&u, &f, 4);
+	out[0] = (BYTE)(u & 0xff);
+	out[1] = (BYTE)((u >> 8) & 0xff);
+	out[2] = (BYTE)((u >> 16) & 0xff);
+	out[3] = (BYTE)(u >> 24);
+}
+
+void iq_convert::interleaveF32_scalar(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	for (int i = 0; i < numSamples; i++)
+	{
+		storeF32(xi[i], out + 8 * i);
+		storeF32(xq[i], out + 8 * i + 4);
+	}
+}
+
+void iq_convert::planarF32_scalar(const short* x, int numSamples, BYTE* out)
+{
+	for (int i = 0; i < numSamples; i++)
+		storeF32(x[i], out + 4 * i);
+}
+
+void iq_convert::planar16(const short* x, int numSamples, BYTE* out)
+{
+	if (common::isLittleEndian())
+	{
+		memcpy(out, x, numSamples * sizeof(short));
+		return;
+	}
+	for (int i = 0, j = 0; i < numSamples; i++)
+	{
+		out[j++] = (BYTE)(x[i] & 0xff);
+		out[j++] = (BYTE)((x[i] & 0xff00) >> 8);
+	}
+}
+
+// x * 2^-shift, rounded to nearest, saturated
+static inline int reduce(short x, int shift)
+{
+	int r = (x + (1 << (shift - 1))) >> shift;
+	int hi = (32767 >> shift);
+	return r > hi ? hi : r;
+}
+
+void iq_convert::pack12_scalar(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	for (int i = 0, j = 0; i < numSamples; i++)
+	{
+		unsigned int w = (reduce(xi[i], 4) & 0xfff) | ((reduce(xq[i], 4) & 0xfff) << 12);
+		out[j++] = (BYTE)(w & 0xff);
+		out[j++] = (BYTE)((w >> 8) & 0xff);
+		out[j++] = (BYTE)((w >> 16) & 0xff);
+	}
+}
+
+void iq_convert::pack14_scalar(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	for (int i = 0, j = 0; i + 1 < numSamples; i += 2)
+	{
+		unsigned long long w = (unsigned long long)(reduce(xi[i], 2) & 0x3fff)
+			| (unsigned long long)(reduce(xq[i], 2) & 0x3fff) << 14
+			| (unsigned long long)(reduce(xi[i + 1], 2) & 0x3fff) << 28
+			| (unsigned long long)(reduce(xq[i + 1], 2) & 0x3fff) << 42;
+		for (int k = 0; k < 7; k++)
+			out[j++] = (BYTE)((w >> (8 * k)) & 0xff);
+	}
+}
+
+int iq_convert::peak_scalar(const short* xi, const short* xq, int numSamples)
+{
+	int m = 0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		int a = xi[i] < 0 ? ~xi[i] : xi[i];
+		int b = xq[i] < 0 ? ~xq[i] : xq[i];
+		m = a > m ? a : m;
+		m = b > m ? b : m;
+	}
+	return m;
+}
+
+int iq_convert::dot16_scalar(const short* x, const short* h, int n)
+{
+	int sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += x[i] * h[i];
+	return sum;
+}
+
+void iq_convert::moments_scalar(const short* xi, const short* xq, int numSamples, long long* m)
+{
+	for (int i = 0; i < numSamples; i++)
+	{
+		int hi = xi[i] >> 1;
+		int hq = xq[i] >> 1;
+		m[0] += xi[i];
+		m[1] += xq[i];
+		m[2] += hi * hi;
+		m[3] += hq * hq;
+		m[4] += hi * hq;
+	}
+}
+
+static inline short saturate16(int x)
+{
+	return (short)(x < -32768 ? -32768 : (x > 32767 ? 32767 : x));
+}
+
+void iq_convert::correct_scalar(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p)
+{
+	for (int i = 0; i < numSamples; i++)
+	{
+		int a = xi[i] * p.kII + xq[i] * p.kIQ + p.offI;
+		int b = xi[i] * p.kQI + xq[i] * p.kQQ + p.offQ;
+		yi[i] = saturate16(a >> 14);
+		yq[i] = saturate16(b >> 14);
+	}
+}
+
+// sign extends a field of the given width, scaled back to 16 bit
+static inline short expand(unsigned int v, int bits)
+{
+	int x = (int)(v << (32 - bits)) >> (32 - bits);
+	return (short)(x * (1 << (16 - bits)));
+}
+
+void iq_convert::unpack12(const BYTE* in, int numSamples, short* xi, short* xq)
+{
+	for (int i = 0; i < numSamples; i++, in += 3)
+	{
+		unsigned int w = in[0] | (in[1] << 8) | (in[2] << 16);
+		xi[i] = expand(w & 0xfff, 12);
+		xq[i] = expand(w >> 12, 12);
+	}
+}
+
+void iq_convert::unpack14(const BYTE* in, int numSamples, short* xi, short* xq)
+{
+	for (int i = 0; i + 1 < numSamples; i += 2, in += 7)
+	{
+		unsigned long long w = 0;
+		for (int k = 0; k < 7; k++)
+			w |= (unsigned long long)in[k] << (8 * k);
+		xi[i] = expand((unsigned int)(w & 0x3fff), 14);
+		xq[i] = expand((unsigned int)((w >> 14) & 0x3fff), 14);
+		xi[i + 1] = expand((unsigned int)((w >> 28) & 0x3fff), 14);
+		xq[i + 1] = expand((unsigned int)((w >> 42) & 0x3fff), 14);
+	}
+}
+
+#if defined(RSP_TCP_HAVE_AVX2)
+static bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+		return false;
+	__cpuid(regs, 1);
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 6) != 6)	// OS saves the YMM registers
+		return false;
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+#endif
+
+#if defined(RSP_TCP_HAVE_SSE2)
+static bool cpuHasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") != 0;
+#elif defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	return (regs[3] & (1 << 26)) != 0;
+#else
+	return false;
+#endif
+}
+#endif
+
+#if defined(RSP_TCP_HAVE_NEON)
+static bool cpuHasNeon()
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+	return true;	// mandatory on ARMv8
+#elif defined(__arm__) && defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+	return false;
+#endif
+}
+#endif
+
+int iq_convert::availableKernels(kernelTable* tables, int maxTables)
+{
+	int n = 0;
+	// the wire format is little endian, the SIMD kernels store native order
+	if (common::isLittleEndian())
+	{
+#if defined(RSP_TCP_HAVE_AVX2)
+		if (n < maxTables && cpuHasAvx2())
+			tables[n++] = { "avx2", interleave16_avx2, convert8_avx2,
+				interleave16be_avx2, interleaveF32_avx2, planarF32_avx2, pack12_avx2, pack14_avx2,
+				peak_avx2, dot16_avx2, moments_avx2, correct_avx2 };
+#endif
+#if defined(RSP_TCP_HAVE_SSE2)
+		if (n < maxTables && cpuHasSse2())
+			tables[n++] = { "sse2", interleave16_sse2, convert8_sse2,
+				interleave16be_sse2, interleaveF32_sse2, planarF32_sse2, pack12_sse2, pack14_sse2,
+				peak_sse2, dot16_sse2, moments_sse2, correct_sse2 };
+#endif
+#if defined(RSP_TCP_HAVE_NEON)
+		if (n < maxTables && cpuHasNeon())
+			tables[n++] = { "neon", interleave16_neon, convert8_neon,
+				interleave16be_neon, interleaveF32_neon, planarF32_neon, pack12_neon, pack14_neon,
+				peak_neon, dot16_neon, moments_neon, correct_neon };
+#endif
+	}
+	if (n < maxTables)
+		tables[n++] = { "scalar", interleave16_scalar, convert8_scalar,
+			interleave16be_scalar, interleaveF32_scalar, planarF32_scalar, pack12_scalar, pack14_scalar,
+			peak_scalar, dot16_scalar, moments_scalar, correct_scalar };
+	return n;
+}
+
+iq_convert::kernelTable iq_convert::select()
+{
+	kernelTable tables[4];
+	availableKernels(tables, 4);
+	return tables[0];	// fastest first
+}
+
+const iq_convert::kernelTable& iq_convert::kernels()
+{
+	static const kernelTable selected = select();
+	return selected;
+}
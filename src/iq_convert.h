@@ -0,0 +1,235 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include "common.h"
+
+// Kernel signature: converts numSamples separate I and Q values into the wire format
+typedef void (*iqConvertFn)(const short* xi, const short* xq, int numSamples, BYTE* out);
+
+/// <summary>
+/// Parameters of the 8 bit conversion, prepared by iq_scale8.
+/// A sample x is mapped to a level, a signed 8.8 fixed point value relative
+/// to the center 127.5, the output is ((level + dither) >> 8) + 128.
+/// </summary>
+struct convert8Params
+{
+	int shift;				// 0..8: level of (x + 0.5) * 2^-shift, -1: level from lut
+	const short* lut;		// 65536 levels (+1 padding), indexed by (unsigned short)x
+	const short* ditherI;	// numSamples dither values in 1/256 steps, 0: no dither
+	const short* ditherQ;
+
+	// the parameters for the samples from index i on
+	convert8Params from(int i) const
+	{
+		convert8Params p = *this;
+		p.ditherI = ditherI != 0 ? ditherI + i : 0;
+		p.ditherQ = ditherQ != 0 ? ditherQ + i : 0;
+		return p;
+	}
+};
+typedef void (*iqConvert8Fn)(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p);
+// Kernel signature: converts numSamples values of one component, for the planar formats
+typedef void (*iqPlanarFn)(const short* x, int numSamples, BYTE* out);
+// Kernel signature: a property of numSamples I/Q samples
+typedef int (*iqReduceFn)(const short* xi, const short* xq, int numSamples);
+// Kernel signature: dot product of 16 bit values, 32 bit result
+typedef int (*iqDotFn)(const short* x, const short* h, int n);
+// Kernel signature: adds the sums of numSamples I/Q samples to m, see iq_convert::moments
+typedef void (*iqMomentsFn)(const short* xi, const short* xq, int numSamples, long long* m);
+
+/// <summary>
+/// Parameters of the DC and IQ imbalance correction, prepared by iq_correction:
+/// y = (k * x + off) >> 14 with a 2x2 matrix k of Q14 values, saturated to 16 bit.
+/// off includes the rounding, the products must not exceed 31 bits.
+/// </summary>
+struct correctParams
+{
+	short kII, kIQ;		// yi from xi, xq
+	short kQI, kQQ;		// yq from xi, xq
+	int offI, offQ;
+};
+typedef void (*iqCorrectFn)(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p);
+
+/// <summary>
+/// Sample conversion kernels for the wire formats.
+/// The fastest implementation for the running CPU is selected once at startup,
+/// all implementations produce bit-identical output to the scalar reference.
+/// </summary>
+class iq_convert
+{
+public:
+	// 16 bit little endian, interleaved I/Q
+	static void interleave16(const short* xi, const short* xq, int numSamples, BYTE* out)
+	{
+		kernels().interleave16(xi, xq, numSamples, out);
+	}
+
+	// 16 bit big endian (network byte order), interleaved I/Q
+	static void interleave16be(const short* xi, const short* xq, int numSamples, BYTE* out)
+	{
+		kernels().interleave16be(xi, xq, numSamples, out);
+	}
+
+	// 32 bit float little endian, interleaved I/Q, full scale is +-1.0
+	static void interleaveF32(const short* xi, const short* xq, int numSamples, BYTE* out)
+	{
+		kernels().interleaveF32(xi, xq, numSamples, out);
+	}
+
+	// one component as 32 bit float little endian, full scale is +-1.0
+	static void planarF32(const short* x, int numSamples, BYTE* out)
+	{
+		kernels().planarF32(x, numSamples, out);
+	}
+
+	// one component as 16 bit little endian
+	static void planar16(const short* x, int numSamples, BYTE* out);
+
+	// 12 bit packed: x / 16 rounded, 3 bytes per I/Q pair, little endian bit order,
+	// i.e. byte 0: I[7:0], byte 1: Q[3:0] I[11:8], byte 2: Q[11:4]
+	static void pack12(const short* xi, const short* xq, int numSamples, BYTE* out)
+	{
+		kernels().pack12(xi, xq, numSamples, out);
+	}
+
+	// 14 bit packed: x / 4 rounded, 7 bytes per two I/Q pairs, the 56 bit little endian
+	// word I0 | Q0 << 14 | I1 << 28 | Q1 << 42. numSamples must be even
+	static void pack14(const short* xi, const short* xq, int numSamples, BYTE* out)
+	{
+		kernels().pack14(xi, xq, numSamples, out);
+	}
+
+	// largest max(x, -1 - x) of I and Q: the samples fit the mid-rise range of this magnitude
+	static int peak(const short* xi, const short* xq, int numSamples)
+	{
+		return kernels().peak(xi, xq, numSamples);
+	}
+
+	// sum of x[i] * h[i]: the FIR filters of the resampler, with Q15 taps
+	static int dot16(const short* x, const short* h, int n)
+	{
+		return kernels().dot16(x, h, n);
+	}
+
+	// adds to m[0..4]: sum xi, sum xq, sum h(xi)^2, sum h(xq)^2, sum h(xi) * h(xq) with h(x) = x >> 1,
+	// so the squares fit 32 bit pairs. numSamples up to 65536
+	static void moments(const short* xi, const short* xq, int numSamples, long long* m)
+	{
+		kernels().moments(xi, xq, numSamples, m);
+	}
+
+	// DC and IQ imbalance correction, see correctParams
+	static void correct(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p)
+	{
+		kernels().correct(xi, xq, numSamples, yi, yq, p);
+	}
+
+	// reference unpackers of the packed formats, for clients and tests,
+	// the values are scaled back to 16 bit
+	static void unpack12(const BYTE* in, int numSamples, short* xi, short* xq);
+	static void unpack14(const BYTE* in, int numSamples, short* xi, short* xq);
+
+	// 8 bit unsigned, interleaved I/Q, scaled, rounded and dithered as prepared by iq_scale8
+	static void convert8(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p)
+	{
+		kernels().convert8(xi, xq, numSamples, out, p);
+	}
+
+	// Name of the selected implementation, e.g. "avx2"
+	static const char* implementation() { return kernels().name; }
+
+	// scalar reference implementations
+	static void interleave16_scalar(const short* xi, const short* xq, int numSamples, BYTE* out);
+	static void convert8_scalar(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p);
+	static void interleave16be_scalar(const short* xi, const short* xq, int numSamples, BYTE* out);
+	static void interleaveF32_scalar(const short* xi, const short* xq, int numSamples, BYTE* out);
+	static void planarF32_scalar(const short* x, int numSamples, BYTE* out);
+	static void pack12_scalar(const short* xi, const short* xq, int numSamples, BYTE* out);
+	static void pack14_scalar(const short* xi, const short* xq, int numSamples, BYTE* out);
+	static int peak_scalar(const short* xi, const short* xq, int numSamples);
+	static int dot16_scalar(const short* x, const short* h, int n);
+	static void moments_scalar(const short* xi, const short* xq, int numSamples, long long* m);
+	static void correct_scalar(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p);
+
+	struct kernelTable
+	{
+		const char* name;
+		iqConvertFn interleave16;
+		iqConvert8Fn convert8;
+		iqConvertFn interleave16be;
+		iqConvertFn interleaveF32;
+		iqPlanarFn planarF32;
+		iqConvertFn pack12;
+		iqConvertFn pack14;
+		iqReduceFn peak;
+		iqDotFn dot16;
+		iqMomentsFn moments;
+		iqCorrectFn correct;
+	};
+
+	// all implementations usable on this CPU, the scalar one last
+	static int availableKernels(kernelTable* tables, int maxTables);
+
+private:
+	static const kernelTable& kernels();
+	static kernelTable select();
+};
+
+// SIMD implementations, see iq_convert_*.cpp
+#if defined(RSP_TCP_HAVE_SSE2)
+void interleave16_sse2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void convert8_sse2(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p);
+void interleave16be_sse2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void interleaveF32_sse2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void planarF32_sse2(const short* x, int numSamples, BYTE* out);
+void pack12_sse2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void pack14_sse2(const short* xi, const short* xq, int numSamples, BYTE* out);
+int peak_sse2(const short* xi, const short* xq, int numSamples);
+int dot16_sse2(const short* x, const short* h, int n);
+void moments_sse2(const short* xi, const short* xq, int numSamples, long long* m);
+void correct_sse2(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p);
+#endif
+#if defined(RSP_TCP_HAVE_AVX2)
+void interleave16_avx2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void convert8_avx2(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p);
+void interleave16be_avx2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void interleaveF32_avx2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void planarF32_avx2(const short* x, int numSamples, BYTE* out);
+void pack12_avx2(const short* xi, const short* xq, int numSamples, BYTE* out);
+void pack14_avx2(const short* xi, const short* xq, int numSamples, BYTE* out);
+int peak_avx2(const short* xi, const short* xq, int numSamples);
+int dot16_avx2(const short* x, const short* h, int n);
+void moments_avx2(const short* xi, const short* xq, int numSamples, long long* m);
+void correct_avx2(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p);
+#endif
+#if defined(RSP_TCP_HAVE_NEON)
+void interleave16_neon(const short* xi, const short* xq, int numSamples, BYTE* out);
+void convert8_neon(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p);
+void interleave16be_neon(const short* xi, const short* xq, int numSamples, BYTE* out);
+void interleaveF32_neon(const short* xi, const short* xq, int numSamples, BYTE* out);
+void planarF32_neon(const short* x, int numSamples, BYTE* out);
+void pack12_neon(const short* xi, const short* xq, int numSamples, BYTE* out);
+void pack14_neon(const short* xi, const short* xq, int numSamples, BYTE* out);
+int peak_neon(const short* xi, const short* xq, int numSamples);
+int dot16_neon(const short* x, const short* h, int n);
+void moments_neon(const short* xi, const short* xq, int numSamples, long long* m);
+void correct_neon(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p);
+#endif
@@ -0,0 +1,342 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+// Compiled with AVX2 enabled, only called after the runtime check in iq_convert.cpp
+#include "iq_convert.h"
+#if defined(RSP_TCP_HAVE_AVX2)
+#include <immintrin.h>
+
+void interleave16_avx2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(xi + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(xq + i));
+		// unpack works per 128 bit lane, reorder the lanes afterwards
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		_mm256_storeu_si256((__m256i*)(out + 4 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + 4 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	iq_convert::interleave16_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+static inline __m256i swapBytes(__m256i v)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+}
+
+void interleave16be_avx2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = swapBytes(_mm256_loadu_si256((const __m256i*)(xi + i)));
+		__m256i vq = swapBytes(_mm256_loadu_si256((const __m256i*)(xq + i)));
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		_mm256_storeu_si256((__m256i*)(out + 4 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + 4 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	iq_convert::interleave16be_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+// eight 16 bit values as float of full scale +-1.0
+static inline __m256 toFloat(__m128i v, __m256 scale)
+{
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), scale);
+}
+
+void interleaveF32_avx2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(xi + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(xq + i));
+		// per 128 bit lane: lo holds the samples 0..3 and 8..11, hi 4..7 and 12..15
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		float* f = (float*)(out + 8 * i);
+		_mm256_storeu_ps(f, toFloat(_mm256_castsi256_si128(lo), scale));
+		_mm256_storeu_ps(f + 8, toFloat(_mm256_castsi256_si128(hi), scale));
+		_mm256_storeu_ps(f + 16, toFloat(_mm256_extracti128_si256(lo, 1), scale));
+		_mm256_storeu_ps(f + 24, toFloat(_mm256_extracti128_si256(hi, 1), scale));
+	}
+	iq_convert::interleaveF32_scalar(xi + i, xq + i, numSamples - i, out + 8 * i);
+}
+
+void planarF32_avx2(const short* x, int numSamples, BYTE* out)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+		_mm256_storeu_ps((float*)(out + 4 * i), toFloat(_mm_loadu_si128((const __m128i*)(x + i)), scale));
+	iq_convert::planarF32_scalar(x + i, numSamples - i, out + 4 * i);
+}
+
+// x * 2^-shift, rounded to nearest, saturated
+static inline __m256i reduce(__m256i x, int shift)
+{
+	return _mm256_srai_epi16(_mm256_adds_epi16(x, _mm256_set1_epi16((short)(1 << (shift - 1)))), shift);
+}
+
+// stores the four 128 bit lanes of lo and hi (samples 0..3, 8..11 and 4..7, 12..15)
+// in sample order, each one holds bytesPerLane bytes, the stores overlap
+static inline void storeLanes(BYTE* out, __m256i lo, __m256i hi, int bytesPerLane)
+{
+	_mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(lo));
+	_mm_storeu_si128((__m128i*)(out + bytesPerLane), _mm256_castsi256_si128(hi));
+	_mm_storeu_si128((__m128i*)(out + 2 * bytesPerLane), _mm256_extracti128_si256(lo, 1));
+	_mm_storeu_si128((__m128i*)(out + 3 * bytesPerLane), _mm256_extracti128_si256(hi, 1));
+}
+
+void pack12_avx2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m256i mask12 = _mm256_set1_epi16(0xfff);
+	const __m256i maskLow = _mm256_set1_epi32(0xfff);
+	const __m256i maskHigh = _mm256_set1_epi32(0xfff000);
+	// 3 of 4 bytes per pair, per 128 bit lane
+	const __m256i compress = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i = 0;
+	// the last store reaches 4 bytes into the next two pairs, which must exist
+	for (; i + 18 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_and_si256(reduce(_mm256_loadu_si256((const __m256i*)(xi + i)), 4), mask12);
+		__m256i vq = _mm256_and_si256(reduce(_mm256_loadu_si256((const __m256i*)(xq + i)), 4), mask12);
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		lo = _mm256_or_si256(_mm256_and_si256(lo, maskLow), _mm256_and_si256(_mm256_srli_epi32(lo, 4), maskHigh));
+		hi = _mm256_or_si256(_mm256_and_si256(hi, maskLow), _mm256_and_si256(_mm256_srli_epi32(hi, 4), maskHigh));
+		storeLanes(out + 3 * i, _mm256_shuffle_epi8(lo, compress), _mm256_shuffle_epi8(hi, compress), 12);
+	}
+	iq_convert::pack12_scalar(xi + i, xq + i, numSamples - i, out + 3 * i);
+}
+
+void pack14_avx2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m256i mask14 = _mm256_set1_epi16(0x3fff);
+	const __m256i m0 = _mm256_set1_epi64x(0xffffLL);
+	const __m256i m1 = _mm256_set1_epi64x(0xffffLL << 16);
+	const __m256i m2 = _mm256_set1_epi64x(0xffffLL << 32);
+	const __m256i m3 = _mm256_set1_epi64x(0xffffLL << 48);
+	// 7 of 8 bytes per two pairs, per 128 bit lane
+	const __m256i compress = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, -1, -1,
+		0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, -1, -1);
+	int i = 0;
+	// the last store reaches 2 bytes into the next two pairs, which must exist
+	for (; i + 18 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_and_si256(reduce(_mm256_loadu_si256((const __m256i*)(xi + i)), 2), mask14);
+		__m256i vq = _mm256_and_si256(reduce(_mm256_loadu_si256((const __m256i*)(xq + i)), 2), mask14);
+		__m256i p[2] = { _mm256_unpacklo_epi16(vi, vq), _mm256_unpackhi_epi16(vi, vq) };
+		for (int k = 0; k < 2; k++)
+		{
+			// I0 Q0 I1 Q1 at 16 bit distance, moved to 14 bit distance
+			__m256i w = _mm256_and_si256(p[k], m0);
+			w = _mm256_or_si256(w, _mm256_srli_epi64(_mm256_and_si256(p[k], m1), 2));
+			w = _mm256_or_si256(w, _mm256_srli_epi64(_mm256_and_si256(p[k], m2), 4));
+			w = _mm256_or_si256(w, _mm256_srli_epi64(_mm256_and_si256(p[k], m3), 6));
+			p[k] = _mm256_shuffle_epi8(w, compress);
+		}
+		storeLanes(out + 7 * (i / 2), p[0], p[1], 14);
+	}
+	iq_convert::pack14_scalar(xi + i, xq + i, numSamples - i, out + 7 * (i / 2));
+}
+
+int peak_avx2(const short* xi, const short* xq, int numSamples)
+{
+	const __m256i ones = _mm256_set1_epi16(-1);
+	__m256i m = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(xi + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(xq + i));
+		m = _mm256_max_epi16(m, _mm256_max_epi16(vi, _mm256_xor_si256(vi, ones)));
+		m = _mm256_max_epi16(m, _mm256_max_epi16(vq, _mm256_xor_si256(vq, ones)));
+	}
+	__m128i h = _mm_max_epi16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+	h = _mm_max_epi16(h, _mm_srli_si128(h, 8));
+	h = _mm_max_epi16(h, _mm_srli_si128(h, 4));
+	h = _mm_max_epi16(h, _mm_srli_si128(h, 2));
+	int result = (short)_mm_cvtsi128_si32(h);
+	int tail = iq_convert::peak_scalar(xi + i, xq + i, numSamples - i);
+	return tail > result ? tail : result;
+}
+
+int dot16_avx2(const short* x, const short* h, int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(x + i)), _mm256_loadu_si256((const __m256i*)(h + i))));
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	if (i + 8 <= n)
+	{
+		s = _mm_add_epi32(s, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(x + i)), _mm_loadu_si128((const __m128i*)(h + i))));
+		i += 8;
+	}
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+	return _mm_cvtsi128_si32(s) + iq_convert::dot16_scalar(x + i, h + i, n - i);
+}
+
+// level of x * 2^-shift: clamped to the range, that does not saturate, then scaled to 8.8
+static inline __m256i levelShift(__m256i x, __m256i lo, __m256i hi, __m128i count, __m256i round)
+{
+	x = _mm256_min_epi16(_mm256_max_epi16(x, lo), hi);
+	return _mm256_add_epi16(_mm256_sll_epi16(x, count), round);
+}
+
+// 16 table lookups by two gathers, the table is padded for the 32 bit reads
+static inline __m256i levelLut(const short* x, const short* lut)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i*)x);
+	__m256i idxLo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+	__m256i idxHi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+	__m256i lo = _mm256_i32gather_epi32((const int*)lut, idxLo, 2);
+	__m256i hi = _mm256_i32gather_epi32((const int*)lut, idxHi, 2);
+	// sign extend the low halves, pack works per 128 bit lane
+	lo = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+	hi = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+}
+
+// (level + dither) >> 8, around 128
+static inline __m256i output8(__m256i level, const short* dither)
+{
+	if (dither != 0)
+		level = _mm256_adds_epi16(level, _mm256_loadu_si256((const __m256i*)dither));
+	return _mm256_add_epi16(_mm256_srai_epi16(level, 8), _mm256_set1_epi16(128));
+}
+
+void convert8_avx2(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p)
+{
+	const __m256i lowByte = _mm256_set1_epi16(0xff);
+	const int shift = p.shift < 0 ? 0 : p.shift;
+	const __m256i lo = _mm256_set1_epi16((short)-(128 << shift));
+	const __m256i hi = _mm256_set1_epi16((short)((128 << shift) - 1));
+	const __m128i count = _mm_cvtsi32_si128(8 - shift);
+	const __m256i round = _mm256_set1_epi16(shift < 8 ? 1 << (7 - shift) : 0);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi, vq;
+		if (p.shift >= 0)
+		{
+			vi = levelShift(_mm256_loadu_si256((const __m256i*)(xi + i)), lo, hi, count, round);
+			vq = levelShift(_mm256_loadu_si256((const __m256i*)(xq + i)), lo, hi, count, round);
+		}
+		else
+		{
+			vi = levelLut(xi + i, p.lut);
+			vq = levelLut(xq + i, p.lut);
+		}
+		vi = output8(vi, p.ditherI != 0 ? p.ditherI + i : 0);
+		vq = output8(vq, p.ditherQ != 0 ? p.ditherQ + i : 0);
+		// one 16 bit word per sample: I in the low byte, Q in the high byte
+		__m256i w = _mm256_or_si256(_mm256_and_si256(vi, lowByte), _mm256_slli_epi16(vq, 8));
+		_mm256_storeu_si256((__m256i*)(out + 2 * i), w);
+	}
+	iq_convert::convert8_scalar(xi + i, xq + i, numSamples - i, out + 2 * i, p.from(i));
+}
+
+// adds the eight 32 bit lanes of v to the four 64 bit lanes of acc, v sign extended
+static inline __m256i addWide(__m256i acc, __m256i v)
+{
+	__m256i sign = _mm256_srai_epi32(v, 31);
+	return _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_unpacklo_epi32(v, sign), _mm256_unpackhi_epi32(v, sign)));
+}
+
+static inline long long sum32(__m256i v)
+{
+	int a[8];
+	_mm256_storeu_si256((__m256i*)a, v);
+	long long s = 0;
+	for (int k = 0; k < 8; k++)
+		s += a[k];
+	return s;
+}
+
+static inline long long sum64(__m256i v)
+{
+	long long a[4];
+	_mm256_storeu_si256((__m256i*)a, v);
+	return a[0] + a[1] + a[2] + a[3];
+}
+
+void moments_avx2(const short* xi, const short* xq, int numSamples, long long* m)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i si = _mm256_setzero_si256(), sq = si, sii = si, sqq = si, siq = si;
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(xi + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(xq + i));
+		si = _mm256_add_epi32(si, _mm256_madd_epi16(vi, ones));
+		sq = _mm256_add_epi32(sq, _mm256_madd_epi16(vq, ones));
+		__m256i hi = _mm256_srai_epi16(vi, 1);
+		__m256i hq = _mm256_srai_epi16(vq, 1);
+		sii = addWide(sii, _mm256_madd_epi16(hi, hi));
+		sqq = addWide(sqq, _mm256_madd_epi16(hq, hq));
+		siq = addWide(siq, _mm256_madd_epi16(hi, hq));
+	}
+	m[0] += sum32(si);
+	m[1] += sum32(sq);
+	m[2] += sum64(sii);
+	m[3] += sum64(sqq);
+	m[4] += sum64(siq);
+	iq_convert::moments_scalar(xi + i, xq + i, numSamples - i, m);
+}
+
+// (k0 * x0 + k1 * x1 + off) >> 14 of the interleaved pairs, saturated to 16 bit.
+// Per 128 bit lane, lo holds the samples 0..3, hi 4..7: the pack restores the order
+static inline __m256i applyRow(__m256i lo, __m256i hi, __m256i k, __m256i off)
+{
+	__m256i a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(lo, k), off), 14);
+	__m256i b = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(hi, k), off), 14);
+	return _mm256_packs_epi32(a, b);
+}
+
+void correct_avx2(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p)
+{
+	const __m256i kI = _mm256_set1_epi32((unsigned short)p.kII | ((unsigned short)p.kIQ << 16));
+	const __m256i kQ = _mm256_set1_epi32((unsigned short)p.kQI | ((unsigned short)p.kQQ << 16));
+	const __m256i offI = _mm256_set1_epi32(p.offI);
+	const __m256i offQ = _mm256_set1_epi32(p.offQ);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(xi + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(xq + i));
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		_mm256_storeu_si256((__m256i*)(yi + i), applyRow(lo, hi, kI, offI));
+		_mm256_storeu_si256((__m256i*)(yq + i), applyRow(lo, hi, kQ, offQ));
+	}
+	iq_convert::correct_scalar(xi + i, xq + i, numSamples - i, yi + i, yq + i, p);
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+// Compiled with NEON enabled, only called after the runtime check in iq_convert.cpp
+#include "iq_convert.h"
+#if defined(RSP_TCP_HAVE_NEON)
+#include <arm_neon.h>
+
+void interleave16_neon(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8x2_t v;
+		v.val[0] = vld1q_s16(xi + i);
+		v.val[1] = vld1q_s16(xq + i);
+		vst2q_s16((int16_t*)(out + 4 * i), v);
+	}
+	iq_convert::interleave16_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+void interleave16be_neon(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		uint8x16x2_t v;
+		v.val[0] = vrev16q_u8(vreinterpretq_u8_s16(vld1q_s16(xi + i)));
+		v.val[1] = vrev16q_u8(vreinterpretq_u8_s16(vld1q_s16(xq + i)));
+		uint16x8x2_t w;
+		w.val[0] = vreinterpretq_u16_u8(v.val[0]);
+		w.val[1] = vreinterpretq_u16_u8(v.val[1]);
+		vst2q_u16((uint16_t*)(out + 4 * i), w);
+	}
+	iq_convert::interleave16be_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+// four 16 bit values as float of full scale +-1.0
+static inline float32x4_t toFloat(int16x4_t v)
+{
+	return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v)), 1.0f / 32768);
+}
+
+void interleaveF32_neon(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t vi = vld1q_s16(xi + i);
+		int16x8_t vq = vld1q_s16(xq + i);
+		float* f = (float*)(out + 8 * i);
+		float32x4x2_t v;
+		v.val[0] = toFloat(vget_low_s16(vi));
+		v.val[1] = toFloat(vget_low_s16(vq));
+		vst2q_f32(f, v);
+		v.val[0] = toFloat(vget_high_s16(vi));
+		v.val[1] = toFloat(vget_high_s16(vq));
+		vst2q_f32(f + 8, v);
+	}
+	iq_convert::interleaveF32_scalar(xi + i, xq + i, numSamples - i, out + 8 * i);
+}
+
+void planarF32_neon(const short* x, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t v = vld1q_s16(x + i);
+		vst1q_f32((float*)(out + 4 * i), toFloat(vget_low_s16(v)));
+		vst1q_f32((float*)(out + 4 * i + 16), toFloat(vget_high_s16(v)));
+	}
+	iq_convert::planarF32_scalar(x + i, numSamples - i, out + 4 * i);
+}
+
+void pack12_neon(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const int16x8_t mask12 = vdupq_n_s16(0xfff);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		// rounded to nearest, saturated, 12 bit
+		uint16x8_t vi = vreinterpretq_u16_s16(vandq_s16(vshrq_n_s16(vqaddq_s16(vld1q_s16(xi + i), vdupq_n_s16(8)), 4), mask12));
+		uint16x8_t vq = vreinterpretq_u16_s16(vandq_s16(vshrq_n_s16(vqaddq_s16(vld1q_s16(xq + i), vdupq_n_s16(8)), 4), mask12));
+		uint8x8x3_t v;
+		v.val[0] = vmovn_u16(vi);
+		v.val[1] = vmovn_u16(vorrq_u16(vshrq_n_u16(vi, 8), vshlq_n_u16(vq, 4)));
+		v.val[2] = vmovn_u16(vshrq_n_u16(vq, 4));
+		vst3_u8(out + 3 * i, v);
+	}
+	iq_convert::pack12_scalar(xi + i, xq + i, numSamples - i, out + 3 * i);
+}
+
+void pack14_neon(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	// the bit layout does not map to byte lanes, the scalar packing is used
+	iq_convert::pack14_scalar(xi, xq, numSamples, out);
+}
+
+int peak_neon(const short* xi, const short* xq, int numSamples)
+{
+	int16x8_t m = vdupq_n_s16(0);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t vi = vld1q_s16(xi + i);
+		int16x8_t vq = vld1q_s16(xq + i);
+		m = vmaxq_s16(m, vmaxq_s16(vi, vmvnq_s16(vi)));
+		m = vmaxq_s16(m, vmaxq_s16(vq, vmvnq_s16(vq)));
+	}
+	int16x4_t h = vpmax_s16(vget_low_s16(m), vget_high_s16(m));
+	h = vpmax_s16(h, h);
+	h = vpmax_s16(h, h);
+	int result = vget_lane_s16(h, 0);
+	int tail = iq_convert::peak_scalar(xi + i, xq + i, numSamples - i);
+	return tail > result ? tail : result;
+}
+
+int dot16_neon(const short* x, const short* h, int n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		int16x8_t vx = vld1q_s16(x + i);
+		int16x8_t vh = vld1q_s16(h + i);
+		acc = vmlal_s16(acc, vget_low_s16(vx), vget_low_s16(vh));
+		acc = vmlal_s16(acc, vget_high_s16(vx), vget_high_s16(vh));
+	}
+	int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	s = vpadd_s32(s, s);
+	return vget_lane_s32(s, 0) + iq_convert::dot16_scalar(x + i, h + i, n - i);
+}
+
+// level of x * 2^-shift: clamped to the range, that does not saturate, then scaled to 8.8
+static inline int16x8_t levelShift(int16x8_t x, int16x8_t lo, int16x8_t hi, int16x8_t count, int16x8_t round)
+{
+	x = vminq_s16(vmaxq_s16(x, lo), hi);
+	return vaddq_s16(vshlq_s16(x, count), round);
+}
+
+static inline int16x8_t levelLut(const short* x, const short* lut)
+{
+	int16_t v[8];
+	for (int k = 0; k < 8; k++)
+		v[k] = lut[(unsigned short)x[k]];
+	return vld1q_s16(v);
+}
+
+// (level + dither) >> 8, around 128
+static inline uint8x8_t output8(int16x8_t level, const short* dither)
+{
+	if (dither != 0)
+		level = vqaddq_s16(level, vld1q_s16(dither));
+	int16x8_t v = vaddq_s16(vshrq_n_s16(level, 8), vdupq_n_s16(128));
+	return vmovn_u16(vreinterpretq_u16_s16(v));
+}
+
+void convert8_neon(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p)
+{
+	const int shift = p.shift < 0 ? 0 : p.shift;
+	const int16x8_t lo = vdupq_n_s16((short)-(128 << shift));
+	const int16x8_t hi = vdupq_n_s16((short)((128 << shift) - 1));
+	const int16x8_t count = vdupq_n_s16((short)(8 - shift));
+	const int16x8_t round = vdupq_n_s16(shift < 8 ? 1 << (7 - shift) : 0);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t vi, vq;
+		if (p.shift >= 0)
+		{
+			vi = levelShift(vld1q_s16(xi + i), lo, hi, count, round);
+			vq = levelShift(vld1q_s16(xq + i), lo, hi, count, round);
+		}
+		else
+		{
+			vi = levelLut(xi + i, p.lut);
+			vq = levelLut(xq + i, p.lut);
+		}
+		uint8x8x2_t v;
+		v.val[0] = output8(vi, p.ditherI != 0 ? p.ditherI + i : 0);
+		v.val[1] = output8(vq, p.ditherQ != 0 ? p.ditherQ + i : 0);
+		vst2_u8(out + 2 * i, v);
+	}
+	iq_convert::convert8_scalar(xi + i, xq + i, numSamples - i, out + 2 * i, p.from(i));
+}
+
+void moments_neon(const short* xi, const short* xq, int numSamples, long long* m)
+{
+	int32x4_t si = vdupq_n_s32(0), sq = vdupq_n_s32(0);
+	int64x2_t sii = vdupq_n_s64(0), sqq = vdupq_n_s64(0), siq = vdupq_n_s64(0);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t vi = vld1q_s16(xi + i);
+		int16x8_t vq = vld1q_s16(xq + i);
+		si = vpadalq_s16(si, vi);
+		sq = vpadalq_s16(sq, vq);
+		int16x8_t hi = vshrq_n_s16(vi, 1);
+		int16x8_t hq = vshrq_n_s16(vq, 1);
+		sii = vpadalq_s32(sii, vmull_s16(vget_low_s16(hi), vget_low_s16(hi)));
+		sii = vpadalq_s32(sii, vmull_s16(vget_high_s16(hi), vget_high_s16(hi)));
+		sqq = vpadalq_s32(sqq, vmull_s16(vget_low_s16(hq), vget_low_s16(hq)));
+		sqq = vpadalq_s32(sqq, vmull_s16(vget_high_s16(hq), vget_high_s16(hq)));
+		siq = vpadalq_s32(siq, vmull_s16(vget_low_s16(hi), vget_low_s16(hq)));
+		siq = vpadalq_s32(siq, vmull_s16(vget_high_s16(hi), vget_high_s16(hq)));
+	}
+	int64x2_t wi = vpaddlq_s32(si);
+	int64x2_t wq = vpaddlq_s32(sq);
+	m[0] += vgetq_lane_s64(wi, 0) + vgetq_lane_s64(wi, 1);
+	m[1] += vgetq_lane_s64(wq, 0) + vgetq_lane_s64(wq, 1);
+	m[2] += vgetq_lane_s64(sii, 0) + vgetq_lane_s64(sii, 1);
+	m[3] += vgetq_lane_s64(sqq, 0) + vgetq_lane_s64(sqq, 1);
+	m[4] += vgetq_lane_s64(siq, 0) + vgetq_lane_s64(siq, 1);
+	iq_convert::moments_scalar(xi + i, xq + i, numSamples - i, m);
+}
+
+// (k0 * xi + k1 * xq + off) >> 14, saturated to 16 bit
+static inline int16x4_t applyRow(int16x4_t vi, int16x4_t vq, int16x4_t k0, int16x4_t k1, int32x4_t off)
+{
+	int32x4_t a = vmlal_s16(vmlal_s16(off, vi, k0), vq, k1);
+	return vqmovn_s32(vshrq_n_s32(a, 14));
+}
+
+void correct_neon(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p)
+{
+	const int16x4_t kII = vdup_n_s16(p.kII), kIQ = vdup_n_s16(p.kIQ);
+	const int16x4_t kQI = vdup_n_s16(p.kQI), kQQ = vdup_n_s16(p.kQQ);
+	const int32x4_t offI = vdupq_n_s32(p.offI);
+	const int32x4_t offQ = vdupq_n_s32(p.offQ);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8_t vi = vld1q_s16(xi + i);
+		int16x8_t vq = vld1q_s16(xq + i);
+		int16x4_t il = vget_low_s16(vi), ih = vget_high_s16(vi);
+		int16x4_t ql = vget_low_s16(vq), qh = vget_high_s16(vq);
+		vst1q_s16(yi + i, vcombine_s16(applyRow(il, ql, kII, kIQ, offI), applyRow(ih, qh, kII, kIQ, offI)));
+		vst1q_s16(yq + i, vcombine_s16(applyRow(il, ql, kQI, kQQ, offQ), applyRow(ih, qh, kQI, kQQ, offQ)));
+	}
+	iq_convert::correct_scalar(xi + i, xq + i, numSamples - i, yi + i, yq + i, p);
+}
+
+#endif
@@ -0,0 +1,319 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "iq_convert.h"
+#if defined(RSP_TCP_HAVE_SSE2)
+#include <emmintrin.h>
+
+void interleave16_sse2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + i));
+		_mm_storeu_si128((__m128i*)(out + 4 * i), _mm_unpacklo_epi16(vi, vq));
+		_mm_storeu_si128((__m128i*)(out + 4 * i + 16), _mm_unpackhi_epi16(vi, vq));
+	}
+	iq_convert::interleave16_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+static inline __m128i swapBytes(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+void interleave16be_sse2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = swapBytes(_mm_loadu_si128((const __m128i*)(xi + i)));
+		__m128i vq = swapBytes(_mm_loadu_si128((const __m128i*)(xq + i)));
+		_mm_storeu_si128((__m128i*)(out + 4 * i), _mm_unpacklo_epi16(vi, vq));
+		_mm_storeu_si128((__m128i*)(out + 4 * i + 16), _mm_unpackhi_epi16(vi, vq));
+	}
+	iq_convert::interleave16be_scalar(xi + i, xq + i, numSamples - i, out + 4 * i);
+}
+
+// four 16 bit values, sign extended, as float of full scale +-1.0
+static inline __m128 toFloat(__m128i v, __m128 scale)
+{
+	return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(v, 16)), scale);
+}
+
+void interleaveF32_sse2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + i));
+		__m128i lo = _mm_unpacklo_epi16(vi, vq);
+		__m128i hi = _mm_unpackhi_epi16(vi, vq);
+		float* f = (float*)(out + 8 * i);
+		_mm_storeu_ps(f, toFloat(_mm_unpacklo_epi16(lo, lo), scale));
+		_mm_storeu_ps(f + 4, toFloat(_mm_unpackhi_epi16(lo, lo), scale));
+		_mm_storeu_ps(f + 8, toFloat(_mm_unpacklo_epi16(hi, hi), scale));
+		_mm_storeu_ps(f + 12, toFloat(_mm_unpackhi_epi16(hi, hi), scale));
+	}
+	iq_convert::interleaveF32_scalar(xi + i, xq + i, numSamples - i, out + 8 * i);
+}
+
+void planarF32_sse2(const short* x, int numSamples, BYTE* out)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+		float* f = (float*)(out + 4 * i);
+		_mm_storeu_ps(f, toFloat(_mm_unpacklo_epi16(v, v), scale));
+		_mm_storeu_ps(f + 4, toFloat(_mm_unpackhi_epi16(v, v), scale));
+	}
+	iq_convert::planarF32_scalar(x + i, numSamples - i, out + 4 * i);
+}
+
+// x * 2^-shift, rounded to nearest, saturated
+static inline __m128i reduce(__m128i x, int shift)
+{
+	return _mm_srai_epi16(_mm_adds_epi16(x, _mm_set1_epi16((short)(1 << (shift - 1)))), shift);
+}
+
+void pack12_sse2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m128i mask12 = _mm_set1_epi16(0xfff);
+	const __m128i maskLow = _mm_set1_epi32(0xfff);
+	const __m128i maskHigh = _mm_set1_epi32(0xfff000);
+	const __m128i mask24 = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+	int i = 0;
+	// the 8 byte stores reach 2 bytes into the next pair, which must exist
+	for (; i + 9 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_and_si128(reduce(_mm_loadu_si128((const __m128i*)(xi + i)), 4), mask12);
+		__m128i vq = _mm_and_si128(reduce(_mm_loadu_si128((const __m128i*)(xq + i)), 4), mask12);
+		__m128i p[2] = { _mm_unpacklo_epi16(vi, vq), _mm_unpackhi_epi16(vi, vq) };
+		for (int k = 0; k < 2; k++)
+		{
+			// 24 bits per pair, then two pairs per 64 bits
+			__m128i w = _mm_or_si128(_mm_and_si128(p[k], maskLow), _mm_and_si128(_mm_srli_epi32(p[k], 4), maskHigh));
+			w = _mm_or_si128(_mm_and_si128(w, mask24), _mm_srli_epi64(_mm_andnot_si128(mask24, w), 8));
+			BYTE* o = out + 3 * i + 12 * k;
+			_mm_storel_epi64((__m128i*)o, w);
+			_mm_storel_epi64((__m128i*)(o + 6), _mm_srli_si128(w, 8));
+		}
+	}
+	iq_convert::pack12_scalar(xi + i, xq + i, numSamples - i, out + 3 * i);
+}
+
+void pack14_sse2(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	const __m128i mask14 = _mm_set1_epi16(0x3fff);
+	const __m128i m1 = _mm_set1_epi64x(0xffffLL << 16);
+	const __m128i m2 = _mm_set1_epi64x(0xffffLL << 32);
+	const __m128i m3 = _mm_set1_epi64x(0xffffLL << 48);
+	const __m128i m0 = _mm_set1_epi64x(0xffffLL);
+	int i = 0;
+	// the 8 byte stores reach 1 byte into the next two pairs, which must exist
+	for (; i + 10 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_and_si128(reduce(_mm_loadu_si128((const __m128i*)(xi + i)), 2), mask14);
+		__m128i vq = _mm_and_si128(reduce(_mm_loadu_si128((const __m128i*)(xq + i)), 2), mask14);
+		__m128i p[2] = { _mm_unpacklo_epi16(vi, vq), _mm_unpackhi_epi16(vi, vq) };
+		for (int k = 0; k < 2; k++)
+		{
+			// I0 Q0 I1 Q1 at 16 bit distance, moved to 14 bit distance
+			__m128i w = _mm_and_si128(p[k], m0);
+			w = _mm_or_si128(w, _mm_srli_epi64(_mm_and_si128(p[k], m1), 2));
+			w = _mm_or_si128(w, _mm_srli_epi64(_mm_and_si128(p[k], m2), 4));
+			w = _mm_or_si128(w, _mm_srli_epi64(_mm_and_si128(p[k], m3), 6));
+			BYTE* o = out + 7 * (i / 2) + 14 * k;
+			_mm_storel_epi64((__m128i*)o, w);
+			_mm_storel_epi64((__m128i*)(o + 7), _mm_srli_si128(w, 8));
+		}
+	}
+	iq_convert::pack14_scalar(xi + i, xq + i, numSamples - i, out + 7 * (i / 2));
+}
+
+int peak_sse2(const short* xi, const short* xq, int numSamples)
+{
+	const __m128i ones = _mm_set1_epi16(-1);
+	__m128i m = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + i));
+		m = _mm_max_epi16(m, _mm_max_epi16(vi, _mm_xor_si128(vi, ones)));
+		m = _mm_max_epi16(m, _mm_max_epi16(vq, _mm_xor_si128(vq, ones)));
+	}
+	m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+	m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+	int result = (short)_mm_cvtsi128_si32(m);
+	int tail = iq_convert::peak_scalar(xi + i, xq + i, numSamples - i);
+	return tail > result ? tail : result;
+}
+
+int dot16_sse2(const short* x, const short* h, int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(x + i)), _mm_loadu_si128((const __m128i*)(h + i))));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+	return _mm_cvtsi128_si32(acc) + iq_convert::dot16_scalar(x + i, h + i, n - i);
+}
+
+// level of x * 2^-shift: clamped to the range, that does not saturate, then scaled to 8.8
+static inline __m128i levelShift(__m128i x, __m128i lo, __m128i hi, __m128i count, __m128i round)
+{
+	x = _mm_min_epi16(_mm_max_epi16(x, lo), hi);
+	return _mm_add_epi16(_mm_sll_epi16(x, count), round);
+}
+
+static inline __m128i levelLut(const short* x, const short* lut)
+{
+	__m128i v = _mm_cvtsi32_si128(lut[(unsigned short)x[0]]);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[1]], 1);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[2]], 2);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[3]], 3);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[4]], 4);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[5]], 5);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[6]], 6);
+	v = _mm_insert_epi16(v, lut[(unsigned short)x[7]], 7);
+	return v;
+}
+
+// (level + dither) >> 8, around 128
+static inline __m128i output8(__m128i level, const short* dither)
+{
+	if (dither != 0)
+		level = _mm_adds_epi16(level, _mm_loadu_si128((const __m128i*)dither));
+	return _mm_add_epi16(_mm_srai_epi16(level, 8), _mm_set1_epi16(128));
+}
+
+void convert8_sse2(const short* xi, const short* xq, int numSamples, BYTE* out, const convert8Params& p)
+{
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+	const int shift = p.shift < 0 ? 0 : p.shift;
+	const __m128i lo = _mm_set1_epi16((short)-(128 << shift));
+	const __m128i hi = _mm_set1_epi16((short)((128 << shift) - 1));
+	const __m128i count = _mm_cvtsi32_si128(8 - shift);
+	const __m128i round = _mm_set1_epi16(shift < 8 ? 1 << (7 - shift) : 0);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi, vq;
+		if (p.shift >= 0)
+		{
+			vi = levelShift(_mm_loadu_si128((const __m128i*)(xi + i)), lo, hi, count, round);
+			vq = levelShift(_mm_loadu_si128((const __m128i*)(xq + i)), lo, hi, count, round);
+		}
+		else
+		{
+			vi = levelLut(xi + i, p.lut);
+			vq = levelLut(xq + i, p.lut);
+		}
+		vi = output8(vi, p.ditherI != 0 ? p.ditherI + i : 0);
+		vq = output8(vq, p.ditherQ != 0 ? p.ditherQ + i : 0);
+		// one 16 bit word per sample: I in the low byte, Q in the high byte
+		__m128i w = _mm_or_si128(_mm_and_si128(vi, lowByte), _mm_slli_epi16(vq, 8));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), w);
+	}
+	iq_convert::convert8_scalar(xi + i, xq + i, numSamples - i, out + 2 * i, p.from(i));
+}
+
+// adds the four 32 bit lanes of v to the two 64 bit lanes of acc, v sign extended
+static inline __m128i addWide(__m128i acc, __m128i v)
+{
+	__m128i sign = _mm_srai_epi32(v, 31);
+	return _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(v, sign), _mm_unpackhi_epi32(v, sign)));
+}
+
+static inline long long sum32(__m128i v)
+{
+	int a[4];
+	_mm_storeu_si128((__m128i*)a, v);
+	return (long long)a[0] + a[1] + a[2] + a[3];
+}
+
+static inline long long sum64(__m128i v)
+{
+	long long a[2];
+	_mm_storeu_si128((__m128i*)a, v);
+	return a[0] + a[1];
+}
+
+void moments_sse2(const short* xi, const short* xq, int numSamples, long long* m)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i si = _mm_setzero_si128(), sq = si, sii = si, sqq = si, siq = si;
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + i));
+		si = _mm_add_epi32(si, _mm_madd_epi16(vi, ones));
+		sq = _mm_add_epi32(sq, _mm_madd_epi16(vq, ones));
+		__m128i hi = _mm_srai_epi16(vi, 1);
+		__m128i hq = _mm_srai_epi16(vq, 1);
+		sii = addWide(sii, _mm_madd_epi16(hi, hi));
+		sqq = addWide(sqq, _mm_madd_epi16(hq, hq));
+		siq = addWide(siq, _mm_madd_epi16(hi, hq));
+	}
+	m[0] += sum32(si);
+	m[1] += sum32(sq);
+	m[2] += sum64(sii);
+	m[3] += sum64(sqq);
+	m[4] += sum64(siq);
+	iq_convert::moments_scalar(xi + i, xq + i, numSamples - i, m);
+}
+
+// (k0 * x0 + k1 * x1 + off) >> 14 of the interleaved pairs, saturated to 16 bit
+static inline __m128i applyRow(__m128i lo, __m128i hi, __m128i k, __m128i off)
+{
+	__m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k), off), 14);
+	__m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k), off), 14);
+	return _mm_packs_epi32(a, b);
+}
+
+void correct_sse2(const short* xi, const short* xq, int numSamples, short* yi, short* yq, const correctParams& p)
+{
+	const __m128i kI = _mm_set1_epi32((unsigned short)p.kII | ((unsigned short)p.kIQ << 16));
+	const __m128i kQ = _mm_set1_epi32((unsigned short)p.kQI | ((unsigned short)p.kQQ << 16));
+	const __m128i offI = _mm_set1_epi32(p.offI);
+	const __m128i offQ = _mm_set1_epi32(p.offQ);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + i));
+		__m128i lo = _mm_unpacklo_epi16(vi, vq);
+		__m128i hi = _mm_unpackhi_epi16(vi, vq);
+		_mm_storeu_si128((__m128i*)(yi + i), applyRow(lo, hi, kI, offI));
+		_mm_storeu_si128((__m128i*)(yq + i), applyRow(lo, hi, kQ, offQ));
+	}
+	iq_convert::correct_scalar(xi + i, xq + i, numSamples - i, yi + i, yq + i, p);
+}
+
+#endif
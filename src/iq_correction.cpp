@@ -0,0 +1,134 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+
+#include "iq_correction.h"
+#include <math.h>
+#include <stdio.h>
+
+// limits of the correction, beyond these the estimate is not trusted
+static const double c_maxDc = 2048;
+static const double c_maxCross = 0.5;
+static const double c_minGain = 0.5;
+static const double c_maxGain = 1.99;
+static const double c_one = 16384;	// Q14
+
+iq_correction::iq_correction()
+	: samples(0), ns(0)
+{
+	params = { (short)c_one, 0, 0, (short)c_one, 1 << 13, 1 << 13 };
+}
+
+void iq_correction::configure(int mode, int timeConstantMs)
+{
+	this->mode = mode;
+	this->timeConstantMs = timeConstantMs;
+	outI.resize(c_maxChunk);
+	outQ.resize(c_maxChunk);
+	dcI = dcQ = 0;
+	powerI = powerQ = crossIQ = 0;
+	params = { (short)c_one, 0, 0, (short)c_one, 1 << 13, 1 << 13 };
+	settledSamples = 0;
+	samples = 0;
+	ns = 0;
+	retunes = 0;
+}
+
+void iq_correction::setRate(int rateHz)
+{
+	timeConstantSamples = (double)rateHz * timeConstantMs / 1000;
+}
+
+/// <summary>
+/// Averages the moments of a chunk into the estimate and derives the correction
+/// </summary>
+void iq_correction::update(const long long* m, int numSamples)
+{
+	// a running mean since the retune, until the time constant is reached
+	double weight = numSamples / (settledSamples + numSamples);
+	double alpha = timeConstantSamples > 0 ? numSamples / timeConstantSamples : 1;
+	if (weight < alpha)
+		weight = alpha;
+	if (weight > 1)
+		weight = 1;
+	settledSamples += numSamples;
+
+	// the squares were taken of x >> 1, whose mean is x / 2 - 1 / 4
+	double meanI = (double)m[0] / numSamples;
+	double meanQ = (double)m[1] / numSamples;
+	double hI = meanI / 2 - 0.25;
+	double hQ = meanQ / 2 - 0.25;
+	double pI = 4 * ((double)m[2] / numSamples - hI * hI);
+	double pQ = 4 * ((double)m[3] / numSamples - hQ * hQ);
+	double cIQ = 4 * ((double)m[4] / numSamples - hI * hQ);
+
+	dcI += weight * (meanI - dcI);
+	dcQ += weight * (meanQ - dcQ);
+	powerI += weight * (pI - powerI);
+	powerQ += weight * (pQ - powerQ);
+	crossIQ += weight * (cIQ - crossIQ);
+
+	double oI = fmax(-c_maxDc, fmin(c_maxDc, dcI));
+	double oQ = fmax(-c_maxDc, fmin(c_maxDc, dcQ));
+	// yq = gain * ((xq - dcQ) - rho * (xi - dcI)): uncorrelated to I, of the power of I
+	double rho = 0;
+	double gain = 1;
+	if (mode == CORRECT_DC_IQ && powerI > 1 && powerQ > 1)
+	{
+		rho = fmax(-c_maxCross, fmin(c_maxCross, crossIQ / powerI));
+		double residual = powerQ - rho * crossIQ;
+		if (residual > 0)
+			gain = fmax(c_minGain, fmin(c_maxGain, sqrt(powerI / residual)));
+	}
+	params.kII = (short)c_one;
+	params.kIQ = 0;
+	params.kQI = (short)lrint(-gain * rho * c_one);
+	params.kQQ = (short)lrint(gain * c_one);
+	params.offI = (int)lrint(-c_one * oI) + (1 << 13);
+	params.offQ = (int)lrint(-(params.kQI * oI + params.kQQ * oQ)) + (1 << 13);
+}
+
+void iq_correction::process(const short* xi, const short* xq, int numSamples)
+{
+	long long t0 = common::monotonicNanos();
+	long long m[5] = { 0, 0, 0, 0, 0 };
+	iq_convert::moments(xi, xq, numSamples, m);
+	if (numSamples > 0)
+		update(m, numSamples);
+	iq_convert::correct(xi, xq, numSamples, &outI[0], &outQ[0], params);
+	ns.fetch_add(common::monotonicNanos() - t0, std::memory_order_relaxed);
+	samples.fetch_add(numSamples, std::memory_order_relaxed);
+}
+
+std::string iq_correction::description() const
+{
+	char s[200];
+	long long n = samples.load();
+	double phase = 0, gainDb = 0;
+	if (powerI > 0 && powerQ > 0)
+	{
+		phase = asin(fmax(-1.0, fmin(1.0, crossIQ / sqrt(powerI * powerQ)))) * 180 / 3.14159265358979323846;
+		gainDb = 10 * log10(powerQ / powerI);
+	}
+	snprintf(s, sizeof(s), "DC I %.1f Q %.1f, Q/I gain %.2f dB, phase %.2f deg, %llu retunes, %.2f ns per sample",
+		dcI, dcQ, gainDb, phase, retunes, n > 0 ? (double)ns.load() / n : 0.0);
+	return s;
+}
@@ -0,0 +1,89 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+
+#pragma once
+#include "iq_convert.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Continuously tracking DC offset and IQ imbalance correction of the I/Q stream,
+/// behind the one-shot DC correction of the tuner.
+/// The mean, the powers and the cross power of I and Q are measured per chunk and
+/// averaged over a time constant; after a retune or gain change, the average restarts,
+/// so the estimate settles within a few packets.
+/// The IQ imbalance is estimated blind, assuming a circular signal:
+/// Q is decorrelated from I and scaled to the power of I.
+/// Estimate and correction run on the moments and correct kernels of iq_convert.
+/// </summary>
+class iq_correction
+{
+public:
+	enum eMode
+	{
+		CORRECT_OFF = 0
+		, CORRECT_DC = 1
+		, CORRECT_DC_IQ = 2
+	};
+	// input samples per call of process
+	static const int c_maxChunk = 4096;
+
+	iq_correction();
+
+	void configure(int mode, int timeConstantMs);
+	// sampling rate of the input, for the time constant
+	void setRate(int rateHz);
+	bool isActive() const { return mode != CORRECT_OFF; }
+
+	// the signal has changed: the average restarts
+	void retune() { settledSamples = 0; retunes++; }
+
+	// corrects up to c_maxChunk samples into outputI / outputQ
+	void process(const short* xi, const short* xq, int numSamples);
+	const short* outputI() const { return &outI[0]; }
+	const short* outputQ() const { return &outQ[0]; }
+
+	// current estimate and cost, only while process is not running
+	std::string description() const;
+
+private:
+	void update(const long long* m, int numSamples);
+
+	int mode = CORRECT_OFF;
+	int timeConstantMs = 100;
+	double timeConstantSamples = 0;
+	double settledSamples = 0;		// samples in the average since the last retune
+
+	// averaged estimate
+	double dcI = 0, dcQ = 0;
+	double powerI = 0, powerQ = 0, crossIQ = 0;
+	correctParams params;
+
+	std::vector<short> outI;
+	std::vector<short> outQ;
+
+	// cost, written by the callback
+	std::atomic<long long> samples;
+	std::atomic<long long> ns;
+	unsigned long long retunes = 0;
+};
@@ -0,0 +1,84 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_fft.h"
+#include "common.h"
+#include <math.h>
+
+iq_fft::iq_fft(int size)
+	: n(size)
+{
+	if (!isPowerOfTwo(size))
+		throw msg_exception("FFT size must be a power of two");
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		if (r > i)
+		{
+			bitReversed.push_back(i);
+			bitReversed.push_back(r);
+		}
+	}
+	cosTable.resize(n / 2);
+	sinTable.resize(n / 2);
+	for (int i = 0; i < n / 2; i++)
+	{
+		double a = 2 * 3.14159265358979323846 * i / n;
+		cosTable[i] = (float)cos(a);
+		sinTable[i] = (float)-sin(a);
+	}
+}
+
+void iq_fft::forward(float* re, float* im) const
+{
+	for (size_t i = 0; i < bitReversed.size(); i += 2)
+	{
+		int a = bitReversed[i], b = bitReversed[i + 1];
+		float t = re[a]; re[a] = re[b]; re[b] = t;
+		t = im[a]; im[a] = im[b]; im[b] = t;
+	}
+	for (int half = 1; half < n; half *= 2)
+	{
+		const int step = n / (2 * half);
+		for (int start = 0; start < n; start += 2 * half)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				const float wr = cosTable[k * step];
+				const float wi = sinTable[k * step];
+				const int a = start + k;
+				const int b = a + half;
+				const float tr = re[b] * wr - im[b] * wi;
+				const float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
@@ -0,0 +1,46 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include <vector>
+
+/// <summary>
+/// In-place complex FFT of a power of two size, radix 2, single precision.
+/// Real and imaginary parts in separate arrays. The twiddle factors and the
+/// bit reversal are computed once by the constructor.
+/// Forward: X[k] = sum x[n] * exp(-j 2 pi k n / N), not normalized.
+/// </summary>
+class iq_fft
+{
+public:
+	explicit iq_fft(int size);
+
+	int size() const { return n; }
+	void forward(float* re, float* im) const;
+
+	static bool isPowerOfTwo(int size) { return size > 0 && (size & (size - 1)) == 0; }
+
+private:
+	int n;
+	std::vector<int> bitReversed;	// swap partners, each pair once
+	std::vector<float> cosTable;	// n / 2 twiddle factors
+	std::vector<float> sinTable;
+};
@@ -0,0 +1,205 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_resampler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const double c_pi = 3.14159265358979323846;
+// Kaiser window for about 70 dB stopband attenuation
+static const double c_kaiserBeta = 6.76;
+// half-band filter: passband 0.2, stopband from 0.3 of its input rate
+static const int c_halfBandTaps = 48;
+// rational stage: taps per phase per ratio of input to output rate
+static const int c_tapsPerRatio = 24;
+
+static int gcd(int a, int b)
+{
+	while (b != 0)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// modified Bessel function of order 0
+static double bessel0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; k < 50; k++)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+iq_resampler::iq_resampler()
+	: inputRateHz(0), outputRateHz(0)
+{
+}
+
+/// <summary>
+/// Windowed sinc lowpass of up * taps coefficients, cutoff relative to up times the input rate.
+/// Split into the phases and quantized, every phase sums up to exactly 1.0 (32768).
+/// </summary>
+void iq_resampler::design(stage& s, double cutoff, int maxIn)
+{
+	const int length = s.up * s.taps;
+	std::vector<double> proto(length);
+	const double center = (length - 1) / 2.0;
+	const double norm = bessel0(c_kaiserBeta);
+	for (int i = 0; i < length; i++)
+	{
+		double t = i - center;
+		double r = t / (center + 1);
+		double w = bessel0(c_kaiserBeta * sqrt(1 - r * r)) / norm;
+		double x = 2 * c_pi * cutoff * t;
+		proto[i] = w * (x == 0 ? 1 : sin(x) / x);
+	}
+
+	s.coeffs.resize(length);
+	for (int p = 0; p < s.up; p++)
+	{
+		short* c = &s.coeffs[p * s.taps];
+		double sum = 0;
+		for (int j = 0; j < s.taps; j++)
+			sum += proto[p + (s.taps - 1 - j) * s.up];
+		int total = 0, largest = 0;
+		for (int j = 0; j < s.taps; j++)
+		{
+			c[j] = (short)floor(proto[p + (s.taps - 1 - j) * s.up] / sum * 32768 + 0.5);
+			total += c[j];
+			if (abs(c[j]) > abs(c[largest]))
+				largest = j;
+		}
+		c[largest] += (short)(32768 - total);
+	}
+
+	s.workI.assign(s.taps - 1 + maxIn, 0);
+	s.workQ.assign(s.taps - 1 + maxIn, 0);
+	int maxOut = (int)((long long)maxIn * s.up / s.down) + 1;
+	s.outI.resize(maxOut);
+	s.outQ.resize(maxOut);
+	s.phase = 0;
+	s.next = s.taps - 1;
+}
+
+bool iq_resampler::configure(int inputRateHz, int outputRateHz)
+{
+	stages.clear();
+	this->inputRateHz = inputRateHz;
+	this->outputRateHz = outputRateHz;
+	if (inputRateHz <= 0 || outputRateHz <= 0 || outputRateHz > inputRateHz)
+		return false;
+
+	int rate = inputRateHz;
+	int maxIn = c_maxChunk;
+	while (rate % 2 == 0 && rate / 2 >= outputRateHz)
+	{
+		stage s;
+		s.up = 1;
+		s.down = 2;
+		s.taps = c_halfBandTaps;
+		design(s, 0.25, maxIn);
+		stages.push_back(s);
+		rate /= 2;
+		maxIn = (int)s.outI.size();
+	}
+
+	if (rate != outputRateHz)
+	{
+		int g = gcd(rate, outputRateHz);
+		stage s;
+		s.up = outputRateHz / g;
+		s.down = rate / g;
+		if (s.up > c_maxPhases)
+		{
+			stages.clear();
+			return false;
+		}
+		s.taps = ((int)ceil(c_tapsPerRatio * (double)rate / outputRateHz) + 7) & ~7;
+		design(s, 0.5 / s.down, maxIn);
+		stages.push_back(s);
+	}
+	return true;
+}
+
+int iq_resampler::run(stage& s, const short* xi, const short* xq, int n)
+{
+	const int history = s.taps - 1;
+	memcpy(&s.workI[history], xi, n * sizeof(short));
+	memcpy(&s.workQ[history], xq, n * sizeof(short));
+	const int end = history + n;
+	int count = 0;
+	while (s.next < end)
+	{
+		const short* c = &s.coeffs[s.phase * s.taps];
+		int start = s.next - history;
+		int yi = (iq_convert::dot16(&s.workI[start], c, s.taps) + 16384) >> 15;
+		int yq = (iq_convert::dot16(&s.workQ[start], c, s.taps) + 16384) >> 15;
+		s.outI[count] = (short)(yi < -32768 ? -32768 : (yi > 32767 ? 32767 : yi));
+		s.outQ[count] = (short)(yq < -32768 ? -32768 : (yq > 32767 ? 32767 : yq));
+		count++;
+		s.phase += s.down;
+		s.next += s.phase / s.up;
+		s.phase %= s.up;
+	}
+	memmove(&s.workI[0], &s.workI[n], history * sizeof(short));
+	memmove(&s.workQ[0], &s.workQ[n], history * sizeof(short));
+	s.next -= n;
+	return count;
+}
+
+int iq_resampler::process(const short* xi, const short* xq, int numSamples)
+{
+	int n = numSamples;
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		n = run(stages[i], xi, xq, n);
+		xi = &stages[i].outI[0];
+		xq = &stages[i].outQ[0];
+	}
+	return n;
+}
+
+std::string iq_resampler::description() const
+{
+	if (stages.empty())
+		return "off";
+	int halfBands = 0;
+	std::string s = std::to_string(inputRateHz) + " -> " + std::to_string(outputRateHz) + " Hz";
+	for (size_t i = 0; i < stages.size(); i++)
+		if (stages[i].up == 1 && stages[i].down == 2)
+			halfBands++;
+	if (halfBands > 0)
+		s += ", " + std::to_string(halfBands) + " half-band stage(s)";
+	const stage& last = stages.back();
+	if (last.up != 1 || last.down != 2)
+		s += ", " + std::to_string(last.up) + "/" + std::to_string(last.down) + " polyphase, "
+			+ std::to_string(last.taps) + " taps per phase";
+	return s;
+}
@@ -0,0 +1,88 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include "iq_convert.h"
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Software resampling of the I/Q stream, from the rate of the hardware
+/// (after its own decimation) to an arbitrary output rate.
+/// A cascade of half-band decimators by 2 brings the rate down to less than twice
+/// the output rate, a rational polyphase filter (up / down, reduced by the gcd) does the rest.
+/// The filters are fixed point: Q15 taps, 32 bit accumulation, so the ARM builds do
+/// the same work as the x86 ones, by the dot16 kernels of iq_convert.
+/// Every phase of a filter has unity DC gain. The output band is flat to about 0.4
+/// of the output rate, the aliases are attenuated by about 70 dB.
+/// </summary>
+class iq_resampler
+{
+public:
+	// input samples per call of process
+	static const int c_maxChunk = 4096;
+	// limit of the rational stage, up is the number of phases
+	static const int c_maxPhases = 1024;
+	// the flat output band, both sides of DC together, in percent of the output rate
+	static const int c_passbandPercent = 80;
+
+	iq_resampler();
+
+	/// <summary>
+	/// Plans the stages, clears the history
+	/// </summary>
+	/// <returns>false, if the ratio cannot be realized; the resampler is then inactive</returns>
+	bool configure(int inputRateHz, int outputRateHz);
+
+	// false: the input is passed on as it is
+	bool isActive() const { return !stages.empty(); }
+	// output samples per input sample
+	double ratio() const { return isActive() ? (double)outputRateHz / inputRateHz : 1.0; }
+
+	// resamples up to c_maxChunk samples, returns the number of samples in outputI / outputQ
+	int process(const short* xi, const short* xq, int numSamples);
+	const short* outputI() const { return &stages.back().outI[0]; }
+	const short* outputQ() const { return &stages.back().outQ[0]; }
+
+	std::string description() const;
+
+private:
+	struct stage
+	{
+		int up;
+		int down;
+		int taps;					// per phase, a multiple of 8
+		std::vector<short> coeffs;	// up * taps, phase by phase, in the order of the samples
+		std::vector<short> workI;	// taps - 1 samples history, followed by the input
+		std::vector<short> workQ;
+		std::vector<short> outI;
+		std::vector<short> outQ;
+		int phase;
+		int next;					// index in work of the newest sample of the next output
+	};
+
+	static void design(stage& s, double cutoff, int maxIn);
+	static int run(stage& s, const short* xi, const short* xq, int n);
+
+	std::vector<stage> stages;
+	int inputRateHz;
+	int outputRateHz;
+};
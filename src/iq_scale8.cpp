@@ -0,0 +1,109 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#include "iq_scale8.h"
+#include <math.h>
+#include <stdio.h>
+
+iq_scale8::iq_scale8()
+	: shift(6), gain(0), dither(false), randomState(0x12345678)
+{
+}
+
+unsigned iq_scale8::nextRandom()
+{
+	// xorshift32, good enough for dither
+	unsigned x = randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	randomState = x;
+	return x;
+}
+
+void iq_scale8::configure(int shift, double gain, bool dither)
+{
+	this->shift = shift < 0 ? 0 : (shift > 8 ? 8 : shift);
+	this->gain = gain;
+	this->dither = dither;
+
+	lut.clear();
+	if (gain > 0)
+	{
+		// level: (x + 0.5) * gain in 8.8 fixed point, relative to 127.5
+		lut.resize(65536 + 1);
+		for (int x = -32768; x < 32768; x++)
+		{
+			double level = floor((x + 0.5) * gain * 256);
+			level = level < -32768 ? -32768 : (level > 32767 ? 32767 : level);
+			lut[(unsigned short)x] = (short)level;
+		}
+		lut[65536] = 0;
+	}
+
+	ditherTable.clear();
+	if (dither)
+	{
+		// sum of two uniform values: triangular in -255..255, i.e. +-1 LSB
+		ditherTable.resize(c_ditherTableSize + c_maxChunk);
+		for (size_t i = 0; i < ditherTable.size(); i++)
+		{
+			unsigned r = nextRandom();
+			ditherTable[i] = (short)((int)(r & 0xff) + (int)((r >> 8) & 0xff) - 255);
+		}
+	}
+}
+
+void iq_scale8::convert(const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	convert8Params p;
+	p.shift = lut.empty() ? shift : -1;
+	p.lut = lut.empty() ? 0 : &lut[0];
+	p.ditherI = 0;
+	p.ditherQ = 0;
+	if (!dither)
+	{
+		iq_convert::convert8(xi, xq, numSamples, out, p);
+		return;
+	}
+	for (int done = 0; done < numSamples; )
+	{
+		int n = numSamples - done < c_maxChunk ? numSamples - done : c_maxChunk;
+		unsigned r = nextRandom();
+		p.ditherI = &ditherTable[(r & 0xffff) % c_ditherTableSize];
+		p.ditherQ = &ditherTable[(r >> 16) % c_ditherTableSize];
+		iq_convert::convert8(xi + done, xq + done, n, out + 2 * done, p);
+		done += n;
+	}
+}
+
+std::string iq_scale8::description() const
+{
+	char s[80];
+	if (gain > 0)
+		snprintf(s, sizeof(s), "gain %g", gain);
+	else
+		snprintf(s, sizeof(s), "shift %d", shift);
+	std::string d = s;
+	if (dither)
+		d += ", TPDF dither";
+	return d;
+}
@@ -0,0 +1,66 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+#pragma once
+#include "iq_convert.h"
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Scaling of the 16 bit samples to the 8 bit wire format.
+/// A sample x is mapped to floor((x + 0.5) * gain + 128), saturated to 0..255,
+/// so the output is correctly rounded and symmetric around 127.5.
+/// The gain is either a power of two (a plain shift) or arbitrary (by a table).
+/// Optional triangular (TPDF) dither of +-1 LSB decorrelates the quantization error
+/// from the signal, which keeps weak signals free of spurs at the cost of 4.8 dB noise.
+/// </summary>
+class iq_scale8
+{
+public:
+	iq_scale8();
+
+	/// <summary>
+	/// Selects the scaling
+	/// </summary>
+	/// <param name="shift">gain of 2^-shift, 0..8</param>
+	/// <param name="gain">arbitrary gain, used instead of the shift if > 0</param>
+	/// <param name="dither">add TPDF dither before the quantization</param>
+	void configure(int shift, double gain, bool dither);
+
+	// converts numSamples I/Q samples into 2 * numSamples bytes
+	void convert(const short* xi, const short* xq, int numSamples, BYTE* out);
+
+	std::string description() const;
+
+private:
+	// dither is taken from random offsets of a precomputed table
+	static const int c_ditherTableSize = 8192;
+	static const int c_maxChunk = 1024;
+
+	unsigned nextRandom();
+
+	int shift;
+	double gain;
+	bool dither;
+	std::vector<short> lut;			// levels by (unsigned short)x, +1 padding
+	std::vector<short> ditherTable;	// c_ditherTableSize + c_maxChunk values
+	unsigned randomState;
+};
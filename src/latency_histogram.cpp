@@ -0,0 +1,148 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "latency_histogram.h"
+#include <math.h>
+#include <stdio.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+using namespace std;
+
+latency_histogram::latency_histogram()
+{
+	reset();
+}
+
+void latency_histogram::reset()
+{
+	for (int i = 0; i < c_numBuckets; i++)
+		counts[i].store(0, std::memory_order_relaxed);
+	total.store(0, std::memory_order_relaxed);
+	sumNs.store(0, std::memory_order_relaxed);
+	maxNs.store(0, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Values below 2^c_subBits have a bucket each, above, every power of two
+/// is split into 2^c_subBits buckets
+/// </summary>
+int latency_histogram::bucketOf(unsigned long long ns)
+{
+	if (ns < (1ull << c_subBits))
+		return (int)ns;
+#ifdef _MSC_VER
+	unsigned long msb;
+	_BitScanReverse64(&msb, ns);
+	int e = (int)msb;
+#else
+	int e = 63 - __builtin_clzll(ns);
+#endif
+	if (e > c_maxExponent)
+		return c_numBuckets - 1;
+	int sub = (int)(ns >> (e - c_subBits)) & ((1 << c_subBits) - 1);
+	return ((e - c_subBits + 1) << c_subBits) + sub;
+}
+
+long long latency_histogram::bucketUpper(int index)
+{
+	if (index < (1 << c_subBits))
+		return index;
+	int e = (index >> c_subBits) + c_subBits - 1;
+	long long sub = index & ((1 << c_subBits) - 1);
+	long long lower = ((1ll << c_subBits) + sub) << (e - c_subBits);
+	return lower + (1ll << (e - c_subBits)) - 1;
+}
+
+/// <summary>
+/// Single writer: plain loads and stores, no read-modify-write on the hot path
+/// </summary>
+void latency_histogram::record(long long ns)
+{
+	if (ns < 0)
+		ns = 0;
+	std::atomic<unsigned long long>& c = counts[bucketOf((unsigned long long)ns)];
+	c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	sumNs.store(sumNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	if (ns > maxNs.load(std::memory_order_relaxed))
+		maxNs.store(ns, std::memory_order_relaxed);
+}
+
+void latency_histogram::merge(const latency_histogram& other)
+{
+	for (int i = 0; i < c_numBuckets; i++)
+	{
+		unsigned long long n = other.counts[i].load(std::memory_order_relaxed);
+		if (n != 0)
+			counts[i].fetch_add(n, std::memory_order_relaxed);
+	}
+	total.fetch_add(other.count(), std::memory_order_relaxed);
+	sumNs.fetch_add(other.sum(), std::memory_order_relaxed);
+	long long m = other.max();
+	long long cur = maxNs.load(std::memory_order_relaxed);
+	while (m > cur && !maxNs.compare_exchange_weak(cur, m, std::memory_order_relaxed))
+		;
+}
+
+long long latency_histogram::percentile(double q) const
+{
+	unsigned long long n = count();
+	if (n == 0)
+		return 0;
+	// the rank of the quantile, counted from 1
+	unsigned long long rank = (unsigned long long)ceil(q * n);
+	if (rank < 1)
+		rank = 1;
+	unsigned long long seen = 0;
+	for (int i = 0; i < c_numBuckets; i++)
+	{
+		seen += counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+		{
+			// the last bucket has no upper bound
+			if (i == c_numBuckets - 1)
+				return max();
+			long long upper = bucketUpper(i);
+			return upper < max() ? upper : max();
+		}
+	}
+	return max();
+}
+
+string latency_histogram::formatNs(long long ns)
+{
+	char s[32];
+	if (ns < 1000)
+		snprintf(s, sizeof(s), "%lld ns", ns);
+	else if (ns < 1000000)
+		snprintf(s, sizeof(s), "%.1f us", ns / 1e3);
+	else if (ns < 1000000000)
+		snprintf(s, sizeof(s), "%.2f ms", ns / 1e6);
+	else
+		snprintf(s, sizeof(s), "%.2f s", ns / 1e9);
+	return s;
+}
+
+string latency_histogram::summary() const
+{
+	return "n " + to_string(count()) + ", p50 " + formatNs(percentile(0.5)) + ", p99 " + formatNs(percentile(0.99))
+		+ ", p99.9 " + formatNs(percentile(0.999)) + ", max " + formatNs(max());
+}
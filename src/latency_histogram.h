@@ -0,0 +1,69 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <string>
+
+/// <summary>
+/// Distribution of durations in ns, with HDR-style log-linear buckets: 16 buckets
+/// per power of two, so a percentile is accurate to 1/16 of its value.
+/// One thread records (a load and a store per bucket, no locks, no allocation),
+/// any thread reads or merges the histograms of several threads.
+/// </summary>
+class latency_histogram
+{
+public:
+	static const int c_subBits = 4;
+	static const int c_maxExponent = 40;	// 2^40 ns, about 18 minutes, longer goes to the last bucket
+	static const int c_numBuckets = (c_maxExponent - c_subBits + 2) << c_subBits;
+
+	latency_histogram();
+
+	// ---- owner thread ----
+	void record(long long ns);
+	// only while the owner does not record
+	void reset();
+
+	// ---- any thread ----
+	// Adds the counts of another histogram
+	void merge(const latency_histogram& other);
+	unsigned long long count() const { return total.load(std::memory_order_relaxed); }
+	long long sum() const { return sumNs.load(std::memory_order_relaxed); }
+	long long max() const { return maxNs.load(std::memory_order_relaxed); }
+	// Upper bound of the bucket holding the q-quantile, 0 <= q <= 1, the maximum for the last bucket
+	long long percentile(double q) const;
+	// "n 1000, p50 20.1 us, p99 ..., p99.9 ..., max ..."
+	std::string summary() const;
+
+	static std::string formatNs(long long ns);
+
+private:
+	latency_histogram(latency_histogram const&);	// Don't Implement
+	void operator=(latency_histogram const&);		// Don't implement
+
+	static int bucketOf(unsigned long long ns);
+	static long long bucketUpper(int index);
+
+	std::atomic<unsigned long long> counts[c_numBuckets];
+	std::atomic<unsigned long long> total;
+	std::atomic<long long> sumNs;
+	std::atomic<long long> maxNs;
+};
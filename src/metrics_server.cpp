@@ -0,0 +1,249 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+
+#include "metrics_server.h"
+#include "devices.h"
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+using namespace std;
+
+metrics_server::metrics_server()
+	: serving(false)
+{
+}
+
+metrics_server::~metrics_server()
+{
+	if (serving)
+	{
+		serving = false;
+		pthread_join(thrdServe, NULL);
+	}
+	if (listenSock != INVALID_SOCKET)
+		closesocket(listenSock);
+}
+
+bool metrics_server::open(const IPAddress& address, int port)
+{
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = inet_addr(address.sIPAddress.c_str());
+	listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listenSock == INVALID_SOCKET)
+		return false;
+	int r = 1;
+	setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+	if (::bind(listenSock, (struct sockaddr *)&local, sizeof(local)) == SOCKET_ERROR
+		|| listen(listenSock, 4) == SOCKET_ERROR)
+	{
+		cout << "Metrics port " << port << ": " << common::getSocketErrorString() << endl;
+		closesocket(listenSock);
+		listenSock = INVALID_SOCKET;
+		return false;
+	}
+	cout << "Metrics -> http://" << address.sIPAddress << ":" << port << "/metrics" << endl;
+	serving = true;
+	pthread_create(&thrdServe, NULL, metricsServe, this);
+	return true;
+}
+
+/// <summary>
+/// Label values are quoted, backslash, quote and newline are escaped
+/// </summary>
+static string labelValue(const string& s)
+{
+	string v;
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '\\' || s[i] == '"')
+			v += '\\';
+		if (s[i] == '\n')
+		{
+			v += "\\n";
+			continue;
+		}
+		v += s[i];
+	}
+	return v;
+}
+
+/// <summary>
+/// One metric family: the help and type lines, then one sample per device
+/// </summary>
+static void family(string& out, const char* name, const char* type, const char* help,
+	const vector<device_metrics>& devices, double device_metrics::*field)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "# HELP rsp_tcp_%s %s\n# TYPE rsp_tcp_%s %s\n", name, help, name, type);
+	out += line;
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		snprintf(line, sizeof(line), "rsp_tcp_%s{serial=\"%s\"} %.15g\n",
+			name, labelValue(devices[i].serial).c_str(), devices[i].*field);
+		out += line;
+	}
+}
+
+string metrics_server::format(const vector<device_metrics>& devices)
+{
+	string out;
+	char line[256];
+	out += "# HELP rsp_tcp_devices Devices found by the enumeration\n# TYPE rsp_tcp_devices gauge\n";
+	snprintf(line, sizeof(line), "rsp_tcp_devices %d\n", (int)devices.size());
+	out += line;
+	out += "# HELP rsp_tcp_device_info Enumeration data of a device, the value is 1\n# TYPE rsp_tcp_device_info gauge\n";
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		snprintf(line, sizeof(line), "rsp_tcp_device_info{serial=\"%s\",name=\"%s\",hw_version=\"%d\"} 1\n",
+			labelValue(devices[i].serial).c_str(), labelValue(devices[i].name).c_str(), devices[i].hwVersion);
+		out += line;
+	}
+	family(out, "device_available", "gauge", "1, if the API reports the device as available", devices, &device_metrics::available);
+	family(out, "device_streaming", "gauge", "1, while a session streams from the device", devices, &device_metrics::streaming);
+	family(out, "clients", "gauge", "Clients connected to the stream", devices, &device_metrics::clients);
+	family(out, "frequency_hz", "gauge", "Center frequency", devices, &device_metrics::frequencyHz);
+	family(out, "gain_reduction_db", "gauge", "Gain reduction", devices, &device_metrics::gainReductionDb);
+	family(out, "sampling_rate_hz", "gauge", "Sampling rate of the stream", devices, &device_metrics::samplingRateHz);
+	family(out, "callbacks_total", "counter", "Stream callbacks of the API", devices, &device_metrics::callbacks);
+	family(out, "samples_total", "counter", "Samples written to the stream", devices, &device_metrics::samples);
+	family(out, "sent_bytes_total", "counter", "Bytes sent to all clients", devices, &device_metrics::sentBytes);
+	family(out, "api_gaps_total", "counter", "Discontinuities of the sample numbers of the API", devices, &device_metrics::apiGaps);
+	family(out, "api_gap_samples_total", "counter", "Samples skipped by the API", devices, &device_metrics::apiGapSamples);
+	family(out, "discarded_samples_total", "counter", "Samples discarded by the server, its ring was full", devices, &device_metrics::discardedSamples);
+	family(out, "ring_dropped_blocks_total", "counter", "Blocks the stream callback found no room for", devices, &device_metrics::ringDroppedBlocks);
+	family(out, "client_dropped_blocks_total", "counter", "Blocks dropped from the queues of slow clients", devices, &device_metrics::clientDroppedBlocks);
+	family(out, "send_blocked_seconds_total", "counter", "Time the transmit threads waited for a writable socket", devices, &device_metrics::sendBlockedSeconds);
+	family(out, "send_stalls_total", "counter", "Waits for a writable socket of 10 ms or more", devices, &device_metrics::sendStalls);
+	family(out, "partial_writes_total", "counter", "Sends the socket took only a part of", devices, &device_metrics::partialWrites);
+	family(out, "resets_total", "counter", "Reset events of the stream callback", devices, &device_metrics::resets);
+	family(out, "hw_removed_total", "counter", "Hardware removal events of the stream callback", devices, &device_metrics::hwRemovals);
+	out += "# HELP rsp_tcp_latency_seconds Latency of the stream path, see latency_histogram\n# TYPE rsp_tcp_latency_seconds summary\n";
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		string serial = labelValue(devices[i].serial);
+		for (size_t k = 0; k < devices[i].latencies.size(); k++)
+		{
+			const device_metrics::latency& l = devices[i].latencies[k];
+			const char* q[] = { "0.5", "0.99", "0.999", "1" };
+			double v[] = { l.p50, l.p99, l.p999, l.max };
+			for (int j = 0; j < 4; j++)
+			{
+				snprintf(line, sizeof(line), "rsp_tcp_latency_seconds{serial=\"%s\",path=\"%s\",quantile=\"%s\"} %.9g\n",
+					serial.c_str(), l.path, q[j], v[j]);
+				out += line;
+			}
+			snprintf(line, sizeof(line), "rsp_tcp_latency_seconds_sum{serial=\"%s\",path=\"%s\"} %.9g\n"
+				"rsp_tcp_latency_seconds_count{serial=\"%s\",path=\"%s\"} %.15g\n",
+				serial.c_str(), l.path, l.sum, serial.c_str(), l.path, l.count);
+			out += line;
+		}
+	}
+	return out;
+}
+
+/// <summary>
+/// Reads the request line, answers GET /metrics, closes the connection
+/// </summary>
+void metrics_server::serve(SOCKET sock)
+{
+	string request;
+	char buf[512];
+	long long end = common::monotonicMicros() + c_requestTimeoutMs * 1000LL;
+	while (request.find("\r\n\r\n") == string::npos && (int)request.size() < c_maxRequestBytes)
+	{
+		long long left = end - common::monotonicMicros();
+		if (left <= 0)
+			return;
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(sock, &readSet);
+		struct timeval tv = { (long)(left / 1000000), (long)(left % 1000000) };
+		if (select(sock + 1, &readSet, 0, 0, &tv) <= 0)
+			return;
+		int n = recv(sock, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return;
+		request.append(buf, n);
+	}
+
+	string status = "200 OK";
+	string body;
+	if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+	{
+		vector<device_metrics> m;
+		devices::instance().collectMetrics(m);
+		body = format(m);
+	}
+	else if (request.compare(0, 4, "GET ") == 0)
+	{
+		status = "404 Not Found";
+		body = "Not found, see /metrics\n";
+	}
+	else
+	{
+		status = "405 Method Not Allowed";
+		body = "GET only\n";
+	}
+	string response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: " + to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+	// a scraper, that does not read, is given up on
+	size_t sent = 0;
+	while (sent < response.size())
+	{
+		fd_set writeSet;
+		FD_ZERO(&writeSet);
+		FD_SET(sock, &writeSet);
+		struct timeval tv = { 1, 0 };
+		if (select(sock + 1, 0, &writeSet, 0, &tv) <= 0)
+			return;
+		int n = send(sock, response.c_str() + sent, (int)(response.size() - sent), 0);
+		if (n <= 0)
+			return;
+		sent += n;
+	}
+}
+
+/// <summary>
+/// Thread of the metrics port, accepts and answers the requests in turn
+/// </summary>
+void* metricsServe(void* p)
+{
+	metrics_server* ms = (metrics_server*)p;
+	while (ms->serving)
+	{
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(ms->listenSock, &readSet);
+		struct timeval tv = { 0, 200000 };
+		if (select(ms->listenSock + 1, &readSet, 0, 0, &tv) <= 0)
+			continue;
+		SOCKET sock = accept(ms->listenSock, 0, 0);
+		if (sock == INVALID_SOCKET)
+			continue;
+		ms->serve(sock);
+		closesocket(sock);
+	}
+	return 0;
+}
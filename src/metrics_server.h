@@ -0,0 +1,68 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "common.h"
+#include "IPAddress.h"
+#include "mir_sdr_device.h"
+
+void* metricsServe(void* p);
+
+/// <summary>
+/// Counters and gauges of the devices in the Prometheus text format, served by HTTP
+/// on a port of its own. Each request reads a snapshot of the devices: the stream
+/// threads keep their counters in atomics, so scraping never stops the stream.
+/// Requests are answered one by one on the server thread, the connection is closed
+/// after the response.
+/// </summary>
+class metrics_server
+{
+public:
+	metrics_server();
+	~metrics_server();
+
+	/// <summary>
+	/// Opens the listener, serves the devices of devices::mirDevices, until destroyed
+	/// </summary>
+	/// <returns>false, if the port cannot be opened</returns>
+	bool open(const IPAddress& address, int port);
+
+	// The response body
+	static std::string format(const std::vector<device_metrics>& devices);
+
+private:
+	metrics_server(metrics_server const&);		// Don't Implement
+	void operator=(metrics_server const&);		// Don't implement
+
+	friend void* metricsServe(void* p);
+
+	void serve(SOCKET sock);
+
+	const int c_requestTimeoutMs = 1000;
+	const int c_maxRequestBytes = 4096;
+
+	SOCKET listenSock = INVALID_SOCKET;
+	pthread_t thrdServe;
+	std::atomic<bool> serving;
+};
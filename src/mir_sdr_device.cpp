@@ -19,6 +19,10 @@
 **/
 
 #include "mir_sdr_device.h"
+#include "iq_convert.h"
+#include "client_session.h"
+#include "sample_sender.h"
+#include "stream_frame.h"
 #include <iostream>
 using namespace std;
 
@@ -39,19 +43,36 @@ const samplingConfiguration mir_sdr_device::samplingConfigs[6] = {
 };
 
 int mir_sdr_device::initSamplingConfigIdx = 3;
+std::atomic<bool> mir_sdr_device::latencyReportRequested(false);
 
 
 mir_sdr_device::~mir_sdr_device()
 {
 	pthread_mutex_destroy(&mutex_rxThreadStarted);
 	pthread_cond_destroy(&started_cond);
+	pthread_mutex_destroy(&mutex_commands);
+	pthread_cond_destroy(&commands_cond);
+	pthread_mutex_destroy(&mutex_clients);
+	delete channels;
+	delete spectrum;
+	delete recorder;
 }
 
 mir_sdr_device::mir_sdr_device() 
+	: isStreaming(false), started(false), requestedFraming(false), callbacks(0), streamedSamples(0), apiGaps(0), apiGapSamples(0),
+	  discards(0), discardedSamples(0), resets(0), hwRemovals(0), retiredSentBytes(0),
+	  retiredQueueDrops(0), retiredStalls(0), retiredBlockedUs(0), retiredPartialWrites(0), resampling(false),
+	  callbacksHeld(false), callbacksActive(0),
+	  publishedFrequencyHz(0), publishedGainReduction(0), publishedSamplingRateHz(0), callbackIntervalUs(0), txRunning(false), ringLent(false)
 {
 	thrdRx = 0;
+	thrdTx = 0;
 	pthread_mutex_init(&mutex_rxThreadStarted, NULL);
 	pthread_cond_init(&started_cond, NULL);
+	pthread_mutex_init(&mutex_commands, NULL);
+	pthread_cond_init(&commands_cond, NULL);
+	pthread_mutex_init(&mutex_clients, NULL);
+	remoteClient = INVALID_SOCKET;
 
 }
 
@@ -62,14 +83,127 @@ void mir_sdr_device::init(rsp_cmdLineArgs* pargs)
 	gainReduction = pargs->GainReduction;
 	currentSamplingRateHz = pargs->SamplingRate;
 	bitWidth = (eBitWidth)pargs->BitWidth;
+	requestedFormat = bitWidth;
+	requestedStageSamples = 0;
+	requestedMantissaBits = iq_bfp::c_maxMantissaBits;
 	antenna = pargs->Antenna;
 	enableBiasT = pargs->enableBiasT;
+	txMode = pargs->txMode;
+	coalesceBytes = pargs->coalesceBytes;
+	maxLatencyUs = pargs->maxLatencyUs;
+	kickMs = pargs->kickMs;
+	lossReportSec = pargs->lossReportSec;
+	prerollSec = pargs->prerollSec;
+	scale8.configure(pargs->scale8Shift, pargs->scale8Gain, pargs->scale8Dither != 0);
+	correction.configure(pargs->correctionMode, pargs->correctionMs);
+	ringPoolFlags = (pargs->lockMemory ? buffer_pool::POOL_LOCKED : 0)
+		| (pargs->hugePages ? buffer_pool::POOL_HUGE_PAGES : 0);
 
 	// ha: determine the SamplingConfigIdx - to allow direct initialization in this mode
 	int defaultSamplingConfigIdx = initSamplingConfigIdx;
-	initSamplingConfigIdx = getSamplingConfigurationTableIndex(currentSamplingRateHz);
-	if ( initSamplingConfigIdx < 0 || initSamplingConfigIdx >= c_numSamplingConfigs )
+	initSamplingConfigIdx = getSamplingConfigurationTableIndex(pargs->SamplingRate);
+	outputSamplingRateHz = pargs->SamplingRate;
+	if ( initSamplingConfigIdx < 0 || initSamplingConfigIdx >= c_numSamplingConfigs
+		|| !resampler.configure(samplingConfigs[initSamplingConfigIdx].samplingRateHz, outputSamplingRateHz))
+	{
 		initSamplingConfigIdx = defaultSamplingConfigIdx;
+		outputSamplingRateHz = samplingConfigs[initSamplingConfigIdx].samplingRateHz;
+	}
+
+	if (pargs->numChannels > 0 && channels == 0)
+	{
+		channels = new channel_server();
+		if (!channels->open(pargs->numChannels, pargs->channels, pargs->channelFilePrefix,
+			pargs->Address, pargs->Port + 1))
+		{
+			cout << "Channelizer not available" << endl;
+			delete channels;
+			channels = 0;
+		}
+	}
+
+	if (pargs->spectrumPort > 0 && spectrum == 0)
+	{
+		spectrum = new spectrum_server();
+		if (!spectrum->open(pargs->Address, pargs->spectrumPort, pargs->spectrumFftSize, pargs->spectrumWindow,
+			pargs->spectrumAverages, pargs->spectrumRate, pargs->spectrumLinear == 0))
+		{
+			cout << "Spectrum not available" << endl;
+			delete spectrum;
+			spectrum = 0;
+		}
+	}
+
+	if (!pargs->recordPrefix.empty() && recorder == 0)
+	{
+		recorder = new sigmf_recorder();
+		string hardware = "SDRplay";
+		if (!DevNm.empty())
+			hardware += " " + DevNm;
+		if (!serno.empty())
+			hardware += ", serial " + serno;
+		recorder->open(pargs->recordPrefix, hardware);
+	}
+}
+
+/// <summary>
+/// Sets up the software resampling from the rate of a config to outputSamplingRateHz.
+/// Only called, while the stream is not initialized.
+/// </summary>
+bool mir_sdr_device::configureResampler(int sampleConfigsTableIndex)
+{
+	// the samples of the previous rate are finished first
+	stopResampling();
+	int inputRateHz = samplingConfigs[sampleConfigsTableIndex].samplingRateHz;
+	if (!resampler.configure(inputRateHz, outputSamplingRateHz))
+	{
+		cout << "Sampling Rate " << outputSamplingRateHz << " cannot be resampled from " << inputRateHz
+			<< ", the ratio needs more than " << iq_resampler::c_maxPhases << " phases" << endl;
+		return false;
+	}
+	cout << "Software Resampling: " << resampler.description() << endl;
+	startResampling(inputRateHz);
+	return true;
+}
+
+/// <summary>
+/// Starts the resampler thread, while the stream is not initialized or its callbacks are held.
+/// Its ring buffers c_ringMs of the device samples, one block per API packet
+/// </summary>
+void mir_sdr_device::startResampling(int inputRateHz)
+{
+	if (!resampler.isActive() || thrdResample != 0)
+		return;
+	int packetSamples = samplesPerPacket > 0 ? samplesPerPacket : c_defaultSamplesPerPacket;
+	if (packetSamples > iq_resampler::c_maxChunk)
+		packetSamples = iq_resampler::c_maxChunk;
+	int blockSize = (int)sizeof(resample_chunk) + 4 * packetSamples;
+	int numBlocks = (int)((double)inputRateHz * c_ringMs / 1000 / packetSamples) + 1;
+	if (numBlocks < c_ringMinBlocks)
+		numBlocks = c_ringMinBlocks;
+	resampleRing.allocate(numBlocks, blockSize, ringPoolFlags);
+	resampleDropped = false;
+	resampling = true;
+	thrdResample = new pthread_t();
+	pthread_create(thrdResample, NULL, &resampleWork, this);
+}
+
+/// <summary>
+/// Stops the resampler thread, after the stream: the samples queued are resampled first
+/// </summary>
+void mir_sdr_device::stopResampling()
+{
+	if (thrdResample == 0)
+		return;
+	resampling = false;
+	resampleRing.wakeup();
+	void* status;
+	pthread_join(*thrdResample, &status);
+	delete thrdResample;
+	thrdResample = 0;
+	if (resampleRing.droppedBlocks() > 0)
+		cout << "Resampler: " << resampleRing.droppedBlocks() << " blocks dropped, the resampler was too slow" << endl;
+	resampleRing.release_all();
 }
 
 void mir_sdr_device::cleanup()
@@ -98,41 +232,179 @@ void mir_sdr_device::stop()
 	else
 		cout << "StreamUnInit failed (1) with " << err << endl;
 	isStreaming = false;
+	// it feeds the channels, the spectrum and the recorder
+	stopResampling();
+	if (channels != 0)
+		channels->stop();
+	if (spectrum != 0)
+		spectrum->stop();
+	if (recorder != 0)
+		recorder->stop();
+
+	// the callback does not produce anymore, now stop the consumer
+	txRunning = false;
+	if (thrdTx != 0)
+	{
+		ring.wakeup();
+		void* status;
+		pthread_join(*thrdTx, &status);
+		delete thrdTx;
+		thrdTx = 0;
+		cout << "++++ Tx thread terminated ++++" << endl;
+	}
+	history.release();
+	reportRingStatistics("Session end");
+	reportCompression("Session end");
+	if (correction.isActive())
+		cout << "Session end: correction " << correction.description() << endl;
+	pthread_mutex_lock(&mutex_clients);
+	std::vector<client_session*> closed;
+	closed.swap(clients);
+	pthread_mutex_unlock(&mutex_clients);
+	for (size_t i = 0; i < closed.size(); i++)
+		retireClient(closed[i]);
+	reportLosses("Session end");
+	reportLatency("Session end");
 
 	err = mir_sdr_ReleaseDeviceIdx();
 	cout << "\nmir_sdr_ReleaseDeviceIdx returned with: " << err << endl;
 	cout << "DeviceIndex released: " << DeviceIndex << endl;
 	started = false;
 
-	closesocket(remoteClient);
+	if (remoteClient != INVALID_SOCKET)
+		closesocket(remoteClient);
 	remoteClient = INVALID_SOCKET;
 	cout << "Socket closed\n\n";
 }
 
-void mir_sdr_device::writeWelcomeString() const
+void mir_sdr_device::writeWelcomeString(SOCKET client) const
 {
-	BYTE buf0[] = "RTL0";
 	BYTE* buf = new BYTE[c_welcomeMessageLength];
+	welcomeString(buf, 0);
+	send(client, (const char*)buf, c_welcomeMessageLength, 0);
+	delete[] buf;
+}
+
+/// <summary>
+/// The c_welcomeMessageLength bytes a client gets first, historyBytes of pre-roll follow them
+/// </summary>
+void mir_sdr_device::welcomeString(BYTE* buf, unsigned int historyBytes) const
+{
+	BYTE buf0[] = "RTL0";
 	memset(buf, 0, c_welcomeMessageLength);
 	memcpy(buf, buf0, 4);
-	buf[6] = bitWidth;
+	// the format of the stream, it may differ from the command line
+	int f = requestedFormat.load();
+	unsigned int n = isStaged(f) ? (unsigned int)requestedStageSamples.load() : 0;
+	buf[6] = (BYTE)f;
 	buf[7] = rxType;
 	buf[11] = gainCount;
 	buf[15] = 0x52; buf[16] = 0x53; buf[17] = 0x50; buf[18] = 0x32; //"RSP2", interpreted e.g. by qirx
-	send(remoteClient, (const char*)buf, c_welcomeMessageLength, 0);
-	delete[] buf;
+	// extensions of this server, unknown to rtl_tcp clients
+	memcpy(buf + 20, "RSPX", 4);
+	buf[27] = CAP_SAMPLE_FORMATS | CAP_FRAMING | CAP_PREROLL | CAP_FORMAT_STATE;
+	buf[28] = (BYTE)(historyBytes >> 24); buf[29] = (BYTE)(historyBytes >> 16);
+	buf[30] = (BYTE)(historyBytes >> 8); buf[31] = (BYTE)historyBytes;
+	buf[32] = (BYTE)(n >> 24); buf[33] = (BYTE)(n >> 16);
+	buf[34] = (BYTE)(n >> 8); buf[35] = (BYTE)n;
+	buf[36] = (BYTE)requestedMantissaBits.load();
+	buf[37] = requestedFraming.load() ? 1 : 0;
 }
 
 
-void mir_sdr_device::start(SOCKET client)
+void mir_sdr_device::start(SOCKET client, bool startTransmitThread)
 {
 	started = true;
 
-	remoteClient = client;
-	writeWelcomeString();
-
 	cout << endl << "Starting..." << endl;
+	cout << "Sample conversion: " << iq_convert::implementation() << endl;
+
+	// Allocate before the stream starts, the callback must not allocate.
+	// Sized from the last known packet size, corrected after mir_sdr_StreamInit
+	if (samplesPerPacket <= 0)
+		samplesPerPacket = c_defaultSamplesPerPacket;
+	int numBlocks, blockSize;
+	ringGeometry(samplesPerPacket, numBlocks, blockSize);
+	ring.allocate(numBlocks, blockSize, ringPoolFlags);
+	ringSamplingRateHz = currentSamplingRateHz;
+	ringBlockBytes = blockSize;
+	ring.resetStatistics();
+	openBlock = 0;
+	lastCallbackUs = 0;
+	commands.clear();
+	commandsClosed = false;
+	// a new session starts in the format of the command line
+	requestedFormat = bitWidth;
+	requestedMantissaBits = iq_bfp::c_maxMantissaBits;
+	format = bitWidth;
+	stageFill = 0;
+	requestedFraming = false;
+	framed = false;
+	haveSampleNum = false;
+	outIndex = 0;
+	frameFlags = 0;
+	codecBlocks = 0;
+	codecRawBytes = 0;
+	codecBytes = 0;
+	codecNs = 0;
+	callbacks = 0;
+	streamedSamples = 0;
+	apiGaps = 0;
+	apiGapSamples = 0;
+	discards = 0;
+	discardedSamples = 0;
+	resets = 0;
+	hwRemovals = 0;
+	retiredSentBytes = 0;
+	retiredQueueDrops = 0;
+	retiredStalls = 0;
+	retiredBlockedUs = 0;
+	retiredPartialWrites = 0;
+	callbackLatency.reset();
+	conversionLatency.reset();
+	callbackJitter.reset();
+	retiredSelectLatency.reset();
+	retiredSendLatency.reset();
+	lastCallbackNs = 0;
+	stageI.resize(c_maxStageSamples);
+	stageQ.resize(c_maxStageSamples);
+	cout << "Sample ring: " << numBlocks << " blocks of " << blockSize << " bytes"
+		<< (ring.isLocked() ? ", locked" : "") << (ring.isHugePages() ? ", huge pages" : "") << endl;
+	if (prerollSec > 0)
+	{
+		// seconds of 16 bit samples, the age limits the history of the smaller formats
+		long long bytes = (long long)prerollSec * outputSamplingRateHz * 4;
+		if (bytes > c_maxPrerollBytes)
+			bytes = c_maxPrerollBytes;
+		history.allocate((size_t)bytes, prerollSec * 1000000000LL, ringPoolFlags);
+		cout << "Pre-roll: " << prerollSec << " s, " << (bytes >> 20) << " MB" << endl;
+	}
+	txRunning = true;
 
+	if (thrdTx != 0) // just in case..
+	{
+		pthread_cancel(*thrdTx);
+		delete thrdTx;
+		thrdTx = 0;
+	}
+	// without the transmit thread, an external backend drains the ring
+	if (startTransmitThread)
+	{
+		queueBlocks = numBlocks;
+		queueBlockSize = blockSize;
+		borrower = 0;
+		ringLent = false;
+		// unattended, the stream starts without a client
+		if (client != INVALID_SOCKET)
+			addClient(client);
+		thrdTx = new pthread_t();
+		pthread_create(thrdTx, NULL, &distribute, this);
+	}
+	else
+	{
+		writeWelcomeString(client);
+		remoteClient = client;
+	}
 
 	if (thrdRx != 0) // just in case..
 	{
@@ -148,35 +420,600 @@ void mir_sdr_device::start(SOCKET client)
 	pthread_attr_destroy(&attr);
 }
 
-BYTE* mir_sdr_device::mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, int& buflen)
+/// <summary>
+/// Converts one packet into the wire format
+/// </summary>
+/// <param name="buf">Destination, must hold samplesPerPacket * bytesPerSample() bytes</param>
+/// <returns>Number of bytes written to buf</returns>
+int mir_sdr_device::mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, BYTE* buf)
+{
+	switch (format)
+	{
+	case FORMAT_CS16:
+		iq_convert::interleave16(idata, qdata, samplesPerPacket, buf);
+		break;
+	case FORMAT_CU8:
+		scale8.convert(idata, qdata, samplesPerPacket, buf);
+		break;
+	case FORMAT_CS16_BE:
+		iq_convert::interleave16be(idata, qdata, samplesPerPacket, buf);
+		break;
+	case FORMAT_CF32:
+		iq_convert::interleaveF32(idata, qdata, samplesPerPacket, buf);
+		break;
+	case FORMAT_CS12_PACKED:
+		iq_convert::pack12(idata, qdata, samplesPerPacket, buf);
+		break;
+	case FORMAT_CS14_PACKED:
+		iq_convert::pack14(idata, qdata, samplesPerPacket, buf);
+		break;
+	default:
+		return 0;
+	}
+	return samplesPerPacket / samplesPerUnit(format) * bytesPerUnit(format);
+}
+
+/// <summary>
+/// Converts one planar block: numSamples I values, followed by numSamples Q values
+/// </summary>
+void mir_sdr_device::mergePlanar(const short* idata, const short* qdata, int numSamples, BYTE* buf)
 {
-	BYTE* buf = 0;
-	buflen = 0;
+	if (format == FORMAT_CF32_PLANAR)
+	{
+		iq_convert::planarF32(idata, numSamples, buf);
+		iq_convert::planarF32(qdata, numSamples, buf + numSamples * 4);
+	}
+	else
+	{
+		iq_convert::planar16(idata, numSamples, buf);
+		iq_convert::planar16(qdata, numSamples, buf + numSamples * 2);
+	}
+}
 
-	if (bitWidth == BITS_16)
+int mir_sdr_device::bytesPerSample(int format)
+{
+	switch (format)
 	{
-		buflen = samplesPerPacket *4;
-		buf = new BYTE[buflen];
-		for (int i = 0, j = 0; i < samplesPerPacket; i++)
-		{
-			buf[j++] = (BYTE)(idata[i] & 0xff);			
-			buf[j++] = (BYTE)((idata[i] & 0xff00) >> 8);  
+	case FORMAT_CU8:
+		return 2;
+	case FORMAT_CS12_PACKED:
+		return 3;
+	case FORMAT_CF32:
+	case FORMAT_CF32_PLANAR:
+		return 8;
+	default:
+		return 4;
+	}
+}
 
-			buf[j++] = (BYTE)(qdata[i] & 0xff);			
-			buf[j++] = (BYTE)((qdata[i] & 0xff00) >> 8); 
-		}
+int mir_sdr_device::stagedBlockBytes(int format, int numSamples, int mantissaBits)
+{
+	if (format == FORMAT_CS16_LOSSLESS)
+		return iq_compress::maxEncodedBytes(numSamples);
+	if (format == FORMAT_BFP)
+		return iq_bfp::encodedBytes(numSamples, mantissaBits);
+	return numSamples * bytesPerSample(format);
+}
+
+const char* mir_sdr_device::formatName(int format)
+{
+	switch (format)
+	{
+	case FORMAT_CU8: return "cu8";
+	case FORMAT_CS16: return "cs16";
+	case FORMAT_CS16_BE: return "cs16 big endian";
+	case FORMAT_CF32: return "cf32";
+	case FORMAT_CS16_PLANAR: return "cs16 planar";
+	case FORMAT_CF32_PLANAR: return "cf32 planar";
+	case FORMAT_CS12_PACKED: return "cs12 packed";
+	case FORMAT_CS14_PACKED: return "cs14 packed";
+	case FORMAT_CS16_LOSSLESS: return "cs16 lossless";
+	case FORMAT_BFP: return "block floating point";
+	default: return "unknown";
 	}
-	else if (bitWidth == BITS_8)
+}
+
+/// <summary>
+/// The read-only clients parse the stream in the format of their welcome string,
+/// the owner can't switch it under them
+/// </summary>
+bool mir_sdr_device::streamShared(const char* what)
+{
+	int n = numClients();
+	if (n <= 1)
+		return false;
+	cout << what << " not switched, " << n << " clients share the stream" << endl;
+	return true;
+}
+
+/// <summary>
+/// Selects the wire format, as commanded by the client.
+/// The low byte is the eSampleFormat, 0 returns to the format of the command line,
+/// the upper bits are the number of samples per planar block, 0 for the default.
+/// </summary>
+void mir_sdr_device::setSampleFormat(int value)
+{
+	if (streamShared("Sample format"))
+		return;
+	int f = value & 0xff;
+	int n = (value >> 8) & 0xffffff;
+	if (f == 0)
+		f = bitWidth;
+	if (f < FORMAT_CU8 || f > FORMAT_BFP)
+	{
+		cout << "Sample format " << f << " not supported" << endl;
+		return;
+	}
+	if (isStaged(f))
+	{
+		if (n == 0)
+			n = isPlanar(f) ? c_defaultPlanarSamples : (f == FORMAT_BFP ? c_defaultBfpSamples : c_defaultCompressedSamples);
+		if (n > c_maxStageSamples)
+			n = c_maxStageSamples;
+		// bfp blocks end at a byte boundary
+		if (f == FORMAT_BFP)
+			n = n < 4 ? 4 : n & ~3;
+		// smaller lossless blocks are mostly header
+		if (f == FORMAT_CS16_LOSSLESS && n < c_minCompressedSamples)
+			n = c_minCompressedSamples;
+		n = fitStageSamples(f, n);
+		requestedStageSamples = n;
+	}
+	requestedFormat = f;
+	cout << "Sample format " << formatName(f);
+	if (isStaged(f))
+		cout << ", " << n << " samples per block";
+	if (f == FORMAT_BFP)
+		cout << ", " << requestedMantissaBits << " bit mantissas";
+	cout << endl;
+}
+
+void mir_sdr_device::setMantissaBits(int value)
+{
+	if (streamShared("Mantissa width"))
+		return;
+	if (value < iq_bfp::c_minMantissaBits || value > iq_bfp::c_maxMantissaBits)
 	{
-		buflen = samplesPerPacket * 2;
-		buf = new BYTE[buflen];
-		for (int i = 0, j = 0; i < samplesPerPacket; i++)
+		cout << "Mantissa width " << value << " not supported" << endl;
+		return;
+	}
+	requestedMantissaBits = value;
+	cout << "Block floating point mantissas: " << value << " bit" << endl;
+}
+
+void mir_sdr_device::setFraming(int value)
+{
+	if (streamShared("Framing"))
+		return;
+	requestedFraming = value != 0;
+	cout << "Framed stream " << (value != 0 ? "on" : "off") << endl;
+}
+
+/// <summary>
+/// Callback: switches the format between two packets, a partly staged block is discarded
+/// </summary>
+void mir_sdr_device::applyRequestedFormat()
+{
+	int f = requestedFormat.load(std::memory_order_relaxed);
+	int n = isStaged(f) ? requestedStageSamples.load(std::memory_order_relaxed) : 0;
+	int b = requestedMantissaBits.load(std::memory_order_relaxed);
+	bool fr = requestedFraming.load(std::memory_order_relaxed);
+	if (f == format && n == stageSamples && b == mantissaBits && fr == framed)
+		return;
+	format = f;
+	framed = fr;
+	stageSamples = n;
+	mantissaBits = b;
+	stageFill = 0;
+	hasCarry = false;
+	// the blocks of the new format get a new tag, the distributor starts a new history with them
+	formatTag++;
+	if (openBlock != 0 && openBlock->length > 0)
+	{
+		ring.commit();
+		openBlock = 0;
+	}
+	else if (openBlock != 0)
+		openBlock->tag = formatTag;
+}
+
+/// <summary>
+/// A staged block and its frame header must fit into one ring block
+/// </summary>
+int mir_sdr_device::fitStageSamples(int format, int n) const
+{
+	while (n > 4 && stagedBlockBytes(format, n, iq_bfp::c_maxMantissaBits) + c_frameHeaderBytes > ringBlockBytes)
+		n /= 2;
+	if (format == FORMAT_BFP)
+		n = n < 4 ? 4 : n & ~3;
+	return n;
+}
+
+void mir_sdr_device::ringGeometry(int samplesPerPacket, int& numBlocks, int& blockSize) const
+{
+	// room for the coalescing threshold plus one packet, so packets are rarely split
+	blockSize = samplesPerPacket * c_maxBytesPerSample + coalesceBytes;
+	double ringBytes = currentSamplingRateHz * c_maxBytesPerSample * c_ringMs / 1000;
+	numBlocks = (int)(ringBytes / blockSize) + 1;
+	if (numBlocks < c_ringMinBlocks)
+		numBlocks = c_ringMinBlocks;
+}
+
+/// <summary>
+/// Resizes the ring, if the packet size or the sampling rate has changed.
+/// Called with the samplesPerPacket reported by mir_sdr_StreamInit / mir_sdr_Reinit.
+/// </summary>
+void mir_sdr_device::configureRing(int samplesPerPacket)
+{
+	if (samplesPerPacket <= 0)
+		return;
+	if (samplesPerPacket == this->samplesPerPacket && currentSamplingRateHz == ringSamplingRateHz)
+		return;
+	this->samplesPerPacket = samplesPerPacket;
+	ringSamplingRateHz = currentSamplingRateHz;
+
+	int numBlocks, blockSize;
+	ringGeometry(samplesPerPacket, numBlocks, blockSize);
+	ringBlockBytes = blockSize;
+	// a format of the same batch of commands was fitted to the previous blocks:
+	// it must fit the new ones, before the producer takes them
+	int f = requestedFormat.load();
+	int n = requestedStageSamples.load();
+	if (isStaged(f) && fitStageSamples(f, n) != n)
+	{
+		requestedStageSamples = fitStageSamples(f, n);
+		cout << "Sample format " << formatName(f) << ", " << requestedStageSamples << " samples per block" << endl;
+	}
+	ring.resize(numBlocks, blockSize);
+	cout << "Sample ring resized: " << numBlocks << " blocks of " << blockSize << " bytes" << endl;
+}
+
+/// <summary>
+/// Attaches a client to the stream. The first client becomes the owner.
+/// Called by the listener, the client gets the welcome string and its own queue.
+/// Joining a running stream, it gets the pre-roll first, its size is in the welcome string.
+/// </summary>
+void mir_sdr_device::addClient(SOCKET client)
+{
+	pthread_mutex_lock(&mutex_clients);
+	bool owner = clients.empty();
+	std::vector<preroll_buffer::piece> pieces;
+	std::vector<BYTE> markers;
+	size_t historyBytes = readHistory(0, pieces, markers);
+	std::vector<BYTE> welcome(c_welcomeMessageLength);
+	welcomeString(&welcome[0], (unsigned int)historyBytes);
+	client_session* cs = new client_session(this, client, nextClientId++, owner);
+	// the new client is served from the queues again
+	reclaimRing();
+	// the queue holds the welcome string, the history and the live blocks behind it:
+	// the transmit thread of the client sends them, nothing blocks under the lock
+	cs->start(queueBlocks + 1 + (int)pieces.size(), queueBlockSize, ringPoolFlags, txMode);
+	cs->deliver(&welcome[0], c_welcomeMessageLength, 0);
+	for (size_t i = 0; i < pieces.size(); i++)
+		cs->deliver(pieces[i].data, pieces[i].length, 0);
+	clients.push_back(cs);
+	cout << "Client " << cs->id() << " (" << cs->peerName() << ") attached"
+		<< (owner ? " as owner" : ", read-only") << ", " << clients.size() << " client(s)";
+	if (historyBytes > 0)
+		cout << ", " << historyBytes << " bytes of history";
+	cout << endl;
+	pthread_mutex_unlock(&mutex_clients);
+}
+
+/// <summary>
+/// Under mutex_clients: the pre-roll of the last ms (0: all) in pieces fitting the client queues.
+/// A framed stream gets marker frames before and after the history, they are in markers.
+/// </summary>
+/// <returns>The bytes of the pieces, the markers included</returns>
+size_t mir_sdr_device::readHistory(int ms, std::vector<preroll_buffer::piece>& pieces, std::vector<BYTE>& markers)
+{
+	if (!history.isActive() || history.size() == 0 || queueBlockSize < c_frameHeaderBytes)
+		return 0;
+	long long now = common::monotonicNanos();
+	long long sinceNs = ms > 0 ? now - ms * 1000000LL : 0;
+	bool marked = requestedFraming.load();
+	markers.resize(marked ? 2 * c_frameHeaderBytes : 0);
+	if (marked)
+	{
+		writeMarker(&markers[0], FRAME_HISTORY);
+		preroll_buffer::piece p = { &markers[0], c_frameHeaderBytes };
+		pieces.push_back(p);
+	}
+	size_t total = history.read(sinceNs, queueBlockSize, pieces);
+	if (total == 0)
+	{
+		pieces.clear();
+		return 0;
+	}
+	if (marked)
+	{
+		writeMarker(&markers[c_frameHeaderBytes], FRAME_LIVE);
+		preroll_buffer::piece p = { &markers[c_frameHeaderBytes], c_frameHeaderBytes };
+		pieces.push_back(p);
+		total += 2 * c_frameHeaderBytes;
+	}
+	return total;
+}
+
+/// <summary>
+/// Transmit thread, under mutex_clients: CMD_REPLAY_HISTORY of a client.
+/// The history follows the blocks queued already, so it needs the markers of the framed stream.
+/// </summary>
+void mir_sdr_device::replayHistory(client_session* cs, int ms)
+{
+	if (!requestedFraming.load())
+	{
+		cout << "Client " << cs->id() << ": history replay needs the framed stream" << endl;
+		return;
+	}
+	std::vector<preroll_buffer::piece> pieces;
+	std::vector<BYTE> markers;
+	size_t bytes = readHistory(ms, pieces, markers);
+	if (bytes == 0)
+	{
+		cout << "Client " << cs->id() << ": no history to replay" << endl;
+		return;
+	}
+	cs->resize(queueBlocks + (int)pieces.size(), queueBlockSize);
+	size_t queued = 0;
+	for (size_t i = 0; i < pieces.size(); i++)
+		if (cs->deliver(pieces[i].data, pieces[i].length, 0))
+			queued += pieces[i].length;
+	cout << "Client " << cs->id() << ": " << queued << " of " << bytes << " bytes of history replayed" << endl;
+}
+
+/// <summary>
+/// A frame without samples, marking the history in the framed stream
+/// </summary>
+void mir_sdr_device::writeMarker(BYTE* out, int flags)
+{
+	stream_frame::write(out, 0, flags, 0, 0, 0, common::realtimeNanos());
+}
+
+/// <summary>
+/// Transmit thread, under mutex_clients: a single client is lent the ring, its transmit
+/// thread sends from the ring directly (with MSG_ZEROCOPY), without the copy into its queue.
+/// The pre-roll needs every block, it keeps the distributor in the path.
+/// A slow borrower overflows the ring instead of its queue, it is not kicked.
+/// </summary>
+void mir_sdr_device::lendRing()
+{
+	if (borrower != 0 || ringLent || clients.size() != 1 || clients[0]->isClosed() || history.isActive())
+		return;
+	borrower = clients[0];
+	ringLent = true;
+	borrower->lendRing(&ring);
+}
+
+/// <summary>
+/// Under mutex_clients: the clients change, the distributor reads the ring again,
+/// when the borrower has returned it
+/// </summary>
+void mir_sdr_device::reclaimRing()
+{
+	if (borrower == 0)
+		return;
+	borrower->reclaimRing();
+	borrower = 0;
+}
+
+int mir_sdr_device::reapClients()
+{
+	std::vector<client_session*> closed;
+	pthread_mutex_lock(&mutex_clients);
+	bool ownerLeft = false;
+	for (size_t i = 0; i < clients.size(); )
+	{
+		if (clients[i]->isClosed())
 		{
-			buf[j++] = (BYTE)(idata[i] / 64 + 127);;
-			buf[j++] = (BYTE)(qdata[i] / 64 + 127);
+			ownerLeft = ownerLeft || clients[i]->isOwner();
+			closed.push_back(clients[i]);
+			clients.erase(clients.begin() + i);
 		}
+		else
+			i++;
+	}
+	if (!closed.empty())
+		reclaimRing();
+	// the longest connected client takes over
+	if (ownerLeft && !clients.empty())
+	{
+		clients[0]->setOwner(true);
+		cout << "Client " << clients[0]->id() << " (" << clients[0]->peerName() << ") is the owner now" << endl;
+	}
+	int remaining = (int)clients.size();
+	pthread_mutex_unlock(&mutex_clients);
+
+	// joining may take a while, the transmit thread must not wait for it
+	for (size_t i = 0; i < closed.size(); i++)
+		retireClient(closed[i]);
+	return remaining;
+}
+
+void mir_sdr_device::wakeListener()
+{
+#ifndef _WIN32
+	if (listenerWakeupFd < 0)
+		return;
+	// non-blocking: a full pipe wakes the listener anyway
+	char c = 0;
+	ssize_t res = write(listenerWakeupFd, &c, 1);
+	(void)res;
+#endif
+}
+
+/// <summary>
+/// Stops a client, that is no longer in the list, and keeps its counters for the loss summary
+/// </summary>
+void mir_sdr_device::retireClient(client_session* cs)
+{
+	cs->stop();
+	cs->reportStatistics();
+	retiredSentBytes += cs->bytesSent();
+	retiredQueueDrops += cs->droppedBlocks();
+	retiredStalls += cs->sendStalls();
+	retiredBlockedUs += cs->blockedMicros();
+	retiredPartialWrites += cs->partialWrites();
+	cs->mergeLatency(retiredSelectLatency, retiredSendLatency);
+	delete cs;
+}
+
+int mir_sdr_device::numClients()
+{
+	pthread_mutex_lock(&mutex_clients);
+	int n = (int)clients.size();
+	pthread_mutex_unlock(&mutex_clients);
+	return n;
+}
+
+void mir_sdr_device::reportCompression(const char* reason) const
+{
+	long long blocks = codecBlocks.load();
+	if (blocks == 0)
+		return;
+	long long raw = codecRawBytes.load();
+	long long coded = codecBytes.load();
+	long long ns = codecNs.load();
+	char s[160];
+	snprintf(s, sizeof(s), "%s: compression ratio %.2f, %.1f us per block, %.1f ns per sample, %lld blocks",
+		reason, (double)raw / coded, ns / 1000.0 / blocks, ns / (raw / 4.0), blocks);
+	cout << s << endl;
+}
+
+/// <summary>
+/// One line with the losses of the session, from the API to the sockets of all clients
+/// </summary>
+void mir_sdr_device::reportLosses(const char* reason)
+{
+	unsigned long long queueDrops = retiredQueueDrops;
+	unsigned long long stalls = retiredStalls;
+	unsigned long long blockedUs = retiredBlockedUs;
+	unsigned long long partialWrites = retiredPartialWrites;
+	pthread_mutex_lock(&mutex_clients);
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		queueDrops += clients[i]->droppedBlocks();
+		stalls += clients[i]->sendStalls();
+		blockedUs += clients[i]->blockedMicros();
+		partialWrites += clients[i]->partialWrites();
+	}
+	pthread_mutex_unlock(&mutex_clients);
+	char s[320];
+	snprintf(s, sizeof(s), "%s: API gaps %llu (%llu samples), server discards %llu (%llu samples), "
+		"client queue drops %llu blocks, send stalls %llu (%llu ms blocked), partial writes %llu, "
+		"resets %u, HW removed %u",
+		reason, apiGaps.load(), apiGapSamples.load(), discards.load(), discardedSamples.load(),
+		queueDrops, stalls, blockedUs / 1000, partialWrites, resets.load(), hwRemovals.load());
+	cout << s << endl;
+}
+
+/// <summary>
+/// Reads the counters, only the list of the clients is locked for it
+/// </summary>
+void mir_sdr_device::readMetrics(device_metrics& m)
+{
+	m.serial = serno;
+	m.name = DevNm;
+	m.hwVersion = hwVer;
+	m.available = devAvail ? 1 : 0;
+	m.streaming = started && isStreaming ? 1 : 0;
+	m.frequencyHz = publishedFrequencyHz;
+	m.gainReductionDb = publishedGainReduction;
+	m.samplingRateHz = publishedSamplingRateHz;
+	m.callbacks = (double)callbacks.load(std::memory_order_relaxed);
+	m.samples = (double)streamedSamples.load(std::memory_order_relaxed);
+	m.apiGaps = (double)apiGaps.load(std::memory_order_relaxed);
+	m.apiGapSamples = (double)apiGapSamples.load(std::memory_order_relaxed);
+	m.discardedSamples = (double)discardedSamples.load(std::memory_order_relaxed);
+	m.ringDroppedBlocks = (double)ring.droppedBlocks();
+	m.resets = resets;
+	m.hwRemovals = hwRemovals;
+
+	unsigned long long sentBytes = retiredSentBytes;
+	unsigned long long queueDrops = retiredQueueDrops;
+	unsigned long long stalls = retiredStalls;
+	unsigned long long blockedUs = retiredBlockedUs;
+	unsigned long long partialWrites = retiredPartialWrites;
+	pthread_mutex_lock(&mutex_clients);
+	m.clients = (double)clients.size();
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		sentBytes += clients[i]->bytesSent();
+		queueDrops += clients[i]->droppedBlocks();
+		stalls += clients[i]->sendStalls();
+		blockedUs += clients[i]->blockedMicros();
+		partialWrites += clients[i]->partialWrites();
+	}
+	pthread_mutex_unlock(&mutex_clients);
+	m.sentBytes = (double)sentBytes;
+	m.clientDroppedBlocks = (double)queueDrops;
+	m.sendStalls = (double)stalls;
+	m.sendBlockedSeconds = blockedUs / 1e6;
+	m.partialWrites = (double)partialWrites;
+
+	latency_histogram* select = new latency_histogram();
+	latency_histogram* send = new latency_histogram();
+	mergeSendLatency(*select, *send);
+	const latency_histogram* h[] = { &callbackLatency, &callbackJitter, &conversionLatency, select, send };
+	const char* path[] = { "callback", "callback_jitter", "conversion", "select", "send" };
+	m.latencies.clear();
+	for (int i = 0; i < 5; i++)
+	{
+		device_metrics::latency l = { path[i], (double)h[i]->count(), h[i]->sum() / 1e9,
+			h[i]->percentile(0.5) / 1e9, h[i]->percentile(0.99) / 1e9, h[i]->percentile(0.999) / 1e9, h[i]->max() / 1e9 };
+		m.latencies.push_back(l);
 	}
-	return buf;
+	delete select;
+	delete send;
+}
+
+/// <summary>
+/// Adds the latencies of the transmit threads of all clients, also of those, that have left
+/// </summary>
+void mir_sdr_device::mergeSendLatency(latency_histogram& select, latency_histogram& send)
+{
+	select.merge(retiredSelectLatency);
+	send.merge(retiredSendLatency);
+	pthread_mutex_lock(&mutex_clients);
+	for (size_t i = 0; i < clients.size(); i++)
+		clients[i]->mergeLatency(select, send);
+	pthread_mutex_unlock(&mutex_clients);
+}
+
+/// <summary>
+/// Percentiles of the latencies of the stream path, one line each
+/// </summary>
+void mir_sdr_device::reportLatency(const char* reason)
+{
+	if (callbackLatency.count() == 0)
+		return;
+	latency_histogram* select = new latency_histogram();
+	latency_histogram* send = new latency_histogram();
+	mergeSendLatency(*select, *send);
+	cout << reason << ": callback " << callbackLatency.summary() << endl;
+	cout << reason << ": callback jitter " << callbackJitter.summary() << endl;
+	cout << reason << ": conversion " << conversionLatency.summary() << endl;
+	cout << reason << ": select " << select->summary() << endl;
+	cout << reason << ": send " << send->summary() << endl;
+	delete select;
+	delete send;
+}
+
+/// <summary>
+/// Receive thread: makes the commanded values readable for the metrics
+/// </summary>
+void mir_sdr_device::publishSettings()
+{
+	publishedFrequencyHz = currentFrequencyHz;
+	publishedGainReduction = gainReduction;
+	publishedSamplingRateHz = outputSamplingRateHz;
+}
+
+void mir_sdr_device::reportRingStatistics(const char* reason) const
+{
+	cout << reason << ": ring fill " << ring.fillLevel() << "/" << ring.capacity()
+		<< " blocks, high-water " << ring.highWaterMark()
+		<< ", dropped " << ring.droppedBlocks() << " blocks" << endl;
 }
 
 
@@ -184,70 +1021,479 @@ void streamCallback(short *xi, short *xq, unsigned int firstSampleNum,
 	int grChanged, int rfChanged, int fsChanged, unsigned int numSamples,
 	unsigned int reset, unsigned int hwRemoved, void *cbContext)
 {
+	mir_sdr_device* md = (mir_sdr_device*)cbContext;
 	if (hwRemoved)
 	{
+		md->hwRemovals++;
 		cout << " !!! HW removed !!!" << endl;
 		return;
 	}
 	if (reset)
 	{
+		md->resets++;
 		cout << " !!! reset !!!" << endl;
 		return;
 	}
 
-	mir_sdr_device* md = (mir_sdr_device*)cbContext;
-	try
+	if (!md->isStreaming || !md->txRunning)
+		return;
+	// the samples of a rate change, while the resampler is reconfigured
+	md->callbacksActive++;
+	if (md->callbacksHeld)
+	{
+		md->callbacksActive--;
+		return;
+	}
+	md->callbacks.fetch_add(1, std::memory_order_relaxed);
+
+	long long t0 = common::monotonicNanos();
+	if (md->lastCallbackNs != 0 && md->currentSamplingRateHz > 0)
+	{
+		long long expectedNs = (long long)(numSamples * 1e9 / md->currentSamplingRateHz);
+		long long deviation = t0 - md->lastCallbackNs - expectedNs;
+		md->callbackJitter.record(deviation < 0 ? -deviation : deviation);
+	}
+	md->lastCallbackNs = t0;
+	long long now = t0 / 1000;
+	md->callbackIntervalUs = now - md->lastCallbackUs;
+	md->lastCallbackUs = now;
+
+	int flags = (grChanged ? FRAME_GAIN_CHANGED : 0) | (rfChanged ? FRAME_RF_CHANGED : 0) | (fsChanged ? FRAME_FS_CHANGED : 0);
+	long long timeNs = common::realtimeNanos();
+	// resampling, the resampler thread follows the format and the sample numbers
+	if (!md->resampling)
+	{
+		md->applyRequestedFormat();
+		md->trackSamples(firstSampleNum, numSamples, flags, timeNs);
+	}
+	if (md->correction.isActive())
 	{
-		if (!md->isStreaming)
+		if (grChanged || rfChanged || fsChanged)
+			md->correction.retune();
+		for (unsigned int done = 0; done < numSamples; )
 		{
-			return;
+			int n = numSamples - done;
+			if (n > iq_correction::c_maxChunk)
+				n = iq_correction::c_maxChunk;
+			md->correction.process(xi + done, xq + done, n);
+			md->resample(md->correction.outputI(), md->correction.outputQ(), n,
+				firstSampleNum + done, done == 0 ? flags : 0, now, timeNs);
+			done += n;
 		}
-		//In case of a socket error, dont process the data for one second
-		if (md->cbksPerSecond-- > 0)
+	}
+	else
+		md->resample(xi, xq, numSamples, firstSampleNum, flags, now, timeNs);
+	md->callbackLatency.record(common::monotonicNanos() - t0);
+	md->callbacksActive--;
+}
+
+/// <summary>
+/// Holds the stream callbacks: returns, when the running one has finished,
+/// the following ones drop their samples until releaseCallbacks
+/// </summary>
+void mir_sdr_device::holdCallbacks()
+{
+	callbacksHeld = true;
+	while (callbacksActive > 0)
+		usleep(100);
+}
+
+/// <summary>
+/// Callback: the samples at the rate of the device. Resampling, they are only copied to the
+/// resampler thread; a full ring drops them, the thread finds the gap in the sample numbers
+/// </summary>
+void mir_sdr_device::resample(const short* xi, const short* xq, unsigned int numSamples,
+	unsigned int firstSampleNum, int flags, long long now, long long timeNs)
+{
+	if (!resampling)
+	{
+		writeSamples(xi, xq, numSamples, now);
+		return;
+	}
+	while (numSamples > 0)
+	{
+		sample_ring::block* b = resampleRing.acquire();
+		if (b == 0)
 		{
-			if (!md->cbkTimerStarted)
-			{
-				md->cbkTimerStarted = true;
-				cout << "Discarding samples for one second\n";
-			}
+			resampleDropped = true;	// counted as dropped
 			return;
 		}
-		else if (md->cbkTimerStarted)
+		int n = (b->capacity - (int)sizeof(resample_chunk)) / 4;
+		if ((unsigned int)n > numSamples)
+			n = numSamples;
+		resample_chunk c = { firstSampleNum, flags | (resampleDropped ? FRAME_DROPPED : 0), n, 0, now, timeNs };
+		memcpy(b->data, &c, sizeof(c));
+		short* out = (short*)(b->data + sizeof(c));
+		memcpy(out, xi, n * sizeof(short));
+		memcpy(out + n, xq, n * sizeof(short));
+		b->length = (int)sizeof(c) + 4 * n;
+		resampleRing.commit();
+		resampleDropped = false;
+		xi += n;
+		xq += n;
+		numSamples -= n;
+		firstSampleNum += n;
+		flags = 0;
+	}
+}
+
+/// <summary>
+/// Resampler thread: resamples the blocks of the callback and converts them into the ring,
+/// as the callback does without resampling
+/// </summary>
+void* resampleWork(void* p)
+{
+	mir_sdr_device* md = (mir_sdr_device*)p;
+	for (;;)
+	{
+		sample_ring::block* b = md->resampleRing.peek(100);
+		if (b == 0)
+		{
+			// stopped, when the blocks queued before are done
+			if (!md->resampling)
+				break;
+			continue;
+		}
+		mir_sdr_device::resample_chunk c;
+		memcpy(&c, b->data, sizeof(c));
+		const short* xi = (const short*)(b->data + sizeof(c));
+		const short* xq = xi + c.numSamples;
+		md->applyRequestedFormat();
+		md->trackSamples(c.firstSampleNum, c.numSamples, c.flags, c.timeNs);
+		for (int done = 0; done < c.numSamples; )
+		{
+			int n = c.numSamples - done;
+			if (n > iq_resampler::c_maxChunk)
+				n = iq_resampler::c_maxChunk;
+			int m = md->resampler.process(xi + done, xq + done, n);
+			done += n;
+			md->writeSamples(md->resampler.outputI(), md->resampler.outputQ(), m, c.now);
+		}
+		md->resampleRing.release();
+	}
+	return 0;
+}
+
+/// <summary>
+/// Callback or resampler thread: follows the sample numbers of the API. Skipped samples advance
+/// the index of the output by as many samples, as the resampler would have made of them.
+/// With FRAME_DROPPED, the gap was dropped on the way to the resampler, not by the API
+/// </summary>
+void mir_sdr_device::trackSamples(unsigned int firstSampleNum, unsigned int numSamples, int flags, long long timeNs)
+{
+	if (haveSampleNum && firstSampleNum != nextSampleNum)
+	{
+		unsigned int gap = firstSampleNum - nextSampleNum;
+		bool dropped = (flags & FRAME_DROPPED) != 0;
+		// a restart of the numbering is a gap of unknown length
+		if (gap < 0x80000000u)
+		{
+			unsigned long long skipped = (unsigned long long)(gap * resampler.ratio() + 0.5);
+			outIndex += skipped;
+			if (dropped)
+				discardedSamples.fetch_add(skipped, std::memory_order_relaxed);
+			else
+				apiGapSamples.fetch_add(gap, std::memory_order_relaxed);
+		}
+		if (dropped)
+			discards.fetch_add(1, std::memory_order_relaxed);
+		else
+		{
+			apiGaps.fetch_add(1, std::memory_order_relaxed);
+			flags |= FRAME_API_GAP;
+		}
+	}
+	haveSampleNum = true;
+	nextSampleNum = firstSampleNum + numSamples;
+	frameFlags |= flags;
+	frameTimeNs = timeNs;
+}
+
+/// <summary>
+/// Callback: the ring is full, numSamples output samples are discarded
+/// </summary>
+void mir_sdr_device::dropSamples(unsigned int numSamples)
+{
+	frameFlags |= FRAME_DROPPED;
+	discards.fetch_add(1, std::memory_order_relaxed);
+	discardedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Callback: the header of a frame, little endian. Consumes the collected flags
+/// </summary>
+void mir_sdr_device::writeFrameHeader(BYTE* out, unsigned int numSamples, unsigned int payloadBytes,
+	unsigned long long firstSample, long long timeNs)
+{
+	stream_frame::write(out, format, frameFlags, numSamples, payloadBytes, firstSample, timeNs);
+	frameFlags = 0;
+}
+
+void mir_sdr_device::writeSamples(const short* xi, const short* xq, unsigned int numSamples, long long now)
+{
+	if (channels != 0)
+		channels->push(xi, xq, numSamples);
+	if (spectrum != 0)
+		spectrum->push(xi, xq, numSamples);
+	if (recorder != 0)
+		recorder->push(xi, xq, numSamples);
+	if (isStaged(format))
+		writeStaged(xi, xq, numSamples, now);
+	else
+		writePacket(xi, xq, numSamples, now);
+	outIndex += numSamples;
+	streamedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Callback: the open block, with at least minBytes free, a new one is taken from the ring if needed.
+/// Returns 0, if the ring is full
+/// </summary>
+sample_ring::block* mir_sdr_device::reserveBlock(int minBytes, long long now)
+{
+	if (openBlock != 0 && openBlock->capacity - openBlock->length < minBytes)
+	{
+		ring.commit();
+		openBlock = 0;
+	}
+	if (openBlock == 0)
+	{
+		openBlock = ring.acquire();
+		if (openBlock == 0)
+			return 0;	// ring full, the block is counted as dropped
+		openBlock->tag = formatTag;
+		openBlockUs = now;
+	}
+	return openBlock->capacity - openBlock->length >= minBytes ? openBlock : 0;
+}
+
+/// <summary>
+/// Callback: commits the open block, when it is full enough or when the next
+/// packet would exceed the latency budget
+/// </summary>
+void mir_sdr_device::finishBlock(int minBytes, long long now)
+{
+	sample_ring::block* b = openBlock;
+	bool late = now - openBlockUs + callbackIntervalUs.load(std::memory_order_relaxed) >= maxLatencyUs;
+	if (late || b->length >= coalesceBytes || b->capacity - b->length < minBytes)
+	{
+		ring.commit();
+		openBlock = 0;
+	}
+}
+
+/// <summary>
+/// Callback, interleaved formats.
+/// Only convert into the ring, never wait for the network here.
+/// Packets are appended to the open block until the coalescing threshold
+/// or the latency budget is reached; a packet not fitting is split.
+/// </summary>
+void mir_sdr_device::writePacket(const short* xi, const short* xq, unsigned int numSamples, long long now)
+{
+	const int spu = samplesPerUnit(format);
+	const int bpu = bytesPerUnit(format);
+	// framed: every part written in one piece gets its header
+	const int hb = framed ? c_frameHeaderBytes : 0;
+	unsigned int done = 0;
+	if (hasCarry && numSamples > 0)
+	{
+		short pi[2] = { carryI, xi[0] };
+		short pq[2] = { carryQ, xq[0] };
+		hasCarry = false;
+		done = 1;
+		sample_ring::block* b = reserveBlock(hb + bpu, now);
+		if (b == 0)
 		{
-			md->cbkTimerStarted = false;
-		} 
-		if (md->remoteClient == INVALID_SOCKET)
+			dropSamples(numSamples + 1);	// with the carried one
 			return;
+		}
+		if (framed)
+		{
+			writeFrameHeader(b->data + b->length, 2, bpu, outIndex - 1, frameTimeNs);
+			b->length += hb;
+		}
+		long long t0 = common::monotonicNanos();
+		b->length += mergeIQ(pi, pq, 2, b->data + b->length);
+		conversionLatency.record(common::monotonicNanos() - t0);
+		finishBlock(hb + bpu, now);
+	}
+	while (numSamples - done >= (unsigned int)spu)
+	{
+		sample_ring::block* b = reserveBlock(hb + bpu, now);
+		if (b == 0)
+		{
+			dropSamples(numSamples - done);
+			return;	// the rest of the packet is dropped
+		}
+		int n = (numSamples - done) / spu;
+		int room = (b->capacity - b->length - hb) / bpu;
+		if (n > room)
+			n = room;
+		if (framed)
+		{
+			writeFrameHeader(b->data + b->length, n * spu, n * bpu, outIndex + done, frameTimeNs);
+			b->length += hb;
+		}
+		n *= spu;
+		long long t0 = common::monotonicNanos();
+		b->length += mergeIQ(xi + done, xq + done, n, b->data + b->length);
+		conversionLatency.record(common::monotonicNanos() - t0);
+		done += n;
+		finishBlock(hb + bpu, now);
+	}
+	if (done < numSamples)
+	{
+		hasCarry = true;
+		carryI = xi[done];
+		carryQ = xq[done];
+	}
+}
+
+/// <summary>
+/// Callback, planar and compressed formats: packets are staged, every complete
+/// block is converted into the ring as a whole
+/// </summary>
+void mir_sdr_device::writeStaged(const short* xi, const short* xq, unsigned int numSamples, long long now)
+{
+	const int blockBytes = stagedBlockBytes(format, stageSamples, mantissaBits);
+	const int hb = framed ? c_frameHeaderBytes : 0;
+	unsigned int done = 0;
+	while (done < numSamples)
+	{
+		if (stageFill == 0)
+		{
+			stageIndex = outIndex + done;
+			stageTimeNs = frameTimeNs;
+		}
+		int n = numSamples - done;
+		if (n > stageSamples - stageFill)
+			n = stageSamples - stageFill;
+		memcpy(&stageI[stageFill], xi + done, n * sizeof(short));
+		memcpy(&stageQ[stageFill], xq + done, n * sizeof(short));
+		stageFill += n;
+		done += n;
+		if (stageFill < stageSamples)
+			break;
 
-		int buflen = 0;
-		BYTE* buf = md->mergeIQ(xi, xq, numSamples, buflen);
-		int remaining = buflen;
-		int sent = 0;
-		while (remaining > 0)
+		stageFill = 0;
+		sample_ring::block* b = reserveBlock(hb + blockBytes, now);
+		if (b == 0)
 		{
-			fd_set writefds;
-			struct timeval tv= {1,0};
-			FD_ZERO(&writefds);
-			FD_SET(md->remoteClient, &writefds);
-			int res  = select(md->remoteClient+1, NULL, &writefds, NULL, &tv);
-			if (res > 0)
+			dropSamples(stageSamples);
+			continue;	// dropped as a whole, the client stays in step
+		}
+		BYTE* header = b->data + b->length;
+		b->length += hb;
+		const int start = b->length;
+		long long tc = common::monotonicNanos();
+		if (format == FORMAT_CS16_LOSSLESS)
+		{
+			long long t0 = common::monotonicNanos();
+			int length = iq_compress::encode(&stageI[0], &stageQ[0], stageSamples, b->data + b->length);
+			b->length += length;
+			codecNs.fetch_add(common::monotonicNanos() - t0, std::memory_order_relaxed);
+			codecBlocks.fetch_add(1, std::memory_order_relaxed);
+			codecRawBytes.fetch_add(stageSamples * 4, std::memory_order_relaxed);
+			codecBytes.fetch_add(length, std::memory_order_relaxed);
+		}
+		else if (format == FORMAT_BFP)
+			b->length += iq_bfp::encode(&stageI[0], &stageQ[0], stageSamples, mantissaBits, b->data + b->length);
+		else
+		{
+			mergePlanar(&stageI[0], &stageQ[0], stageSamples, b->data + b->length);
+			b->length += blockBytes;
+		}
+		conversionLatency.record(common::monotonicNanos() - tc);
+		if (framed)
+			writeFrameHeader(header, stageSamples, b->length - start, stageIndex, stageTimeNs);
+		finishBlock(hb + blockBytes, now);
+	}
+}
+
+/// <summary>
+/// Transmit thread, distributes the ring to the queues of the clients
+/// </summary>
+void* distribute(void* p)
+{
+	mir_sdr_device* md = (mir_sdr_device*)p;
+	cout << "**** transmit thread entered.  *****" << endl;
+	cout << "Transmit mode: " << sample_sender::modeName(md->txMode) << endl;
+
+	unsigned long long reportedDrops = 0;
+	time_t lastReport = 0;
+	time_t lastCodecReport = time(NULL);
+	time_t lastLossReport = time(NULL);
+	try
+	{
+		while (md->txRunning)
+		{
+			// lent to a single client, the ring is not read here
+			sample_ring::block* b = md->ringLent ? 0 : md->ring.peek(100);
+			if (b == 0 && md->ringLent)
+				usleep(10000);
+			if (b != 0)
 			{
-				sent = send(md->remoteClient, (const char*)buf + (buflen - remaining), remaining, 0);
-				remaining -= sent;
+				pthread_mutex_lock(&md->mutex_clients);
+				// the ring has been resized: the client queues follow
+				if (b->capacity != md->queueBlockSize)
+				{
+					md->queueBlockSize = b->capacity;
+					md->queueBlocks = md->ring.capacity();
+					for (size_t i = 0; i < md->clients.size(); i++)
+						md->clients[i]->resize(md->queueBlocks, md->queueBlockSize);
+				}
+				for (size_t i = 0; i < md->clients.size(); i++)
+				{
+					int ms = md->clients[i]->takeReplayRequest();
+					if (ms >= 0)
+						md->replayHistory(md->clients[i], ms);
+					md->clients[i]->deliver(b->data, b->length, md->kickMs);
+				}
+				// the history is of one format: the joining clients are told that one
+				if (b->tag != md->historyTag)
+				{
+					md->history.clear();
+					md->historyTag = b->tag;
+				}
+				md->history.append(b->data, b->length, common::monotonicNanos());
+				pthread_mutex_unlock(&md->mutex_clients);
+				md->ring.release();
 			}
-			else
+
+			// report overflows, at most once per second
+			unsigned long long drops = md->ring.droppedBlocks();
+			if (drops != reportedDrops && time(NULL) != lastReport)
+			{
+				md->reportRingStatistics("Ring overflow");
+				reportedDrops = drops;
+				lastReport = time(NULL);
+			}
+			if (time(NULL) - lastCodecReport >= 10)
+			{
+				md->reportCompression("Compression");
+				lastCodecReport = time(NULL);
+			}
+			if (md->lossReportSec > 0 && time(NULL) - lastLossReport >= md->lossReportSec)
 			{
-				md->cbksPerSecond = md->currentSamplingRateHz / numSamples; //1 sec "timer" in the error case. assumed this does not change frequently
-				delete[] buf;
-				throw msg_exception("socket error " + to_string(errno));
+				md->reportLosses("Losses");
+				lastLossReport = time(NULL);
 			}
+			if (mir_sdr_device::latencyReportRequested.exchange(false))
+				md->reportLatency("Latency");
+
+			pthread_mutex_lock(&md->mutex_clients);
+			md->lendRing();
+			pthread_mutex_unlock(&md->mutex_clients);
 		}
-		delete[] buf;
 	}
 	catch (exception& e)
 	{
-		cout << "Error in streaming callback :" << e.what() <<  endl;
+		cout << "Error in transmit :" << e.what() << endl;
 	}
+	// the callback stops producing, when the consumer is gone
+	md->txRunning = false;
+	cout << "**** Tx thread terminating. ****" << endl;
+	return 0;
 }
 
 void gainChangeCallback(unsigned int gRdB, unsigned int lnaGRdB, void* cbContext)
@@ -255,20 +1501,42 @@ void gainChangeCallback(unsigned int gRdB, unsigned int lnaGRdB, void* cbContext
 	// do nothing...
 }
 
-
-int getCommandAndValue(char* rxBuf, int& value)
+void mir_sdr_device::pushCommands(const char* cmds, int count)
 {
-	BYTE valbuf[4];
-	int cmd = rxBuf[0];
-	memcpy( valbuf, rxBuf + 1,4);
+	pthread_mutex_lock(&mutex_commands);
+	for (int i = 0; i < count; i++)
+		commands.push_back(string(cmds + 5 * i, 5));
+	pthread_cond_signal(&commands_cond);
+	pthread_mutex_unlock(&mutex_commands);
+}
 
-	if (common::isLittleEndian())
-		value = valbuf[3] + valbuf[2] * 0x100 + valbuf[1] * 0x10000 + valbuf[0] * 0x1000000;
-	else
-		value = valbuf[0] + valbuf[1] * 0x100 + valbuf[2] * 0x10000 + valbuf[3] * 0x1000000;
-	return cmd;
+void mir_sdr_device::closeCommands()
+{
+	pthread_mutex_lock(&mutex_commands);
+	commandsClosed = true;
+	pthread_cond_signal(&commands_cond);
+	pthread_mutex_unlock(&mutex_commands);
 }
 
+/// <summary>
+/// Waits for a command, then takes all the commands queued, the receive thread applies them as one batch
+/// </summary>
+void mir_sdr_device::readCommands(std::vector<std::string>& batch)
+{
+	batch.clear();
+	pthread_mutex_lock(&mutex_commands);
+	while (commands.empty() && !commandsClosed)
+		pthread_cond_wait(&commands_cond, &mutex_commands);
+	bool closed = commands.empty();
+	while (!commands.empty())
+	{
+		batch.push_back(commands.front());
+		commands.pop_front();
+	}
+	pthread_mutex_unlock(&mutex_commands);
+	if (closed)
+		throw msg_exception("Socket closed");
+}
 
 /// <summary>
 /// Receive thread, to process commands
@@ -295,6 +1563,15 @@ void* receive(void* p)
 
 		// ha: initialize directly to desired samplingConfig
 		md->currentSamplingRateHz = md->samplingConfigs[md->initSamplingConfigIdx].samplingRateHz;
+		md->deviceRateHz = md->samplingConfigs[md->initSamplingConfigIdx].deviceSamplingRateHz;
+		md->configureResampler(md->initSamplingConfigIdx);
+		md->correction.setRate((int)md->currentSamplingRateHz);
+		if (md->channels != 0)
+			md->channels->start(md->outputSamplingRateHz);
+		if (md->spectrum != 0)
+			md->spectrum->start(md->outputSamplingRateHz, md->currentFrequencyHz);
+		if (md->recorder != 0)
+			md->recorder->start(md->outputSamplingRateHz, md->currentFrequencyHz, md->gainReduction);
 
 		int smplsPerPacket;
 
@@ -312,7 +1589,9 @@ void* receive(void* p)
 			md);
 
 		// ha: detailed output - including samplerate and bandwidth
-		cout << "\nmir_sdr_StreamInit(bw " << md->samplingConfigs[md->initSamplingConfigIdx].bandwidth << " , srate " << md->currentSamplingRateHz << ") returned with: " << errInit << endl;
+		cout << "\nmir_sdr_StreamInit(bw " << md->samplingConfigs[md->initSamplingConfigIdx].bandwidth << " , srate " << md->deviceRateHz << ") returned with: " << errInit << endl;
+		if (errInit == mir_sdr_Success)
+			md->configureRing(smplsPerPacket);
 
 		// disable DC offset and IQ imbalance correction (default is for these to be enabled  this
 		// just show how to disable if required)
@@ -371,6 +1650,7 @@ void* receive(void* p)
 				cout << "Decimation Factor set to  " << decimationFactor << endl;
 			}
 		}
+		md->publishSettings();
 	}
 	catch (const std::exception& )
 	{
@@ -381,60 +1661,90 @@ void* receive(void* p)
 	try
 	{
 		char rxBuf[16];
+		std::vector<std::string> batch;
 		for (;;)
 		{
 			const int cmd_length = 5;
-			memset(rxBuf, 0, 16);
-			int remaining = cmd_length;
-
-			while (remaining > 0)
+			// everything, that arrived while the last batch was applied.
+			// Frequency, gain and sampling rate are collected, the last one of each wins,
+			// and applied together before the next other command, see applyTunerChange
+			md->readCommands(batch);
+			mir_sdr_device::tuner_change tc;
+			for (size_t i = 0; i < batch.size(); i++)
 			{
-				int rcvd = recv(md->remoteClient, rxBuf + (cmd_length - remaining), remaining, 0); //read 5 bytes (cmd + value)
-				remaining -= rcvd;
-
-				if (rcvd  == 0)
-					throw msg_exception("Socket closed");
-				if (rcvd == SOCKET_ERROR )
-					throw msg_exception("Socket error");
-			}
-
-			int value = 0; // out parameter
-			int cmd = getCommandAndValue(rxBuf,  value);
-
-			// The ids of the commands are defined in rtl_tcp, the names had been inserted here
-			// for better readability
-			switch (cmd)
-			{
-			case mir_sdr_device::CMD_SET_FREQUENCY: //set frequency
-													  //value is freq in Hz
-				err = md->setFrequency(value);
-				break;
-
-			case (int)mir_sdr_device::CMD_SET_SAMPLINGRATE:
-				err = md->setSamplingRate(value);//value is sr in Hz
-				break;
-
-			case (int)mir_sdr_device::CMD_SET_FREQUENCYCORRECTION: //value is ppm correction
-				md->setFrequencyCorrection(value);
-				break;
-
-			case (int)mir_sdr_device::CMD_SET_TUNER_GAIN_BY_INDEX:
-				//value is gain value between 0 and 100
-				err = md->setGain(value);
-				break;
-
-			case (int)mir_sdr_device::CMD_SET_AGC_MODE:
-				err = md->setAGC(value != 0);
-				break;
-
-			case (int)mir_sdr_device::CMD_SET_RSP2_ANTENNA_CONTROL:
-				md->setAntenna(value);
-				break;
-			default:
-				printf("Unknown Command; 0x%x 0x%x 0x%x 0x%x 0x%x\n",
-					rxBuf[0], rxBuf[1], rxBuf[2], rxBuf[3], rxBuf[4]);
-				break;
+				memset(rxBuf, 0, 16);
+				memcpy(rxBuf, batch[i].data(), cmd_length);
+
+				int value = 0; // out parameter
+				int cmd = getCommandAndValue(rxBuf,  value);
+				// the tuner commands before any other one are applied first, in the order of the client
+				bool tunerCommand = cmd == mir_sdr_device::CMD_SET_FREQUENCY || cmd == mir_sdr_device::CMD_SET_SAMPLINGRATE
+					|| cmd == mir_sdr_device::CMD_SET_TUNER_GAIN_BY_INDEX;
+				if (!tunerCommand && tc.commands > 0)
+				{
+					err = md->applyTunerChange(tc);
+					tc = mir_sdr_device::tuner_change();
+				}
+
+				// The ids of the commands are defined in rtl_tcp, the names had been inserted here
+				// for better readability
+				switch (cmd)
+				{
+				case mir_sdr_device::CMD_SET_FREQUENCY: //set frequency
+														  //value is freq in Hz
+					tc.frequency = true;
+					tc.frequencyHz = value;
+					tc.commands++;
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_SAMPLINGRATE:
+					tc.rate = true;
+					tc.rateHz = value;//value is sr in Hz
+					tc.commands++;
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_FREQUENCYCORRECTION: //value is ppm correction
+					md->setFrequencyCorrection(value);
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_TUNER_GAIN_BY_INDEX:
+					//value is gain value between 0 and 100
+					tc.gain = true;
+					tc.gainValue = value;
+					tc.commands++;
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_AGC_MODE:
+					err = md->setAGC(value != 0);
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_RSP2_ANTENNA_CONTROL:
+					md->setAntenna(value);
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_SAMPLE_FORMAT:
+					md->setSampleFormat(value);
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_BFP_MANTISSA:
+					md->setMantissaBits(value);
+					break;
+
+				case (int)mir_sdr_device::CMD_SET_FRAMING:
+					md->setFraming(value);
+					break;
+
+				case (int)mir_sdr_device::CMD_REPLAY_HISTORY:
+					cout << "History replay is served by the threaded network backend only" << endl;
+					break;
+				default:
+					printf("Unknown Command; 0x%x 0x%x 0x%x 0x%x 0x%x\n",
+						rxBuf[0], rxBuf[1], rxBuf[2], rxBuf[3], rxBuf[4]);
+					break;
+				}
 			}
+			err = md->applyTunerChange(tc);
+			md->publishSettings();
 		}
 	}
 	catch (exception& e)
@@ -501,22 +1811,128 @@ mir_sdr_ErrT mir_sdr_device::setGain(int value)
 		cout << "SetGr failed with requested value: " << 100-value << endl;
 	}
 	else
+	{
 		cout << "SetGr succeeded with requested value: " << 100-value << endl;
+		gainChanged(100 - value);
+	}
 
 	return err;
 }
 
-mir_sdr_ErrT mir_sdr_device::setSamplingRate(int requestedSrHz)
+/// <summary>
+/// Applies the frequency, gain and sampling rate of a batch of commands with as few
+/// stream changes as possible: all of them together are one mir_sdr_Reinit,
+/// a single frequency or gain takes its own call
+/// </summary>
+mir_sdr_ErrT mir_sdr_device::applyTunerChange(const tuner_change& c)
 {
-	mir_sdr_ErrT err = stream_Uninit();
-	if (err != mir_sdr_Success)
-		return err;
+	bool frequency = c.frequency && c.frequencyHz != currentFrequencyHz;
+	bool gain = c.gain && 100 - c.gainValue != gainReduction;
+	bool rate = c.rate && c.rateHz != outputSamplingRateHz;
+	if (c.commands > 1)
+		cout << "\n" << c.commands << " tuner commands coalesced:" << (frequency ? " frequency" : "")
+			<< (gain ? " gain" : "") << (rate ? " sampling rate" : "") << endl;
+	if (rate && getSamplingConfigurationTableIndex(c.rateHz) < 0)
+		rate = false;
+
+	if (rate)
+		return setSamplingRate(c.rateHz, frequency ? c.frequencyHz : currentFrequencyHz,
+			gain ? 100 - c.gainValue : gainReduction,
+			(mir_sdr_ReasonForReinitT)((frequency ? mir_sdr_CHANGE_RF_FREQ : 0) | (gain ? mir_sdr_CHANGE_GR : 0)));
+	if (frequency && gain)
+		return reinit_Tuner(c.frequencyHz, 100 - c.gainValue,
+			(mir_sdr_ReasonForReinitT)(mir_sdr_CHANGE_RF_FREQ | mir_sdr_CHANGE_GR));
+	if (frequency)
+		return setFrequency(c.frequencyHz);
+	if (gain)
+		return setGain(c.gainValue);
+	return mir_sdr_Success;
+}
 
+void mir_sdr_device::frequencyChanged(int valueHz)
+{
+	currentFrequencyHz = valueHz;
+	if (spectrum != 0)
+		spectrum->setFrequency(valueHz);
+	if (recorder != 0)
+		recorder->setFrequency(valueHz);
+}
+
+void mir_sdr_device::gainChanged(int gainReductionDb)
+{
+	gainReduction = gainReductionDb;
+	if (recorder != 0)
+		recorder->setGainReduction(gainReductionDb);
+}
+
+/// <summary>
+/// Any rate up to the highest one of the table: the cheapest config for it,
+/// the rest is done by the software resampler.
+/// Frequency and gain reduction of the reasons are changed by the same mir_sdr_Reinit,
+/// the stream is only restarted, if the reinit fails
+/// </summary>
+mir_sdr_ErrT mir_sdr_device::setSamplingRate(int requestedSrHz, int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons)
+{
 	int ix = getSamplingConfigurationTableIndex(requestedSrHz);
 	if (ix == -1)
 		return mir_sdr_Fail;
 
-	err = stream_InitForSamplingRate(ix);
+	holdCallbacks();
+	mir_sdr_ErrT err = reinit_Tuner(valueHz, gainReductionDb, reasons, ix);
+	if (err != mir_sdr_Success)
+		err = restartStream(ix, valueHz, gainReductionDb, reasons);
+	if (err == mir_sdr_Success)
+	{
+		outputSamplingRateHz = requestedSrHz;
+		configureResampler(ix);
+		correction.setRate(samplingConfigs[ix].samplingRateHz);
+		correction.retune();
+		if (resampler.isActive())
+			cout << "Output Sampling Rate (Hz): " << outputSamplingRateHz << endl;
+		if (channels != 0)
+			channels->setRate(outputSamplingRateHz);
+		if (spectrum != 0)
+			spectrum->setRate(outputSamplingRateHz);
+		if (recorder != 0)
+			recorder->setRate(outputSamplingRateHz);
+	}
+	releaseCallbacks();
+	return err;
+}
+
+/// <summary>
+/// Fallback of a failed mir_sdr_Reinit: mir_sdr_StreamUninit and mir_sdr_StreamInit
+/// at the config, frequency and gain reduction
+/// </summary>
+mir_sdr_ErrT mir_sdr_device::restartStream(int sampleConfigsTableIndex, int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons)
+{
+	cout << "Restarting the stream" << endl;
+	mir_sdr_ErrT err = stream_Uninit();
+	if (err != mir_sdr_Success)
+		return err;
+
+	// mir_sdr_StreamInit takes them
+	int oldFrequencyHz = currentFrequencyHz;
+	int oldGainReduction = gainReduction;
+	currentFrequencyHz = valueHz;
+	gainReduction = gainReductionDb;
+	err = stream_InitForSamplingRate(sampleConfigsTableIndex);
+	if (err != mir_sdr_Success)
+	{
+		currentFrequencyHz = oldFrequencyHz;
+		gainReduction = oldGainReduction;
+		return err;
+	}
+	if (reasons & mir_sdr_CHANGE_RF_FREQ)
+	{
+		frequencyChanged(valueHz);
+		cout << "Frequency set to (Hz): " << valueHz << endl;
+	}
+	if (reasons & mir_sdr_CHANGE_GR)
+	{
+		gainChanged(gainReduction);
+		cout << "Gain Reduction set to: " << gainReduction << endl;
+	}
 	return err;
 }
 
@@ -529,18 +1945,10 @@ mir_sdr_ErrT mir_sdr_device::setFrequency(int valueHz)
 	{
 	case mir_sdr_Success:
 		break;
+	// the previous update is still pending: the reinit does not wait for it
 	case mir_sdr_RfUpdateError:
-		sleep(0.5f);//wait for the old command to settle
-		err = mir_sdr_SetRf((double)valueHz, 1, 0);
-		cout << "\nmir_sdr_SetRf returned with: " << err << endl;
-		cout << "Frequency setting result: " << err << endl;
-
-		if (err == mir_sdr_OutOfRange || mir_sdr_RfUpdateError)
-			err = reinit_Frequency(valueHz);
-		break;
-
 	case mir_sdr_OutOfRange:
-		err = reinit_Frequency(valueHz);
+		err = reinit_Tuner(valueHz, gainReduction, mir_sdr_CHANGE_RF_FREQ);
 		break;
 	default:
 		break;
@@ -552,38 +1960,76 @@ mir_sdr_ErrT mir_sdr_device::setFrequency(int valueHz)
 	}
 	else
 	{
-		currentFrequencyHz = valueHz;
+		frequencyChanged(valueHz);
 		cout << "Frequency set to (Hz): " << valueHz << endl;
 	}
 	return err;
 }
 
-mir_sdr_ErrT mir_sdr_device::reinit_Frequency(int valueHz)
+/// <summary>
+/// Frequency and / or gain reduction by one mir_sdr_Reinit, reasons are mir_sdr_CHANGE_RF_FREQ and mir_sdr_CHANGE_GR.
+/// With a config, its sampling rate, bandwidth and zero IF are changed by the same call
+/// </summary>
+mir_sdr_ErrT mir_sdr_device::reinit_Tuner(int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons, int sampleConfigsTableIndex)
 {
 	mir_sdr_ErrT err = mir_sdr_Fail;
 
 	int samplesPerPacket;
+	int gr = gainReductionDb;
+	int ix = sampleConfigsTableIndex;
+	int fsHz = deviceRateHz;
+	mir_sdr_Bw_MHzT bandwidth = (mir_sdr_Bw_MHzT)0;//mir_sdr_Bw_MHzT.mir_sdr_BW_1_536,
+	mir_sdr_If_kHzT ifType = (mir_sdr_If_kHzT)0;//mir_sdr_If_kHzT.mir_sdr_IF_Zero,
+	if (ix != -1)
+	{
+		fsHz = samplingConfigs[ix].deviceSamplingRateHz;
+		bandwidth = samplingConfigs[ix].bandwidth;
+		ifType = mir_sdr_IF_Zero;
+		reasons = (mir_sdr_ReasonForReinitT)(reasons | mir_sdr_CHANGE_FS_FREQ | mir_sdr_CHANGE_BW_TYPE | mir_sdr_CHANGE_IF_TYPE);
+	}
 
-	err = mir_sdr_Reinit(&gainReduction,
-		currentSamplingRateHz / 1e6,
+	err = mir_sdr_Reinit(&gr,
+		fsHz / 1e6,
 		(double)valueHz / 1e6,
-		(mir_sdr_Bw_MHzT)0,//mir_sdr_Bw_MHzT.mir_sdr_BW_1_536,
-		(mir_sdr_If_kHzT)0,//mir_sdr_If_kHzT.mir_sdr_IF_Zero,
+		bandwidth,
+		ifType,
 		(mir_sdr_LoModeT)0,//mir_sdr_LoModeT.mir_sdr_LO_Undefined,
 		0,
 		&sys,
 		(mir_sdr_SetGrModeT)0,//mir_sdr_SetGrModeT.mir_sdr_USE_SET_GR,
 		&samplesPerPacket,
-		mir_sdr_CHANGE_RF_FREQ);
-	cout << "\nmir_sdr_Reinit returned with: " << err << endl;
+		reasons);
+	cout << "\nmir_sdr_Reinit(0x" << hex << (int)reasons << dec << ") returned with: " << err << endl;
 	if (err != mir_sdr_Success)
 	{
-		cout << "Requested Frequency (Hz) was: " << valueHz << endl;
+		if (reasons & mir_sdr_CHANGE_RF_FREQ)
+			cout << "Requested Frequency (Hz) was: " << valueHz << endl;
+		if (reasons & mir_sdr_CHANGE_GR)
+			cout << "Requested Gain Reduction was: " << gainReductionDb << endl;
+		if (reasons & mir_sdr_CHANGE_FS_FREQ)
+			cout << "Requested Sampling Rate was: " << samplingConfigs[ix].samplingRateHz << endl;
 	}
 	else
 	{
-		cout << "Frequency set to (Hz): " << valueHz << endl;
-		currentFrequencyHz = valueHz;
+		if (reasons & mir_sdr_CHANGE_RF_FREQ)
+		{
+			cout << "Frequency set to (Hz): " << valueHz << endl;
+			frequencyChanged(valueHz);
+		}
+		if (reasons & mir_sdr_CHANGE_GR)
+		{
+			cout << "Gain Reduction set to: " << gr << endl;
+			gainChanged(gr);
+		}
+		if (reasons & mir_sdr_CHANGE_FS_FREQ)
+		{
+			cout << "Sampling Rate set to (Hz): " << fsHz << endl;
+			currentSamplingRateHz = samplingConfigs[ix].samplingRateHz;
+			deviceRateHz = fsHz;
+		}
+		configureRing(samplesPerPacket);
+		if (reasons & mir_sdr_CHANGE_FS_FREQ)
+			configureDecimation(ix);
 	}
 	return err;
 }
@@ -595,8 +2041,6 @@ mir_sdr_ErrT mir_sdr_device::stream_InitForSamplingRate(int sampleConfigsTableIn
 	mir_sdr_Bw_MHzT bandwidth = samplingConfigs[ix].bandwidth;
 	int reqSamplingRateHz = samplingConfigs[ix].samplingRateHz;
 	int deviceSamplingRateHz = samplingConfigs[ix].deviceSamplingRateHz;
-	unsigned int decimationFactor = samplingConfigs[ix].decimationFactor;
-	unsigned int  doDecimation = samplingConfigs[ix].doDecimation ? 1 : 0;
 
 	mir_sdr_ErrT err = mir_sdr_Fail;
 
@@ -625,28 +2069,43 @@ mir_sdr_ErrT mir_sdr_device::stream_InitForSamplingRate(int sampleConfigsTableIn
 	else
 	{
 		cout << "Sampling Rate set to (Hz): " << deviceSamplingRateHz << endl;
-		currentSamplingRateHz = deviceSamplingRateHz;
-
-		// ha: always configure decimation - also switch it off - in case previously activated
-		if ( !doDecimation )
-			decimationFactor = 1;
-		err = mir_sdr_DecimateControl(doDecimation, decimationFactor, 0);
-		cout << "mir_sdr_DecimateControl returned with: " << err << endl;
-		if (doDecimation == 1)
-		{
-			if (err != mir_sdr_Success)
-			{
-				cout << "Requested Decimation Factor  was: " << decimationFactor << endl;
-			}
-			else
-			{
-				cout << "Decimation Factor set to  " << decimationFactor << endl;
-			}
+		// the callback delivers the decimated rate, the jitter and the ring are measured by it
+		currentSamplingRateHz = reqSamplingRateHz;
+		deviceRateHz = deviceSamplingRateHz;
+		configureRing(samplesPerPacket);
+
+		err = configureDecimation(ix);
+	}
+	return err;
+}
 
+/// <summary>
+/// Decimation of the config, after its sampling rate was set
+/// </summary>
+mir_sdr_ErrT mir_sdr_device::configureDecimation(int sampleConfigsTableIndex)
+{
+	unsigned int decimationFactor = samplingConfigs[sampleConfigsTableIndex].decimationFactor;
+	unsigned int doDecimation = samplingConfigs[sampleConfigsTableIndex].doDecimation ? 1 : 0;
+
+	// ha: always configure decimation - also switch it off - in case previously activated
+	if ( !doDecimation )
+		decimationFactor = 1;
+	mir_sdr_ErrT err = mir_sdr_DecimateControl(doDecimation, decimationFactor, 0);
+	cout << "mir_sdr_DecimateControl returned with: " << err << endl;
+	if (doDecimation == 1)
+	{
+		if (err != mir_sdr_Success)
+		{
+			cout << "Requested Decimation Factor  was: " << decimationFactor << endl;
 		}
 		else
-			cout << "No Decimation applied\n";
+		{
+			cout << "Decimation Factor set to  " << decimationFactor << endl;
+		}
+
 	}
+	else
+		cout << "No Decimation applied\n";
 	return err;
 }
 
@@ -673,30 +2132,46 @@ mir_sdr_ErrT mir_sdr_device::stream_Uninit()
 }
 
 /// <summary>
-/// Gets the config table index for a requested sampling rate
+/// Gets the config table index for a requested sampling rate: a rate of the table is taken as it is,
+/// any other one is resampled from the config of the lowest rate of the ADC,
+/// whose bandwidth covers the flat band of the resampler and whose ratio the resampler can realize
 /// </summary>
 /// <param name="requestedSrHz">Requested sampling rate in Hz</param>
-/// <returns>Index into the samplingConfigs table, -1 if not found</returns>
+/// <returns>Index into the samplingConfigs table, -1 if the rate is not supported</returns>
 int mir_sdr_device::getSamplingConfigurationTableIndex(int requestedSrHz)
 {
+	int best = -1;
+	for (int i = 0; i < c_numSamplingConfigs; i++)
+	{
+		if (samplingConfigs[i].samplingRateHz == requestedSrHz)
+			return i;
+	}
 	for (int i = 0; i < c_numSamplingConfigs; i++)
 	{
 		samplingConfiguration sc = samplingConfigs[i];
-		if (requestedSrHz == sc.samplingRateHz)
+		if (requestedSrHz <= 0 || requestedSrHz > sc.samplingRateHz
+			|| (long long)sc.bandwidth * 1000 * 100 < (long long)requestedSrHz * iq_resampler::c_passbandPercent)
+			continue;
+		if (best != -1 && (sc.deviceSamplingRateHz > samplingConfigs[best].deviceSamplingRateHz
+			|| (sc.deviceSamplingRateHz == samplingConfigs[best].deviceSamplingRateHz
+				&& sc.samplingRateHz >= samplingConfigs[best].samplingRateHz)))
+			continue;
+		iq_resampler check;
+		if (!check.configure(sc.samplingRateHz, requestedSrHz))
 		{
-			return i;
+			cout << "Sampling Rate " << requestedSrHz << " cannot be resampled from " << sc.samplingRateHz
+				<< ", the ratio needs more than " << iq_resampler::c_maxPhases << " phases" << endl;
+			continue;
 		}
+		best = i;
 	}
-	printf("Invalid Sampling Rate: %d; Must be ", requestedSrHz);
-	// ha: use single source - no duplicates of possible samplerates
-	for (int i = 0; i < c_numSamplingConfigs; i++)
+	if (best == -1 && (requestedSrHz <= 0 || requestedSrHz > samplingConfigs[c_numSamplingConfigs - 1].samplingRateHz))
 	{
-		printf("%d%s",
-			samplingConfigs[i].samplingRateHz,
-			(i+1==c_numSamplingConfigs ? "\n" : " or ") );
+		// ha: use single source - no duplicates of possible samplerates
+		printf("Invalid Sampling Rate: %d; Must be at most %d\n", requestedSrHz,
+			samplingConfigs[c_numSamplingConfigs - 1].samplingRateHz);
 	}
-	return -1;
+	else if (best == -1)
+		cout << "Sampling Rate " << requestedSrHz << " cannot be resampled from any config" << endl;
+	return best;
 }
-
-
-
@@ -24,6 +24,19 @@
 #include "IPAddress.h"
 #include <mirsdrapi-rsp.h>
 #include "rsp_cmdLineArgs.h"
+#include "sample_ring.h"
+#include "iq_scale8.h"
+#include "iq_compress.h"
+#include "iq_bfp.h"
+#include "iq_resampler.h"
+#include "iq_correction.h"
+#include "channel_server.h"
+#include "spectrum_server.h"
+#include "sigmf_recorder.h"
+#include "preroll_buffer.h"
+#include "latency_histogram.h"
+#include <deque>
+#include <vector>
 #define HAVE_STRUCT_TIMESPEC
 #include <pthread.h>
 #ifdef _WIN32
@@ -35,7 +48,11 @@
 #endif
 using namespace std;
 
+class client_session;
+
 void* receive(void* md);
+void* distribute(void* md);
+void* resampleWork(void* md);
 void streamCallback(short *xi, short *xq, unsigned int firstSampleNum,
 	int grChanged, int rfChanged, int fsChanged, unsigned int numSamples,
 	unsigned int reset, unsigned int hwRemoved, void *cbContext);
@@ -60,6 +77,43 @@ struct samplingConfiguration
 	}
 };
 
+/// <summary>
+/// Snapshot of the counters and settings of a device, see metrics_server.
+/// Counters restart with every session
+/// </summary>
+struct device_metrics
+{
+	// quantiles of a latency_histogram, in seconds
+	struct latency
+	{
+		const char* path;
+		double count, sum, p50, p99, p999, max;
+	};
+
+	string serial;
+	string name;
+	int hwVersion = 0;
+	double available = 0;
+	double streaming = 0;
+	double clients = 0;
+	double frequencyHz = 0;
+	double gainReductionDb = 0;
+	double samplingRateHz = 0;
+	double callbacks = 0;
+	double samples = 0;
+	double sentBytes = 0;
+	double apiGaps = 0;
+	double apiGapSamples = 0;
+	double discardedSamples = 0;
+	double ringDroppedBlocks = 0;
+	double clientDroppedBlocks = 0;
+	double sendBlockedSeconds = 0;
+	double sendStalls = 0;
+	double partialWrites = 0;
+	double resets = 0;
+	double hwRemovals = 0;
+	std::vector<latency> latencies;
+};
 
 class mir_sdr_device
 {
@@ -69,22 +123,49 @@ public:
 
 private:
 	int getSamplingConfigurationTableIndex(int requestedSrHz);
-	void writeWelcomeString() const;
+	void writeWelcomeString(SOCKET client) const;
+	void welcomeString(BYTE* buf, unsigned int historyBytes) const;
 	void cleanup();
 
 	friend void* receive(void* p);
+	friend void* distribute(void* p);
+	friend void* resampleWork(void* p);
 	friend void streamCallback(short *xi, short *xq, unsigned int firstSampleNum,
 		int grChanged, int rfChanged, int fsChanged, unsigned int numSamples,
 		unsigned int reset, unsigned int hwRemoved, void *cbContext);
 
 public:
 	void init(rsp_cmdLineArgs* pargs);
-	void start(SOCKET client);
+	void start(SOCKET client, bool startTransmitThread = true);
 	void stop();
 
+	// Clients sharing the stream: the first one owns the device, the others are read-only
+	void addClient(SOCKET client);
+	// Removes disconnected clients, hands the ownership on, returns the number left
+	int reapClients();
+	int numClients();
+	// A client session has closed: the listener reaps it, fd is the write end of its wakeup pipe
+	void setListenerWakeup(int fd) { listenerWakeupFd = fd; }
+	void wakeListener();
+	// Called by the metrics server, without stopping the stream
+	void readMetrics(device_metrics& m);
+	// Asks the transmit thread for the latency report, e.g. from a signal handler
+	static void requestLatencyReport() { latencyReportRequested = true; }
+
+	// Command channel, the client sessions or an external backend (io_uring) read the sockets
+	void pushCommand(const char* cmd) { pushCommands(cmd, 1); }
+	// count commands of 5 bytes, queued at once, so the receive thread takes them as one batch
+	void pushCommands(const char* cmds, int count);
+	void closeCommands();
+	// Ring the samples are streamed into, when an external backend transmits them
+	sample_ring* sampleRing() { return &ring; }
+	// The transmit thread of a client gives the lent ring back to the distributor
+	void returnRing() { ringLent = false; }
+
 	pthread_mutex_t mutex_rxThreadStarted;
 	pthread_cond_t started_cond = PTHREAD_COND_INITIALIZER;
 	pthread_t* thrdRx;
+	pthread_t* thrdTx;
 
 	/// <summary>
 	/// API: Device Enumeration Structure
@@ -93,26 +174,100 @@ public:
 	string DevNm;		// device string (USB)
 	BYTE hwVer;			// HW version
 	bool devAvail;		// true if available
-	bool isStreaming;
+	// read by the metrics server and the callback
+	std::atomic<bool> isStreaming;
 
-	bool started = false;
+	std::atomic<bool> started;
 	unsigned int DeviceIndex;
 
 
 private:
 
 	const int c_welcomeMessageLength = 100;
-	BYTE* mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, int& buflen);
+
+	// Ring between the stream callback and the transmit thread.
+	// One block per API packet, enough blocks to buffer c_ringMs of samples
+	const int c_ringMs = 250;
+	const int c_ringMinBlocks = 8;
+	const int c_maxBytesPerSample = 8;
+	// until the API reports the real packet size
+	const int c_defaultSamplesPerPacket = 1008;
+	void configureRing(int samplesPerPacket);
+	void ringGeometry(int samplesPerPacket, int& numBlocks, int& blockSize) const;
+	int fitStageSamples(int format, int n) const;
+
+	void readCommands(std::vector<std::string>& batch);
+	// Frequency, gain and sampling rate of a batch of commands, the last one of each
+	struct tuner_change
+	{
+		bool frequency = false;
+		bool gain = false;
+		bool rate = false;
+		int frequencyHz = 0;
+		int gainValue = 0;		// 0..100, as CMD_SET_TUNER_GAIN_BY_INDEX
+		int rateHz = 0;
+		int commands = 0;		// received, before coalescing
+	};
+
+	int mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, BYTE* buf);
+	void mergePlanar(const short* idata, const short* qdata, int numSamples, BYTE* buf);
+	int bytesPerSample() const { return bytesPerSample(format); }
+	static int bytesPerSample(int format);
+	// smallest part of the interleaved formats: 2 samples for the 14 bit packing
+	static int samplesPerUnit(int format) { return format == FORMAT_CS14_PACKED ? 2 : 1; }
+	static int bytesPerUnit(int format) { return format == FORMAT_CS14_PACKED ? 7 : bytesPerSample(format); }
+	static bool isPlanar(int format) { return format == FORMAT_CS16_PLANAR || format == FORMAT_CF32_PLANAR; }
+	// formats written in blocks of stageSamples
+	static bool isStaged(int format) { return isPlanar(format) || format == FORMAT_CS16_LOSSLESS || format == FORMAT_BFP; }
+	static int stagedBlockBytes(int format, int numSamples, int mantissaBits);
+	static const char* formatName(int format);
+	void setSampleFormat(int value);
+	void setMantissaBits(int value);
+	void setFraming(int value);
+	bool streamShared(const char* what);
+	void trackSamples(unsigned int firstSampleNum, unsigned int numSamples, int flags, long long timeNs);
+	void writeFrameHeader(BYTE* out, unsigned int numSamples, unsigned int payloadBytes,
+		unsigned long long firstSample, long long timeNs);
+	void applyRequestedFormat();
+	void writePacket(const short* xi, const short* xq, unsigned int numSamples, long long now);
+	void writeStaged(const short* xi, const short* xq, unsigned int numSamples, long long now);
+	void writeSamples(const short* xi, const short* xq, unsigned int numSamples, long long now);
+	void resample(const short* xi, const short* xq, unsigned int numSamples,
+		unsigned int firstSampleNum, int flags, long long now, long long timeNs);
+	bool configureResampler(int sampleConfigsTableIndex);
+	void startResampling(int inputRateHz);
+	void stopResampling();
+	sample_ring::block* reserveBlock(int minBytes, long long now);
+	void finishBlock(int minBytes, long long now);
+	void reportRingStatistics(const char* reason) const;
+	void reportCompression(const char* reason) const;
+	void reportLosses(const char* reason);
+	void dropSamples(unsigned int numSamples);
+	void retireClient(client_session* cs);
+	size_t readHistory(int ms, std::vector<preroll_buffer::piece>& pieces, std::vector<BYTE>& markers);
+	void replayHistory(client_session* cs, int ms);
+	void lendRing();
+	void reclaimRing();
+	static void writeMarker(BYTE* out, int flags);
+	void publishSettings();
+	void reportLatency(const char* reason);
+	void mergeSendLatency(latency_histogram& select, latency_histogram& send);
 	mir_sdr_ErrT setFrequencyCorrection(int value);
 	mir_sdr_ErrT setAntenna(int value);
 	mir_sdr_ErrT setAGC(bool on);
 	mir_sdr_ErrT setGain(int value);
-	mir_sdr_ErrT setSamplingRate(int requestedSrHz);
+	mir_sdr_ErrT setSamplingRate(int requestedSrHz, int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons);
+	mir_sdr_ErrT restartStream(int sampleConfigsTableIndex, int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons);
 	mir_sdr_ErrT setFrequency(int valueHz);
-	mir_sdr_ErrT reinit_Frequency(int valueHz);
+	mir_sdr_ErrT reinit_Tuner(int valueHz, int gainReductionDb, mir_sdr_ReasonForReinitT reasons, int sampleConfigsTableIndex = -1);
+	mir_sdr_ErrT configureDecimation(int sampleConfigsTableIndex);
+	mir_sdr_ErrT applyTunerChange(const tuner_change& c);
+	void frequencyChanged(int valueHz);
+	void gainChanged(int gainReductionDb);
 	mir_sdr_ErrT stream_InitForSamplingRate(int sampleConfigsTableIndex);
 	mir_sdr_ErrT stream_Uninit();
 
+public:
 	//Reference: rtl_tcp.c fct command_worker, line 277
 	//Copied from QIRX
 	enum eRTLCommands
@@ -128,12 +283,123 @@ private:
 		, CMD_SET_OFFSET_TUNING = 10          //int on
 		, CMD_SET_TUNER_GAIN_BY_INDEX = 13
 		, CMD_SET_RSP2_ANTENNA_CONTROL = 33   //int Antenna Select
+		// extensions of this server
+		, CMD_SET_SAMPLE_FORMAT = 64          //int eSampleFormat | block samples << 8, 0: command line default
+		, CMD_SET_BFP_MANTISSA = 65           //int mantissa bits of the block floating point format, 6..8
+		, CMD_SET_FRAMING = 66                //int 1: every block preceded by a streamFrameHeader, 0: raw
+		, CMD_REPLAY_HISTORY = 67             //int ms of the pre-roll sent to this client, 0: all; handled by its session
 	};
 
+private:
 	// This server is able to stream native 16-bit data (of "short" type)
 	// or - for comaptibility with some apps, 8-bit data, 
-	// where ( 8-bit Byte) =  ( 16-bit short /64) + 127
+	// where ( 8-bit Byte) =  floor(( 16-bit short + 0.5) * gain + 128), see iq_scale8
 	eBitWidth bitWidth = BITS_16;
+	iq_scale8 scale8;
+
+	// Wire format, requested by the receive thread, picked up by the callback between packets.
+	// The planar and the compressed formats are staged, until a block of stageSamples I and Q values is complete
+	const int c_defaultPlanarSamples = 1024;
+	const int c_defaultCompressedSamples = 4096;
+	const int c_minCompressedSamples = 16;
+	const int c_defaultBfpSamples = 64;
+	const int c_maxStageSamples = 16384;
+	std::atomic<int> requestedFormat;
+	std::atomic<int> requestedStageSamples;
+	std::atomic<int> requestedMantissaBits;
+	int mantissaBits = 8;
+	int format = FORMAT_CS16;
+	int stageSamples = 0;
+	int stageFill = 0;
+	std::vector<short> stageI;
+	std::vector<short> stageQ;
+	// 14 bit packing: a sample left over from the last packet, packed with the first of the next one
+	bool hasCarry = false;
+	short carryI = 0;
+	short carryQ = 0;
+	// Framed stream, requested like the format. The callback tracks the sample numbers of the API:
+	// outIndex is the index of the next output sample, frameFlags collects the events for the next header
+	static const int c_frameHeaderBytes = sizeof(streamFrameHeader);
+	std::atomic<bool> requestedFraming;
+	bool framed = false;
+	bool haveSampleNum = false;
+	unsigned int nextSampleNum = 0;
+	unsigned long long outIndex = 0;
+	int frameFlags = 0;
+	long long frameTimeNs = 0;
+	unsigned long long stageIndex = 0;	// of the first sample of the staged block
+	long long stageTimeNs = 0;
+	// compression statistics, written by the callback
+	std::atomic<long long> codecBlocks;
+	std::atomic<long long> codecRawBytes;
+	std::atomic<long long> codecBytes;
+	std::atomic<long long> codecNs;
+	// Throughput of the session, written by the callback
+	std::atomic<unsigned long long> callbacks;
+	std::atomic<unsigned long long> streamedSamples;
+	// Losses of the session, written by the callback: skipped by the API (firstSampleNum
+	// not continuous), discarded by the server (ring full), reset and removal events
+	std::atomic<unsigned long long> apiGaps;
+	std::atomic<unsigned long long> apiGapSamples;
+	std::atomic<unsigned long long> discards;
+	std::atomic<unsigned long long> discardedSamples;
+	std::atomic<unsigned int> resets;
+	std::atomic<unsigned int> hwRemovals;
+	// counters of the clients, that have left the session
+	std::atomic<unsigned long long> retiredSentBytes;
+	std::atomic<unsigned long long> retiredQueueDrops;
+	std::atomic<unsigned long long> retiredStalls;
+	std::atomic<unsigned long long> retiredBlockedUs;
+	std::atomic<unsigned long long> retiredPartialWrites;
+	int lossReportSec = 10;	// interval of the summary, 0: at the end of the session only
+	// Latency of the stream path in ns, recorded by the callback: the whole callback, each
+	// conversion into the ring, and the deviation of the callback interval from numSamples / rate.
+	// The transmit thread of every client records its own, see sample_sender
+	latency_histogram callbackLatency;
+	latency_histogram conversionLatency;
+	latency_histogram callbackJitter;
+	long long lastCallbackNs = 0;
+	// of the clients, that have left the session
+	latency_histogram retiredSelectLatency;
+	latency_histogram retiredSendLatency;
+	static std::atomic<bool> latencyReportRequested;
+
+	// Software DC and IQ imbalance correction of the device samples, before the resampler
+	iq_correction correction;
+
+	// Rates not in samplingConfigs: resampled in software from the next higher config.
+	// The callback only copies the samples into resampleRing, the resampler runs on a thread
+	// of its own and takes over the conversion into the wire format: while resampling, it is
+	// the producer of the ring, not the callback
+	iq_resampler resampler;
+	int outputSamplingRateHz = 0;
+	sample_ring resampleRing;
+	std::atomic<bool> resampling;
+	pthread_t* thrdResample = 0;
+	bool resampleDropped = false;	// callback: the next block follows dropped ones
+	// A rate change by mir_sdr_Reinit keeps the stream running: its callbacks are held,
+	// while the resampler and the correction are reconfigured
+	std::atomic<bool> callbacksHeld;
+	std::atomic<int> callbacksActive;
+	void holdCallbacks();
+	void releaseCallbacks() { callbacksHeld = false; }
+	// heads the samples of a block of resampleRing, I followed by Q
+	struct resample_chunk
+	{
+		unsigned int firstSampleNum;
+		int flags;					// eFrameFlags of the API
+		int numSamples;
+		int reserved;
+		long long now;				// us, monotonic, of the callback
+		long long timeNs;			// ns since 1970, of the callback
+	};
+
+	// Channelizer of the stream, from the command line; outlives the sessions, so do its clients
+	channel_server* channels = 0;
+	// Averaged spectra of the stream, from the command line, like the channelizer
+	spectrum_server* spectrum = 0;
+	// SigMF recording of the stream, from the command line, like the channelizer
+	sigmf_recorder* recorder = 0;
 
 public:
 	// ha: made following members public and static,
@@ -164,13 +430,60 @@ private:
 	// currently commanded values
 	int currentFrequencyHz;
 	int gainReduction;
-	double currentSamplingRateHz;
+	double currentSamplingRateHz;	// of the callback, after the hardware decimation
+	double deviceRateHz = 0;		// of the ADC, before the decimation
 	int antenna = 5;
 	int enableBiasT = 0;	// ha: added bias-T to allow powering external LNAs
+	int ringPoolFlags = 0;	// buffer_pool::eFlags, from the command line
+	int txMode = 0;			// sample_sender::eTxMode, from the command line
+	// the commanded values, published by the receive thread for the metrics
+	std::atomic<int> publishedFrequencyHz;
+	std::atomic<int> publishedGainReduction;
+	std::atomic<int> publishedSamplingRateHz;
+
+	// Send coalescing: a ring block is committed to the transmit thread, when it
+	// holds coalesceBytes, or when the next packet would exceed maxLatencyUs
+	int coalesceBytes = 0;
+	int maxLatencyUs = 0;
+	sample_ring::block* openBlock = 0;	// filled by the callback, not yet committed
+	int formatTag = 0;					// of the blocks, counts the format changes
+	long long openBlockUs = 0;
+	long long lastCallbackUs = 0;
+	std::atomic<long long> callbackIntervalUs;	// read by the resampler thread
+
+	// packet size, as reported by mir_sdr_StreamInit / mir_sdr_Reinit
+	int samplesPerPacket = 0;
+	double ringSamplingRateHz = 0;
+	int ringBlockBytes = 0;		// as configured, the producer may still fill the previous blocks
+
+	// Converted samples, written by the stream callback, drained by the transmit thread
+	sample_ring ring;
+	std::atomic<bool> txRunning;
+
+	// Clients of the stream, each one with its own queue, filled by the transmit thread.
+	// Geometry of the queues follows the blocks the transmit thread takes from the ring
+	std::vector<client_session*> clients;
+	pthread_mutex_t mutex_clients;
+	int nextClientId = 1;
+	int listenerWakeupFd = -1;
+	int queueBlocks = 0;
+	int queueBlockSize = 0;
+	int kickMs = 0;			// disconnect clients overflowing longer, 0: only drop
+	// A single client drains the ring itself, without the copy into its queue.
+	// borrower under mutex_clients, ringLent is cleared by the client, when it returns the ring
+	client_session* borrower = 0;
+	std::atomic<bool> ringLent;
+	// Pre-roll: the last seconds of the wire stream, appended by the transmit thread and replayed
+	// to joining clients, both under mutex_clients
+	preroll_buffer history;
+	int historyTag = 0;		// of the blocks in the history
+	int prerollSec = 0;		// from the command line, 0: off
+	static const long long c_maxPrerollBytes = 1LL << 30;
 
-	//Callbacks per second, for a "timer" to discard samples 
-	//to prevent overrun in the device in the error case
-	int cbksPerSecond = 0;
-	bool cbkTimerStarted = false;
+	// commands pushed by an external backend, read by the receive thread
+	std::deque<std::string> commands;
+	bool commandsClosed = false;
+	pthread_mutex_t mutex_commands;
+	pthread_cond_t commands_cond;
 };
 
@@ -0,0 +1,111 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "preroll_buffer.h"
+#include <string.h>
+
+preroll_buffer::preroll_buffer()
+{
+}
+
+preroll_buffer::~preroll_buffer()
+{
+	release();
+}
+
+void preroll_buffer::allocate(size_t bytes, long long maxAgeNs, int poolFlags)
+{
+	release();
+	pool = new buffer_pool(1, (int)bytes, poolFlags);
+	memory = pool->buffer(0);
+	this->bytes = bytes;
+	this->maxAgeNs = maxAgeNs;
+}
+
+void preroll_buffer::release()
+{
+	delete pool;
+	pool = 0;
+	memory = 0;
+	bytes = 0;
+	clear();
+}
+
+void preroll_buffer::clear()
+{
+	entries.clear();
+	head = 0;
+	used = 0;
+}
+
+void preroll_buffer::dropOldest()
+{
+	used -= entries.front().length;
+	entries.pop_front();
+}
+
+void preroll_buffer::append(const BYTE* data, int length, long long nowNs)
+{
+	if (pool == 0 || length <= 0 || (size_t)length > bytes)
+		return;
+	while (used + length > bytes)
+		dropOldest();
+	while (!entries.empty() && nowNs - entries.front().timeNs > maxAgeNs)
+		dropOldest();
+
+	entry e = { head, length, nowNs };
+	size_t first = bytes - head;
+	if (first >= (size_t)length)
+		memcpy(memory + head, data, length);
+	else
+	{
+		memcpy(memory + head, data, first);
+		memcpy(memory, data + first, length - first);
+	}
+	head = (head + length) % bytes;
+	used += length;
+	entries.push_back(e);
+}
+
+size_t preroll_buffer::read(long long sinceNs, int maxBytes, std::vector<piece>& pieces) const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const entry& e = entries[i];
+		if (e.timeNs < sinceNs)
+			continue;
+		size_t offset = e.offset;
+		int rest = e.length;
+		while (rest > 0)
+		{
+			// neither across the end of the memory nor longer than maxBytes
+			int n = rest < maxBytes ? rest : maxBytes;
+			if ((size_t)n > bytes - offset)
+				n = (int)(bytes - offset);
+			piece p = { memory + offset, n };
+			pieces.push_back(p);
+			offset = (offset + n) % bytes;
+			rest -= n;
+			total += n;
+		}
+	}
+	return total;
+}
@@ -0,0 +1,83 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <deque>
+#include <vector>
+#include <stddef.h>
+#include "common.h"
+#include "buffer_pool.h"
+
+/// <summary>
+/// The last seconds of the wire stream, for clients joining late: they get the history
+/// first, then the live stream. Bounded by its size and by the age of the blocks.
+/// Filled by the distributor with the blocks of the device ring, as they were sent.
+/// Not thread safe, the device uses it under its client lock only.
+/// </summary>
+class preroll_buffer
+{
+public:
+	struct piece
+	{
+		const BYTE* data;
+		int length;
+	};
+
+	preroll_buffer();
+	~preroll_buffer();
+
+	void allocate(size_t bytes, long long maxAgeNs, int poolFlags);
+	void release();
+	bool isActive() const { return pool != 0; }
+
+	// Drops the history, e.g. when the format of the stream has changed
+	void clear();
+	// Keeps one block, the oldest ones are dropped to make room
+	void append(const BYTE* data, int length, long long nowNs);
+
+	// The history since sinceNs, oldest first, in pieces of at most maxBytes
+	size_t read(long long sinceNs, int maxBytes, std::vector<piece>& pieces) const;
+
+	size_t size() const { return used; }
+	size_t capacity() const { return bytes; }
+	// of the oldest block kept, 0 if empty
+	long long oldestNs() const { return entries.empty() ? 0 : entries.front().timeNs; }
+
+private:
+	preroll_buffer(preroll_buffer const&);		// Don't Implement
+	void operator=(preroll_buffer const&);		// Don't implement
+
+	struct entry
+	{
+		size_t offset;
+		int length;
+		long long timeNs;
+	};
+
+	void dropOldest();
+
+	buffer_pool* pool = 0;
+	BYTE* memory = 0;
+	size_t bytes = 0;
+	long long maxAgeNs = 0;
+	std::deque<entry> entries;
+	size_t head = 0;	// next write position
+	size_t used = 0;
+};
@@ -24,6 +24,7 @@
 #include "common.h"
 #include "mir_sdr_device.h"
 #include <string>
+#include <ctype.h>
 
 
 rsp_cmdLineArgs::rsp_cmdLineArgs(int argc, char** argv)
@@ -34,7 +35,8 @@ rsp_cmdLineArgs::rsp_cmdLineArgs(int argc, char** argv)
 	{
 		string s = argv[i];
 		int len = s.length();
-		if (len == 2 && s[0] == '-')
+		// a negative number is a value, not a selector
+		if (len == 2 && s[0] == '-' && !isdigit((unsigned char)s[1]))
 		{
 			selectors[s[1]] = i;
 		}
@@ -69,6 +71,92 @@ int rsp_cmdLineArgs::intValue(int index, string error, int minval, int maxval)
 	return -1;
 }
 
+double rsp_cmdLineArgs::doubleValue(int index, string error, double minval, double maxval)
+{
+	if (argc > index + 1)
+	{
+		string s = argv[index + 1];
+		try
+		{
+			double val = std::stod(s);
+			if (val < minval || val > maxval)
+				throw msg_exception("Out of Range Error");
+			return val;
+		}
+		catch (exception& )
+		{
+			std::cout << error << s << endl << endl;
+		}
+	}
+	else
+		std::cout << "Missing Argument" << endl << endl;
+	return -1;
+}
+
+bool rsp_cmdLineArgs::stringValue(int index, string error, string& value)
+{
+	if (argc > index + 1 && argv[index + 1][0] != 0)
+	{
+		value = argv[index + 1];
+		return true;
+	}
+	std::cout << error << "Missing Argument" << endl << endl;
+	return false;
+}
+
+/// <summary>
+/// Parses the port map of the supervisor, e.g. "1234567890=7890,2345678901=7891"
+/// </summary>
+bool rsp_cmdLineArgs::parsePortMap(const string& s)
+{
+	vector<string> entries = common::split(s, ',');
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		vector<string> kv = common::split(entries[i], '=');
+		if (kv.size() != 2 || kv[0].empty())
+		{
+			std::cout << "Invalid Port Map entry " << entries[i] << endl << endl;
+			return false;
+		}
+		int port = -1;
+		try
+		{
+			port = std::stoi(kv[1]);
+		}
+		catch (exception&)
+		{
+		}
+		if (!common::checkRange(port, 1, 0xffff))
+		{
+			std::cout << "Invalid Port Map entry " << entries[i] << endl << endl;
+			return false;
+		}
+		portMap[kv[0]] = port;
+	}
+	return true;
+}
+
+/// <summary>
+/// Parses the exported channels of the channelizer, e.g. "-3,0,5"
+/// </summary>
+bool rsp_cmdLineArgs::parseChannels(const string& s)
+{
+	vector<string> entries = common::split(s, ',');
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		try
+		{
+			channels.push_back(std::stoi(entries[i]));
+		}
+		catch (exception&)
+		{
+			std::cout << "Invalid Channel " << entries[i] << endl << endl;
+			return false;
+		}
+	}
+	return !channels.empty();
+}
+
 IPAddress* rsp_cmdLineArgs::ipAddValue( int index, string error)
 {
 	IPAddress*  ipadd = 0;
@@ -91,19 +179,50 @@ void rsp_cmdLineArgs::displayUsage()
 	cout << "Usage: \t[-a listen address, default is 127.0.0.1]" << endl;
 	cout << "\t[-p listen port, default is 7890]" << endl;
 	cout << "\t[-f frequency [Hz], default is 178352000Hz]" << endl;
-	cout << "\t[-s sampling rate [Hz], allowed values are ";
+	cout << "\t[-s sampling rate [Hz], native values are ";
 	// ha: use single source - no duplicates of possible samplerates
 	for ( int k = 0; k < mir_sdr_device::c_numSamplingConfigs; ++k )
 	{
 		cout << mir_sdr_device::samplingConfigs[k].samplingRateHz << ", ";
 	}
-	cout << "default is " << mir_sdr_device::samplingConfigs[mir_sdr_device::initSamplingConfigIdx].samplingRateHz
+	cout << "other values from " << c_minSamplingRate << " are resampled in software, default is " << mir_sdr_device::samplingConfigs[mir_sdr_device::initSamplingConfigIdx].samplingRateHz
 		<< "]" << endl;
 	cout << "\t[-g gain reduction, values betwee 0 and 100, default is 50]" << endl;
 	cout << "\t[-W bit width, value of 1 means 8 bit, value of 2 means 16 bit, default is 16 bit]" << endl;
+	cout << "\t[-x 8 bit scaling shift, output is x * 2^-shift rounded, values between 0 and 8, default is 6]" << endl;
+	cout << "\t[-G 8 bit scaling gain, output is x * gain rounded, overrides -x, e.g. 0.02]" << endl;
+	cout << "\t[-D 8 bit dither, value of 1 adds triangular dither of +-1 LSB, default is off]" << endl;
 	cout << "\t[-d device index, value counts from 0 to number of devices -1, default is 0]" << endl;
+	cout << "\t[-n device serial number, selects the device instead of the index]" << endl;
 	cout << "\t[-T antenna, value of 1 means Antenna A, value of 2 means Antenna B, default is Antenna A]" << endl;
 	cout << "\t[-b bias-t, value of 1 activated, value of 0 means off, default is off]" << endl;
+	cout << "\t[-c send coalescing threshold [bytes], 0 sends every packet, default is 65536]" << endl;
+	cout << "\t[-l send coalescing latency budget [us], default is 2000]" << endl;
+	cout << "\t[-z transmit mode, 0 means send, 1 means gather (sendmsg), 2 means zerocopy (Linux), default is 0]" << endl;
+	cout << "\t[-u network backend, value of 1 means io_uring (Linux), value of 0 means threads, default is 0]" << endl;
+	cout << "\t[-L lock sample buffers into RAM, value of 1 means on, default is off]" << endl;
+	cout << "\t[-H huge page sample buffers, value of 1 means on, default is off]" << endl;
+	cout << "\t[-m maximum number of clients sharing the stream, the first one controls the device, default is 1]" << endl;
+	cout << "\t[-k disconnect a client, whose queue overflows longer than this [ms], 0 means never, default is 0]" << endl;
+	cout << "\t[-M supervisor, value of 1 serves every device by its own worker process (Linux), default is off]" << endl;
+	cout << "\t[-P supervisor port map, serial=port[,serial=port...], other devices count up from the listen port]" << endl;
+	cout << "\t[-C channelizer, number of channels the stream is split into, power of two up to 4096, default is off]" << endl;
+	cout << "\t[-E channels exported, e.g. -3,0,5, channel c is centered at c * sampling rate / channels, default is all]" << endl;
+	cout << "\t[-O channel file prefix, channels are written to prefix_chN.cs16, default is TCP ports from listen port + 1]" << endl;
+	cout << "\t[-S spectrum port, streams averaged power spectra, 0 means off, default is off]" << endl;
+	cout << "\t[-F spectrum FFT size, power of two between 16 and 65536, default is 1024]" << endl;
+	cout << "\t[-w spectrum window, 0 means rectangular, 1 means hann, 2 means blackman-harris, default is hann]" << endl;
+	cout << "\t[-A spectrum averages, FFTs averaged per spectrum, default is 8]" << endl;
+	cout << "\t[-R spectrum rate, spectra per second, default is 10]" << endl;
+	cout << "\t[-B spectrum output, value of 1 means linear power, value of 0 means dBFS, default is dBFS]" << endl;
+	cout << "\t[-I software correction, 1 means DC offset, 2 means DC offset and IQ imbalance, 0 means off, default is off]" << endl;
+	cout << "\t[-j software correction time constant [ms], default is 100]" << endl;
+	cout << "\t[-r loss summary interval [s], 0 means at the end of a session only, default is 10]" << endl;
+	cout << "\t[-e metrics port, Prometheus text format by HTTP, 0 means off, default is off; supervisor workers count up from it]" << endl;
+	cout << "\t[-i metrics listen address, default is 127.0.0.1]" << endl;
+	cout << "\t[-o recording prefix, the stream is recorded to prefix_time.sigmf-data and .sigmf-meta, default is off]" << endl;
+	cout << "\t[-Y unattended recording, value of 1 streams and records without a client, default is off]" << endl;
+	cout << "\t[-V pre-roll [s], clients joining the stream get its last seconds first, 0 means off, default is off]" << endl;
 }
 
 
@@ -120,7 +239,7 @@ int rsp_cmdLineArgs::parse()
 		switch (it->first) //key
 		{
 		case 's':
-			SamplingRate = intValue(it->second, "Invalid Sampling Rate ", 512000, 8192000);
+			SamplingRate = intValue(it->second, "Invalid Sampling Rate ", c_minSamplingRate, 8192000);
 			if (SamplingRate == -1)
 				goto exit;
 			break;
@@ -144,6 +263,21 @@ int rsp_cmdLineArgs::parse()
 			if (BitWidth == -1)
 				goto exit;
 			break;
+		case 'x':
+			scale8Shift = intValue(it->second, "Invalid 8 Bit Scaling Shift ", 0, 8);
+			if (scale8Shift == -1)
+				goto exit;
+			break;
+		case 'G':
+			scale8Gain = doubleValue(it->second, "Invalid 8 Bit Scaling Gain ", 1e-6, 1.0);
+			if (scale8Gain < 0)
+				goto exit;
+			break;
+		case 'D':
+			scale8Dither = intValue(it->second, "Invalid 8 Bit Dither value ", 0, 1);
+			if (scale8Dither == -1)
+				goto exit;
+			break;
 		case 'a':
 			ipa = ipAddValue(it->second, "Invalid IP Address ");
 			if (ipa == 0)
@@ -156,6 +290,158 @@ int rsp_cmdLineArgs::parse()
 		case 'b':
 			enableBiasT = intValue(it->second, "Invalid Bias-T value  ", 0, 1);
 			break;
+		case 'c':
+			coalesceBytes = intValue(it->second, "Invalid Coalescing Threshold ", 0, 1048576);
+			if (coalesceBytes == -1)
+				goto exit;
+			break;
+		case 'l':
+			maxLatencyUs = intValue(it->second, "Invalid Latency Budget ", 0, 1000000);
+			if (maxLatencyUs == -1)
+				goto exit;
+			break;
+		case 'z':
+			txMode = intValue(it->second, "Invalid Transmit Mode ", 0, 2);
+			if (txMode == -1)
+				goto exit;
+			break;
+		case 'u':
+			ioUring = intValue(it->second, "Invalid Network Backend ", 0, 1);
+			if (ioUring == -1)
+				goto exit;
+			break;
+		case 'L':
+			lockMemory = intValue(it->second, "Invalid Lock Memory value ", 0, 1);
+			if (lockMemory == -1)
+				goto exit;
+			break;
+		case 'H':
+			hugePages = intValue(it->second, "Invalid Huge Pages value ", 0, 1);
+			if (hugePages == -1)
+				goto exit;
+			break;
+		case 'm':
+			maxClients = intValue(it->second, "Invalid Maximum Number of Clients ", 1, 64);
+			if (maxClients == -1)
+				goto exit;
+			break;
+		case 'k':
+			kickMs = intValue(it->second, "Invalid Slow Client Timeout ", 0, 3600000);
+			if (kickMs == -1)
+				goto exit;
+			break;
+		case 'n':
+			if (!stringValue(it->second, "Invalid Serial Number ", requestedSerial))
+				goto exit;
+			break;
+		case 'M':
+			supervisor = intValue(it->second, "Invalid Supervisor value ", 0, 1);
+			if (supervisor == -1)
+				goto exit;
+			break;
+		case 'P':
+			{
+				string s;
+				if (!stringValue(it->second, "Invalid Port Map ", s) || !parsePortMap(s))
+					goto exit;
+			}
+			break;
+		case 'C':
+			numChannels = intValue(it->second, "Invalid Number of Channels ", 2, 4096);
+			if (numChannels == -1)
+				goto exit;
+			if ((numChannels & (numChannels - 1)) != 0)
+			{
+				cout << "Invalid Number of Channels " << numChannels << ", must be a power of two" << endl << endl;
+				goto exit;
+			}
+			break;
+		case 'E':
+			{
+				string s;
+				if (!stringValue(it->second, "Invalid Channels ", s) || !parseChannels(s))
+					goto exit;
+			}
+			break;
+		case 'O':
+			if (!stringValue(it->second, "Invalid Channel File Prefix ", channelFilePrefix))
+				goto exit;
+			break;
+		case 'S':
+			spectrumPort = intValue(it->second, "Invalid Spectrum Port ", 0, 0xffff);
+			if (spectrumPort == -1)
+				goto exit;
+			break;
+		case 'F':
+			spectrumFftSize = intValue(it->second, "Invalid Spectrum FFT Size ", 16, 65536);
+			if (spectrumFftSize == -1)
+				goto exit;
+			if ((spectrumFftSize & (spectrumFftSize - 1)) != 0)
+			{
+				cout << "Invalid Spectrum FFT Size " << spectrumFftSize << ", must be a power of two" << endl << endl;
+				goto exit;
+			}
+			break;
+		case 'w':
+			spectrumWindow = intValue(it->second, "Invalid Spectrum Window ", 0, 2);
+			if (spectrumWindow == -1)
+				goto exit;
+			break;
+		case 'A':
+			spectrumAverages = intValue(it->second, "Invalid Spectrum Averages ", 1, 1000);
+			if (spectrumAverages == -1)
+				goto exit;
+			break;
+		case 'R':
+			spectrumRate = doubleValue(it->second, "Invalid Spectrum Rate ", 0.01, 1000);
+			if (spectrumRate < 0)
+				goto exit;
+			break;
+		case 'B':
+			spectrumLinear = intValue(it->second, "Invalid Spectrum Output ", 0, 1);
+			if (spectrumLinear == -1)
+				goto exit;
+			break;
+		case 'I':
+			correctionMode = intValue(it->second, "Invalid Correction Mode ", 0, 2);
+			if (correctionMode == -1)
+				goto exit;
+			break;
+		case 'j':
+			correctionMs = intValue(it->second, "Invalid Correction Time Constant ", 1, 100000);
+			if (correctionMs == -1)
+				goto exit;
+			break;
+		case 'r':
+			lossReportSec = intValue(it->second, "Invalid Loss Summary Interval ", 0, 86400);
+			if (lossReportSec == -1)
+				goto exit;
+			break;
+		case 'e':
+			metricsPort = intValue(it->second, "Invalid Metrics Port ", 0, 0xffff);
+			if (metricsPort == -1)
+				goto exit;
+			break;
+		case 'i':
+			ipa = ipAddValue(it->second, "Invalid Metrics Address ");
+			if (ipa == 0)
+				goto exit;
+			metricsAddress = *ipa;
+			break;
+		case 'o':
+			if (!stringValue(it->second, "Invalid Recording Prefix ", recordPrefix))
+				goto exit;
+			break;
+		case 'V':
+			prerollSec = intValue(it->second, "Invalid Pre-roll ", 0, 600);
+			if (prerollSec == -1)
+				goto exit;
+			break;
+		case 'Y':
+			recordUnattended = intValue(it->second, "Invalid Unattended Recording ", 0, 1);
+			if (recordUnattended == -1)
+				goto exit;
+			break;
 		case 'd':
 			requestedDeviceIndex = intValue(it->second, "Invalid Device Index requested  ", 0, 8);
 			if (requestedDeviceIndex == -1)
@@ -171,6 +457,21 @@ int rsp_cmdLineArgs::parse()
 
 		}
 	}
+	if (numChannels > 0)
+	{
+		if (channels.empty())
+			for (int c = -numChannels / 2; c < numChannels / 2; c++)
+				channels.push_back(c);
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			if (!common::checkRange(channels[i], -numChannels / 2, numChannels / 2 - 1))
+			{
+				cout << "Invalid Channel " << channels[i] << ", must be between " << -numChannels / 2
+					<< " and " << numChannels / 2 - 1 << endl << endl;
+				goto exit;
+			}
+		}
+	}
 	return 0;
 	exit:
 		return -1;
@@ -34,23 +34,63 @@ private:
 
 	map < char, int> selectors;
 	int intValue(int index, string error, int minval, int maxval);
+	double doubleValue(int index, string error, double minval, double maxval);
+	bool stringValue(int index, string error, string& value);
+	bool parsePortMap(const string& s);
+	bool parseChannels(const string& s);
 	IPAddress* ipAddValue(int index, string error);
 
 public:
+	// lowest sampling rate, the rates below the native ones are resampled in software
+	static const int c_minSamplingRate = 32000;
+
 	IPAddress  Address{ 127,0,0,1 };
 	int Port = 7890;
 	int Frequency = 178352000;
 	int GainReduction = 50;
 	int SamplingRate = 2048000;
 	int BitWidth = 2; //16 Bit
+	int scale8Shift = 6;		// 8 bit output: x * 2^-shift, rounded
+	double scale8Gain = 0;		// 8 bit output: x * gain, rounded, overrides the shift if > 0
+	int scale8Dither = 0;		// 8 bit output: TPDF dither
 	mir_sdr_RSPII_AntennaSelectT Antenna = mir_sdr_RSPII_ANTENNA_A;
 	int requestedDeviceIndex = 0;
+	string requestedSerial;		// selects the device by serial number, overrides the index
 	int enableBiasT = 0;
+	int coalesceBytes = 65536;	// send threshold, 0 sends every packet
+	int maxLatencyUs = 2000;	// latency budget for coalescing
+	int txMode = 0;			// 0 send, 1 gather (sendmsg), 2 zerocopy (Linux)
+	int ioUring = 0;		// 1: io_uring network backend (Linux)
+	int lockMemory = 0;		// mlock the sample buffers
+	int hugePages = 0;		// huge page backed sample buffers
+	int maxClients = 1;		// clients sharing the stream, the first one is the owner
+	int kickMs = 0;			// disconnect a client overflowing its queue this long, 0: never
+	int supervisor = 0;		// 1: one worker process per device
+	map<string, int> portMap;	// supervisor: port by serial number, the others count up from Port
+	int numChannels = 0;		// channelizer: channels of the grid, power of two, 0: off
+	vector<int> channels;		// channelizer: channels exported, all if empty
+	string channelFilePrefix;	// channelizer: files instead of TCP ports counting up from Port + 1
+	int spectrumPort = 0;		// averaged spectra on this port, 0: off
+	int spectrumFftSize = 1024;	// bins per spectrum, power of two
+	int spectrumWindow = 1;		// spectrum_server::eWindow
+	int spectrumAverages = 8;	// FFTs averaged per spectrum
+	double spectrumRate = 10;	// spectra per second
+	int spectrumLinear = 0;		// 1: linear power instead of dB
+	int correctionMode = 0;		// iq_correction::eMode, software DC / IQ imbalance correction
+	int correctionMs = 100;		// time constant of the correction
+	int lossReportSec = 10;		// interval of the loss summary, 0: at the end of a session only
+	int metricsPort = 0;		// Prometheus metrics by HTTP on this port, 0: off
+	IPAddress metricsAddress{ 127,0,0,1 };
+	string recordPrefix;		// SigMF recordings of the stream, named prefix_time, empty: off
+	int recordUnattended = 0;	// 1: the stream runs and is recorded without a client
+	int prerollSec = 0;		// seconds of the stream kept for clients joining it, 0: off
 
 	rsp_cmdLineArgs(int argc, char** argv);
 	int parse();
 	virtual ~rsp_cmdLineArgs();
 	static void displayUsage();
+	int argCount() const { return argc; }
+	char** args() const { return argv; }
 
 };
 
@@ -0,0 +1,413 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "rsp_supervisor.h"
+#include <iostream>
+#include <set>
+#include <atomic>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+using namespace std;
+
+static std::atomic<int> s_stopSignal(0);
+static std::atomic<bool> s_statusRequested(false);
+
+#ifndef _WIN32
+static void supervisorSignal(int signum)
+{
+	if (signum == SIGUSR1)
+		s_statusRequested = true;
+	else
+		s_stopSignal = signum;
+}
+#endif
+
+rsp_supervisor::rsp_supervisor(rsp_cmdLineArgs* pargs)
+	: pargs(pargs)
+{
+}
+
+/// <summary>
+/// Ports from the port map first, the other devices count up from the listen port,
+/// skipping the mapped ports. Each worker takes a range of ports: its listen port,
+/// followed by the ports of its channels (-C), which count up from the listen port.
+/// </summary>
+void rsp_supervisor::assignPorts(const map<string, mir_sdr_device*>& devices)
+{
+	int range = 1;
+	if (pargs->numChannels > 0 && pargs->channelFilePrefix.empty())
+		range += (int)pargs->channels.size();
+
+	set<int> used;
+	map<string, int>::const_iterator pm;
+	for (pm = pargs->portMap.begin(); pm != pargs->portMap.end(); pm++)
+	{
+		for (int k = 0; k < range; k++)
+			used.insert(pm->second + k);
+		if (devices.count(pm->first) == 0)
+			cout << "Supervisor: device " << pm->first << " of the port map not found" << endl;
+	}
+
+	int nextPort = pargs->Port;
+	map<string, mir_sdr_device*>::const_iterator it;
+	for (it = devices.begin(); it != devices.end(); it++)
+	{
+		worker w;
+		w.serno = it->first;
+		pm = pargs->portMap.find(w.serno);
+		if (pm != pargs->portMap.end())
+			w.port = pm->second;
+		else
+		{
+			// the whole range must be free
+			for (int k = 0; k < range; k++)
+			{
+				if (used.count(nextPort + k) != 0)
+				{
+					nextPort += k + 1;
+					k = -1;
+				}
+			}
+			w.port = nextPort;
+			nextPort += range;
+		}
+		workers.push_back(w);
+	}
+}
+
+/// <summary>
+/// The command line of the supervisor, without the options selecting
+/// the device, the ports and the files, which are set per worker
+/// </summary>
+vector<string> rsp_supervisor::workerArguments(const worker& w) const
+{
+	vector<string> args;
+	int argc = pargs->argCount();
+	char** argv = pargs->args();
+	args.push_back(argv[0]);
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-M" || a == "-P" || a == "-p" || a == "-d" || a == "-n" || a == "-e" || a == "-o"
+			|| a == "-S" || a == "-O")
+		{
+			i++;	// skip the value
+			continue;
+		}
+		args.push_back(a);
+	}
+	args.push_back("-p");
+	args.push_back(to_string(w.port));
+	args.push_back("-n");
+	args.push_back(w.serno);
+	int index = (int)(&w - &workers[0]);
+	if (pargs->metricsPort > 0)
+	{
+		args.push_back("-e");
+		args.push_back(to_string(pargs->metricsPort + index));
+	}
+	if (pargs->spectrumPort > 0)
+	{
+		args.push_back("-S");
+		args.push_back(to_string(pargs->spectrumPort + index));
+	}
+	if (!pargs->channelFilePrefix.empty())
+	{
+		args.push_back("-O");
+		args.push_back(pargs->channelFilePrefix + "_" + w.serno);
+	}
+	// the workers start their recordings at the same time
+	if (!pargs->recordPrefix.empty())
+	{
+		args.push_back("-o");
+		args.push_back(pargs->recordPrefix + "_" + w.serno);
+	}
+	return args;
+}
+
+#ifndef _WIN32
+
+bool rsp_supervisor::startWorker(worker& w)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		cout << "Supervisor: pipe failed with " << errno << endl;
+		return false;
+	}
+	vector<string> args = workerArguments(w);
+	vector<char*> argv;
+	for (size_t i = 0; i < args.size(); i++)
+		argv.push_back((char*)args[i].c_str());
+	argv.push_back(0);
+
+	cout.flush();
+	int pid = fork();
+	if (pid < 0)
+	{
+		cout << "Supervisor: fork failed with " << errno << endl;
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0)
+	{
+		// worker: a fresh process image, the API state is not inherited
+#ifdef __linux__
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+		dup2(fds[1], 1);
+		dup2(fds[1], 2);
+		close(fds[0]);
+		close(fds[1]);
+		signal(SIGUSR1, SIG_DFL);
+		execv("/proc/self/exe", &argv[0]);
+		execvp(argv[0], &argv[0]);
+		_exit(127);
+	}
+	close(fds[1]);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	w.pid = pid;
+	w.outFd = fds[0];
+	w.pending.clear();
+	w.startTime = time(NULL);
+	cout << "Supervisor: worker for device " << w.serno << " started on port " << w.port
+		<< ", pid " << pid << endl;
+	return true;
+}
+
+void rsp_supervisor::readOutput(worker& w)
+{
+	char buf[4096];
+	int n = read(w.outFd, buf, sizeof(buf));
+	if (n <= 0)
+	{
+		if (!w.pending.empty())
+			cout << "[" << w.serno << "] " << w.pending << endl;
+		w.pending.clear();
+		close(w.outFd);
+		w.outFd = -1;
+		return;
+	}
+	w.pending.append(buf, n);
+	size_t pos;
+	while ((pos = w.pending.find('\n')) != string::npos)
+	{
+		string line = w.pending.substr(0, pos);
+		w.pending.erase(0, pos + 1);
+		if (!line.empty())
+			cout << "[" << w.serno << "] " << line << endl;
+	}
+}
+
+void rsp_supervisor::reapWorkers()
+{
+	int status;
+	int pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			worker& w = workers[i];
+			if (w.pid != pid)
+				continue;
+			w.pid = -1;
+			if (WIFSIGNALED(status))
+				w.lastExit = "killed by signal " + to_string(WTERMSIG(status));
+			else
+				w.lastExit = "exit code " + to_string(WEXITSTATUS(status));
+
+			// a worker failing right after its start is restarted with increasing delay
+			time_t now = time(NULL);
+			if (now - w.startTime < c_minUptimeSec)
+				w.backoffSec = w.backoffSec == 0 ? 1 : min(2 * w.backoffSec, (int)c_maxBackoffSec);
+			else
+				w.backoffSec = 1;
+			w.nextStart = now + w.backoffSec;
+			cout << "Supervisor: worker for device " << w.serno << " terminated, " << w.lastExit
+				<< ", restart in " << w.backoffSec << " s" << endl;
+		}
+	}
+}
+
+void rsp_supervisor::stopWorkers()
+{
+	for (size_t i = 0; i < workers.size(); i++)
+		if (workers[i].pid > 0)
+			kill(workers[i].pid, SIGTERM);
+
+	time_t deadline = time(NULL) + c_stopTimeoutSec;
+	for (;;)
+	{
+		bool alive = false;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			worker& w = workers[i];
+			if (w.pid > 0 && waitpid(w.pid, 0, WNOHANG) == w.pid)
+				w.pid = -1;
+			alive = alive || w.pid > 0;
+		}
+		if (!alive)
+			break;
+		if (time(NULL) > deadline)
+		{
+			for (size_t i = 0; i < workers.size(); i++)
+				if (workers[i].pid > 0)
+				{
+					kill(workers[i].pid, SIGKILL);
+					waitpid(workers[i].pid, 0, 0);
+					workers[i].pid = -1;
+				}
+			break;
+		}
+		usleep(100000);
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		while (workers[i].outFd >= 0)
+			readOutput(workers[i]);
+	}
+}
+
+void rsp_supervisor::reportStatus() const
+{
+	int running = 0;
+	int restarts = 0;
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		running += workers[i].pid > 0 ? 1 : 0;
+		restarts += workers[i].restarts;
+	}
+	cout << "Supervisor status: " << running << "/" << workers.size() << " workers running, "
+		<< restarts << " restarts" << endl;
+
+	time_t now = time(NULL);
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		const worker& w = workers[i];
+		cout << "\t" << w.serno << " port " << w.port;
+		if (w.pid > 0)
+			cout << " pid " << w.pid << " running for " << (now - w.startTime) << " s";
+		else if (s_stopSignal != 0)
+			cout << " stopped";
+		else
+			cout << " restarting in " << max(0L, (long)(w.nextStart - now)) << " s";
+		cout << ", " << w.restarts << " restarts";
+		if (!w.lastExit.empty())
+			cout << ", last " << w.lastExit;
+		cout << endl;
+	}
+}
+
+bool rsp_supervisor::run(const map<string, mir_sdr_device*>& devices)
+{
+	assignPorts(devices);
+	if (workers.empty())
+	{
+		cout << "Supervisor: no devices" << endl;
+		return true;
+	}
+
+	struct sigaction sigact;
+	memset(&sigact, 0, sizeof(sigact));
+	sigact.sa_handler = supervisorSignal;
+	sigemptyset(&sigact.sa_mask);
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGUSR1, &sigact, NULL);
+
+	cout << "Supervisor: " << workers.size() << " device(s), status on SIGUSR1 and every "
+		<< c_statusIntervalSec << " s" << endl;
+	for (size_t i = 0; i < workers.size(); i++)
+		startWorker(workers[i]);
+	time_t nextStatus = time(NULL) + c_statusIntervalSec;
+
+	while (s_stopSignal == 0)
+	{
+		vector<pollfd> fds;
+		vector<int> owners;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			if (workers[i].outFd < 0)
+				continue;
+			pollfd p = { workers[i].outFd, POLLIN, 0 };
+			fds.push_back(p);
+			owners.push_back((int)i);
+		}
+		int n = poll(fds.empty() ? 0 : &fds[0], fds.size(), 1000);
+		for (int k = 0; n > 0 && k < (int)fds.size(); k++)
+			if (fds[k].revents != 0)
+				readOutput(workers[owners[k]]);
+
+		reapWorkers();
+
+		time_t now = time(NULL);
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			worker& w = workers[i];
+			if (w.pid < 0 && w.outFd < 0 && now >= w.nextStart && s_stopSignal == 0)
+			{
+				if (startWorker(w))
+					w.restarts++;
+				else
+					w.nextStart = now + c_maxBackoffSec;
+			}
+		}
+		bool requested = s_statusRequested.exchange(false);
+		if (requested || now >= nextStatus)
+		{
+			reportStatus();
+			nextStatus = now + c_statusIntervalSec;
+		}
+		// the workers report their latencies
+		for (size_t i = 0; requested && i < workers.size(); i++)
+			if (workers[i].pid > 0)
+				kill(workers[i].pid, SIGUSR1);
+	}
+
+	cout << "Supervisor: stopping the workers (signal " << s_stopSignal << ")" << endl;
+	stopWorkers();
+	reportStatus();
+	return true;
+}
+
+#else
+
+bool rsp_supervisor::startWorker(worker& w) { return false; }
+void rsp_supervisor::readOutput(worker& w) {}
+void rsp_supervisor::reapWorkers() {}
+void rsp_supervisor::stopWorkers() {}
+void rsp_supervisor::reportStatus() const {}
+
+bool rsp_supervisor::run(const map<string, mir_sdr_device*>& devices)
+{
+	cout << "Supervisor mode is not available on this platform" << endl;
+	return false;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "rsp_cmdLineArgs.h"
+#include "mir_sdr_device.h"
+
+/// <summary>
+/// Supervisor mode: serves every attached device by its own worker process.
+/// The device selection of the API is process global, so each device gets
+/// a fresh rsp_tcp process, bound to its own port. The output of the workers
+/// is collected with the serial number prepended, crashed workers are restarted.
+/// </summary>
+class rsp_supervisor
+{
+public:
+	rsp_supervisor(rsp_cmdLineArgs* pargs);
+
+	// Runs until SIGINT / SIGTERM, returns false, if not supported on this platform
+	bool run(const map<string, mir_sdr_device*>& devices);
+
+private:
+	struct worker
+	{
+		string serno;
+		int port = 0;
+		int pid = -1;
+		int outFd = -1;			// stdout and stderr of the worker
+		string pending;			// incomplete output line
+		int restarts = 0;
+		time_t startTime = 0;
+		time_t nextStart = 0;	// restart time, after the worker has exited
+		int backoffSec = 0;
+		string lastExit;
+	};
+
+	// worker, that exits earlier than this after its start, are restarted with increasing delay
+	static const int c_minUptimeSec = 10;
+	static const int c_maxBackoffSec = 60;
+	static const int c_statusIntervalSec = 60;
+	static const int c_stopTimeoutSec = 5;
+
+	void assignPorts(const map<string, mir_sdr_device*>& devices);
+	vector<string> workerArguments(const worker& w) const;
+	bool startWorker(worker& w);
+	void readOutput(worker& w);
+	void reapWorkers();
+	void stopWorkers();
+	void reportStatus() const;
+
+	rsp_cmdLineArgs* pargs;
+	vector<worker> workers;
+};
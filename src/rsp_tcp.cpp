@@ -32,6 +32,9 @@
 #include "rsp_tcp.h"
 #include "rsp_cmdLineArgs.h"
 #include "devices.h"
+#include "rsp_supervisor.h"
+#include "iq_scale8.h"
+#include "sigmf_recorder.h"
 #ifndef _WIN32
 #include <signal.h>
 #endif
@@ -91,8 +94,14 @@ static void sighandler(int signum)
 {
 	printf("Shutdown \n\n");
 	//devices::instance().Stop();
+	sigmf_recorder::closeOnSignal();
 	exit(0);
 }
+
+static void reportHandler(int)
+{
+	mir_sdr_device::requestLatencyReport();
+}
 #endif
 
 
@@ -122,7 +131,14 @@ int main(int argc, char* argv[])
 	sigaction(SIGTERM, &sigact, NULL);
 	sigaction(SIGQUIT, &sigact, NULL);
 	sigaction(SIGPIPE, &sigign, NULL);
+	struct sigaction sigreport;
+	sigreport.sa_handler = reportHandler;
+	sigemptyset(&sigreport.sa_mask);
+	sigreport.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sigreport, NULL);
 #endif
+	// keeps the lines in order, when the output is collected by the supervisor or a logger
+	setvbuf(stdout, NULL, _IOLBF, 0);
 
 	std::cout << "\nRSP_tcp V" + Version << std::endl;
 	std::cout << "Copyright (c) softsyst GmbH and Clem Schmidt. All rights reserved" << endl;
@@ -142,8 +158,30 @@ int main(int argc, char* argv[])
 	std::cout << "Frequency = " + to_string(pargs->Frequency) << endl;
 	std::cout << "Gain = " + to_string(pargs->GainReduction) << endl;
 	std::cout << "BitWidth = " + to_string(pargs->BitWidth) << endl;
+	if (pargs->BitWidth == BITS_8)
+	{
+		iq_scale8 scale8;
+		scale8.configure(pargs->scale8Shift, pargs->scale8Gain, pargs->scale8Dither != 0);
+		std::cout << "8 Bit Scaling = " + scale8.description() << endl;
+	}
 	std::cout << "Device Index = " + to_string(pargs->requestedDeviceIndex) << endl;
+	if (!pargs->requestedSerial.empty())
+		std::cout << "Device Serial = " + pargs->requestedSerial << endl;
 	std::cout << "Antenna = " + to_string(pargs->Antenna) << endl;
+	std::cout << "Send Coalescing = " + to_string(pargs->coalesceBytes) + " bytes / " + to_string(pargs->maxLatencyUs) + " us" << endl;
+	std::cout << "Max Clients = " + to_string(pargs->maxClients) << endl;
+	if (pargs->numChannels > 0)
+		std::cout << "Channelizer = " + to_string(pargs->numChannels) + " channels, " + to_string(pargs->channels.size()) + " exported" << endl;
+	if (pargs->correctionMode > 0)
+		std::cout << "Software Correction = " + string(pargs->correctionMode == 2 ? "DC and IQ imbalance" : "DC") + ", " + to_string(pargs->correctionMs) + " ms" << endl;
+	if (pargs->spectrumPort > 0)
+		std::cout << "Spectrum Port = " + to_string(pargs->spectrumPort) << endl;
+	if (pargs->metricsPort > 0)
+		std::cout << "Metrics = " + pargs->metricsAddress.sIPAddress + ":" + to_string(pargs->metricsPort) << endl;
+	if (pargs->prerollSec > 0)
+		std::cout << "Pre-roll = " + to_string(pargs->prerollSec) + " s" << endl;
+	if (!pargs->recordPrefix.empty())
+		std::cout << "Recording = " + pargs->recordPrefix + "_<time>.sigmf-data" + (pargs->recordUnattended ? ", unattended" : "") << endl;
 
 	cout << "\nStarting sdrplay...\n";
 	if (devices::instance().getDevices())
@@ -181,7 +219,10 @@ int main(int argc, char* argv[])
 		}
 		//err = mir_sdr_DebugEnable(1);
 		//cout << "mir_sdr_DebugEnable(1) returned with " << err << endl;
-		devices::instance().Start(pargs);
+		if (pargs->supervisor)
+			rsp_supervisor(pargs).run(devices::instance().mirDevices);
+		else
+			devices::instance().Start(pargs);
 	}
 	else
 	{
@@ -20,8 +20,55 @@
 
 #pragma once
 #include <string>
+#include <stdint.h>
 
 enum eBitWidth { BITS_8 = 1, BITS_16 = 2 };
+// Wire formats of the samples, 1 and 2 are the formats of the bit widths
+enum eSampleFormat
+{
+	 FORMAT_CU8 = 1				// 8 bit unsigned, interleaved I/Q
+	,FORMAT_CS16 = 2			// 16 bit little endian, interleaved I/Q
+	,FORMAT_CS16_BE = 3			// 16 bit big endian, interleaved I/Q
+	,FORMAT_CF32 = 4			// 32 bit float little endian, interleaved I/Q
+	,FORMAT_CS16_PLANAR = 5		// blocks of n I values, followed by n Q values, 16 bit little endian
+	,FORMAT_CF32_PLANAR = 6		// the same, 32 bit float little endian
+	,FORMAT_CS12_PACKED = 7		// 12 bit, 3 bytes per I/Q pair, see iq_convert::pack12
+	,FORMAT_CS14_PACKED = 8		// 14 bit, 7 bytes per two I/Q pairs, see iq_convert::pack14
+	,FORMAT_CS16_LOSSLESS = 9	// 16 bit, losslessly compressed blocks, see iq_compress
+	,FORMAT_BFP = 10			// block floating point, 6..8 bit mantissas, see iq_bfp
+};
+// Extensions announced in the welcome string: "RSPX" at byte 20, followed by these bits (big endian)
+enum eCapabilities
+{
+	 CAP_SAMPLE_FORMATS = 1		// CMD_SET_SAMPLE_FORMAT, CMD_SET_BFP_MANTISSA
+	,CAP_FRAMING = 2			// CMD_SET_FRAMING
+	,CAP_PREROLL = 4			// CMD_REPLAY_HISTORY; bytes 28..31 (big endian): history following the welcome string
+	,CAP_FORMAT_STATE = 8		// byte 6: the eSampleFormat of the stream, bytes 32..35 (big endian): samples per
+								// staged block, byte 36: bfp mantissa bits, byte 37: 1 if framed
+};
+// Framed stream: every block of samples is preceded by a header, all fields little endian.
+// A client finds the first frame after switching by the magic.
+struct streamFrameHeader
+{
+	char magic[4];			// "RSPF"
+	uint16_t headerBytes;	// sizeof(streamFrameHeader), the payload follows
+	uint8_t format;			// eSampleFormat of the payload
+	uint8_t flags;			// eFrameFlags, what happened since the previous frame
+	uint32_t numSamples;
+	uint32_t payloadBytes;
+	uint64_t firstSample;	// absolute index at the output rate, counts on over gaps
+	uint64_t timestampNs;	// host time of the callback of the first sample, ns since 1970 (UTC)
+};
+enum eFrameFlags
+{
+	 FRAME_GAIN_CHANGED = 1		// grChanged of the stream callback
+	,FRAME_RF_CHANGED = 2		// rfChanged
+	,FRAME_FS_CHANGED = 4		// fsChanged
+	,FRAME_API_GAP = 8			// the API skipped samples, see firstSample
+	,FRAME_DROPPED = 16			// the server dropped samples, its ring was full
+	,FRAME_HISTORY = 32			// marker without samples: the frames up to the next marker are history
+	,FRAME_LIVE = 64			// marker without samples: the live stream continues, after the history
+};
 enum eErrors
 {
 	 E_OK = 0
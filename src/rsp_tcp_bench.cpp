@@ -0,0 +1,571 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** rsp_tcp_bench - benchmarks for the streaming path.
+** Needs neither RSP hardware nor the SDRplay library: a synthetic source
+** stands in for the API stream callback.
+**
+** Usage: rsp_tcp_bench [all|convert|command|callback|transport] [seconds]
+**/
+
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "common.h"
+#include "iq_convert.h"
+#include "iq_scale8.h"
+#include "latency_histogram.h"
+#include "sample_ring.h"
+#include "sample_sender.h"
+#include "uring_backend.h"
+using namespace std;
+
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD RUSAGE_SELF
+#endif
+
+// Every allocation of the process is counted: the streaming path must not allocate per packet
+static std::atomic<unsigned long long> s_allocations(0);
+static std::atomic<unsigned long long> s_allocatedBytes(0);
+
+void* operator new(size_t n)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	s_allocatedBytes.fetch_add(n, std::memory_order_relaxed);
+	void* p = malloc(n != 0 ? n : 1);
+	if (p == 0)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// The native rates of mir_sdr_device::samplingConfigs; the bench does not include the API header
+static const int c_samplingRatesHz[] = { 384000, 512000, 1024000, 2048000, 4096000, 8192000 };
+// packet sizes of the stream callback, 1008 is the size of the zero IF modes
+static const int c_packetSizes[] = { 252, 504, 1008 };
+
+struct threadUsage
+{
+	double cpuUs = 0;
+	long contextSwitches = 0;
+
+	void sample()
+	{
+		struct rusage ru;
+		getrusage(RUSAGE_THREAD, &ru);
+		cpuUs = ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec + ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+		contextSwitches = ru.ru_nvcsw + ru.ru_nivcsw;
+	}
+	threadUsage operator-(const threadUsage& o) const
+	{
+		threadUsage d;
+		d.cpuUs = cpuUs - o.cpuUs;
+		d.contextSwitches = contextSwitches - o.contextSwitches;
+		return d;
+	}
+};
+
+/// <summary>
+/// Emulates the API: packets of samplesPerPacket separate I/Q shorts, converted
+/// to 16 bit wire format into coalesced ring blocks like streamCallback does
+/// </summary>
+class synthetic_source
+{
+public:
+	synthetic_source(int samplesPerPacket, int bytesPerSample = 4)
+		: xi(samplesPerPacket), xq(samplesPerPacket), samplesPerPacket(samplesPerPacket),
+		  bytesPerSample(bytesPerSample)
+	{
+		scale8.configure(6, 0, false);
+		for (int i = 0; i < samplesPerPacket; i++)
+		{
+			xi[i] = (short)(8000 * cos(0.01 * i));
+			xq[i] = (short)(8000 * sin(0.01 * i));
+		}
+	}
+
+	// samplingRateHz 0 produces as fast as the ring is drained
+	void run(sample_ring& ring, double samplingRateHz, int coalesceBytes, const std::atomic<bool>& running)
+	{
+		long long start = common::monotonicMicros();
+		unsigned long long samples = 0;
+		sample_ring::block* open = 0;
+		allocatedBytes = s_allocatedBytes.load();
+		while (running)
+		{
+			if (samplingRateHz > 0)
+			{
+				long long due = start + (long long)(samples * 1e6 / samplingRateHz);
+				long long now = common::monotonicMicros();
+				if (due > now)
+					usleep((useconds_t)(due - now));
+			}
+			// the part of the loop, that stands for the callback
+			long long t0 = common::monotonicNanos();
+			int done = 0;
+			while (done < samplesPerPacket)
+			{
+				if (open == 0 && (open = ring.acquire()) == 0)
+				{
+					if (samplingRateHz > 0)
+						break;	// real time: dropped
+					usleep(50);
+					if (!running)
+						return;
+					continue;
+				}
+				int n = samplesPerPacket - done;
+				int room = (open->capacity - open->length) / bytesPerSample;
+				if (n > room)
+					n = room;
+				if (bytesPerSample == 2)
+					scale8.convert(&xi[done], &xq[done], n, open->data + open->length);
+				else
+					iq_convert::interleave16(&xi[done], &xq[done], n, open->data + open->length);
+				open->length += bytesPerSample * n;
+				done += n;
+				if (open->length >= coalesceBytes || open->capacity - open->length < bytesPerSample)
+				{
+					ring.commit();
+					open = 0;
+				}
+			}
+			callbackNs.record(common::monotonicNanos() - t0);
+			samples += samplesPerPacket;
+			packets++;
+		}
+		allocatedBytes = s_allocatedBytes.load() - allocatedBytes;
+	}
+
+	// time per packet, packets and bytes allocated by all threads, during run
+	latency_histogram callbackNs;
+	unsigned long long packets = 0;
+	unsigned long long allocatedBytes = 0;
+
+private:
+	vector<short> xi;
+	vector<short> xq;
+	int samplesPerPacket;
+	int bytesPerSample;
+	iq_scale8 scale8;
+};
+
+struct transportResult
+{
+	double seconds = 0;
+	unsigned long long bytes = 0;
+	unsigned long long syscalls = 0;
+	threadUsage usage;
+	unsigned long long dropped = 0;
+};
+
+static SOCKET listenLoopback(int& port)
+{
+	SOCKET ls = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::bind(ls, (sockaddr*)&a, sizeof(a)) != 0 || listen(ls, 1) != 0)
+		throw msg_exception("cannot listen on loopback");
+	socklen_t len = sizeof(a);
+	getsockname(ls, (sockaddr*)&a, &len);
+	port = ntohs(a.sin_port);
+	return ls;
+}
+
+// The remote client: reads and discards, until 'seconds' are over
+static void sinkClient(int port, double seconds, std::atomic<bool>& running, unsigned long long& received)
+{
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	a.sin_port = htons(port);
+	connect(s, (sockaddr*)&a, sizeof(a));
+	static char buf[1 << 18];
+	long long end = common::monotonicMicros() + (long long)(seconds * 1e6);
+	while (common::monotonicMicros() < end)
+	{
+		int n = recv(s, buf, sizeof(buf), 0);
+		if (n <= 0)
+			break;
+		received += n;
+	}
+	running = false;
+	closesocket(s);
+}
+
+static const int c_samplesPerPacket = 1008;
+static const int c_coalesceBytes = 65536;
+
+static void allocateRing(sample_ring& ring, double samplingRateHz)
+{
+	int blockSize = c_samplesPerPacket * 4 + c_coalesceBytes;
+	int numBlocks = (int)((samplingRateHz > 0 ? samplingRateHz : 8192000) * 4 / 4 / blockSize) + 8;
+	ring.allocate(numBlocks, blockSize, buffer_pool::POOL_DEFAULT);
+}
+
+static transportResult runThreaded(int txMode, double samplingRateHz, double seconds)
+{
+	transportResult r;
+	int port;
+	SOCKET ls = listenLoopback(port);
+	std::atomic<bool> running(true);
+	sample_ring ring;
+	allocateRing(ring, samplingRateHz);
+	synthetic_source source(c_samplesPerPacket);
+
+	unsigned long long received = 0;
+	std::thread client(sinkClient, port, seconds, std::ref(running), std::ref(received));
+	SOCKET s = accept(ls, NULL, NULL);
+	long long start = common::monotonicMicros();
+
+	std::thread producer([&] { source.run(ring, samplingRateHz, c_coalesceBytes, running); });
+	std::thread transmitter([&]
+	{
+		sample_sender sender(ring, s, txMode);
+		threadUsage before, after;
+		before.sample();
+		try
+		{
+			while (running)
+				sender.poll(100, running);
+		}
+		catch (exception&)
+		{
+		}
+		sender.finish(100);
+		after.sample();
+		r.usage = after - before;
+		r.syscalls = sender.systemCalls();
+	});
+	client.join();
+	transmitter.join();
+	producer.join();
+	r.seconds = (common::monotonicMicros() - start) / 1e6;
+	r.bytes = received;
+	r.dropped = ring.droppedBlocks();
+	closesocket(s);
+	closesocket(ls);
+	return r;
+}
+
+class bench_session : public uring_backend::handler
+{
+public:
+	bench_session(sample_ring& ring, std::atomic<bool>& running) : ring(ring), running(running) {}
+	sample_ring* sessionStart(SOCKET) { return &ring; }
+	void command(const char*) {}
+	void sessionEnd() { running = false; }
+private:
+	sample_ring& ring;
+	std::atomic<bool>& running;
+};
+
+static transportResult runUring(double samplingRateHz, double seconds, bool& available)
+{
+	transportResult r;
+	uring_backend backend;
+	available = backend.init();
+	if (!available)
+		return r;
+	int port;
+	SOCKET ls = listenLoopback(port);
+	std::atomic<bool> running(true);
+	std::atomic<bool> serving(true);
+	sample_ring ring;
+	allocateRing(ring, samplingRateHz);
+	synthetic_source source(c_samplesPerPacket);
+	bench_session session(ring, serving);
+
+	unsigned long long received = 0;
+	long long start = common::monotonicMicros();
+	std::thread producer([&] { source.run(ring, samplingRateHz, c_coalesceBytes, running); });
+	std::thread loop([&]
+	{
+		threadUsage before, after;
+		before.sample();
+		try
+		{
+			backend.serve(ls, session, serving);
+		}
+		catch (exception& e)
+		{
+			cout << e.what() << endl;
+		}
+		after.sample();
+		r.usage = after - before;
+	});
+	sinkClient(port, seconds, running, received);
+	loop.join();
+	producer.join();
+	r.seconds = (common::monotonicMicros() - start) / 1e6;
+	r.bytes = received;
+	r.syscalls = backend.enterCalls();
+	r.dropped = ring.droppedBlocks();
+	closesocket(ls);
+	return r;
+}
+
+static void printTransport(const char* name, const transportResult& r)
+{
+	double mb = r.bytes / 1e6;
+	if (mb <= 0)
+		mb = 1e-9;
+	cout << left << setw(10) << name << right << fixed << setprecision(1)
+		<< setw(10) << mb / r.seconds << " MB/s"
+		<< setw(10) << r.syscalls / mb << " syscalls/MB"
+		<< setw(10) << r.usage.contextSwitches / mb << " ctxsw/MB"
+		<< setw(10) << r.usage.cpuUs / mb << " cpu-us/MB"
+		<< setw(8) << r.dropped << " dropped" << endl;
+}
+
+/// <summary>
+/// Transmit backends, unpaced (throughput) and paced at 8 MSPS 16 bit (cost per MB)
+/// </summary>
+static void benchTransport(double seconds)
+{
+	const double rates[] = { 0, 8192000 };
+	for (double rate : rates)
+	{
+		if (rate == 0)
+			cout << "\ntransport, unpaced, loopback TCP:" << endl;
+		else
+			cout << "\ntransport, paced at " << rate << " S/s, 16 bit, loopback TCP:" << endl;
+		for (int mode = sample_sender::TX_SEND; mode <= sample_sender::TX_ZEROCOPY; mode++)
+			printTransport(sample_sender::modeName(mode), runThreaded(mode, rate, seconds));
+		bool available;
+		transportResult r = runUring(rate, seconds, available);
+		if (available)
+			printTransport("io_uring", r);
+	}
+}
+
+static void printRate(const string& name, double ns, unsigned long long samples, unsigned long long packets,
+	unsigned long long allocatedBytes)
+{
+	cout << left << setw(28) << name << right << fixed << setprecision(2)
+		<< setw(10) << ns / samples << " ns/sample"
+		<< setw(10) << samples / (ns / 1e3) << " MS/s"
+		<< setw(10) << (double)allocatedBytes / packets << " bytes allocated/packet" << endl;
+}
+
+/// <summary>
+/// The conversions of mergeIQ: 16 bit interleaving and 8 bit scaling, with and without dither
+/// </summary>
+static void benchConvert(double seconds)
+{
+	cout << "\nconversion (mergeIQ), per packet size:" << endl;
+	for (int samplesPerPacket : c_packetSizes)
+	{
+		vector<short> xi(samplesPerPacket), xq(samplesPerPacket);
+		for (int i = 0; i < samplesPerPacket; i++)
+		{
+			xi[i] = (short)(8000 * cos(0.01 * i));
+			xq[i] = (short)(8000 * sin(0.01 * i));
+		}
+		vector<BYTE> out(samplesPerPacket * 4);
+		iq_scale8 scale8, dither8;
+		scale8.configure(6, 0, false);
+		dither8.configure(6, 0, true);
+		for (int kind = 0; kind < 3; kind++)
+		{
+			unsigned long long packets = 0;
+			unsigned long long allocated = s_allocatedBytes.load();
+			long long t0 = common::monotonicNanos();
+			long long end = t0 + (long long)(seconds / 3 * 1e9);
+			long long now;
+			do
+			{
+				for (int k = 0; k < 256; k++)
+				{
+					if (kind == 0)
+						iq_convert::interleave16(&xi[0], &xq[0], samplesPerPacket, &out[0]);
+					else if (kind == 1)
+						scale8.convert(&xi[0], &xq[0], samplesPerPacket, &out[0]);
+					else
+						dither8.convert(&xi[0], &xq[0], samplesPerPacket, &out[0]);
+				}
+				packets += 256;
+				now = common::monotonicNanos();
+			} while (now < end);
+			const char* names[] = { "16 bit", "8 bit", "8 bit dither" };
+			printRate(string(names[kind]) + ", " + to_string(samplesPerPacket) + " samples", (double)(now - t0),
+				packets * samplesPerPacket, packets, s_allocatedBytes.load() - allocated);
+		}
+	}
+}
+
+/// <summary>
+/// Parsing of the 5 byte commands of the receive thread
+/// </summary>
+static void benchCommand(double seconds)
+{
+	char cmds[256][5];
+	for (int i = 0; i < 256; i++)
+	{
+		cmds[i][0] = (char)(1 + i % 64);
+		for (int k = 1; k < 5; k++)
+			cmds[i][k] = (char)(i * 37 + k * 11);
+	}
+	unsigned long long calls = 0;
+	volatile int sink = 0;
+	long long t0 = common::monotonicNanos();
+	long long end = t0 + (long long)(seconds / 4 * 1e9);
+	long long now;
+	do
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			int value;
+			sink = sink + getCommandAndValue(cmds[i], value) + value;
+		}
+		calls += 256;
+		now = common::monotonicNanos();
+	} while (now < end);
+	cout << "\ncommand parsing (getCommandAndValue): " << fixed << setprecision(2)
+		<< (double)(now - t0) / calls << " ns/command" << endl;
+}
+
+/// <summary>
+/// Callback to socket, paced at the native rates: conversion into coalesced ring blocks,
+/// the transmit thread copying them into the queue of a client (like distribute),
+/// the client's sender writing to a loopback TCP sink.
+/// ns/sample is the time of the callback, MS/s the rate the sink received
+/// </summary>
+static void benchCallback(double seconds)
+{
+	const double runSeconds = seconds / 4;
+	for (int bytesPerSample = 4; bytesPerSample >= 2; bytesPerSample -= 2)
+	{
+		cout << "\ncallback to socket, " << (bytesPerSample == 4 ? 16 : 8) << " bit, loopback TCP:" << endl;
+		for (int rate : c_samplingRatesHz)
+		{
+			for (int samplesPerPacket : c_packetSizes)
+			{
+				int port;
+				SOCKET ls = listenLoopback(port);
+				std::atomic<bool> running(true);
+				sample_ring ring, queue;
+				allocateRing(ring, rate);
+				allocateRing(queue, rate);
+				synthetic_source source(samplesPerPacket, bytesPerSample);
+
+				unsigned long long received = 0;
+				std::thread client(sinkClient, port, runSeconds, std::ref(running), std::ref(received));
+				SOCKET s = accept(ls, NULL, NULL);
+				long long start = common::monotonicMicros();
+				std::thread distributor([&]
+				{
+					while (running)
+					{
+						sample_ring::block* b = ring.peek(100);
+						if (b == 0)
+							continue;
+						sample_ring::block* q = queue.acquire();
+						if (q != 0)
+						{
+							memcpy(q->data, b->data, b->length);
+							q->length = b->length;
+							queue.commit();
+						}
+						ring.release();
+					}
+				});
+				std::thread transmitter([&]
+				{
+					sample_sender sender(queue, s, sample_sender::TX_SEND);
+					try
+					{
+						while (running)
+							sender.poll(100, running);
+					}
+					catch (exception&)
+					{
+					}
+				});
+				// last, the allocations of the other threads' start are not counted
+				std::thread producer([&] { source.run(ring, rate, c_coalesceBytes, running); });
+				client.join();
+				ring.wakeup();
+				queue.wakeup();
+				transmitter.join();
+				distributor.join();
+				producer.join();
+				double secs = (common::monotonicMicros() - start) / 1e6;
+				unsigned long long samples = source.packets * samplesPerPacket;
+				cout << left << setw(28) << (to_string(rate) + " S/s, " + to_string(samplesPerPacket)) << right
+					<< fixed << setprecision(2)
+					<< setw(10) << (samples > 0 ? (double)source.callbackNs.sum() / samples : 0) << " ns/sample"
+					<< setw(10) << received / bytesPerSample / secs / 1e6 << " MS/s"
+					<< setw(10) << (source.packets > 0 ? (double)source.allocatedBytes / source.packets : 0) << " bytes allocated/packet"
+					<< "   callback p99 " << latency_histogram::formatNs(source.callbackNs.percentile(0.99))
+					<< ", dropped " << ring.droppedBlocks() + queue.droppedBlocks() << endl;
+				closesocket(s);
+				closesocket(ls);
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	string what = argc > 1 ? argv[1] : "all";
+	double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+	cout << "rsp_tcp_bench, sample conversion: " << iq_convert::implementation() << endl;
+	try
+	{
+		if (what == "all" || what == "convert")
+			benchConvert(seconds);
+		if (what == "all" || what == "command")
+			benchCommand(seconds);
+		if (what == "all" || what == "callback")
+			benchCallback(seconds);
+		if (what == "all" || what == "transport")
+			benchTransport(seconds);
+	}
+	catch (exception& e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,229 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "sample_ring.h"
+#include <string.h>
+
+sample_ring::storage::storage(int numBlocks, int blockSize, int poolFlags)
+	: pool(numBlocks, blockSize, poolFlags)
+{
+	this->numBlocks = numBlocks;
+	blocks = new block[numBlocks];
+	for (int i = 0; i < numBlocks; i++)
+	{
+		blocks[i].data = pool.buffer(i);
+		blocks[i].length = 0;
+		blocks[i].capacity = blockSize;
+		blocks[i].tag = 0;
+	}
+}
+
+sample_ring::storage::~storage()
+{
+	delete[] blocks;
+}
+
+sample_ring::sample_ring()
+	: pending(0), head(0), tail(0), currentCapacity(0), currentBlockSize(0),
+	locked(false), hugePages(false), hwm(0), dropped(0), consumerSleeping(false)
+{
+	sem_init(&available, 0, 0);
+}
+
+sample_ring::~sample_ring()
+{
+	freeAll();
+	sem_destroy(&available);
+}
+
+void sample_ring::freeAll()
+{
+	// walk the chain of geometries the consumer has not released yet
+	storage* s = oldest;
+	while (s != 0)
+	{
+		storage* n = s->next;
+		if (s == prod)
+			n = 0;
+		delete s;
+		s = n;
+	}
+	delete prodNext;
+	delete pending.exchange(0);
+	prod = cons = oldest = prodNext = 0;
+}
+
+void sample_ring::publishGeometry(const storage* s)
+{
+	currentCapacity.store(s->numBlocks);
+	currentBlockSize.store(s->pool.bufferSize());
+	locked.store(s->pool.isLocked());
+	hugePages.store(s->pool.isHugePages());
+}
+
+void sample_ring::allocate(int numBlocks, int blockSize, int poolFlags)
+{
+	this->poolFlags = poolFlags;
+	if (prod != 0 && prod == oldest && pending.load() == 0 && prodNext == 0 &&
+		prod->numBlocks == numBlocks && prod->pool.bufferSize() == blockSize)
+	{
+		release_all();
+		return;
+	}
+	freeAll();
+	prod = cons = oldest = new storage(numBlocks, blockSize, poolFlags);
+	publishGeometry(prod);
+	release_all();
+}
+
+void sample_ring::resize(int numBlocks, int blockSize)
+{
+	storage* s = new storage(numBlocks, blockSize, poolFlags);
+	// a previous request the producer did not pick up yet is obsolete
+	delete pending.exchange(s);
+}
+
+void sample_ring::release_all()
+{
+	head.store(0);
+	tail.store(0);
+	readPos = 0;
+	while (sem_trywait(&available) == 0)
+		;
+}
+
+// Places the marker into the current geometry, returns false if the ring is full
+bool sample_ring::switchProducer(storage* to)
+{
+	unsigned long long h = head.load(std::memory_order_relaxed);
+	unsigned long long t = tail.load(std::memory_order_acquire);
+	if (h - t >= (unsigned long long)prod->numBlocks)
+		return false;
+	block* b = &prod->blocks[h % prod->numBlocks];
+	b->length = -1;
+	prod->next = to;
+	prod = to;
+	publishGeometry(prod);
+	commit();
+	return true;
+}
+
+sample_ring::block* sample_ring::acquire()
+{
+	if (prodNext == 0 && pending.load(std::memory_order_relaxed) != 0)
+		prodNext = pending.exchange(0, std::memory_order_acquire);
+	if (prodNext != 0 && prod != 0 && switchProducer(prodNext))
+		prodNext = 0;
+
+	unsigned long long h = head.load(std::memory_order_relaxed);
+	unsigned long long t = tail.load(std::memory_order_acquire);
+	if (prod == 0 || h - t >= (unsigned long long)prod->numBlocks)
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	block* b = &prod->blocks[h % prod->numBlocks];
+	b->length = 0;
+	return b;
+}
+
+void sample_ring::commit()
+{
+	unsigned long long h = head.load(std::memory_order_relaxed) + 1;
+	head.store(h, std::memory_order_release);
+
+	int fill = (int)(h - tail.load(std::memory_order_relaxed));
+	if (fill > hwm.load(std::memory_order_relaxed))
+		hwm.store(fill, std::memory_order_relaxed);
+
+	sem_post(&available);
+#ifndef _WIN32
+	if (notifyFd >= 0 && consumerSleeping.exchange(false))
+	{
+		unsigned long long one = 1;
+		if (write(notifyFd, &one, sizeof(one)) < 0)
+			consumerSleeping.store(true);
+	}
+#endif
+}
+
+sample_ring::block* sample_ring::peek(int timeoutMs)
+{
+	timespec timeout = common::getRelativeTimeoutValueMs(timeoutMs);
+	for (;;)
+	{
+		int res = timeoutMs > 0 ? sem_timedwait(&available, &timeout) : sem_trywait(&available);
+		if (res != 0)
+			return 0;
+
+		unsigned long long r = readPos;
+		if (r == head.load(std::memory_order_acquire))
+			return 0;	// woken up without data
+		block* b = &cons->blocks[r % cons->numBlocks];
+		readPos = r + 1;
+		if (b->length >= 0)
+			return b;
+
+		// geometry marker: continue in the new blocks, the old ones
+		// are freed, when all blocks before the marker are released
+		cons->markerPos = r;
+		cons = cons->next;
+		freeRetired();
+	}
+}
+
+void sample_ring::release()
+{
+	tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	freeRetired();
+}
+
+void sample_ring::freeRetired()
+{
+	while (oldest != cons && tail.load(std::memory_order_relaxed) == oldest->markerPos)
+	{
+		storage* n = oldest->next;
+		tail.store(oldest->markerPos + 1, std::memory_order_release);	// the marker itself
+		delete oldest;
+		oldest = n;
+	}
+}
+
+void sample_ring::consumerMemory(const BYTE*& base, size_t& size) const
+{
+	base = cons != 0 ? cons->pool.base() : 0;
+	size = cons != 0 ? cons->pool.bytesAllocated() : 0;
+}
+
+void sample_ring::wakeup()
+{
+	sem_post(&available);
+}
+
+int sample_ring::fillLevel() const
+{
+	return (int)(head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed));
+}
+
+void sample_ring::resetStatistics()
+{
+	hwm.store(0);
+	dropped.store(0);
+}
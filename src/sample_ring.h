@@ -0,0 +1,137 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include "common.h"
+#include "buffer_pool.h"
+#define HAVE_STRUCT_TIMESPEC
+#include <semaphore.h>
+
+/// <summary>
+/// Lock-free single producer / single consumer ring of sample blocks.
+/// The producer is the API stream callback, which must never block,
+/// the consumer is the transmit thread, which may block on the socket.
+/// </summary>
+class sample_ring
+{
+public:
+	struct block
+	{
+		BYTE* data;
+		int length;		// valid bytes in data
+		int capacity;	// size of data
+		int tag;		// set by the producer, e.g. the format of the data
+	};
+
+	sample_ring();
+	~sample_ring();
+
+	// Not thread safe: call only while neither producer nor consumer is running
+	void allocate(int numBlocks, int blockSize, int poolFlags);
+	void release_all();
+
+	// Changes the geometry while streaming. The new blocks are allocated here,
+	// the producer switches to them with its next block and the consumer
+	// frees the old ones, after it has drained them.
+	void resize(int numBlocks, int blockSize);
+
+	int capacity() const { return currentCapacity.load(std::memory_order_relaxed); }
+	int blockSize() const { return currentBlockSize.load(std::memory_order_relaxed); }
+
+	// ---- producer side (stream callback) ----
+	// Returns the next free block or 0, if the ring is full.
+	// A full ring is counted as a dropped block.
+	block* acquire();
+	void commit();
+
+	// ---- consumer side (transmit thread) ----
+	// Returns the next committed block or 0 after timeoutMs (0: don't wait).
+	// Several blocks may be peeked, before they are released in the same order.
+	block* peek(int timeoutMs);
+	void release();
+	// Memory of the blocks, the consumer currently peeks, e.g. to register it
+	void consumerMemory(const BYTE*& base, size_t& size) const;
+	int peekedBlocks() const { return (int)(readPos - tail.load(std::memory_order_relaxed)); }
+	// Wakes up a consumer waiting in peek()
+	void wakeup();
+
+	// For consumers sleeping somewhere else than in peek(), e.g. in io_uring:
+	// while sleeping is announced, the next commit writes to the eventfd
+	void setNotifyFd(int fd) { notifyFd = fd; }
+	void announceSleep(bool sleeping) { consumerSleeping.store(sleeping); }
+
+	// ---- statistics, may be read from any thread ----
+	int fillLevel() const;
+	int highWaterMark() const { return hwm.load(std::memory_order_relaxed); }
+	unsigned long long droppedBlocks() const { return dropped.load(std::memory_order_relaxed); }
+	void resetStatistics();
+	bool isLocked() const { return locked.load(std::memory_order_relaxed); }
+	bool isHugePages() const { return hugePages.load(std::memory_order_relaxed); }
+
+private:
+	sample_ring(sample_ring const&);		// Don't Implement
+	void operator=(sample_ring const&);		// Don't implement
+
+	// One ring geometry. A block with negative length is the marker,
+	// that the producer continues in 'next', found by the consumer at markerPos.
+	struct storage
+	{
+		storage(int numBlocks, int blockSize, int poolFlags);
+		~storage();
+		buffer_pool pool;
+		block* blocks;
+		int numBlocks;
+		storage* next = 0;
+		unsigned long long markerPos = 0;
+	};
+	void freeAll();
+	bool switchProducer(storage* to);
+	void freeRetired();
+	void publishGeometry(const storage* s);
+
+	storage* prod = 0;		// used by the producer only
+	storage* prodNext = 0;	// taken from pending, waiting for a free block for the marker
+	storage* cons = 0;		// peeked by the consumer
+	storage* oldest = 0;	// released by the consumer, cons or older
+	std::atomic<storage*> pending;
+	int poolFlags = 0;
+
+	// head: next block to be written by the producer
+	// tail: next block to be read by the consumer
+	// both count monotonically, the index is count % numBlocks. The counts are
+	// 64 bit: numBlocks is no power of two, a wrapping 32 bit count would
+	// alias the slots.
+	std::atomic<unsigned long long> head;
+	std::atomic<unsigned long long> tail;
+	unsigned long long readPos = 0;	// next block to be peeked, tail <= readPos <= head
+
+	std::atomic<int> currentCapacity;
+	std::atomic<int> currentBlockSize;
+	std::atomic<bool> locked;
+	std::atomic<bool> hugePages;
+	std::atomic<int> hwm;
+	std::atomic<unsigned long long> dropped;
+
+	// counts committed blocks, lets the consumer sleep while the ring is empty
+	sem_t available;
+	int notifyFd = -1;
+	std::atomic<bool> consumerSleeping;
+};
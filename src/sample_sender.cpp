@@ -0,0 +1,331 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "sample_sender.h"
+#include <iostream>
+#include <string.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
+using namespace std;
+
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#else
+#define MSG_ZEROCOPY 0
+#endif
+
+sample_sender::sample_sender(sample_ring& ring, SOCKET sock, int mode)
+	: ring(&ring), sock(sock), txMode(mode), sentBytes(0), calls(0), syscalls(0),
+	  stalls(0), blockedNs(0), partials(0)
+{
+#ifdef _WIN32
+	txMode = TX_SEND;
+#else
+	if (txMode == TX_ZEROCOPY)
+	{
+#ifdef HAVE_ZEROCOPY
+		int one = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+		{
+			cout << "SO_ZEROCOPY not supported (" << errno << "), using gather mode" << endl;
+			txMode = TX_GATHER;
+		}
+#else
+		txMode = TX_GATHER;
+#endif
+	}
+#endif
+	memset(inFlight, 0, sizeof(inFlight));
+}
+
+sample_sender::~sample_sender()
+{
+}
+
+const char* sample_sender::modeName(int mode)
+{
+	switch (mode)
+	{
+	case TX_GATHER: return "gather";
+	case TX_ZEROCOPY: return "zerocopy";
+	default: return "send";
+	}
+}
+
+bool sample_sender::waitWritable(const std::atomic<bool>& running)
+{
+	long long t0 = common::monotonicNanos();
+	while (running)
+	{
+		fd_set writefds;
+		struct timeval tv = { 1,0 };
+		FD_ZERO(&writefds);
+		FD_SET(sock, &writefds);
+		int res = select(sock + 1, NULL, &writefds, NULL, &tv);
+		syscalls.fetch_add(1, std::memory_order_relaxed);
+		if (res > 0)
+		{
+			long long waited = common::monotonicNanos() - t0;
+			selectWait.record(waited);
+			blockedNs.fetch_add(waited, std::memory_order_relaxed);
+			if (waited >= c_stallUs * 1000LL)
+				stalls.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		if (res == 0)
+		{
+			// network stall: the ring keeps buffering, meanwhile collect completions
+			if (txMode == TX_ZEROCOPY)
+				readCompletions(false);
+			continue;
+		}
+		if (errno != EINTR)
+			throw msg_exception("socket error " + to_string(errno));
+	}
+	return false;
+}
+
+/// <summary>
+/// Writes a complete buffer to the socket
+/// </summary>
+void sample_sender::sendBuffer(const BYTE* buf, int buflen, const std::atomic<bool>& running)
+{
+	int remaining = buflen;
+	while (remaining > 0 && waitWritable(running))
+	{
+		long long t0 = common::monotonicNanos();
+		int sent = send(sock, (const char*)buf + (buflen - remaining), remaining, 0);
+		sendCall.record(common::monotonicNanos() - t0);
+		calls.fetch_add(1, std::memory_order_relaxed);
+		syscalls.fetch_add(1, std::memory_order_relaxed);
+		if (sent == SOCKET_ERROR)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+				continue;
+			throw msg_exception("socket error " + to_string(errno));
+		}
+		if (sent < remaining)
+			partials.fetch_add(1, std::memory_order_relaxed);
+		remaining -= sent;
+		sentBytes.fetch_add(sent, std::memory_order_relaxed);
+	}
+}
+
+/// <summary>
+/// Writes several blocks with as few sendmsg calls as possible
+/// </summary>
+void sample_sender::sendGather(sample_ring::block** blocks, int numBlocks, int flags, const std::atomic<bool>& running)
+{
+#ifndef _WIN32
+	struct iovec iov[c_maxBlocksPerSend];
+	int first = 0;
+	size_t remaining = 0;
+	for (int i = 0; i < numBlocks; i++)
+	{
+		iov[i].iov_base = blocks[i]->data;
+		iov[i].iov_len = blocks[i]->length;
+		remaining += blocks[i]->length;
+	}
+	while (first < numBlocks && waitWritable(running))
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + first;
+		msg.msg_iovlen = numBlocks - first;
+		long long t0 = common::monotonicNanos();
+		ssize_t sent = sendmsg(sock, &msg, flags);
+		sendCall.record(common::monotonicNanos() - t0);
+		calls.fetch_add(1, std::memory_order_relaxed);
+		syscalls.fetch_add(1, std::memory_order_relaxed);
+		if (sent < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+				continue;
+			if (errno == ENOBUFS && (flags & MSG_ZEROCOPY) != 0)
+			{
+				// too many notifications pending: wait for the kernel
+				readCompletions(true);
+				continue;
+			}
+			throw msg_exception("socket error " + to_string(errno));
+		}
+		if ((size_t)sent < remaining)
+			partials.fetch_add(1, std::memory_order_relaxed);
+		remaining -= sent;
+		sentBytes.fetch_add(sent, std::memory_order_relaxed);
+		if (flags & MSG_ZEROCOPY)
+		{
+			// the blocks completed by this call are released with its notification
+			int done = 0;
+			size_t n = (size_t)sent;
+			while (first < numBlocks && n >= iov[first].iov_len)
+			{
+				n -= iov[first].iov_len;
+				first++;
+				done++;
+			}
+			inFlight[nextId % c_maxZerocopyInFlight] = done;
+			nextId++;
+			if (first < numBlocks)
+			{
+				iov[first].iov_base = (char*)iov[first].iov_base + n;
+				iov[first].iov_len -= n;
+			}
+			if (nextId - completedId >= (unsigned)c_maxZerocopyInFlight)
+				readCompletions(true);
+		}
+		else
+		{
+			size_t n = (size_t)sent;
+			while (first < numBlocks && n >= iov[first].iov_len)
+			{
+				n -= iov[first].iov_len;
+				first++;
+			}
+			if (first < numBlocks)
+			{
+				iov[first].iov_base = (char*)iov[first].iov_base + n;
+				iov[first].iov_len -= n;
+			}
+		}
+	}
+#endif
+}
+
+/// <summary>
+/// Reads zerocopy notifications from the socket error queue and
+/// releases the blocks of all completed sends to the producer
+/// </summary>
+void sample_sender::readCompletions(bool wait)
+{
+#ifdef HAVE_ZEROCOPY
+	for (;;)
+	{
+		if (completedId == nextId)
+			return;
+		if (wait)
+		{
+			struct pollfd pfd = { sock, 0, 0 };	// POLLERR is always reported
+			::poll(&pfd, 1, 100);
+			syscalls.fetch_add(1, std::memory_order_relaxed);
+		}
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		wait = false;	// poll once at most
+		syscalls.fetch_add(1, std::memory_order_relaxed);
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return;
+			throw msg_exception("socket error queue " + to_string(errno));
+		}
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != 0; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{
+				if (copied++ == 0)
+					cout << "zerocopy: the kernel copies on this route (e.g. loopback), consider gather mode" << endl;
+			}
+			// [ee_info, ee_data] is a range of completed ids, TCP completes them in order
+			unsigned hi = serr->ee_data + 1;
+			while ((int)(hi - completedId) > 0)
+			{
+				int n = inFlight[completedId % c_maxZerocopyInFlight];
+				for (int i = 0; i < n; i++)
+					ring->release();
+				completedId++;
+			}
+		}
+	}
+#endif
+}
+
+void sample_sender::poll(int timeoutMs, const std::atomic<bool>& running)
+{
+	if (txMode == TX_ZEROCOPY)
+	{
+		readCompletions(false);
+		// don't sleep long, while the kernel may complete sends
+		if (completedId != nextId && timeoutMs > 1)
+			timeoutMs = 1;
+	}
+
+	sample_ring::block* b = ring->peek(timeoutMs);
+	if (b == 0)
+		return;
+
+	if (txMode == TX_SEND)
+	{
+		sendBuffer(b->data, b->length, running);
+		ring->release();
+		return;
+	}
+
+	// everything else, that is already queued, goes with the same call
+	sample_ring::block* blocks[c_maxBlocksPerSend];
+	int n = 0;
+	blocks[n++] = b;
+	while (n < c_maxBlocksPerSend && (b = ring->peek(0)) != 0)
+		blocks[n++] = b;
+
+	if (txMode == TX_ZEROCOPY)
+	{
+#ifdef HAVE_ZEROCOPY
+		sendGather(blocks, n, MSG_ZEROCOPY, running);
+#endif
+		return;	// released by readCompletions
+	}
+	sendGather(blocks, n, 0, running);
+	for (int i = 0; i < n; i++)
+		ring->release();
+}
+
+void sample_sender::finish(int timeoutMs)
+{
+	long long end = common::monotonicMicros() + (long long)timeoutMs * 1000;
+	while (txMode == TX_ZEROCOPY && completedId != nextId && common::monotonicMicros() < end)
+	{
+		try
+		{
+			readCompletions(true);
+		}
+		catch (exception&)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,104 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include "common.h"
+#include "sample_ring.h"
+#include "latency_histogram.h"
+
+/// <summary>
+/// Drains a sample_ring to a socket, on the transmit thread.
+/// TX_SEND sends block by block, TX_GATHER sends all queued blocks with one
+/// sendmsg, TX_ZEROCOPY additionally lets the kernel transmit directly from
+/// the ring (Linux MSG_ZEROCOPY); those blocks are released to the producer
+/// only when the kernel reports their completion.
+/// </summary>
+class sample_sender
+{
+public:
+	enum eTxMode { TX_SEND = 0, TX_GATHER = 1, TX_ZEROCOPY = 2 };
+
+	sample_sender(sample_ring& ring, SOCKET sock, int mode);
+	~sample_sender();
+
+	// Sends what is queued, waits up to timeoutMs for data.
+	// Throws msg_exception on socket errors.
+	void poll(int timeoutMs, const std::atomic<bool>& running);
+
+	// Waits for outstanding zerocopy completions, before the ring is reused
+	void finish(int timeoutMs);
+	// No zerocopy send waits for its completion, all peeked blocks are released
+	bool idle() const { return completedId == nextId; }
+	// Continues with another ring, when idle()
+	void setRing(sample_ring& r) { ring = &r; }
+
+	int mode() const { return txMode; }
+	static const char* modeName(int mode);
+
+	unsigned long long bytesSent() const { return sentBytes.load(std::memory_order_relaxed); }
+	unsigned long long sendCalls() const { return calls.load(std::memory_order_relaxed); }
+	// select, send, sendmsg and error queue reads
+	unsigned long long systemCalls() const { return syscalls.load(std::memory_order_relaxed); }
+	unsigned long long zerocopyCopied() const { return copied; }
+	// waits of at least c_stallUs for a writable socket, and the time blocked in all waits
+	unsigned long long sendStalls() const { return stalls.load(std::memory_order_relaxed); }
+	unsigned long long blockedMicros() const { return blockedNs.load(std::memory_order_relaxed) / 1000; }
+	// sends, the socket took only a part of
+	unsigned long long partialWrites() const { return partials.load(std::memory_order_relaxed); }
+
+	// ns blocked in select per send, and spent in send / sendmsg
+	const latency_histogram& selectLatency() const { return selectWait; }
+	const latency_histogram& sendLatency() const { return sendCall; }
+
+	static const int c_stallUs = 10000;
+
+private:
+	sample_sender(sample_sender const&);		// Don't Implement
+	void operator=(sample_sender const&);		// Don't implement
+
+	static const int c_maxBlocksPerSend = 64;	// IOV_MAX is at least 1024
+	static const int c_maxZerocopyInFlight = 256;
+
+	bool waitWritable(const std::atomic<bool>& running);
+	void sendBuffer(const BYTE* buf, int buflen, const std::atomic<bool>& running);
+	void sendGather(sample_ring::block** blocks, int numBlocks, int flags, const std::atomic<bool>& running);
+	void readCompletions(bool wait);
+
+	sample_ring* ring;
+	SOCKET sock;
+	int txMode;
+
+	// zerocopy bookkeeping: every successful sendmsg gets the next notification id,
+	// inFlight[] holds the number of blocks to release, when that id completes
+	unsigned nextId = 0;
+	unsigned completedId = 0;	// all ids below are completed
+	int inFlight[c_maxZerocopyInFlight];
+	unsigned long long copied = 0;	// completions, the kernel had to copy anyway
+
+	std::atomic<unsigned long long> sentBytes;
+	std::atomic<unsigned long long> calls;
+	std::atomic<unsigned long long> syscalls;
+	std::atomic<unsigned long long> stalls;
+	std::atomic<unsigned long long> blockedNs;
+	std::atomic<unsigned long long> partials;
+	latency_histogram selectWait;
+	latency_histogram sendCall;
+};
@@ -0,0 +1,545 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "sigmf_recorder.h"
+#include "iq_convert.h"
+#include <iostream>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+using namespace std;
+
+std::atomic<int> sigmf_recorder::s_openFd(-1);
+std::atomic<long long> sigmf_recorder::s_openBytes(0);
+std::atomic<bool> sigmf_recorder::s_closeRequested(false);
+
+sigmf_recorder::sigmf_recorder()
+	: rateHz_(0), frequencyHz_(0), gainReductionDb_(0), working(false)
+{
+}
+
+sigmf_recorder::~sigmf_recorder()
+{
+	stop();
+}
+
+void sigmf_recorder::open(const string& prefix, const string& hardware)
+{
+	this->prefix = prefix;
+	this->hardware = hardware;
+}
+
+/// <summary>
+/// Called before the stream starts: the recording is opened by the writer,
+/// with the first record in the ring
+/// </summary>
+void sigmf_recorder::start(int rateHz, int frequencyHz, int gainReductionDb)
+{
+	stop();
+	rateHz_ = rate = rateHz;
+	frequencyHz_ = frequency = frequencyHz;
+	gainReductionDb_ = gainReduction = gainReductionDb;
+	int blocks = (int)((long long)rateHz * c_bufferMs / 1000 / c_blockSamples) + 1;
+	ring.allocate(blocks < c_minBlocks ? c_minBlocks : blocks, (int)sizeof(record) + c_blockSamples * 4, 0);
+	openBlock = 0;
+	lost = 0;
+	emit(RECORD_START, 0);
+	working = true;
+	pthread_create(&thrdWork, NULL, recorderWork, this);
+}
+
+/// <summary>
+/// Called after the stream has stopped, the writer drains the ring and closes the recording
+/// </summary>
+void sigmf_recorder::stop()
+{
+	if (!working)
+		return;
+	commitOpen();
+	working = false;
+	ring.wakeup();
+	pthread_join(thrdWork, NULL);
+	ring.release_all();
+}
+
+void sigmf_recorder::commitOpen()
+{
+	if (openBlock == 0)
+		return;
+	ring.commit();
+	openBlock = 0;
+}
+
+/// <summary>
+/// Producer: a record without samples, after the samples before it
+/// </summary>
+/// <returns>false, if the ring is full</returns>
+bool sigmf_recorder::emit(int type, int numSamples)
+{
+	commitOpen();
+	sample_ring::block* b = ring.acquire();
+	if (b == 0)
+		return false;
+	record* r = (record*)b->data;
+	r->type = type;
+	r->numSamples = numSamples;
+	r->rateHz = rate;
+	r->frequencyHz = frequency;
+	r->gainReductionDb = gainReduction;
+	r->reserved = 0;
+	r->timeNs = common::realtimeNanos();
+	b->length = sizeof(record);
+	ring.commit();
+	return true;
+}
+
+void sigmf_recorder::push(const short* xi, const short* xq, int numSamples)
+{
+	// the settings are noted, before the samples they apply to.
+	// If the ring is full, they are noted with the next samples, which get through
+	int r = rateHz_.load(std::memory_order_relaxed);
+	int f = frequencyHz_.load(std::memory_order_relaxed);
+	int g = gainReductionDb_.load(std::memory_order_relaxed);
+	if (r != rate)
+	{
+		int oldRate = rate, oldFrequency = frequency, oldGain = gainReduction;
+		rate = r;
+		frequency = f;
+		gainReduction = g;
+		if (!emit(RECORD_START, 0))
+		{
+			rate = oldRate;
+			frequency = oldFrequency;
+			gainReduction = oldGain;
+			lost += numSamples;
+			return;
+		}
+		// the samples lost belong to the previous recording
+		lost = 0;
+	}
+	if (f != frequency)
+	{
+		frequency = f;
+		if (!emit(RECORD_RETUNE, 0))
+		{
+			frequency = -1;
+			lost += numSamples;
+			return;
+		}
+	}
+	if (g != gainReduction)
+	{
+		gainReduction = g;
+		if (!emit(RECORD_GAIN, 0))
+		{
+			gainReduction = -1;
+			lost += numSamples;
+			return;
+		}
+	}
+
+	while (numSamples > 0)
+	{
+		if (openBlock == 0)
+		{
+			if (lost > 0)
+			{
+				if (!emit(RECORD_DROPPED, lost > 0x7fffffff ? 0x7fffffff : (int)lost))
+				{
+					lost += numSamples;
+					return;
+				}
+				lost = 0;
+			}
+			openBlock = ring.acquire();
+			if (openBlock == 0)
+			{
+				lost += numSamples;
+				return;
+			}
+			record* h = (record*)openBlock->data;
+			memset(h, 0, sizeof(record));
+			h->type = RECORD_SAMPLES;
+			openBlock->length = sizeof(record);
+		}
+		record* h = (record*)openBlock->data;
+		int n = c_blockSamples - h->numSamples;
+		if (n > numSamples)
+			n = numSamples;
+		iq_convert::interleave16(xi, xq, n, openBlock->data + openBlock->length);
+		openBlock->length += n * 4;
+		h->numSamples += n;
+		if (h->numSamples == c_blockSamples)
+			commitOpen();
+		xi += n;
+		xq += n;
+		numSamples -= n;
+	}
+}
+
+/// <summary>
+/// Writer thread: moves the records of the ring into the files, until the recorder is stopped
+/// and the ring is drained, or a shutdown by signal closes the recording at once
+/// </summary>
+void* recorderWork(void* p)
+{
+	sigmf_recorder* r = (sigmf_recorder*)p;
+#ifndef _WIN32
+	// the signal handler waits for this thread, it must run on another one
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGQUIT);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+#endif
+	for (;;)
+	{
+		if (sigmf_recorder::s_closeRequested)
+			break;
+		bool last = !r->working;
+		sample_ring::block* b = r->ring.peek(last ? 0 : 100);
+		if (b == 0)
+		{
+			if (last)
+				break;
+			continue;
+		}
+		r->process(*(const sigmf_recorder::record*)b->data, b->data + sizeof(sigmf_recorder::record));
+		r->ring.release();
+	}
+	r->closeRecording();
+	return 0;
+}
+
+void sigmf_recorder::process(const record& r, const BYTE* payload)
+{
+	bool recording = fd >= 0 || file != 0;
+	switch (r.type)
+	{
+	case RECORD_START:
+		closeRecording();
+		openRecording(r);
+		break;
+	case RECORD_SAMPLES:
+		if (!recording)
+			break;
+		write(payload, (size_t)r.numSamples * 4);
+		samplesWritten += r.numSamples;
+		break;
+	case RECORD_RETUNE:
+		if (!recording)
+			break;
+		// one capture per sample index
+		if (captures.back().sampleStart == samplesWritten)
+		{
+			captures.back().frequencyHz = r.frequencyHz;
+			captures.back().timeNs = r.timeNs;
+		}
+		else
+		{
+			capture c = { samplesWritten, r.frequencyHz, r.timeNs };
+			captures.push_back(c);
+		}
+		annotate("retune", "tuned to " + to_string(r.frequencyHz) + " Hz");
+		break;
+	case RECORD_GAIN:
+		if (recording)
+			annotate("gain", "gain reduction " + to_string(r.gainReductionDb) + " dB");
+		break;
+	case RECORD_DROPPED:
+		if (!recording)
+			break;
+		samplesDropped += r.numSamples;
+		annotate("dropped", to_string(r.numSamples) + " samples lost, the recorder was too slow");
+		break;
+	default:
+		break;
+	}
+}
+
+bool sigmf_recorder::openRecording(const record& r)
+{
+	string base = prefix + "_" + isoTime(r.timeNs, true);
+	baseName = base;
+	struct stat st;
+	for (int n = 2; stat((baseName + ".sigmf-data").c_str(), &st) == 0; n++)
+		baseName = base + "_" + to_string(n);
+	string dataName = baseName + ".sigmf-data";
+#ifdef _WIN32
+	file = fopen(dataName.c_str(), "wb");
+	bool opened = file != 0;
+#else
+	fd = ::open(dataName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	bool opened = fd >= 0;
+	s_openBytes = 0;
+	s_openFd = fd;
+#endif
+	if (!opened)
+	{
+		cout << "Recording: cannot create " << dataName << ": " << strerror(errno) << endl;
+		return false;
+	}
+	recordingRateHz = r.rateHz;
+	recordingGainReduction = r.gainReductionDb;
+	recordingStartNs = r.timeNs;
+	captures.clear();
+	capture c = { 0, r.frequencyHz, r.timeNs };
+	captures.push_back(c);
+	annotations.clear();
+	samplesWritten = 0;
+	samplesDropped = 0;
+	fileBytes = 0;
+	segment = 0;
+	segmentOffset = 0;
+	segmentFill = 0;
+	failed = false;
+	// a recording, which is not closed properly, is still described
+	writeMeta();
+	cout << "Recording to " << dataName << ", " << r.rateHz << " Hz" << endl;
+	return true;
+}
+
+void sigmf_recorder::closeRecording()
+{
+	if (fd < 0 && file == 0)
+		return;
+#ifdef _WIN32
+	fclose(file);
+	file = 0;
+#else
+	unmapSegment();
+	// the preallocated rest of the last segment
+	if (ftruncate(fd, (off_t)fileBytes) != 0)
+		cout << "Recording: cannot truncate " << baseName << ".sigmf-data: " << strerror(errno) << endl;
+	close(fd);
+	fd = -1;
+#endif
+	writeMeta();
+	cout << "Recording " << baseName << " closed: " << samplesWritten << " samples, "
+		<< captures.size() << " capture(s), " << samplesDropped << " samples lost" << endl;
+#ifndef _WIN32
+	// closed, for closeOnSignal
+	s_openFd = -1;
+#endif
+}
+
+void sigmf_recorder::write(const BYTE* data, size_t length)
+{
+	if (failed)
+		return;
+#ifdef _WIN32
+	if (fwrite(data, 1, length, file) != length)
+	{
+		cout << "Recording: write error, " << baseName << " ends here" << endl;
+		failed = true;
+		return;
+	}
+	fileBytes += length;
+#else
+	while (length > 0)
+	{
+		if (segment == 0 && !mapSegment())
+		{
+			failed = true;
+			return;
+		}
+		size_t n = c_segmentBytes - segmentFill;
+		if (n > length)
+			n = length;
+		memcpy(segment + segmentFill, data, n);
+		segmentFill += n;
+		fileBytes += n;
+		data += n;
+		length -= n;
+		if (segmentFill == c_segmentBytes)
+		{
+			unmapSegment();
+			// the description so far, for a recording that is not closed
+			writeMeta();
+		}
+	}
+	s_openBytes.store((long long)fileBytes, std::memory_order_relaxed);
+#endif
+}
+
+void sigmf_recorder::closeOnSignal()
+{
+#ifndef _WIN32
+	s_closeRequested = true;
+	for (int ms = 0; ms < c_signalCloseMs && s_openFd.load() >= 0; ms += 10)
+		usleep(10000);
+	// the writer is stuck, the data file at least ends with the last sample written
+	int f = s_openFd.load();
+	if (f >= 0)
+	{
+		int res = ftruncate(f, (off_t)s_openBytes.load());
+		(void)res;
+	}
+#endif
+}
+
+/// <summary>
+/// Allocates the next segment of the data file on the disk, before it is mapped:
+/// a full disk shows up here, not as a SIGBUS at a store into the mapping
+/// </summary>
+bool sigmf_recorder::mapSegment()
+{
+#ifndef _WIN32
+	segmentOffset = fileBytes;
+	int err = posix_fallocate(fd, (off_t)segmentOffset, (off_t)c_segmentBytes);
+	if (err != 0)
+	{
+		cout << "Recording: cannot allocate " << (c_segmentBytes >> 20) << " MB for " << baseName
+			<< ".sigmf-data: " << strerror(err) << ", the recording ends here" << endl;
+		return false;
+	}
+	void* p = mmap(NULL, c_segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)segmentOffset);
+	if (p == MAP_FAILED)
+	{
+		cout << "Recording: cannot map " << baseName << ".sigmf-data: " << strerror(errno)
+			<< ", the recording ends here" << endl;
+		return false;
+	}
+	segment = (BYTE*)p;
+	segmentFill = 0;
+#endif
+	return true;
+}
+
+void sigmf_recorder::unmapSegment()
+{
+#ifndef _WIN32
+	if (segment == 0)
+		return;
+	// the kernel writes the pages back, the writer does not wait for the disk
+	munmap(segment, c_segmentBytes);
+	segment = 0;
+	segmentFill = 0;
+#endif
+}
+
+void sigmf_recorder::annotate(const string& label, const string& comment)
+{
+	annotation a = { samplesWritten, label, comment };
+	annotations.push_back(a);
+}
+
+/// <summary>
+/// Writes the .sigmf-meta of the current recording, replaced at every call
+/// </summary>
+void sigmf_recorder::writeMeta() const
+{
+	string s = "{\n";
+	s += "    \"global\": {\n";
+	s += "        \"core:datatype\": \"ci16_le\",\n";
+	s += "        \"core:sample_rate\": " + to_string(recordingRateHz) + ",\n";
+	s += "        \"core:version\": \"1.0.0\",\n";
+	s += "        \"core:num_channels\": 1,\n";
+	s += "        \"core:recorder\": \"rsp_tcp\",\n";
+	if (!hardware.empty())
+		s += "        \"core:hw\": " + jsonString(hardware) + ",\n";
+	s += "        \"core:extensions\": [ { \"name\": \"rsp_tcp\", \"version\": \"1.0.0\", \"optional\": true } ],\n";
+	s += "        \"rsp_tcp:gain_reduction_db\": " + to_string(recordingGainReduction) + ",\n";
+	s += "        \"rsp_tcp:samples_lost\": " + to_string(samplesDropped) + "\n";
+	s += "    },\n";
+	s += "    \"captures\": [";
+	for (size_t i = 0; i < captures.size(); i++)
+	{
+		const capture& c = captures[i];
+		s += i == 0 ? "\n" : ",\n";
+		s += "        { \"core:sample_start\": " + to_string(c.sampleStart)
+			+ ", \"core:frequency\": " + to_string(c.frequencyHz)
+			+ ", \"core:datetime\": \"" + isoTime(c.timeNs, false) + "\" }";
+	}
+	s += "\n    ],\n";
+	s += "    \"annotations\": [";
+	for (size_t i = 0; i < annotations.size(); i++)
+	{
+		const annotation& a = annotations[i];
+		s += i == 0 ? "\n" : ",\n";
+		s += "        { \"core:sample_start\": " + to_string(a.sampleStart)
+			+ ", \"core:label\": " + jsonString(a.label)
+			+ ", \"core:comment\": " + jsonString(a.comment) + " }";
+	}
+	s += annotations.empty() ? "]\n" : "\n    ]\n";
+	s += "}\n";
+
+	string metaName = baseName + ".sigmf-meta";
+	FILE* f = fopen(metaName.c_str(), "wb");
+	if (f == 0 || fwrite(s.data(), 1, s.size(), f) != s.size())
+		cout << "Recording: cannot write " << metaName << endl;
+	if (f != 0)
+		fclose(f);
+}
+
+/// <summary>
+/// ISO 8601 in UTC, compact for file names: 20171231T235959Z, else 2017-12-31T23:59:59.123456Z
+/// </summary>
+string sigmf_recorder::isoTime(long long timeNs, bool compact)
+{
+	time_t t = (time_t)(timeNs / 1000000000);
+	struct tm tm;
+#ifdef _WIN32
+	gmtime_s(&tm, &t);
+#else
+	gmtime_r(&t, &tm);
+#endif
+	char buf[64];
+	if (compact)
+		strftime(buf, sizeof(buf), "%Y%m%dT%H%M%SZ", &tm);
+	else
+	{
+		size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+		snprintf(buf + n, sizeof(buf) - n, ".%06dZ", (int)(timeNs % 1000000000 / 1000));
+	}
+	return buf;
+}
+
+string sigmf_recorder::jsonString(const string& s)
+{
+	string out = "\"";
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}
+		else
+			out += (char)c;
+	}
+	return out + "\"";
+}
@@ -0,0 +1,164 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "common.h"
+#include "sample_ring.h"
+
+void* recorderWork(void* p);
+
+/// <summary>
+/// Records the I/Q stream to disk as a SigMF recording: the samples in prefix_time.sigmf-data,
+/// 16 bit little endian interleaved (ci16_le), the description in prefix_time.sigmf-meta.
+/// Retunes start a new capture segment and are annotated, gain changes and lost samples too.
+/// A new sampling rate cannot be described in one recording, it starts the next one.
+/// The stream callback copies into a ring of its own, a writer thread moves the blocks into
+/// preallocated, memory mapped segments of the data file.
+/// </summary>
+class sigmf_recorder
+{
+public:
+	sigmf_recorder();
+	~sigmf_recorder();
+
+	/// <summary>
+	/// The recordings are named prefix_yyyymmddThhmmssZ, hardware is noted in the metadata
+	/// </summary>
+	void open(const std::string& prefix, const std::string& hardware);
+
+	// Starts / stops the recording with the stream of the device
+	void start(int rateHz, int frequencyHz, int gainReductionDb);
+	void stop();
+	// noted at the next samples of the stream
+	void setRate(int rateHz) { rateHz_ = rateHz; }
+	void setFrequency(int frequencyHz) { frequencyHz_ = frequencyHz; }
+	void setGainReduction(int gainReductionDb) { gainReductionDb_ = gainReductionDb; }
+
+	// ---- producer side (stream callback) ----
+	void push(const short* xi, const short* xq, int numSamples);
+
+	// For a shutdown by signal, which does not stop the recorder, async signal safe:
+	// the writer closes the recording being written, truncated and with its full description.
+	// Waits up to c_signalCloseMs for it, then only cuts the preallocated rest off the data file
+	static void closeOnSignal();
+
+private:
+	sigmf_recorder(sigmf_recorder const&);		// Don't Implement
+	void operator=(sigmf_recorder const&);		// Don't implement
+
+	friend void* recorderWork(void* p);
+
+	enum eRecord
+	{
+		RECORD_SAMPLES = 0		// numSamples interleaved samples follow
+		, RECORD_START = 1		// a new recording, at rateHz
+		, RECORD_RETUNE = 2		// a new capture segment at frequencyHz
+		, RECORD_GAIN = 3		// gainReductionDb changed
+		, RECORD_DROPPED = 4	// numSamples lost, the ring was full
+	};
+	// Starts every block of the ring
+	struct record
+	{
+		int32_t type;			// eRecord
+		int32_t numSamples;
+		int32_t rateHz;
+		int32_t frequencyHz;
+		int32_t gainReductionDb;
+		int32_t reserved;
+		int64_t timeNs;			// host time, ns since 1970 (UTC)
+	};
+	struct capture
+	{
+		unsigned long long sampleStart;
+		int frequencyHz;
+		long long timeNs;
+	};
+	struct annotation
+	{
+		unsigned long long sampleStart;
+		std::string label;
+		std::string comment;
+	};
+
+	// producer
+	bool emit(int type, int numSamples);
+	void commitOpen();
+	// writer
+	void process(const record& r, const BYTE* payload);
+	bool openRecording(const record& r);
+	void closeRecording();
+	void write(const BYTE* data, size_t length);
+	bool mapSegment();
+	void unmapSegment();
+	void writeMeta() const;
+	void annotate(const std::string& label, const std::string& comment);
+	static std::string isoTime(long long timeNs, bool compact);
+	static std::string jsonString(const std::string& s);
+
+	static const int c_blockSamples = 16384;
+	static const int c_bufferMs = 1000;			// ring, the writer may stall on the disk that long
+	static const int c_minBlocks = 8;
+	static const size_t c_segmentBytes = (size_t)64 << 20;	// preallocated and mapped at once
+	static const int c_signalCloseMs = 2000;
+
+	std::string prefix;
+	std::string hardware;
+
+	// producer: the block filled, the settings of the samples written so far
+	sample_ring ring;
+	sample_ring::block* openBlock = 0;
+	int rate = 0;
+	int frequency = 0;
+	int gainReduction = 0;
+	unsigned long long lost = 0;
+	std::atomic<int> rateHz_;
+	std::atomic<int> frequencyHz_;
+	std::atomic<int> gainReductionDb_;
+
+	// writer: the current recording
+	std::string baseName;
+	int recordingRateHz = 0;
+	int recordingGainReduction = 0;
+	long long recordingStartNs = 0;
+	std::vector<capture> captures;
+	std::vector<annotation> annotations;
+	unsigned long long samplesWritten = 0;
+	unsigned long long samplesDropped = 0;
+	int fd = -1;
+	FILE* file = 0;			// without mmap
+	size_t fileBytes = 0;	// written
+	BYTE* segment = 0;
+	size_t segmentOffset = 0;
+	size_t segmentFill = 0;
+	bool failed = false;
+
+	pthread_t thrdWork;
+	std::atomic<bool> working;
+
+	// the data file being written in this process, for closeOnSignal
+	static std::atomic<int> s_openFd;
+	static std::atomic<long long> s_openBytes;
+	static std::atomic<bool> s_closeRequested;
+};
@@ -0,0 +1,343 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+
+#include "spectrum_server.h"
+#include "iq_convert.h"
+#include <iostream>
+#include <math.h>
+#include <string.h>
+using namespace std;
+
+static const double c_pi = 3.14159265358979323846;
+
+spectrum_server::spectrum_server()
+	: samplesPerFrame(0), rateHz_(0), frequencyHz_(0), working(false), accepting(false)
+{
+	pthread_mutex_init(&mutex_clients, NULL);
+}
+
+spectrum_server::~spectrum_server()
+{
+	stop();
+	if (accepting)
+	{
+		accepting = false;
+		pthread_join(thrdAccept, NULL);
+	}
+	for (size_t i = 0; i < clients.size(); i++)
+		closesocket(clients[i].sock);
+	if (listenSock != INVALID_SOCKET)
+		closesocket(listenSock);
+	delete fft;
+	pthread_mutex_destroy(&mutex_clients);
+}
+
+const char* spectrum_server::windowName(int window)
+{
+	switch (window)
+	{
+	case WINDOW_RECTANGULAR: return "rectangular";
+	case WINDOW_HANN: return "hann";
+	case WINDOW_BLACKMAN_HARRIS: return "blackman-harris";
+	default: return "unknown";
+	}
+}
+
+bool spectrum_server::open(const IPAddress& address, int port, int fftSize, int window, int averages,
+	double spectraPerSecond, bool dB)
+{
+	this->fftSize = fftSize;
+	this->window = window;
+	this->averages = averages;
+	this->spectraPerSecond = spectraPerSecond;
+	this->dB = dB;
+	fft = new iq_fft(fftSize);
+	computeWindow();
+	re.resize(fftSize);
+	im.resize(fftSize);
+	power.assign(fftSize, 0);
+	frame.resize(sizeof(frameHeader) + fftSize * sizeof(float));
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = inet_addr(address.sIPAddress.c_str());
+	listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listenSock == INVALID_SOCKET)
+		return false;
+	int r = 1;
+	setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+	if (::bind(listenSock, (struct sockaddr *)&local, sizeof(local)) == SOCKET_ERROR
+		|| listen(listenSock, 4) == SOCKET_ERROR)
+	{
+		cout << "Spectrum port " << port << ": " << common::getSocketErrorString() << endl;
+		closesocket(listenSock);
+		listenSock = INVALID_SOCKET;
+		return false;
+	}
+	cout << "Spectrum -> " << address.sIPAddress << ":" << port << ", " << fftSize << " bins, "
+		<< windowName(window) << " window, " << averages << " averages, "
+		<< spectraPerSecond << " per second, " << (dB ? "dB" : "linear") << endl;
+	accepting = true;
+	pthread_create(&thrdAccept, NULL, spectrumAccept, this);
+	return true;
+}
+
+/// <summary>
+/// Scaled, so a full scale tone in the center of a bin reads 1.0, i.e. 0 dBFS
+/// </summary>
+void spectrum_server::computeWindow()
+{
+	coeffs.resize(fftSize);
+	double sum = 0;
+	for (int i = 0; i < fftSize; i++)
+	{
+		double x = 2 * c_pi * i / fftSize;
+		double w = 1;
+		if (window == WINDOW_HANN)
+			w = 0.5 - 0.5 * cos(x);
+		else if (window == WINDOW_BLACKMAN_HARRIS)
+			w = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+		coeffs[i] = (float)w;
+		sum += w;
+	}
+	for (int i = 0; i < fftSize; i++)
+		coeffs[i] = (float)(coeffs[i] / (sum * 32768.0));
+}
+
+void spectrum_server::setRate(int rateHz)
+{
+	rateHz_ = rateHz;
+	int n = (int)(rateHz / spectraPerSecond);
+	samplesPerFrame = n < fftSize * averages ? fftSize * averages : n;
+}
+
+/// <summary>
+/// Called before the stream starts, not thread safe with push
+/// </summary>
+void spectrum_server::start(int rateHz, int frequencyHz)
+{
+	stop();
+	setRate(rateHz);
+	frequencyHz_ = frequencyHz;
+	ring.allocate(averages < c_ringMinBlocks ? c_ringMinBlocks : averages, fftSize * 4, 0);
+	openBlock = 0;
+	framePos = 0;
+	blockFill = 0;
+	accumulated = 0;
+	working = true;
+	pthread_create(&thrdWork, NULL, spectrumWork, this);
+}
+
+void spectrum_server::stop()
+{
+	if (!working)
+		return;
+	working = false;
+	ring.wakeup();
+	pthread_join(thrdWork, NULL);
+	if (ring.droppedBlocks() > 0)
+		cout << "Spectrum: " << ring.droppedBlocks() << " FFT blocks dropped, the worker was too slow" << endl;
+	ring.release_all();
+}
+
+/// <summary>
+/// Copies averages * fftSize samples at the start of each frame period, skips the rest.
+/// A block, which finds the ring full, is skipped as well.
+/// </summary>
+void spectrum_server::push(const short* xi, const short* xq, int numSamples)
+{
+	const int frameSamples = samplesPerFrame.load(std::memory_order_relaxed);
+	const int captureSamples = fftSize * averages;
+	while (numSamples > 0)
+	{
+		int n = numSamples;
+		if (framePos >= captureSamples)
+		{
+			if (n > frameSamples - framePos)
+				n = frameSamples - framePos;
+		}
+		else
+		{
+			if (blockFill == 0)
+				openBlock = ring.acquire();
+			if (n > fftSize - blockFill)
+				n = fftSize - blockFill;
+			if (openBlock != 0)
+				iq_convert::interleave16(xi, xq, n, openBlock->data + blockFill * 4);
+			blockFill += n;
+			if (blockFill == fftSize)
+			{
+				if (openBlock != 0)
+				{
+					openBlock->length = fftSize * 4;
+					ring.commit();
+				}
+				openBlock = 0;
+				blockFill = 0;
+			}
+		}
+		xi += n;
+		xq += n;
+		numSamples -= n;
+		framePos += n;
+		if (framePos >= frameSamples)
+			framePos = 0;
+	}
+}
+
+/// <summary>
+/// Worker: adds the power of one windowed block
+/// </summary>
+void spectrum_server::transform(const short* iq)
+{
+	for (int i = 0; i < fftSize; i++)
+	{
+		re[i] = iq[2 * i] * coeffs[i];
+		im[i] = iq[2 * i + 1] * coeffs[i];
+	}
+	fft->forward(&re[0], &im[0]);
+	for (int i = 0; i < fftSize; i++)
+		power[i] += (double)re[i] * re[i] + (double)im[i] * im[i];
+	accumulated++;
+}
+
+/// <summary>
+/// Worker: sends the average of the accumulated blocks to every client
+/// </summary>
+void spectrum_server::emit()
+{
+	frameHeader* h = (frameHeader*)&frame[0];
+	memcpy(h->magic, "RSPS", 4);
+	h->headerBytes = sizeof(frameHeader);
+	h->fftSize = fftSize;
+	h->samplingRateHz = rateHz_.load();
+	h->centerFrequencyHz = frequencyHz_.load();
+	h->averages = accumulated;
+	h->flags = dB ? SPECTRUM_DB : 0;
+	h->sequence = sequence++;
+
+	// bin 0 is the center frequency: the upper half of the FFT comes first
+	float* bins = (float*)&frame[sizeof(frameHeader)];
+	const double scale = 1.0 / accumulated;
+	for (int i = 0; i < fftSize; i++)
+	{
+		double p = power[(i + fftSize / 2) & (fftSize - 1)] * scale;
+		bins[i] = (float)(dB ? 10 * log10(p + 1e-20) : p);
+	}
+	power.assign(fftSize, 0);
+	accumulated = 0;
+
+	pthread_mutex_lock(&mutex_clients);
+	for (size_t i = 0; i < clients.size(); )
+	{
+		send(clients[i], &frame[0], (int)frame.size());
+		if (clients[i].sock == INVALID_SOCKET)
+			clients.erase(clients.begin() + i);
+		else
+			i++;
+	}
+	pthread_mutex_unlock(&mutex_clients);
+}
+
+/// <summary>
+/// Never blocks: a spectrum is sent as a whole or not at all,
+/// while the rest of the previous one is pending
+/// </summary>
+void spectrum_server::send(client& c, const BYTE* data, int length)
+{
+	if (!c.pending.empty())
+	{
+		int res = ::send(c.sock, (const char*)&c.pending[0], c.pending.size(), MSG_DONTWAIT);
+		if (res > 0)
+			c.pending.erase(c.pending.begin(), c.pending.begin() + res);
+	}
+	int res = 0;
+	if (c.pending.empty())
+		res = ::send(c.sock, (const char*)data, length, MSG_DONTWAIT);
+	if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		cout << "Spectrum: client disconnected";
+		if (c.droppedSpectra > 0)
+			cout << ", " << c.droppedSpectra << " spectra dropped";
+		cout << endl;
+		closesocket(c.sock);
+		c.sock = INVALID_SOCKET;
+	}
+	else if (res < 0 || (res == 0 && !c.pending.empty()))
+		c.droppedSpectra++;
+	else if (res < length)
+		c.pending.assign(data + res, data + length);
+}
+
+void* spectrumWork(void* p)
+{
+	spectrum_server* ss = (spectrum_server*)p;
+	while (ss->working)
+	{
+		sample_ring::block* b = ss->ring.peek(100);
+		if (b == 0)
+			continue;
+		ss->transform((const short*)b->data);
+		ss->ring.release();
+		if (ss->accumulated == ss->averages)
+			ss->emit();
+	}
+	return 0;
+}
+
+/// <summary>
+/// Accepts the clients of the spectrum port, up to c_maxClients
+/// </summary>
+void* spectrumAccept(void* p)
+{
+	spectrum_server* ss = (spectrum_server*)p;
+	while (ss->accepting)
+	{
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(ss->listenSock, &readSet);
+		struct timeval tv = { 0, 200000 };
+		if (select(ss->listenSock + 1, &readSet, 0, 0, &tv) <= 0)
+			continue;
+		SOCKET sock = accept(ss->listenSock, 0, 0);
+		if (sock == INVALID_SOCKET)
+			continue;
+		pthread_mutex_lock(&ss->mutex_clients);
+		if ((int)ss->clients.size() >= ss->c_maxClients)
+		{
+			cout << "Spectrum: client rejected, " << ss->clients.size() << " clients connected" << endl;
+			closesocket(sock);
+		}
+		else
+		{
+			spectrum_server::client c;
+			c.sock = sock;
+			c.droppedSpectra = 0;
+			ss->clients.push_back(c);
+			cout << "Spectrum: client accepted, " << ss->clients.size() << " client(s)" << endl;
+		}
+		pthread_mutex_unlock(&ss->mutex_clients);
+	}
+	return 0;
+}
@@ -0,0 +1,153 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+
+
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include "common.h"
+#include "IPAddress.h"
+#include "sample_ring.h"
+#include "iq_fft.h"
+
+void* spectrumWork(void* p);
+void* spectrumAccept(void* p);
+
+/// <summary>
+/// Streams averaged power spectra of the I/Q stream on a port of its own, for waterfalls
+/// and dashboards, which do not need the samples.
+/// Per spectrum, only averages * fftSize samples are taken by the stream callback, the rest
+/// of the frame period is skipped, so the cost follows the spectrum rate, not the sampling rate.
+/// The FFTs run on a thread of their own, a slow client loses whole spectra.
+/// </summary>
+class spectrum_server
+{
+public:
+	enum eWindow
+	{
+		WINDOW_RECTANGULAR = 0
+		, WINDOW_HANN = 1
+		, WINDOW_BLACKMAN_HARRIS = 2
+	};
+	enum eFlags
+	{
+		SPECTRUM_DB = 1		// bins in dBFS, else linear power relative to full scale
+	};
+
+	/// <summary>
+	/// Precedes every spectrum, followed by fftSize float bins, lowest frequency first.
+	/// All fields in host byte order, little endian on the supported platforms.
+	/// </summary>
+	struct frameHeader
+	{
+		char magic[4];				// "RSPS"
+		uint32_t headerBytes;		// sizeof(frameHeader), the bins follow
+		uint32_t fftSize;
+		uint32_t samplingRateHz;
+		uint32_t centerFrequencyHz;
+		uint32_t averages;
+		uint32_t flags;				// eFlags
+		uint32_t sequence;			// counts the spectra, a gap is a spectrum dropped for the client
+	};
+
+	static const int c_minFftSize = 16;
+	static const int c_maxFftSize = 65536;
+
+	spectrum_server();
+	~spectrum_server();
+
+	/// <summary>
+	/// Opens the listener, the spectra are computed from start to stop
+	/// </summary>
+	/// <returns>false, if the port cannot be opened</returns>
+	bool open(const IPAddress& address, int port, int fftSize, int window, int averages,
+		double spectraPerSecond, bool dB);
+
+	// Starts / stops the spectra with the stream of the device
+	void start(int rateHz, int frequencyHz);
+	void stop();
+	// shown in the header of the following spectra
+	void setRate(int rateHz);
+	void setFrequency(int frequencyHz) { frequencyHz_ = frequencyHz; }
+
+	// ---- producer side (stream callback) ----
+	void push(const short* xi, const short* xq, int numSamples);
+
+	static const char* windowName(int window);
+
+private:
+	spectrum_server(spectrum_server const&);		// Don't Implement
+	void operator=(spectrum_server const&);			// Don't implement
+
+	friend void* spectrumWork(void* p);
+	friend void* spectrumAccept(void* p);
+
+	struct client
+	{
+		SOCKET sock;
+		std::vector<BYTE> pending;	// rest of a partial send
+		unsigned long long droppedSpectra;
+	};
+
+	void computeWindow();
+	void transform(const short* iq);
+	void emit();
+	void send(client& c, const BYTE* data, int length);
+
+	const int c_ringMinBlocks = 8;
+	const int c_maxClients = 16;
+
+	int fftSize = 0;
+	int window = WINDOW_HANN;
+	int averages = 1;
+	double spectraPerSecond = 0;
+	bool dB = true;
+
+	// producer: position in the frame period and in the block of one FFT
+	std::atomic<int> samplesPerFrame;
+	int framePos = 0;
+	int blockFill = 0;
+	sample_ring::block* openBlock = 0;
+	sample_ring ring;
+
+	// worker
+	iq_fft* fft = 0;
+	std::vector<float> coeffs;		// window, scaled to 1 / full scale
+	std::vector<float> re;
+	std::vector<float> im;
+	std::vector<double> power;		// accumulated |X|^2
+	int accumulated = 0;
+	uint32_t sequence = 0;
+	std::vector<BYTE> frame;
+	std::atomic<int> rateHz_;
+	std::atomic<int> frequencyHz_;
+
+	SOCKET listenSock = INVALID_SOCKET;
+	std::vector<client> clients;
+	pthread_mutex_t mutex_clients;
+
+	pthread_t thrdWork;
+	pthread_t thrdAccept;
+	std::atomic<bool> working;
+	std::atomic<bool> accepting;
+};
@@ -0,0 +1,67 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "stream_frame.h"
+#include <string.h>
+
+void stream_frame::write(BYTE* out, int format, int flags, unsigned int numSamples, unsigned int payloadBytes,
+	unsigned long long firstSample, long long timeNs)
+{
+	memcpy(out, "RSPF", 4);
+	out[4] = (BYTE)c_headerBytes;
+	out[5] = 0;
+	out[6] = (BYTE)format;
+	out[7] = (BYTE)flags;
+	for (int k = 0; k < 4; k++)
+	{
+		out[8 + k] = (BYTE)(numSamples >> (8 * k));
+		out[12 + k] = (BYTE)(payloadBytes >> (8 * k));
+	}
+	for (int k = 0; k < 8; k++)
+	{
+		out[16 + k] = (BYTE)(firstSample >> (8 * k));
+		out[24 + k] = (BYTE)((unsigned long long)timeNs >> (8 * k));
+	}
+}
+
+bool stream_frame::read(const BYTE* in, streamFrameHeader& header)
+{
+	if (memcmp(in, "RSPF", 4) != 0 || in[4] + (in[5] << 8) != c_headerBytes)
+		return false;
+	memcpy(header.magic, in, 4);
+	header.headerBytes = (uint16_t)c_headerBytes;
+	header.format = in[6];
+	header.flags = in[7];
+	header.numSamples = 0;
+	header.payloadBytes = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		header.numSamples |= (uint32_t)in[8 + k] << (8 * k);
+		header.payloadBytes |= (uint32_t)in[12 + k] << (8 * k);
+	}
+	header.firstSample = 0;
+	header.timestampNs = 0;
+	for (int k = 0; k < 8; k++)
+	{
+		header.firstSample |= (uint64_t)in[16 + k] << (8 * k);
+		header.timestampNs |= (uint64_t)in[24 + k] << (8 * k);
+	}
+	return true;
+}
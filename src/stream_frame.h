@@ -0,0 +1,40 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include "common.h"
+#include "rsp_tcp.h"
+
+/// <summary>
+/// Header of a frame of the framed stream, see streamFrameHeader, all fields little endian.
+/// The frames of samples and the markers without samples have the same serializer,
+/// read is its counterpart of a client.
+/// </summary>
+class stream_frame
+{
+public:
+	static const int c_headerBytes = sizeof(streamFrameHeader);
+
+	// writes c_headerBytes at out, a marker has neither samples nor payload
+	static void write(BYTE* out, int format, int flags, unsigned int numSamples, unsigned int payloadBytes,
+		unsigned long long firstSample, long long timeNs);
+	// false, if in does not start with the magic and the size of the header
+	static bool read(const BYTE* in, streamFrameHeader& header);
+};
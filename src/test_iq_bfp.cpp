@@ -0,0 +1,90 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_bfp - the block floating point codec: every decoded value is within half a mantissa
+** step 2^(e-1) of the input, the exponent is the smallest one, and the block has encodedBytes.
+**
+** Usage: test_iq_bfp, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "iq_bfp.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_bfp");
+
+// random samples of -amplitude..amplitude, the extremes included
+static void testBlock(int b, int n, int amplitude)
+{
+	const string where = ", " + to_string(b) + " bit, " + to_string(n) + " samples, amplitude " + to_string(amplitude);
+	vector<short> xi(n), xq(n);
+	int peak = 0;
+	for (int i = 0; i < n; i++)
+	{
+		xi[i] = (short)(s_test.random(2 * amplitude + 1) - amplitude);
+		xq[i] = (short)(s_test.random(2 * amplitude + 1) - amplitude);
+		if (i == n / 2)
+			xq[i] = (short)-amplitude;
+		// the mantissas cover -2^(b-1+e)..2^(b-1+e)-1: -1 - x is the magnitude of negative x
+		peak = max(peak, max(xi[i] < 0 ? -1 - xi[i] : xi[i], xq[i] < 0 ? -1 - xq[i] : xq[i]));
+	}
+	// the encoder packs in place, in the space of the 8 bit mantissas
+	const int guard = 16;
+	int bytes = iq_bfp::encodedBytes(n, b);
+	vector<BYTE> out(1 + 2 * n + guard, 0xa5);
+	s_test.check(iq_bfp::encode(&xi[0], &xq[0], n, b, &out[0]) == bytes, "encoded size" + where);
+	bool guarded = true;
+	for (int i = 1 + 2 * n; i < (int)out.size(); i++)
+		guarded = guarded && out[i] == 0xa5;
+	s_test.check(guarded, "bytes beyond the block" + where);
+
+	// smallest exponent: the peak needs it, or it is the minimum of 8 - b
+	int e = out[0];
+	s_test.check(peak < (1 << (b - 1 + e)), "exponent too small" + where);
+	s_test.check(e == 8 - b || peak >= (1 << (b - 2 + e)), "exponent too large" + where);
+
+	vector<float> yi(n), yq(n);
+	s_test.check(iq_bfp::decode(&out[0], n, b, &yi[0], &yq[0]) == bytes, "decoded size" + where);
+	double maxError = 0;
+	for (int i = 0; i < n; i++)
+	{
+		maxError = max(maxError, fabs(yi[i] * 32768.0 - xi[i]));
+		maxError = max(maxError, fabs(yq[i] * 32768.0 - xq[i]));
+	}
+	s_test.check(maxError <= ldexp(1.0, e - 1), "error beyond half a mantissa step" + where);
+}
+
+int main()
+{
+	const int amplitudes[] = { 0, 1, 3, 100, 127, 128, 1000, 4095, 4096, 20000, 32767 };
+	for (int b = iq_bfp::c_minMantissaBits; b <= iq_bfp::c_maxMantissaBits; b++)
+	{
+		for (int n = 4; n <= 64; n += 4)
+			for (size_t a = 0; a < sizeof(amplitudes) / sizeof(amplitudes[0]); a++)
+				testBlock(b, n, amplitudes[a]);
+		testBlock(b, 1024, 32767);
+		testBlock(b, 4096, 777);
+	}
+	return s_test.result();
+}
@@ -0,0 +1,116 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_channelizer - the polyphase filter bank: a tone at a channel center passes with
+** unity gain, the band of +-1/4 channel is flat, two channels meet at -6 dB halfway,
+** and every channel from 3/4 of a channel width away is isolated by at least 70 dB.
+**
+** Usage: test_iq_channelizer, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include "iq_channelizer.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_channelizer");
+
+static const double c_amplitude = 16000;
+static const double c_minIsolationDb = 70;
+
+// power of every exported channel in dB relative to the tone, after the filters settled;
+// the tone frequency is in channel widths
+static vector<double> channelLevels(iq_channelizer& z, int numChannels, double frequency)
+{
+	vector<int> channels;
+	for (int c = -numChannels / 2; c < numChannels / 2; c++)
+		channels.push_back(c);
+	z.configure(numChannels, channels);
+
+	const int n = 4096;
+	vector<short> iq(2 * n);
+	vector<double> power(numChannels, 0);
+	long long numOutput = 0, settle = 2 * iq_channelizer::c_tapsPerBranch;
+	for (long long done = 0; done < 16 * n; done += n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			double phase = 2 * M_PI * fmod(frequency / numChannels * (done + i), 1.0);
+			iq[2 * i] = (short)lrint(c_amplitude * cos(phase));
+			iq[2 * i + 1] = (short)lrint(c_amplitude * sin(phase));
+		}
+		int m = z.process(&iq[0], n);
+		s_test.check(m == 2 * n / numChannels, "output samples per input chunk: " + to_string(m));
+		for (int k = 0; k < numChannels; k++)
+		{
+			vector<short>& out = z.output(k);
+			for (int j = 0; j < m; j++)
+			{
+				if (numOutput + j < settle)
+					continue;
+				double yi = out[2 * j], yq = out[2 * j + 1];
+				power[k] += yi * yi + yq * yq;
+			}
+			out.clear();
+		}
+		numOutput += m;
+	}
+	vector<double> db(numChannels);
+	for (int k = 0; k < numChannels; k++)
+		db[k] = power[k] > 0 ? 10 * log10(power[k] / (numOutput - settle) / (c_amplitude * c_amplitude)) : -200;
+	return db;
+}
+
+static void testChannel(int numChannels, int channel)
+{
+	iq_channelizer z;
+	const string where = " of channel " + to_string(channel) + " of " + to_string(numChannels);
+	const int index = channel + numChannels / 2;
+	const double offsets[] = { -0.25, 0, 0.25 };
+	for (int o = 0; o < 3; o++)
+	{
+		vector<double> db = channelLevels(z, numChannels, channel + offsets[o]);
+		s_test.check(fabs(db[index]) < 0.1, "gain" + where + " at " + to_string(offsets[o]) + ": " + to_string(db[index]) + " dB");
+		double leak = -200;
+		for (int k = 0; k < numChannels; k++)
+			if (k != index)
+				leak = max(leak, db[k]);
+		// at +-1/4, the neighbor sees the tone at 3/4 of a channel width
+		s_test.check(leak < -c_minIsolationDb, "isolation" + where + " at " + to_string(offsets[o]) + ": " + to_string(leak) + " dB");
+	}
+
+	// halfway to the next channel, both have half the amplitude
+	vector<double> db = channelLevels(z, numChannels, channel + 0.5);
+	int upper = (index + 1) % numChannels;
+	s_test.check(fabs(db[index] + 6.02) < 0.2 && fabs(db[upper] + 6.02) < 0.2,
+		"crossover" + where + ": " + to_string(db[index]) + " dB, " + to_string(db[upper]) + " dB");
+}
+
+int main()
+{
+	testChannel(16, 0);
+	testChannel(16, 3);
+	testChannel(16, -8);
+	testChannel(16, 7);
+	testChannel(64, -21);
+	return s_test.result();
+}
@@ -0,0 +1,122 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_compress - every block decodes to the exact samples, never exceeds maxEncodedBytes,
+** and a client finds the next block again after garbage or a truncated block.
+**
+** Usage: test_iq_compress, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include "iq_compress.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_compress");
+
+static short clip(double v)
+{
+	return (short)(v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+}
+
+// the signals the predictors and the raw fallback are made for
+static void generate(int kind, int n, vector<short>& xi, vector<short>& xq)
+{
+	for (int i = 0; i < n; i++)
+	{
+		switch (kind)
+		{
+		case 0:	// weak noise, low gain
+			xi[i] = (short)(s_test.random(65) - 32);
+			xq[i] = (short)(s_test.random(65) - 32);
+			break;
+		case 1:	// narrowband: a strong tone with noise
+			xi[i] = clip(20000 * cos(0.01 * i) + s_test.random(17) - 8);
+			xq[i] = clip(20000 * sin(0.01 * i) + s_test.random(17) - 8);
+			break;
+		case 2:	// full scale noise, incompressible
+			xi[i] = (short)(s_test.random(65536) - 32768);
+			xq[i] = (short)(s_test.random(65536) - 32768);
+			break;
+		case 3:	// constant
+			xi[i] = -32768;
+			xq[i] = 32767;
+			break;
+		default:	// mostly quiet with rare spikes: escape codes
+			xi[i] = (short)(s_test.random(100) == 0 ? s_test.random(65536) - 32768 : s_test.random(9) - 4);
+			xq[i] = (short)(s_test.random(100) == 0 ? s_test.random(65536) - 32768 : s_test.random(9) - 4);
+			break;
+		}
+	}
+}
+
+static const char* s_signals[] = { "weak noise", "tone", "full scale noise", "constant", "spikes" };
+
+static void testRoundTrip(int kind, int n)
+{
+	const string where = string(" of ") + s_signals[kind] + ", " + to_string(n) + " samples";
+	vector<short> xi(n + 1), xq(n + 1), yi(n + 1), yq(n + 1);
+	generate(kind, n, xi, xq);
+	// guard bytes beyond the largest encoding must stay untouched
+	const int guard = 64;
+	int maxBytes = iq_compress::maxEncodedBytes(n);
+	vector<BYTE> out(maxBytes + guard, 0xa5);
+	int bytes = iq_compress::encode(&xi[0], &xq[0], n, &out[0]);
+	s_test.check(bytes > 0 && bytes <= maxBytes, "encoded size" + where);
+	bool guarded = true;
+	for (int i = maxBytes; i < maxBytes + guard; i++)
+		guarded = guarded && out[i] == 0xa5;
+	s_test.check(guarded, "bytes beyond maxEncodedBytes" + where);
+
+	int blockBytes = -1;
+	int decoded = iq_compress::decode(&out[0], bytes, &yi[0], &yq[0], n, blockBytes);
+	s_test.check(decoded == n && blockBytes == bytes, "decoded size" + where);
+	s_test.check(memcmp(&xi[0], &yi[0], n * sizeof(short)) == 0 && memcmp(&xq[0], &yq[0], n * sizeof(short)) == 0,
+		"round trip" + where);
+
+	// a truncated block is incomplete, not invalid
+	decoded = iq_compress::decode(&out[0], bytes - 1, &yi[0], &yq[0], n, blockBytes);
+	s_test.check(decoded == 0, "truncated block" + where);
+
+	// resync: garbage, the truncated block, then the complete one
+	vector<BYTE> stream;
+	for (int i = 0; i < 37; i++)
+		stream.push_back((BYTE)s_test.random(256));
+	stream.insert(stream.end(), out.begin(), out.begin() + bytes / 2);
+	size_t start = stream.size();
+	stream.insert(stream.end(), out.begin(), out.begin() + bytes);
+	s_test.check(iq_compress::findBlock(&stream[0], (int)stream.size()) == (int)start, "resync" + where);
+}
+
+int main()
+{
+	for (int kind = 0; kind < 5; kind++)
+	{
+		for (int n = 1; n <= 40; n++)
+			testRoundTrip(kind, n);
+		testRoundTrip(kind, 1000);
+		testRoundTrip(kind, 16384);
+		testRoundTrip(kind, iq_compress::c_maxSamples);
+	}
+	return s_test.result();
+}
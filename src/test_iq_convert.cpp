@@ -0,0 +1,173 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_convert - every SIMD kernel of iq_convert gives the bit-identical output of the
+** scalar reference, for all lengths around the vector widths and for the extreme values.
+**
+** Usage: test_iq_convert, the exit code is the number of failed checks
+**/
+
+#include <algorithm>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include "iq_convert.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_convert");
+
+// random samples, every 7th one at full scale
+static void fill(vector<short>& x)
+{
+	for (size_t i = 0; i < x.size(); i++)
+	{
+		short v = (short)(s_test.random(65536) - 32768);
+		if (i % 7 == 3)
+			v = s_test.random(2) ? 32767 : -32768;
+		x[i] = v;
+	}
+}
+
+static void testKernels(const iq_convert::kernelTable& k, const iq_convert::kernelTable& ref, int n)
+{
+	const string where = string(" of ") + k.name + ", " + to_string(n) + " samples";
+	vector<short> xi(n + 1), xq(n + 1);
+	fill(xi);
+	fill(xq);
+	// one byte beyond the output must stay untouched
+	vector<BYTE> out(8 * n + 1, 0xa5), expected(8 * n + 1, 0xa5);
+
+	k.interleave16(&xi[0], &xq[0], n, &out[0]);
+	ref.interleave16(&xi[0], &xq[0], n, &expected[0]);
+	s_test.check(out == expected, "interleave16" + where);
+
+	k.interleave16be(&xi[0], &xq[0], n, &out[0]);
+	ref.interleave16be(&xi[0], &xq[0], n, &expected[0]);
+	s_test.check(out == expected, "interleave16be" + where);
+
+	k.interleaveF32(&xi[0], &xq[0], n, &out[0]);
+	ref.interleaveF32(&xi[0], &xq[0], n, &expected[0]);
+	s_test.check(out == expected, "interleaveF32" + where);
+
+	k.planarF32(&xi[0], n, &out[0]);
+	ref.planarF32(&xi[0], n, &expected[0]);
+	s_test.check(out == expected, "planarF32" + where);
+
+	k.pack12(&xi[0], &xq[0], n, &out[0]);
+	ref.pack12(&xi[0], &xq[0], n, &expected[0]);
+	s_test.check(out == expected, "pack12" + where);
+
+	int even = n & ~1;
+	k.pack14(&xi[0], &xq[0], even, &out[0]);
+	ref.pack14(&xi[0], &xq[0], even, &expected[0]);
+	s_test.check(out == expected, "pack14" + where);
+
+	s_test.check(k.peak(&xi[0], &xq[0], n) == ref.peak(&xi[0], &xq[0], n), "peak" + where);
+
+	// Q15 taps of the size the resampler uses, the sum must not overflow
+	vector<short> h(n + 1);
+	for (int i = 0; i < n; i++)
+		h[i] = (short)(xq[i] >> 6);
+	if (n <= 96)
+		s_test.check(k.dot16(&xi[0], &h[0], n) == ref.dot16(&xi[0], &h[0], n), "dot16" + where);
+
+	long long m[5] = { 1, 2, 3, 4, 5 }, mref[5] = { 1, 2, 3, 4, 5 };
+	k.moments(&xi[0], &xq[0], n, m);
+	ref.moments(&xi[0], &xq[0], n, mref);
+	s_test.check(memcmp(m, mref, sizeof(m)) == 0, "moments" + where);
+
+	// a correction of a few percent, with DC offsets and the rounding
+	correctParams p = { 16384 + 300, -200, 150, 16384 - 250, 120 * (1 << 14) + (1 << 13), -80 * (1 << 14) + (1 << 13) };
+	vector<short> yi(n + 1, 0x5a5a), yq(n + 1, 0x5a5a), ri(n + 1, 0x5a5a), rq(n + 1, 0x5a5a);
+	k.correct(&xi[0], &xq[0], n, &yi[0], &yq[0], p);
+	ref.correct(&xi[0], &xq[0], n, &ri[0], &rq[0], p);
+	s_test.check(yi == ri && yq == rq, "correct" + where);
+
+	// 8 bit: every shift, the table of an arbitrary gain, with and without dither
+	vector<short> ditherI(n + 1), ditherQ(n + 1), lut(65536 + 1);
+	for (int i = 0; i < n; i++)
+	{
+		ditherI[i] = (short)(xi[i] % 256);
+		ditherQ[i] = (short)(xq[i] % 256);
+	}
+	for (int x = -32768; x < 32768; x++)
+		lut[(unsigned short)x] = (short)max(-32768, min(32767, x * 3 / 2));
+	for (int shift = -1; shift <= 8; shift++)
+	{
+		for (int dither = 0; dither < 2; dither++)
+		{
+			convert8Params c8 = { shift, shift < 0 ? &lut[0] : 0, dither ? &ditherI[0] : 0, dither ? &ditherQ[0] : 0 };
+			k.convert8(&xi[0], &xq[0], n, &out[0], c8);
+			ref.convert8(&xi[0], &xq[0], n, &expected[0], c8);
+			s_test.check(out == expected, "convert8, shift " + to_string(shift) + (dither ? " and dither" : "") + where);
+		}
+	}
+}
+
+// the reference unpackers give the samples back, within one step of the packed format
+static void testPackedRoundTrip()
+{
+	const int n = 4096;
+	vector<short> xi(n), xq(n), yi(n), yq(n);
+	fill(xi);
+	fill(xq);
+	vector<BYTE> packed(4 * n);
+	const int bits[] = { 12, 14 };
+	for (int f = 0; f < 2; f++)
+	{
+		if (bits[f] == 12)
+		{
+			iq_convert::pack12(&xi[0], &xq[0], n, &packed[0]);
+			iq_convert::unpack12(&packed[0], n, &yi[0], &yq[0]);
+		}
+		else
+		{
+			iq_convert::pack14(&xi[0], &xq[0], n, &packed[0]);
+			iq_convert::unpack14(&packed[0], n, &yi[0], &yq[0]);
+		}
+		int maxError = 0;
+		for (int i = 0; i < n; i++)
+			maxError = max(maxError, max(abs(yi[i] - xi[i]), abs(yq[i] - xq[i])));
+		s_test.check(maxError < 1 << (16 - bits[f]), "round trip of " + to_string(bits[f]) + " bit, error " + to_string(maxError));
+	}
+}
+
+int main()
+{
+	iq_convert::kernelTable tables[4];
+	int numTables = iq_convert::availableKernels(tables, 4);
+	const iq_convert::kernelTable& ref = tables[numTables - 1];
+	cout << "kernels:";
+	for (int t = 0; t < numTables; t++)
+		cout << " " << tables[t].name;
+	cout << endl;
+
+	for (int t = 0; t < numTables - 1; t++)
+	{
+		for (int n = 0; n <= 70; n++)
+			testKernels(tables[t], ref, n);
+		testKernels(tables[t], ref, 1008);
+		testKernels(tables[t], ref, 16384 + 13);
+	}
+	testPackedRoundTrip();
+	return s_test.result();
+}
@@ -0,0 +1,126 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_correction - DC offset and IQ imbalance of a tone converge: after a few time
+** constants, the DC is gone and the image of the tone is suppressed; DC mode leaves the
+** imbalance alone, and after a retune the estimate settles again.
+**
+** Usage: test_iq_correction, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include "iq_correction.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_correction");
+
+static const int c_rateHz = 2000000;
+static const int c_timeConstantMs = 10;
+static const double c_amplitude = 8000;
+static const double c_tone = 0.0123;		// cycles per sample
+
+struct impairment
+{
+	double dcI, dcQ;
+	double gain;		// of Q relative to I
+	double phaseDeg;	// of Q
+};
+
+struct measurement
+{
+	double dcI, dcQ;
+	double imageDb;		// image relative to the tone
+};
+
+// runs the tone through the correction, measures the output of the last chunks
+static measurement run(iq_correction& c, const impairment& x, long long& pos, int numChunks)
+{
+	const int n = iq_correction::c_maxChunk;
+	vector<short> xi(n), xq(n);
+	double sumI = 0, sumQ = 0, toneRe = 0, toneIm = 0, imageRe = 0, imageIm = 0;
+	const int measured = 8;
+	for (int chunk = 0; chunk < numChunks; chunk++)
+	{
+		for (int i = 0; i < n; i++, pos++)
+		{
+			double theta = 2 * M_PI * fmod(c_tone * pos, 1.0);
+			xi[i] = (short)lrint(c_amplitude * cos(theta) + x.dcI);
+			xq[i] = (short)lrint(x.gain * c_amplitude * sin(theta + x.phaseDeg * M_PI / 180) + x.dcQ);
+		}
+		c.process(&xi[0], &xq[0], n);
+		if (chunk < numChunks - measured)
+			continue;
+		long long p = pos - n;
+		for (int i = 0; i < n; i++, p++)
+		{
+			double yi = c.outputI()[i], yq = c.outputQ()[i];
+			double theta = 2 * M_PI * fmod(c_tone * p, 1.0);
+			sumI += yi;
+			sumQ += yq;
+			// y * exp(-j theta) and y * exp(j theta)
+			toneRe += yi * cos(theta) + yq * sin(theta);
+			toneIm += yq * cos(theta) - yi * sin(theta);
+			imageRe += yi * cos(theta) - yq * sin(theta);
+			imageIm += yq * cos(theta) + yi * sin(theta);
+		}
+	}
+	measurement m;
+	m.dcI = sumI / (measured * n);
+	m.dcQ = sumQ / (measured * n);
+	m.imageDb = 10 * log10((imageRe * imageRe + imageIm * imageIm) / (toneRe * toneRe + toneIm * toneIm));
+	return m;
+}
+
+static string describe(const measurement& m)
+{
+	return ": DC " + to_string(m.dcI) + ", " + to_string(m.dcQ) + ", image " + to_string(m.imageDb) + " dB";
+}
+
+int main()
+{
+	const impairment x = { 500, -300, 1.12, 6 };
+	// 20 time constants
+	const int chunks = 20 * c_rateHz / 1000 * c_timeConstantMs / iq_correction::c_maxChunk;
+	long long pos = 0;
+
+	iq_correction c;
+	c.configure(iq_correction::CORRECT_DC, c_timeConstantMs);
+	c.setRate(c_rateHz);
+	measurement m = run(c, x, pos, chunks);
+	s_test.check(fabs(m.dcI) < 2 && fabs(m.dcQ) < 2, "DC removed in DC mode" + describe(m));
+	s_test.check(m.imageDb > -30 && m.imageDb < -20, "imbalance kept in DC mode" + describe(m));
+
+	c.configure(iq_correction::CORRECT_DC_IQ, c_timeConstantMs);
+	c.setRate(c_rateHz);
+	m = run(c, x, pos, chunks);
+	s_test.check(fabs(m.dcI) < 2 && fabs(m.dcQ) < 2, "DC removed in DC and IQ mode" + describe(m));
+	s_test.check(m.imageDb < -60, "image suppressed" + describe(m));
+
+	// a retune to other impairments: the estimate restarts and settles within a few time constants
+	const impairment y = { -1200, 700, 0.9, -4 };
+	c.retune();
+	m = run(c, y, pos, chunks / 4);
+	s_test.check(fabs(m.dcI) < 2 && fabs(m.dcQ) < 2, "DC removed after the retune" + describe(m));
+	s_test.check(m.imageDb < -60, "image suppressed after the retune" + describe(m));
+	return s_test.result();
+}
@@ -0,0 +1,121 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_resampler - the resampler against its specification: the output band is flat to
+** 0.4 of the output rate, the aliases into that band are attenuated by about 70 dB,
+** and the number of output samples follows the ratio.
+**
+** Usage: test_iq_resampler, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include "iq_resampler.h"
+#include "unit_test.h"
+using namespace std;
+
+// limits of the checks, with a margin for the rounding noise of the fixed point filters
+static const double c_maxRippleDb = 0.1;
+static const double c_minAliasAttenuationDb = 68;
+static const double c_amplitude = 16000;
+
+static unit_test s_test("test_iq_resampler");
+
+static void check(bool ok, const iq_resampler& r, const char* what, double frequencyHz, double db)
+{
+	s_test.check(ok, r.description() + ", " + what + " at " + to_string((int)frequencyHz) + " Hz: " + to_string(db) + " dB");
+}
+
+// output power of a complex tone relative to its input power in dB, after the filters settled
+static double toneLevel(iq_resampler& r, int inputRateHz, int outputRateHz, double frequencyHz)
+{
+	r.configure(inputRateHz, outputRateHz);
+	const int n = iq_resampler::c_maxChunk;
+	vector<short> xi(n), xq(n);
+	long long settle = outputRateHz / 100;
+	long long numOutput = 0;
+	double power = 0;
+	for (long long done = 0; done < inputRateHz / 50 + settle * inputRateHz / outputRateHz; done += n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			double phase = 2 * M_PI * fmod(frequencyHz * (done + i) / inputRateHz, 1.0);
+			xi[i] = (short)lrint(c_amplitude * cos(phase));
+			xq[i] = (short)lrint(c_amplitude * sin(phase));
+		}
+		int m = r.process(&xi[0], &xq[0], n);
+		for (int i = 0; i < m; i++, numOutput++)
+		{
+			if (numOutput < settle)
+				continue;
+			double yi = r.outputI()[i], yq = r.outputQ()[i];
+			power += yi * yi + yq * yq;
+		}
+	}
+	power /= numOutput - settle;
+	return power > 0 ? 10 * log10(power / (c_amplitude * c_amplitude)) : -200;
+}
+
+static void testRatio(int inputRateHz, int outputRateHz)
+{
+	iq_resampler r;
+	if (!r.configure(inputRateHz, outputRateHz))
+	{
+		s_test.check(false, to_string(inputRateHz) + " -> " + to_string(outputRateHz) + " Hz not realized");
+		return;
+	}
+	cout << r.description() << endl;
+
+	// the sample count follows the ratio, up to the delay of the filters
+	const int n = iq_resampler::c_maxChunk;
+	vector<short> zero(n, 0);
+	long long numOutput = 0, numInput = 0;
+	for (int i = 0; i < 200; i++, numInput += n)
+		numOutput += r.process(&zero[0], &zero[0], n);
+	double expected = (double)numInput * outputRateHz / inputRateHz;
+	s_test.check(fabs(numOutput - expected) <= 2, r.description() + ", " + to_string(numOutput) + " output samples");
+
+	// pass band, both sides
+	for (double f = -0.4; f <= 0.4001; f += 0.05)
+	{
+		double db = toneLevel(r, inputRateHz, outputRateHz, f * outputRateHz);
+		check(fabs(db) <= c_maxRippleDb, r, "pass band", f * outputRateHz, db);
+	}
+
+	// every tone beyond 0.6 of the output rate aliases into the band of +-0.4 or is removed
+	double nyquist = min(inputRateHz / 2.0, 4.0 * outputRateHz);
+	for (double f = 0.6 * outputRateHz; f < nyquist; f += 0.1 * outputRateHz)
+	{
+		double db = toneLevel(r, inputRateHz, outputRateHz, f);
+		check(db <= -c_minAliasAttenuationDb, r, "alias", f, db);
+		db = toneLevel(r, inputRateHz, outputRateHz, -f);
+		check(db <= -c_minAliasAttenuationDb, r, "alias", -f, db);
+	}
+}
+
+int main()
+{
+	testRatio(384000, 250000);		// rational only
+	testRatio(2000000, 250000);		// half-bands only
+	testRatio(2048000, 48000);		// both
+	testRatio(6000000, 1000000);
+	return s_test.result();
+}
@@ -0,0 +1,110 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_iq_scale8 - the 8 bit output is floor((x + 0.5) * gain + 128), saturated to 0..255,
+** for every 16 bit input, every shift and arbitrary gains, and TPDF dither keeps its mean.
+**
+** Usage: test_iq_scale8, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include "iq_scale8.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_iq_scale8");
+
+static int expected8(int x, double gain)
+{
+	double level = floor((x + 0.5) * gain + 128);
+	return level < 0 ? 0 : (level > 255 ? 255 : (int)level);
+}
+
+// all 65536 inputs, as I and reversed as Q
+static void testRounding(int shift, double gain)
+{
+	iq_scale8 scale;
+	scale.configure(shift, gain, false);
+	vector<short> xi(65536), xq(65536);
+	for (int i = 0; i < 65536; i++)
+	{
+		xi[i] = (short)(i - 32768);
+		xq[i] = (short)(32767 - i);
+	}
+	vector<BYTE> out(2 * 65536);
+	scale.convert(&xi[0], &xq[0], 65536, &out[0]);
+
+	double g = gain > 0 ? gain : ldexp(1.0, -shift);
+	int errors = 0, asymmetric = 0;
+	for (int i = 0; i < 65536; i++)
+	{
+		if (out[2 * i] != expected8(xi[i], g) || out[2 * i + 1] != expected8(xq[i], g))
+			errors++;
+		// x and -1 - x are mirrored around 127.5
+		if (out[2 * i] + out[2 * (65535 - i)] != 255)
+			asymmetric++;
+	}
+	s_test.check(errors == 0, "rounding of " + scale.description());
+	s_test.check(asymmetric == 0, "symmetry of " + scale.description());
+}
+
+// a constant input: dither stays within one level and its mean is the exact level
+static void testDither(int shift, double gain, short x)
+{
+	iq_scale8 plain, dithered;
+	plain.configure(shift, gain, false);
+	dithered.configure(shift, gain, true);
+	const int n = 100000;
+	vector<short> xi(n, x), xq(n, (short)(-1 - x));
+	vector<BYTE> out(2 * n), ref(2 * n);
+	plain.convert(&xi[0], &xq[0], n, &ref[0]);
+	dithered.convert(&xi[0], &xq[0], n, &out[0]);
+
+	double g = gain > 0 ? gain : ldexp(1.0, -shift);
+	double sum = 0;
+	int outliers = 0;
+	for (int i = 0; i < 2 * n; i += 2)
+	{
+		sum += out[i];
+		if (abs(out[i] - ref[i]) > 1)
+			outliers++;
+	}
+	double exact = (x + 0.5) * g + 127.5;
+	s_test.check(outliers == 0, "dither range of " + dithered.description() + " at " + to_string(x));
+	s_test.check(fabs(sum / n - exact) < 0.02, "dither mean of " + dithered.description() + " at " + to_string(x));
+}
+
+int main()
+{
+	for (int shift = 0; shift <= 8; shift++)
+		testRounding(shift, 0);
+	const double gains[] = { 1.0 / 64, 1.0 / 100, 0.0123, 0.3, 1.7 };
+	for (size_t i = 0; i < sizeof(gains) / sizeof(gains[0]); i++)
+		testRounding(0, gains[i]);
+
+	testDither(6, 0, 0);
+	testDither(6, 0, 1000);
+	testDither(6, 0, -777);
+	testDither(0, 0.0123, 4321);
+	return s_test.result();
+}
@@ -0,0 +1,114 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_latency_histogram - histograms recorded by two threads and merged: the count, the
+** sum and the maximum are exact, every percentile is the upper bound of the bucket of the
+** exact quantile, within 1/16 of its value, the maximum for the last bucket.
+**
+** Usage: test_latency_histogram, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <pthread.h>
+#include "latency_histogram.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_latency_histogram");
+
+struct recording
+{
+	latency_histogram histogram;
+	vector<long long> values;
+};
+
+static void* recordThread(void* arg)
+{
+	recording& r = *(recording*)arg;
+	for (size_t i = 0; i < r.values.size(); i++)
+		r.histogram.record(r.values[i]);
+	return 0;
+}
+
+static void checkPercentiles(const latency_histogram& h, vector<long long> values, const string& what)
+{
+	sort(values.begin(), values.end());
+	long long sum = 0;
+	for (size_t i = 0; i < values.size(); i++)
+		sum += values[i];
+	s_test.check(h.count() == values.size() && h.sum() == sum && h.max() == values.back(), "count, sum and max of " + what);
+
+	const double quantiles[] = { 0, 0.1, 0.5, 0.9, 0.99, 0.999, 1 };
+	const char* names[] = { "p0", "p10", "p50", "p90", "p99", "p99.9", "p100" };
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+	{
+		double q = quantiles[i];
+		size_t rank = max((size_t)1, (size_t)ceil(q * values.size()));
+		long long exact = values[rank - 1];
+		long long p = h.percentile(q);
+		s_test.check(p >= exact && p <= exact + exact / 16 && p <= h.max(),
+			string(names[i]) + " of " + what + ": " + to_string(p) + " ns, exact " + to_string(exact) + " ns");
+	}
+}
+
+int main()
+{
+	// log-uniform from 100 ns to 10 ms, and two clusters with outliers of minutes
+	// and of an hour, beyond 2^c_maxExponent ns, in the last bucket
+	recording a, b;
+	for (int i = 0; i < 200000; i++)
+		a.values.push_back((long long)(100 * pow(10.0, s_test.random(1000000) / 200000.0)));
+	for (int i = 0; i < 100000; i++)
+	{
+		if (i % 1000 == 0)
+			b.values.push_back((3ll << 38) + i);
+		else if (i % 1000 == 500)
+			b.values.push_back((3ll << 40) + i);
+		else
+			b.values.push_back((i % 2 ? 15 : 20000) + s_test.random(50));
+	}
+
+	pthread_t threads[2];
+	pthread_create(&threads[0], 0, recordThread, &a);
+	pthread_create(&threads[1], 0, recordThread, &b);
+	pthread_join(threads[0], 0);
+	pthread_join(threads[1], 0);
+	checkPercentiles(a.histogram, a.values, "the first thread");
+	checkPercentiles(b.histogram, b.values, "the second thread");
+
+	latency_histogram merged;
+	merged.merge(a.histogram);
+	merged.merge(b.histogram);
+	vector<long long> all = a.values;
+	all.insert(all.end(), b.values.begin(), b.values.end());
+	checkPercentiles(merged, all, "the merged histogram");
+
+	// merging the same histogram again doubles the counts
+	merged.merge(a.histogram);
+	all.insert(all.end(), a.values.begin(), a.values.end());
+	checkPercentiles(merged, all, "the histogram merged twice");
+
+	merged.reset();
+	s_test.check(merged.count() == 0 && merged.max() == 0 && merged.percentile(0.5) == 0, "reset");
+	return s_test.result();
+}
@@ -0,0 +1,119 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_preroll_buffer - the history against a model of the blocks kept: appends across the
+** end of the memory come back complete and in order, in pieces of at most maxBytes, the
+** oldest blocks make room and the ones older than the maximum age are dropped.
+**
+** Usage: test_preroll_buffer, the exit code is the number of failed checks
+**/
+
+#include <deque>
+#include <vector>
+#include "preroll_buffer.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_preroll_buffer");
+
+static const size_t c_bytes = 1000;
+static const long long c_maxAgeNs = 1000000000;
+
+struct block
+{
+	vector<BYTE> data;
+	long long timeNs;
+};
+
+// the bytes of the model since sinceNs
+static vector<BYTE> expected(const deque<block>& model, long long sinceNs)
+{
+	vector<BYTE> bytes;
+	for (size_t i = 0; i < model.size(); i++)
+		if (model[i].timeNs >= sinceNs)
+			bytes.insert(bytes.end(), model[i].data.begin(), model[i].data.end());
+	return bytes;
+}
+
+static bool compare(const preroll_buffer& p, const deque<block>& model, long long sinceNs, int maxBytes)
+{
+	vector<preroll_buffer::piece> pieces;
+	size_t total = p.read(sinceNs, maxBytes, pieces);
+	vector<BYTE> bytes;
+	bool sized = true;
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		sized = sized && pieces[i].length > 0 && pieces[i].length <= maxBytes;
+		bytes.insert(bytes.end(), pieces[i].data, pieces[i].data + pieces[i].length);
+	}
+	return sized && total == bytes.size() && bytes == expected(model, sinceNs);
+}
+
+int main()
+{
+	preroll_buffer p;
+	p.allocate(c_bytes, c_maxAgeNs, buffer_pool::POOL_DEFAULT);
+	s_test.check(p.isActive() && p.capacity() == c_bytes && p.size() == 0 && p.oldestNs() == 0, "empty buffer");
+
+	deque<block> model;
+	long long now = 0;
+	size_t used = 0;
+	for (int i = 0; i < 2000; i++)
+	{
+		block b;
+		b.data.resize(1 + s_test.random(300));
+		for (size_t j = 0; j < b.data.size(); j++)
+			b.data[j] = (BYTE)(i + j);
+		// mostly 10 ms apart, now and then a pause beyond the maximum age
+		now += i % 97 == 0 ? 3 * c_maxAgeNs / 2 : 10000000;
+		b.timeNs = now;
+
+		// the model: room by size first, then by age
+		while (used + b.data.size() > c_bytes)
+		{
+			used -= model.front().data.size();
+			model.pop_front();
+		}
+		while (!model.empty() && now - model.front().timeNs > c_maxAgeNs)
+		{
+			used -= model.front().data.size();
+			model.pop_front();
+		}
+		model.push_back(b);
+		used += b.data.size();
+		p.append(&b.data[0], (int)b.data.size(), now);
+
+		const string where = ", block " + to_string(i);
+		s_test.check(p.size() == used && p.oldestNs() == model.front().timeNs, "size and oldest block" + where);
+		if (!s_test.check(compare(p, model, 0, 64), "history" + where))
+			break;
+		s_test.check(compare(p, model, now - 50000000, 17), "history of the last 50 ms" + where);
+	}
+
+	// a block larger than the buffer is not kept
+	vector<BYTE> large(c_bytes + 1);
+	p.append(&large[0], (int)large.size(), now);
+	s_test.check(p.size() == used && compare(p, model, 0, 1000), "block larger than the buffer");
+
+	p.release();
+	s_test.check(!p.isActive() && p.size() == 0, "released buffer");
+	return s_test.result();
+}
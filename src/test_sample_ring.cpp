@@ -0,0 +1,235 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_sample_ring - the SPSC ring: blocks arrive in order and complete while the counts
+** wrap around the ring many times, a full ring drops and counts, a resize takes effect
+** through the marker without losing a block, several blocks are peeked before they are
+** released, also across a marker, and a producer and a consumer thread
+** transfer every block, while the geometry changes.
+**
+** Usage: test_sample_ring, the exit code is the number of failed checks
+**/
+
+#include <pthread.h>
+#include <string.h>
+#include "sample_ring.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_sample_ring");
+
+static bool produce(sample_ring& ring, unsigned sequence)
+{
+	sample_ring::block* b = ring.acquire();
+	if (b == 0)
+		return false;
+	memcpy(b->data, &sequence, sizeof(sequence));
+	b->length = sizeof(sequence);
+	ring.commit();
+	return true;
+}
+
+static bool isBlock(const sample_ring::block* b, unsigned expected)
+{
+	unsigned sequence;
+	if (b == 0 || b->length != (int)sizeof(sequence))
+		return false;
+	memcpy(&sequence, b->data, sizeof(sequence));
+	return sequence == expected;
+}
+
+static bool consume(sample_ring& ring, unsigned expected)
+{
+	sample_ring::block* b = ring.peek(1000);
+	if (b == 0)
+		return false;
+	bool ok = isBlock(b, expected);
+	ring.release();
+	return ok;
+}
+
+// 5 blocks, no power of two: the slot index follows the count across many turns
+static void testWrapAround()
+{
+	sample_ring ring;
+	ring.allocate(5, 64, buffer_pool::POOL_DEFAULT);
+	unsigned produced = 0, consumed = 0;
+	for (int turn = 0; turn < 20000; turn++)
+	{
+		int batch = 1 + turn % 5;
+		bool ok = true;
+		for (int i = 0; i < batch; i++)
+			ok = ok && produce(ring, produced++);
+		s_test.check(ok && ring.fillLevel() == batch, "acquire, turn " + to_string(turn));
+		for (int i = 0; i < batch; i++)
+			ok = ok && consume(ring, consumed++);
+		if (!s_test.check(ok && ring.fillLevel() == 0, "peek of the blocks in order, turn " + to_string(turn)))
+			return;
+	}
+	s_test.check(ring.droppedBlocks() == 0 && ring.highWaterMark() == 5, "statistics after the wrap around");
+}
+
+static void testFull()
+{
+	sample_ring ring;
+	ring.allocate(3, 64, buffer_pool::POOL_DEFAULT);
+	s_test.check(ring.peek(0) == 0, "peek of an empty ring");
+	for (unsigned i = 0; i < 3; i++)
+		produce(ring, i);
+	s_test.check(ring.acquire() == 0 && ring.acquire() == 0, "acquire of a full ring");
+	s_test.check(ring.droppedBlocks() == 2 && ring.fillLevel() == 3, "dropped blocks of a full ring");
+	s_test.check(consume(ring, 0) && produce(ring, 3), "acquire after a release");
+	s_test.check(consume(ring, 1) && consume(ring, 2) && consume(ring, 3), "blocks after the drops");
+	ring.resetStatistics();
+	s_test.check(ring.droppedBlocks() == 0 && ring.highWaterMark() == 0, "statistics after the reset");
+}
+
+// the blocks before the marker are drained from the old geometry, the new one follows
+static void testResize()
+{
+	sample_ring ring;
+	ring.allocate(4, 64, buffer_pool::POOL_DEFAULT);
+	for (unsigned i = 0; i < 3; i++)
+		produce(ring, i);
+	ring.resize(6, 128);
+	s_test.check(ring.capacity() == 4 && ring.blockSize() == 64, "geometry before the producer switched");
+	sample_ring::block* b = ring.acquire();
+	s_test.check(b != 0 && b->capacity == 128, "block of the new geometry");
+	s_test.check(ring.capacity() == 6 && ring.blockSize() == 128, "geometry after the producer switched");
+	unsigned sequence = 3;
+	memcpy(b->data, &sequence, sizeof(sequence));
+	b->length = sizeof(sequence);
+	ring.commit();
+	// the old blocks and the marker occupy the new geometry, until they are drained
+	s_test.check(produce(ring, 4) && ring.acquire() == 0, "capacity while the old blocks are pending");
+	bool ok = true;
+	for (unsigned i = 0; i < 5; i++)
+		ok = ok && consume(ring, i);
+	for (unsigned i = 5; i < 11; i++)
+		ok = ok && produce(ring, i);
+	s_test.check(ok && ring.fillLevel() == 6, "capacity of the new geometry");
+	ok = true;
+	for (unsigned i = 5; i < 11; i++)
+		ok = ok && consume(ring, i);
+	s_test.check(ok && ring.fillLevel() == 0, "blocks across the marker in order");
+
+	// a full ring has no room for the marker: the switch waits for the consumer
+	for (unsigned i = 0; i < 6; i++)
+		produce(ring, i);
+	ring.resize(3, 64);
+	s_test.check(ring.acquire() == 0 && ring.capacity() == 6, "switch of a full ring");
+	s_test.check(consume(ring, 0) && ring.acquire() == 0 && ring.capacity() == 3, "switch after a release");
+	ok = true;
+	for (unsigned i = 1; i < 6; i++)
+		ok = ok && consume(ring, i);
+	// the marker is passed with the next peek
+	s_test.check(ok && ring.fillLevel() == 1, "marker after the old blocks");
+	for (unsigned i = 6; i < 8; i++)
+		ok = ok && produce(ring, i);
+	for (unsigned i = 6; i < 8; i++)
+		ok = ok && consume(ring, i);
+	s_test.check(ok && ring.fillLevel() == 0, "blocks across the delayed marker in order");
+}
+
+// peeked blocks stay valid and occupied, until they are released in order
+static void testPeekSeveral()
+{
+	sample_ring ring;
+	ring.allocate(5, 64, buffer_pool::POOL_DEFAULT);
+	for (unsigned i = 0; i < 5; i++)
+		produce(ring, i);
+	sample_ring::block* peeked[3];
+	for (int i = 0; i < 3; i++)
+		peeked[i] = ring.peek(0);
+	s_test.check(isBlock(peeked[0], 0) && isBlock(peeked[1], 1) && isBlock(peeked[2], 2), "blocks peeked in order");
+	s_test.check(ring.peekedBlocks() == 3 && ring.fillLevel() == 5 && ring.acquire() == 0, "peeked blocks occupy the ring");
+	ring.release();
+	s_test.check(ring.peekedBlocks() == 2 && produce(ring, 5), "acquire after the release of a peeked block");
+	ring.release();
+	ring.release();
+	bool ok = true;
+	for (unsigned i = 3; i < 6; i++)
+		ok = ok && consume(ring, i);
+	s_test.check(ok && ring.peekedBlocks() == 0 && ring.fillLevel() == 0, "blocks after the peeked ones");
+
+	// the old geometry is freed, when the last block before the marker is released
+	for (unsigned i = 0; i < 2; i++)
+		produce(ring, i);
+	peeked[0] = ring.peek(0);
+	peeked[1] = ring.peek(0);
+	ring.resize(4, 64);
+	s_test.check(produce(ring, 2) && ring.capacity() == 4, "switch while blocks are peeked");
+	peeked[2] = ring.peek(0);
+	s_test.check(isBlock(peeked[2], 2), "block peeked across the marker");
+	s_test.check(isBlock(peeked[0], 0) && isBlock(peeked[1], 1), "old blocks still valid");
+	s_test.check(ring.peek(0) == 0, "peek of a drained ring");
+	for (int i = 0; i < 3; i++)
+		ring.release();
+	s_test.check(ring.peekedBlocks() == 0 && ring.fillLevel() == 0, "release of the blocks across the marker");
+	for (unsigned i = 3; i < 7; i++)
+		ok = ok && produce(ring, i);
+	for (unsigned i = 3; i < 7; i++)
+		ok = ok && consume(ring, i);
+	s_test.check(ok, "new geometry after the release");
+}
+
+static const unsigned c_threadBlocks = 200000;
+
+static void* producerThread(void* arg)
+{
+	sample_ring& ring = *(sample_ring*)arg;
+	for (unsigned i = 0; i < c_threadBlocks; )
+	{
+		if (produce(ring, i))
+			i++;
+		else
+			sched_yield();
+	}
+	return 0;
+}
+
+// the consumer sees every block in order, the producer retries on a full ring
+static void testThreads()
+{
+	sample_ring ring;
+	ring.allocate(7, 64, buffer_pool::POOL_DEFAULT);
+	pthread_t producer;
+	pthread_create(&producer, 0, producerThread, &ring);
+	unsigned consumed = 0;
+	while (consumed < c_threadBlocks && consume(ring, consumed))
+	{
+		// the geometry changes under the producer
+		if (++consumed % 10000 == 0)
+			ring.resize(3 + consumed / 10000 % 6, 64);
+	}
+	pthread_join(producer, 0);
+	s_test.check(consumed == c_threadBlocks, "blocks transferred between threads: " + to_string(consumed));
+}
+
+int main()
+{
+	testWrapAround();
+	testFull();
+	testResize();
+	testPeekSeveral();
+	testThreads();
+	return s_test.result();
+}
@@ -0,0 +1,145 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_spectrum_server - the spectra a client receives on the spectrum port: the tone
+** is in its bin, with the average of the powers of the blocks in dBFS, the leakage of the
+** window stays in the neighboring bins, and the header counts the spectra.
+**
+** Usage: test_spectrum_server, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include "spectrum_server.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_spectrum_server");
+
+static const int c_fftSize = 1024;
+static const int c_averages = 2;
+
+static bool receive(SOCKET sock, BYTE* data, int length)
+{
+	while (length > 0)
+	{
+		int n = recv(sock, (char*)data, length, 0);
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+// one frame period: a block per average, the tone of bin k with the given amplitudes
+static void pushTone(spectrum_server& ss, int k, const double* amplitudes)
+{
+	vector<short> xi(c_fftSize), xq(c_fftSize);
+	for (int a = 0; a < c_averages; a++)
+	{
+		for (int i = 0; i < c_fftSize; i++)
+		{
+			double phase = 2 * M_PI * k * i / c_fftSize;
+			xi[i] = (short)lrint(amplitudes[a] * cos(phase));
+			xq[i] = (short)lrint(amplitudes[a] * sin(phase));
+		}
+		ss.push(&xi[0], &xq[0], c_fftSize);
+	}
+}
+
+static void testSpectrum(SOCKET sock, int k, const double* amplitudes, unsigned sequence)
+{
+	const string where = " of the tone in bin " + to_string(k);
+	vector<BYTE> frame(sizeof(spectrum_server::frameHeader) + c_fftSize * sizeof(float));
+	if (!s_test.check(receive(sock, &frame[0], (int)frame.size()), "spectrum received" + where))
+		return;
+	spectrum_server::frameHeader h;
+	memcpy(&h, &frame[0], sizeof(h));
+	s_test.check(memcmp(h.magic, "RSPS", 4) == 0 && h.headerBytes == sizeof(h) && h.fftSize == c_fftSize
+		&& (h.flags & spectrum_server::SPECTRUM_DB) != 0, "header" + where);
+	s_test.check(h.averages == c_averages && h.sequence == sequence, "averages and sequence" + where);
+
+	vector<float> bins(c_fftSize);
+	memcpy(&bins[0], &frame[sizeof(h)], c_fftSize * sizeof(float));
+	int peak = 0;
+	for (int i = 1; i < c_fftSize; i++)
+		if (bins[i] > bins[peak])
+			peak = i;
+	s_test.check(peak == c_fftSize / 2 + k, "peak in bin " + to_string(peak - c_fftSize / 2) + where);
+
+	// the window is normalized to its coherent gain: a tone at full scale is 0 dBFS
+	double power = 0;
+	for (int a = 0; a < c_averages; a++)
+		power += amplitudes[a] * amplitudes[a] / c_averages;
+	double expected = 10 * log10(power / (32768.0 * 32768.0));
+	s_test.check(fabs(bins[peak] - expected) < 0.05, "level " + to_string(bins[peak]) + " dBFS" + where);
+
+	// a tone in the center of a bin leaks into the direct neighbors of the Hann window only,
+	// the neighbors of the highest bin are the one below and the lowest
+	float leak = -200;
+	for (int i = 0; i < c_fftSize; i++)
+	{
+		int distance = (i - peak) & (c_fftSize - 1);
+		if (distance > 1 && distance < c_fftSize - 1)
+			leak = max(leak, bins[i]);
+	}
+	s_test.check(leak < expected - 60, "leakage " + to_string(leak) + " dBFS" + where);
+}
+
+int main()
+{
+	// a port of its own, the first free one
+	spectrum_server ss;
+	int port = 47300;
+	while (!ss.open(IPAddress(127, 0, 0, 1), port, c_fftSize, spectrum_server::WINDOW_HANN, c_averages, 1, true))
+	{
+		if (!s_test.check(++port < 47400, "spectrum port opened"))
+			return s_test.result();
+	}
+
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	struct sockaddr_in server;
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	server.sin_addr.s_addr = inet_addr("127.0.0.1");
+	struct timeval tv = { 5, 0 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv));
+	if (!s_test.check(connect(sock, (struct sockaddr*)&server, sizeof(server)) == 0, "client connected"))
+		return s_test.result();
+	// the accept thread registers the client
+	usleep(300000);
+
+	// one frame period per spectrum: no sample is skipped
+	ss.start(c_fftSize * c_averages, 100000000);
+	const double amplitudes[][c_averages] = { { 8000, 16000 }, { 32767, 32767 }, { 100, 300 } };
+	const int tones[] = { 37, -100, 511 };
+	for (unsigned s = 0; s < 3; s++)
+	{
+		pushTone(ss, tones[s], amplitudes[s]);
+		testSpectrum(sock, tones[s], amplitudes[s], s);
+	}
+	ss.stop();
+	closesocket(sock);
+	return s_test.result();
+}
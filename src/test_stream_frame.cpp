@@ -0,0 +1,113 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+/**
+** test_stream_frame - a framed stream of the serializer, frames of samples around the markers
+** of a history, is parsed back: every field of every header, the payloads in between, and the
+** little endian layout of streamFrameHeader. Bytes without the magic are no frame.
+**
+** Usage: test_stream_frame, the exit code is the number of failed checks
+**/
+
+#include <vector>
+#include <string.h>
+#include "stream_frame.h"
+#include "unit_test.h"
+using namespace std;
+
+static unit_test s_test("test_stream_frame");
+
+struct frame
+{
+	int format;
+	int flags;
+	unsigned int numSamples;
+	unsigned int payloadBytes;
+	unsigned long long firstSample;
+	long long timeNs;
+};
+
+int main()
+{
+	s_test.check(stream_frame::c_headerBytes == 32, "32 bytes of header");
+
+	// history between the markers, then the live stream with a gap, in other formats
+	const frame frames[] = {
+		{ 0, FRAME_HISTORY, 0, 0, 0, 1700000000123456789ll },
+		{ FORMAT_CS16, 0, 1008, 4032, 5000000000ll, 1700000000000000000ll },
+		{ FORMAT_CS16, FRAME_GAIN_CHANGED | FRAME_RF_CHANGED, 1008, 4032, 5000001008ll, 1700000000000504000ll },
+		{ 0, FRAME_LIVE, 0, 0, 0, 1700000000123456999ll },
+		{ FORMAT_BFP, FRAME_API_GAP | FRAME_DROPPED, 4096, 3333, 0x123456789abcdefull, 1700000001000000000ll },
+		{ FORMAT_CS14_PACKED, FRAME_FS_CHANGED, 2, 7, 0xffffffffffull, 1700000002000000000ll },
+	};
+	const int numFrames = sizeof(frames) / sizeof(frames[0]);
+
+	vector<BYTE> stream;
+	for (int i = 0; i < numFrames; i++)
+	{
+		const frame& f = frames[i];
+		size_t at = stream.size();
+		stream.resize(at + stream_frame::c_headerBytes + f.payloadBytes);
+		stream_frame::write(&stream[at], f.format, f.flags, f.numSamples, f.payloadBytes, f.firstSample, f.timeNs);
+		for (unsigned int k = 0; k < f.payloadBytes; k++)
+			stream[at + stream_frame::c_headerBytes + k] = (BYTE)(i * 31 + k);
+	}
+
+	size_t at = 0;
+	for (int i = 0; i < numFrames; i++)
+	{
+		const frame& f = frames[i];
+		string what = "frame " + to_string(i);
+		streamFrameHeader h;
+		if (!s_test.check(at + stream_frame::c_headerBytes <= stream.size() && stream_frame::read(&stream[at], h),
+			what + ": header"))
+			break;
+		s_test.check(memcmp(h.magic, "RSPF", 4) == 0 && h.headerBytes == stream_frame::c_headerBytes, what + ": magic and size");
+		s_test.check(h.format == f.format && h.flags == f.flags, what + ": format and flags");
+		s_test.check(h.numSamples == f.numSamples && h.payloadBytes == f.payloadBytes, what + ": samples and payload");
+		s_test.check(h.firstSample == f.firstSample, what + ": first sample");
+		s_test.check((long long)h.timestampNs == f.timeNs, what + ": timestamp");
+		at += stream_frame::c_headerBytes;
+		bool payload = at + h.payloadBytes <= stream.size();
+		for (unsigned int k = 0; payload && k < h.payloadBytes; k++)
+			payload = stream[at + k] == (BYTE)(i * 31 + k);
+		s_test.check(payload, what + ": payload");
+		at += h.payloadBytes;
+	}
+	s_test.check(at == stream.size(), "the frames end with the stream");
+
+	// the layout on the wire, as a client in another language reads it
+	const BYTE* b = &stream[stream_frame::c_headerBytes];
+	s_test.check(b[4] == 32 && b[5] == 0 && b[6] == FORMAT_CS16 && b[7] == 0, "bytes 4..7");
+	s_test.check(b[8] == (1008 & 0xff) && b[9] == (1008 >> 8) && b[10] == 0 && b[11] == 0, "numSamples, little endian");
+	s_test.check(b[12] == (4032 & 0xff) && b[13] == (4032 >> 8), "payloadBytes, little endian");
+	s_test.check(b[16] == (BYTE)5000000000ll && b[20] == 1 && b[23] == 0, "firstSample, little endian");
+	s_test.check(b[31] == (BYTE)(1700000000000000000ll >> 56), "timestampNs, little endian");
+
+	// a client searching the magic after switching to the framed stream
+	streamFrameHeader h;
+	vector<BYTE> junk(stream.begin(), stream.begin() + stream_frame::c_headerBytes);
+	junk[0] = 'X';
+	s_test.check(!stream_frame::read(&junk[0], h), "no magic");
+	junk[0] = 'R';
+	junk[4] = 16;
+	s_test.check(!stream_frame::read(&junk[0], h), "another header size");
+	return s_test.result();
+}
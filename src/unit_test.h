@@ -0,0 +1,63 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <iostream>
+#include <string>
+
+/// <summary>
+/// Scaffolding of the ctest executables: the failed checks are printed and counted,
+/// the exit code of a test is the number of failures.
+/// </summary>
+class unit_test
+{
+public:
+	unit_test(const char* name) : name(name), failures(0), seed(1) {}
+
+	// returns ok, so a caller may add details of a failure
+	bool check(bool ok, const std::string& what)
+	{
+		if (!ok)
+		{
+			std::cout << "FAILED: " << what << std::endl;
+			failures++;
+		}
+		return ok;
+	}
+
+	// deterministic pseudo random numbers in 0..range-1, the runs are reproducible
+	int random(int range)
+	{
+		seed = seed * 1103515245 + 12345;
+		return (int)((seed >> 8) % (unsigned)range);
+	}
+
+	// the exit code of main
+	int result() const
+	{
+		std::cout << name << ": " << (failures == 0 ? "passed" : "FAILED") << std::endl;
+		return failures;
+	}
+
+private:
+	const char* name;
+	int failures;
+	unsigned seed;
+};
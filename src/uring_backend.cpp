@@ -0,0 +1,479 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "uring_backend.h"
+#include <iostream>
+#include <string.h>
+#ifdef RSP_TCP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#endif
+using namespace std;
+
+#define USER_DATA(op, idx) (((unsigned long long)(op) << 32) | (unsigned)(idx))
+
+uring_backend::uring_backend()
+{
+}
+
+uring_backend::~uring_backend()
+{
+#ifdef RSP_TCP_HAVE_IO_URING
+	if (sqesMap != 0)
+		munmap(sqesMap, sqesMapSize);
+	if (cqMap != 0 && cqMap != sqMap)
+		munmap(cqMap, cqMapSize);
+	if (sqMap != 0)
+		munmap(sqMap, sqMapSize);
+	if (ringFd >= 0)
+		close(ringFd);
+	if (notifyFd >= 0)
+		close(notifyFd);
+#endif
+}
+
+#ifndef RSP_TCP_HAVE_IO_URING
+
+bool uring_backend::init()
+{
+	cout << "io_uring backend not available in this build" << endl;
+	return false;
+}
+
+void uring_backend::serve(SOCKET listenSock, handler& h, const std::atomic<bool>& running)
+{
+}
+
+#else
+
+static struct __kernel_timespec s_timeout = { 0, 100000000 };	// 100 ms: check 'running'
+
+bool uring_backend::init()
+{
+	const unsigned entries = 2 * c_maxBlocksPerBatch + 8;
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ringFd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ringFd < 0)
+	{
+		cout << "io_uring_setup failed with " << errno << ", io_uring backend not available" << endl;
+		return false;
+	}
+
+	sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqMapSize > sqMapSize)
+			sqMapSize = cqMapSize;
+		cqMapSize = sqMapSize;
+	}
+	sqMap = mmap(0, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqMap == MAP_FAILED)
+	{
+		sqMap = 0;
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cqMap = sqMap;
+	else
+	{
+		cqMap = mmap(0, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqMap == MAP_FAILED)
+		{
+			cqMap = 0;
+			return false;
+		}
+	}
+	sqesMapSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqesMap = mmap(0, sqesMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqesMap == MAP_FAILED)
+	{
+		sqesMap = 0;
+		return false;
+	}
+
+	BYTE* sq = (BYTE*)sqMap;
+	BYTE* cq = (BYTE*)cqMap;
+	sqHead = (unsigned*)(sq + p.sq_off.head);
+	sqTail = (unsigned*)(sq + p.sq_off.tail);
+	sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+	sqArray = (unsigned*)(sq + p.sq_off.array);
+	cqHead = (unsigned*)(cq + p.cq_off.head);
+	cqTail = (unsigned*)(cq + p.cq_off.tail);
+	cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+	sqes = (struct io_uring_sqe*)sqesMap;
+	cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	sqLocalTail = *sqTail;
+
+	notifyFd = eventfd(0, EFD_CLOEXEC);
+	if (notifyFd < 0)
+		return false;
+	return true;
+}
+
+io_uring_sqe* uring_backend::getSqe()
+{
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if (sqLocalTail - head > *sqMask)
+	{
+		submitAndWait(0);	// full: hand the queued entries to the kernel first
+		head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (sqLocalTail - head > *sqMask)
+			throw msg_exception("io_uring submission queue full");
+	}
+	unsigned idx = sqLocalTail & *sqMask;
+	struct io_uring_sqe* sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqArray[idx] = idx;
+	sqLocalTail++;
+	pendingOps++;
+	return sqe;
+}
+
+int uring_backend::submitAndWait(unsigned waitNr)
+{
+	unsigned toSubmit = sqLocalTail - *sqTail;
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+	enters++;
+	int res = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr,
+		waitNr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		throw msg_exception("io_uring_enter failed with " + to_string(errno));
+	return res;
+}
+
+bool uring_backend::nextCqe(unsigned long long& userData, int& res)
+{
+	unsigned head = *cqHead;
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		return false;
+	struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+	userData = cqe->user_data;
+	res = cqe->res;
+	__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+	pendingOps--;
+	return true;
+}
+
+void uring_backend::armAccept(SOCKET listenSock)
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listenSock;
+	sqe->user_data = USER_DATA(OP_ACCEPT, 0);
+}
+
+void uring_backend::armRecv()
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = client;
+	sqe->addr = (unsigned long long)(cmdBuf + cmdFill);
+	sqe->len = sizeof(cmdBuf) - cmdFill;
+	sqe->user_data = USER_DATA(OP_RECV, 0);
+	recvArmed = true;
+}
+
+void uring_backend::armTimeout()
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long long)&s_timeout;
+	sqe->len = 1;
+	sqe->user_data = USER_DATA(OP_TIMEOUT, 0);
+	timeoutArmed = true;
+}
+
+void uring_backend::armNotify()
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = notifyFd;
+	sqe->addr = (unsigned long long)&notifyValue;
+	sqe->len = sizeof(notifyValue);
+	sqe->user_data = USER_DATA(OP_NOTIFY, 0);
+	notifyArmed = true;
+}
+
+/// <summary>
+/// Registers the consumer side pool of the sample ring as fixed buffer.
+/// Only called without pending writes.
+/// </summary>
+void uring_backend::updateRegisteredBuffer()
+{
+	const BYTE* base;
+	size_t size;
+	ring->consumerMemory(base, size);
+	if (base == regBase || regFailed)
+		return;
+	if (regBase != 0)
+	{
+		syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+		regBase = 0;
+		regSize = 0;
+	}
+	if (base == 0)
+		return;
+	struct iovec iov = { (void*)base, size };
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+	{
+		// e.g. RLIMIT_MEMLOCK: plain sends from the same memory
+		cout << "io_uring buffer registration failed with " << errno << ", using unregistered sends" << endl;
+		regFailed = true;
+		return;
+	}
+	regBase = base;
+	regSize = size;
+}
+
+void uring_backend::peekBlocks()
+{
+	sample_ring::block* b;
+	while (batchSize < c_maxBlocksPerBatch && (b = ring->peek(0)) != 0)
+	{
+		batchDone[batchSize] = 0;
+		batch[batchSize++] = b;
+	}
+}
+
+void uring_backend::fillBatch()
+{
+	batchSize = 0;
+	peekBlocks();
+	if (batchSize == 0)
+	{
+		// empty: announce the sleep, then look again, not to miss a commit in between
+		ring->announceSleep(true);
+		peekBlocks();
+		if (batchSize == 0)
+			return;
+		ring->announceSleep(false);
+	}
+	updateRegisteredBuffer();
+	batchError = 0;
+	submitBatch(0);
+}
+
+/// <summary>
+/// Queues linked writes for the batch, starting at block 'from'.
+/// A short write breaks the link, the rest is submitted again.
+/// </summary>
+void uring_backend::submitBatch(int from)
+{
+	for (int i = from; i < batchSize; i++)
+	{
+		const BYTE* data = batch[i]->data + batchDone[i];
+		unsigned len = batch[i]->length - batchDone[i];
+		struct io_uring_sqe* sqe = getSqe();
+		if (data >= regBase && data + len <= regBase + regSize)
+		{
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->buf_index = 0;
+		}
+		else
+		{
+			sqe->opcode = IORING_OP_SEND;
+			sqe->msg_flags = MSG_NOSIGNAL;
+		}
+		sqe->fd = client;
+		sqe->addr = (unsigned long long)data;
+		sqe->len = len;
+		sqe->off = (unsigned long long)-1;	// sockets have no file position
+		if (i + 1 < batchSize)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = USER_DATA(OP_SEND, i);
+		batchPending++;
+	}
+}
+
+void uring_backend::completeSend(int index, int res)
+{
+	batchPending--;
+	if (res > 0)
+	{
+		batchDone[index] += res;
+		sentBytes += res;
+	}
+	else if (res < 0 && res != -ECANCELED)
+		batchError = res;
+	if (batchPending > 0)
+		return;
+
+	if (batchError != 0 || closing)
+	{
+		if (!closing)
+			cout << "Error in transmit :socket error " << -batchError << endl;
+		closing = true;
+		batchSize = 0;
+		return;
+	}
+	for (int i = 0; i < batchSize; i++)
+	{
+		if (batchDone[i] < batch[i]->length)
+		{
+			submitBatch(i);
+			return;
+		}
+	}
+	for (int i = 0; i < batchSize; i++)
+		ring->release();
+	batchSize = 0;
+}
+
+void uring_backend::completeRecv(int res, handler& h)
+{
+	recvArmed = false;
+	if (res <= 0)
+	{
+		if (!closing)
+			cout << "Error in receive :" << (res == 0 ? "Socket closed" : "Socket error") << endl;
+		closing = true;
+		return;
+	}
+	cmdFill += res;
+	int used = 0;
+	while (cmdFill - used >= c_cmdLength)
+	{
+		h.command(cmdBuf + used);
+		used += c_cmdLength;
+	}
+	memmove(cmdBuf, cmdBuf + used, cmdFill - used);
+	cmdFill -= used;
+}
+
+void uring_backend::endSession(handler& h)
+{
+	if (regBase != 0)
+	{
+		syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+		regBase = 0;
+		regSize = 0;
+	}
+	regFailed = false;
+	ring->announceSleep(false);
+	ring->setNotifyFd(-1);
+	h.sessionEnd();
+	client = INVALID_SOCKET;
+	ring = 0;
+	closing = false;
+	batchSize = 0;
+}
+
+void uring_backend::serve(SOCKET listenSock, handler& h, const std::atomic<bool>& running)
+{
+	bool acceptArmed = false;
+	while (running)
+	{
+		if (ring == 0 && !acceptArmed)
+		{
+			armAccept(listenSock);
+			acceptArmed = true;
+		}
+		if (ring != 0 && !closing)
+		{
+			if (batchSize == 0)
+				fillBatch();
+			if (!recvArmed)
+				armRecv();
+		}
+		if (!timeoutArmed)
+			armTimeout();
+		if (!notifyArmed)
+			armNotify();
+
+		submitAndWait(1);
+
+		unsigned long long userData;
+		int res;
+		while (nextCqe(userData, res))
+		{
+			int op = (int)(userData >> 32);
+			int idx = (int)(userData & 0xffffffff);
+			switch (op)
+			{
+			case OP_ACCEPT:
+				acceptArmed = false;
+				if (res < 0)
+				{
+					cout << "accept failed with " << -res << endl;
+					break;
+				}
+				cout << "Client Accepted!\n" << endl;
+				client = res;
+				cmdFill = 0;
+				ring = h.sessionStart(client);
+				if (ring == 0)
+				{
+					closesocket(client);
+					client = INVALID_SOCKET;
+				}
+				else
+					ring->setNotifyFd(notifyFd);
+				break;
+			case OP_RECV:
+				completeRecv(res, h);
+				break;
+			case OP_SEND:
+				completeSend(idx, res);
+				break;
+			case OP_TIMEOUT:
+				timeoutArmed = false;
+				break;
+			case OP_NOTIFY:
+				notifyArmed = false;
+				break;
+			}
+		}
+
+		if (closing && client != INVALID_SOCKET)
+		{
+			// terminates the pending receive and writes
+			shutdown(client, SHUT_RDWR);
+			if (!recvArmed && batchPending == 0)
+				endSession(h);
+		}
+	}
+
+	if (client != INVALID_SOCKET)
+	{
+		shutdown(client, SHUT_RDWR);
+		unsigned long long userData;
+		int res;
+		while (recvArmed || batchPending > 0)
+		{
+			submitAndWait(1);
+			while (nextCqe(userData, res))
+			{
+				if ((int)(userData >> 32) == OP_RECV)
+					recvArmed = false;
+				else if ((int)(userData >> 32) == OP_SEND)
+					batchPending--;
+			}
+		}
+		endSession(h);
+	}
+}
+
+#endif
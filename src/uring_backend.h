@@ -0,0 +1,137 @@
+/**
+** RSP_tcp - TCP/IP I/Q Data Server for the sdrplay RSP2
+** Copyright (C) 2017 Clem Schmidt, softsyst GmbH, http://www.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include "common.h"
+#include "sample_ring.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// <summary>
+/// Optional Linux io_uring network backend. One submission ring serves
+/// the listening socket (accept), the command channel (recv) and the
+/// sample stream (linked writes of all queued ring blocks, from registered
+/// buffers when the kernel allows it), all from a single thread.
+/// Uses the raw system calls, no liburing needed.
+/// </summary>
+class uring_backend
+{
+public:
+	// The session side: the device server or the benchmark
+	class handler
+	{
+	public:
+		virtual ~handler() {}
+		// a client was accepted; returns the ring to stream, 0 rejects the client
+		virtual sample_ring* sessionStart(SOCKET client) = 0;
+		// one complete 5 byte rtl_tcp command
+		virtual void command(const char* cmd) = 0;
+		// the client is gone, no more operations on its socket are pending
+		virtual void sessionEnd() = 0;
+	};
+
+	uring_backend();
+	~uring_backend();
+
+	// false, if the kernel (or the build) has no usable io_uring
+	bool init();
+
+	// Serves one client after the other, until running is false
+	void serve(SOCKET listenSock, handler& h, const std::atomic<bool>& running);
+
+	unsigned long long enterCalls() const { return enters; }
+	unsigned long long bytesSent() const { return sentBytes; }
+
+private:
+	uring_backend(uring_backend const&);		// Don't Implement
+	void operator=(uring_backend const&);		// Don't implement
+
+	static const int c_maxBlocksPerBatch = 64;
+	static const int c_cmdLength = 5;
+
+	enum eOp { OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3, OP_TIMEOUT = 4, OP_NOTIFY = 5 };
+
+	io_uring_sqe* getSqe();
+	int submitAndWait(unsigned waitNr);
+	bool nextCqe(unsigned long long& userData, int& res);
+
+	void armAccept(SOCKET listenSock);
+	void armRecv();
+	void armTimeout();
+	void armNotify();
+	void peekBlocks();
+	void fillBatch();
+	void submitBatch(int from);
+	void completeSend(int index, int res);
+	void completeRecv(int res, handler& h);
+	void updateRegisteredBuffer();
+	void endSession(handler& h);
+
+	// ring memory
+	int ringFd = -1;
+	void* sqMap = 0;
+	size_t sqMapSize = 0;
+	void* cqMap = 0;
+	size_t cqMapSize = 0;
+	void* sqesMap = 0;
+	size_t sqesMapSize = 0;
+	unsigned* sqHead = 0;
+	unsigned* sqTail = 0;
+	unsigned* sqMask = 0;
+	unsigned* sqArray = 0;
+	unsigned* cqHead = 0;
+	unsigned* cqTail = 0;
+	unsigned* cqMask = 0;
+	io_uring_sqe* sqes = 0;
+	io_uring_cqe* cqes = 0;
+	unsigned sqLocalTail = 0;
+	int pendingOps = 0;
+	bool timeoutArmed = false;
+
+	// eventfd, written by the producer, when new blocks arrive in the ring
+	int notifyFd = -1;
+	unsigned long long notifyValue = 0;
+	bool notifyArmed = false;
+
+	// registered sample buffer (the ring's current pool)
+	const BYTE* regBase = 0;
+	size_t regSize = 0;
+	bool regFailed = false;
+
+	// the session
+	SOCKET client = INVALID_SOCKET;
+	sample_ring* ring = 0;
+	bool closing = false;
+	char cmdBuf[64];
+	int cmdFill = 0;
+	bool recvArmed = false;
+
+	// the batch of ring blocks currently written
+	sample_ring::block* batch[c_maxBlocksPerBatch];
+	int batchDone[c_maxBlocksPerBatch];
+	int batchSize = 0;
+	int batchPending = 0;
+	int batchError = 0;
+
+	unsigned long long enters = 0;
+	unsigned long long sentBytes = 0;
+};